@@ -165,6 +165,7 @@ void ReaderIClass(uint8_t arg0);
 void ReaderIClass_Replay(uint8_t arg0,uint8_t *MAC);
 void IClass_iso14443A_GetPublic(uint8_t arg0);
 void iClass_Authentication(uint8_t *MAC);
+void iClass_CheckKeys(uint8_t flags, uint8_t num_macs, uint8_t *macs);
 void iClass_WriteBlock(uint8_t blockNo, uint8_t *data);
 void iClass_ReadBlk(uint8_t blockNo);
 bool iClass_ReadBlock(uint8_t blockNo, uint8_t *readdata);
@@ -1945,6 +1945,77 @@ void iClass_Authentication(uint8_t *MAC) {
 	isOK = sendCmdGetResponseWithRetries(check, sizeof(check), resp, 4, 6);
 	cmd_send(CMD_ACK,isOK,0,0,0,0);
 }
+
+/**
+ * @brief Tests a list of precomputed MACs against the card in the field (hf iclass chk).
+ * The CC of a card doesn't change unless it is written to. The client therefore selects the card
+ * once, computes the MACs for all keys of a dictionary and streams them here. A failed CHECK
+ * only requires a new READCHECK, not a new select. A MAC is tested twice before it is rejected,
+ * because a lost frame would otherwise hide the valid key.
+ * @param flags FLAG_ICLASS_CHKKEYS_*
+ * @param num_macs number of 4 byte MACs
+ * @param data CSN (8 bytes) and CC (8 bytes) the MACs were computed for, followed by the MACs.
+ * The CSN and CC are compared after each select, the MACs are useless for another card or CC.
+ * Answers with CMD_ACK, arg0 = ICLASS_CHKKEYS_* status, arg1 = index of the valid MAC or -1,
+ * arg2 = number of MACs tested.
+ */
+void iClass_CheckKeys(uint8_t flags, uint8_t num_macs, uint8_t *data) {
+	bool use_credit_key = flags & FLAG_ICLASS_CHKKEYS_CREDITKEY;
+	uint8_t readcheck_cc[] = { use_credit_key ? ICLASS_CMD_READCHECK_KC : ICLASS_CMD_READCHECK_KD, 0x02 };
+	uint8_t check[] = { ICLASS_CMD_CHECK, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	uint8_t *csn_cc = data;
+	uint8_t *macs = data + 16;
+	uint8_t card_data[16];
+	uint8_t resp[ICLASS_BUFFER_SIZE];
+	uint8_t status = ICLASS_CHKKEYS_OK;
+	int found = -1;
+	uint8_t i;
+
+	if (!(flags & FLAG_ICLASS_CHKKEYS_CONTINUE)) {
+		setupIclassReader();
+		if (handshakeIclassTag_ext(card_data, use_credit_key) != 2) {
+			status = ICLASS_CHKKEYS_NO_CARD;
+		} else if (memcmp(card_data, csn_cc, 16) != 0) {
+			status = ICLASS_CHKKEYS_CARD_CHANGED;
+		}
+	}
+
+	for (i = 0; status == ICLASS_CHKKEYS_OK && i < num_macs; i++) {
+		WDT_HIT();
+		if (BUTTON_PRESS()) break;
+		memcpy(check+5, macs+4*i, 4);
+		for (uint8_t attempt = 0; attempt < 2; attempt++) {
+			// restart the authentication. Reselect the card if it doesn't answer anymore
+			if (!sendCmdGetResponseWithRetries(readcheck_cc, sizeof(readcheck_cc), resp, 8, 3)) {
+				if (handshakeIclassTag_ext(card_data, use_credit_key) != 2) {
+					status = ICLASS_CHKKEYS_NO_CARD;
+					break;
+				}
+				if (memcmp(card_data, csn_cc, 16) != 0) {
+					status = ICLASS_CHKKEYS_CARD_CHANGED;
+					break;
+				}
+			}
+			if (sendCmdGetResponseWithRetries(check, sizeof(check), resp, 4, 1)) {
+				found = i;
+				break;
+			}
+		}
+		if (status != ICLASS_CHKKEYS_OK) break;
+		if (found >= 0) {
+			i++;
+			break;
+		}
+	}
+
+	cmd_send(CMD_ACK, status, found, i, 0, 0);
+
+	if (status != ICLASS_CHKKEYS_OK || found >= 0 || !(flags & FLAG_ICLASS_CHKKEYS_KEEP_FIELD)) {
+		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+		LEDsoff();
+	}
+}
+
 bool iClass_ReadBlock(uint8_t blockNo, uint8_t *readdata) {
 	uint8_t readcmd[] = {ICLASS_CMD_READ_OR_IDENTIFY, blockNo, 0x00, 0x00}; //0x88, 0x00 // can i use 0C?
 	char bl = blockNo;
@@ -2113,25 +2113,23 @@ void ReaderIso14443a(UsbCommand *c)
 
 // Determine the distance between two nonces.
 // Assume that the difference is small, but we don't know which is first.
-// Therefore try in alternating directions.
+// Therefore return the shorter of both directions.
 static int32_t dist_nt(uint32_t nt1, uint32_t nt2) {
 
-	uint16_t i;
-	uint32_t nttmp1, nttmp2;
+	int32_t dist;
 
 	if (nt1 == nt2) return 0;
 
-	nttmp1 = nt1;
-	nttmp2 = nt2;
-	
-	for (i = 1; i < 32768; i++) {
-		nttmp1 = prng_successor(nttmp1, 1);
-		if (nttmp1 == nt2) return i;
-		nttmp2 = prng_successor(nttmp2, 1);
-		if (nttmp2 == nt1) return -i;
-		}
-	
-	return(-99999); // either nt1 or nt2 are invalid nonces
+	if (!prng_valid_nonce(nt1) || !prng_valid_nonce(nt2)) {
+		return(-99999); // either nt1 or nt2 are invalid nonces
+	}
+
+	dist = nonce_distance(nt1, nt2);
+	if (dist >= 32768) {
+		dist -= 65535;
+	}
+
+	return dist;
 }
 
 
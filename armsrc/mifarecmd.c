@@ -960,6 +960,10 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t calibrate, uint8_t *dat
 //-----------------------------------------------------------------------------
 // MIFARE check keys. key count up to 85.
 //
+// Large dictionaries are streamed as a sequence of these commands. The client
+// sends the next batch before waiting for the answer of the current one. The
+// field stays on between the batches of a stream (flags continueStream and
+// keepField), i.e. neither USB round trips nor field resets interrupt the check.
 //-----------------------------------------------------------------------------
 void MifareChkKeys(uint16_t arg0, uint16_t arg1, uint8_t arg2, uint8_t *datain)
 {
@@ -967,6 +971,8 @@ void MifareChkKeys(uint16_t arg0, uint16_t arg1, uint8_t arg2, uint8_t *datain)
 	uint8_t keyType = (arg0 >> 8) & 0xff;
 	bool clearTrace = arg1 & 0x01;
 	bool multisectorCheck = arg1 & 0x02;
+	bool continueStream = arg1 & 0x04;	// not the first batch: the field is already on
+	bool keepField = arg1 & 0x08;		// more batches will follow: leave the field on
 	uint8_t set14aTimeout = (arg1 >> 8) & 0xff;
 	uint8_t keyCount = arg2;
 
@@ -977,9 +983,10 @@ void MifareChkKeys(uint16_t arg0, uint16_t arg1, uint8_t arg2, uint8_t *datain)
 	LED_A_ON();
 	LED_B_OFF();
 	LED_C_OFF();
-	iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
-
-	if (clearTrace) clear_trace();
+	if (!continueStream) {
+		iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+		if (clearTrace) clear_trace();
+	}
 	set_tracing(true);
 
 	if (set14aTimeout){
@@ -1010,8 +1017,10 @@ void MifareChkKeys(uint16_t arg0, uint16_t arg1, uint8_t arg2, uint8_t *datain)
 		LED_B_OFF();
 	}
 
-	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-	LEDsoff();
+	if (!keepField) {
+		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+		LEDsoff();
+	}
 
 	// restore debug level
 	MF_DBGLEVEL = OLD_MF_DBGLEVEL;
@@ -537,6 +537,7 @@ int CmdHFList(const char *Cmd)
 		PrintAndLog("------------|------------|-----|-----------------------------------------------------------------|-----|--------------------|");
 
 		ClearAuthData();
+		ClearTraceKeys();
 		while(tracepos < traceLen)
 		{
 			tracepos = printTraceLine(tracepos, traceLen, trace, protocol, showWaitCycles, markCRCBytes);
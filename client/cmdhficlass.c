@@ -26,13 +26,16 @@
 #include "polarssl/des.h"
 #include "loclass/cipherutils.h"
 #include "loclass/cipher.h"
+#include "loclass/cipher_bs.h"
 #include "loclass/ikeys.h"
 #include "loclass/elite_crack.h"
+#include "loclass/elite_store.h"
 #include "loclass/fileutils.h"
 #include "protocols.h"
 #include "usb_cmd.h"
 #include "cmdhfmfu.h"
 #include "util_posix.h"
+#include "keydict.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -100,6 +103,24 @@ int usage_hf_iclass_sim(void) {
 }
 
 #define NUM_CSNS 15
+// the CSNs used by the reader attack (hf iclass sim 2)
+static const uint8_t csns[8*NUM_CSNS] = {
+	0x00, 0x0B, 0x0F, 0xFF, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x04, 0x0E, 0x08, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x09, 0x0D, 0x05, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x0A, 0x0C, 0x06, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x0F, 0x0B, 0x03, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x08, 0x0A, 0x0C, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x0D, 0x09, 0x09, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x0E, 0x08, 0x0A, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x03, 0x07, 0x17, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x3C, 0x06, 0xE0, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x01, 0x05, 0x1D, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x02, 0x04, 0x1E, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x07, 0x03, 0x1B, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x00, 0x02, 0x24, 0xF7, 0xFF, 0x12, 0xE0,
+	0x00, 0x05, 0x01, 0x21, 0xF7, 0xFF, 0x12, 0xE0 };
+
 int CmdHFiClassSim(const char *Cmd) {
 	uint8_t simType = 0;
 	uint8_t CSN[8] = {0, 0, 0, 0, 0, 0, 0, 0};
@@ -130,22 +151,6 @@ int CmdHFiClassSim(const char *Cmd) {
 		UsbCommand c = {CMD_SIMULATE_TAG_ICLASS, {simType,NUM_CSNS}};
 		UsbCommand resp = {0};
 
-		uint8_t csns[8*NUM_CSNS] = {
-			0x00, 0x0B, 0x0F, 0xFF, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x04, 0x0E, 0x08, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x09, 0x0D, 0x05, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x0A, 0x0C, 0x06, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x0F, 0x0B, 0x03, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x08, 0x0A, 0x0C, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x0D, 0x09, 0x09, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x0E, 0x08, 0x0A, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x03, 0x07, 0x17, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x3C, 0x06, 0xE0, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x01, 0x05, 0x1D, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x02, 0x04, 0x1E, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x07, 0x03, 0x1B, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x00, 0x02, 0x24, 0xF7, 0xFF, 0x12, 0xE0,
-			0x00, 0x05, 0x01, 0x21, 0xF7, 0xFF, 0x12, 0xE0 };
 
 		memcpy(c.d.asBytes, csns, 8*NUM_CSNS);
 
@@ -1245,6 +1250,42 @@ int CmdHFiClass_ReadBlock(const char *Cmd) {
 	return ReadBlock(KEY, blockno, keyType, elite, rawkey, true, auth);
 }
 
+static int loclassStore(const char *storeName, const char *Cmd) {
+	elite_store_t store;
+	char dumpName[255] = {0};
+	int errors = 0;
+
+	if (elite_store_load(storeName, &store)) return 1;
+
+	if (param_getstr(Cmd, 2, dumpName, sizeof(dumpName)) > 0) {
+		size_t dumpsize = 0;
+		uint8_t *dump = NULL;
+		FILE *f = fopen(dumpName, "rb");
+		if (f) {
+			fseek(f, 0, SEEK_END);
+			long fsize = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			dump = malloc(fsize > 0 ? fsize : 1);
+			if (dump != NULL) dumpsize = fread(dump, 1, fsize > 0 ? fsize : 0, f);
+			fclose(f);
+		}
+		if (dump == NULL) {
+			PrintAndLog("Failed to read from file '%s'", dumpName);
+			elite_store_free(&store);
+			return 1;
+		}
+		uint32_t added = elite_store_add_dump(&store, dump, dumpsize);
+		free(dump);
+		PrintAndLog("Added %u new items from %s", added, dumpName);
+		errors += elite_store_save(storeName, &store);
+	}
+
+	errors += elite_store_crack(&store, storeName);
+	elite_store_report(&store, csns, NUM_CSNS);
+	elite_store_free(&store);
+	return errors;
+}
+
 int CmdHFiClass_loclass(const char *Cmd) {
 	char opt = param_getchar(Cmd, 0);
 
@@ -1261,6 +1302,12 @@ int CmdHFiClass_loclass(const char *Cmd) {
 		PrintAndLog("                   <8 byte CSN><8 byte CC><4 byte NR><4 byte MAC>");
 		PrintAndLog("                   <8 byte CSN><8 byte CC><4 byte NR><4 byte MAC>");
 		PrintAndLog("                  ... totalling N*24 bytes");
+		PrintAndLog("s <store> [<filename>]  Add iclass dumpfile to a loclass store and bruteforce");
+		PrintAndLog("                   The store keeps all dumps added so far and the cracked key bytes.");
+		PrintAndLog("                   Only the bytes still missing are bruteforced, an interrupted");
+		PrintAndLog("                   run continues where it stopped. Lists which of the 15 CSNs of");
+		PrintAndLog("                   'hf iclass sim 2' would recover missing bytes. Other CSNs are not");
+		PrintAndLog("                   searched, 'hf iclass sim 2' can't simulate them.");
 		return 0;
 	}
 	char fileName[255] = {0};
@@ -1274,6 +1321,16 @@ int CmdHFiClass_loclass(const char *Cmd) {
 			PrintAndLog("You must specify a filename");
 		}
 	}
+	else if(opt == 's')
+	{
+		if(param_getstr(Cmd, 1, fileName, sizeof(fileName)) > 0)
+		{
+			return loclassStore(fileName, Cmd);
+		}else
+		{
+			PrintAndLog("You must specify a store filename");
+		}
+	}
 	else if(opt == 't')
 	{
 		int errors = testCipherUtils();
@@ -1712,25 +1769,73 @@ int CmdHFiClassManageKeys(const char *Cmd) {
 	return 0;
 }
 
+#define ICLASS_CHKKEYS_BATCH ((USB_CMD_DATA_SIZE - 16) / 4)		// after CSN and CC
+
+// Streams precomputed MACs to the device in batches. Returns the index of the valid MAC,
+// -1 if none was valid or -2 if the card was lost or replaced or the user aborted.
+static int32_t iclass_check_macs(const uint8_t *CSN, const uint8_t *CC, const uint8_t *macs, uint32_t num_macs, bool use_credit_key) {
+	UsbCommand resp;
+	uint8_t flags = use_credit_key ? FLAG_ICLASS_CHKKEYS_CREDITKEY : 0;
+
+	for (uint32_t base = 0; base < num_macs; ) {
+		uint32_t batch = MIN(num_macs - base, ICLASS_CHKKEYS_BATCH);
+		printf("."); fflush(stdout);
+		if (ukbhit()) {
+			int gc = getchar(); (void)gc;
+			printf("\naborted via keyboard!\n");
+			return -2;
+		}
+
+		UsbCommand c = {CMD_ICLASS_CHECK_KEYS, {flags, batch, 0}};
+		if (base + batch < num_macs)
+			c.arg[0] |= FLAG_ICLASS_CHKKEYS_KEEP_FIELD;
+		memcpy(c.d.asBytes, CSN, 8);
+		memcpy(c.d.asBytes + 8, CC, 8);
+		memcpy(c.d.asBytes + 16, macs + 4 * base, 4 * batch);
+		clearCommandBuffer();
+		SendCommand(&c);
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, 20000)) {
+			PrintAndLog("\nCommand execute timeout");
+			return -2;
+		}
+		if (resp.arg[0] == ICLASS_CHKKEYS_NO_CARD) {
+			PrintAndLog("\nFailed to select the card. Aborting");
+			return -2;
+		}
+		if (resp.arg[0] == ICLASS_CHKKEYS_CARD_CHANGED) {
+			PrintAndLog("\nCSN or CC of the card changed. Aborting");
+			return -2;
+		}
+		int32_t found = resp.arg[1];
+		if (found >= 0)
+			return base + found;
+		if (resp.arg[2] < batch) {
+			PrintAndLog("\naborted via button press!");
+			return -2;
+		}
+		base += batch;
+		flags |= FLAG_ICLASS_CHKKEYS_CONTINUE;
+	}
+
+	return -1;
+}
+
 int CmdHFiClassCheckKeys(const char *Cmd) {
 
-	uint8_t mac[4] = {0x00,0x00,0x00,0x00};
-	uint8_t key[8] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
-	uint8_t div_key[8] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
+	uint8_t CSN[8] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
+	uint8_t CCNR[12] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
 
 	// elite key,  raw key, standard key
 	bool use_elite = false;
 	bool use_raw = false;	
-	bool found_debit = false;
-	bool found_credit = false;	
 	bool errors = false;
 	uint8_t cmdp = 0x00;
-	FILE * f;
 	char filename[FILE_PATH_SIZE] = {0};
 	uint8_t fileNameLen = 0;
-	char buf[17];
-	uint8_t *keyBlock = NULL, *p;
-	int keyitems = 0, keycnt = 0;
+	uint8_t *keyBlock = NULL;
+	uint8_t *div_keys = NULL;
+	uint8_t *macs = NULL;
+	keydict_t dict;
 
 	while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
 		switch (param_getchar(Cmd, cmdp)) {
@@ -1764,83 +1869,54 @@ int CmdHFiClassCheckKeys(const char *Cmd) {
 	}
 	if (errors) return usage_hf_iclass_chk();	
 			
-	if ( !(f = fopen( filename , "r")) ) {
+	if (!keydict_load(filename, 8, &dict)) {
 		PrintAndLog("File: %s: not found or locked.", filename);
 		return 1;
 	}
-
-	while( fgets(buf, sizeof(buf), f) ){
-		if (strlen(buf) < 16 || buf[15] == '\n')
-			continue;
-	
-		while (fgetc(f) != '\n' && !feof(f)) ;  //goto next line
-		
-		if( buf[0]=='#' ) continue;	//The line start with # is comment, skip
-
-		if (!isxdigit(buf[0])){
-			PrintAndLog("File content error. '%s' must include 16 HEX symbols",buf);
-			continue;
-		}
-		
-		buf[16] = 0;
-
-		p = realloc(keyBlock, 8 * (keyitems += 64));
-		if (!p) {
-			PrintAndLog("Cannot allocate memory for default keys");
-			free(keyBlock);
-			fclose(f);
-			return 2;
-		}
-		keyBlock = p;
-
-		memset(keyBlock + 8 * keycnt, 0, 8);
-		num_to_bytes(strtoull(buf, NULL, 16), 8, keyBlock + 8 * keycnt);
-
-		//PrintAndLog("check key[%2d] %016" PRIx64, keycnt, bytes_to_num(keyBlock + 8*keycnt, 8));
-		keycnt++;
-		memset(buf, 0, sizeof(buf));
+	uint32_t keycnt = dict.count;
+	keyBlock = calloc(keycnt + 1, 8);
+	div_keys = calloc(keycnt + 1, 8);
+	macs = calloc(keycnt + 1, 4);
+	if (keyBlock == NULL || div_keys == NULL || macs == NULL) {
+		PrintAndLog("Cannot allocate memory for default keys");
+		free(keyBlock);
+		free(div_keys);
+		free(macs);
+		keydict_close(&dict);
+		return 2;
 	}
-	fclose(f);
-	PrintAndLog("Loaded %2d keys from %s", keycnt, filename);
+	keydict_get_keys(&dict, keyBlock);
+	PrintAndLog("Loaded %2" PRIu32 " keys from %s", keycnt, filename);
 	
 	// time
 	uint64_t t1 = msclock();
-				
-	for (uint32_t c = 0; c < keycnt; c += 1) {
-			printf("."); fflush(stdout);			
-			if (ukbhit()) {
-				int gc = getchar(); (void)gc;
-				printf("\naborted via keyboard!\n");
-				break;
-			}
-			
-			memcpy(key, keyBlock + 8 * c , 8); 
 
-			// debit key. try twice
-			for (int foo = 0; foo < 2 && !found_debit; foo++) {
-				if (!select_and_auth(key, mac, div_key, false, use_elite, use_raw, false))
-					continue;
+	// The CC (and therefore the MAC for a given key) is the same for the debit and the credit key
+	// and doesn't change while we only try to authenticate. Select the card once and precompute
+	// the MACs of all keys.
+	if (select_only(CSN, CCNR, false, true)) {
+		for (uint32_t c = 0; c < keycnt; c++) {
+			if (use_raw)
+				memcpy(div_keys + 8 * c, keyBlock + 8 * c, 8);
+			else
+				HFiClassCalcDivKey(CSN, keyBlock + 8 * c, div_keys + 8 * c, use_elite);
+		}
+		doMAC_bs(CCNR, div_keys, keycnt, macs);
 
-				// key found.
-				PrintAndLog("\n--------------------------------------------------------");
-			PrintAndLog("   Found AA1 debit key\t\t[%s]", sprint_hex(key, 8));
-				found_debit = true;
-			}
-			
-			// credit key. try twice
-			for (int foo = 0; foo < 2 && !found_credit; foo++) {
-				if (!select_and_auth(key, mac, div_key, true, use_elite, use_raw, false))
-					continue;
-				
-				// key found
+		int32_t found = iclass_check_macs(CSN, CCNR, macs, keycnt, false);
+		if (found >= 0) {
+			PrintAndLog("\n--------------------------------------------------------");
+			PrintAndLog("   Found AA1 debit key\t\t[%s]", sprint_hex(keyBlock + 8 * found, 8));
+			keydict_add_hit(&dict, bytes_to_num(keyBlock + 8 * found, 8));
+		}
+		if (found >= -1) {
+			found = iclass_check_macs(CSN, CCNR, macs, keycnt, true);
+			if (found >= 0) {
 				PrintAndLog("\n--------------------------------------------------------");
-				PrintAndLog("   Found AA2 credit key\t\t[%s]", sprint_hex(key, 8));
-				found_credit = true;
+				PrintAndLog("   Found AA2 credit key\t\t[%s]", sprint_hex(keyBlock + 8 * found, 8));
+				keydict_add_hit(&dict, bytes_to_num(keyBlock + 8 * found, 8));
 			}
-			
-			// both keys found.
-			if ( found_debit && found_credit )
-				break;
+		}
 	}
 
 	t1 = msclock() - t1;
@@ -1848,7 +1924,10 @@ int CmdHFiClassCheckKeys(const char *Cmd) {
 	PrintAndLog("\nTime in iclass checkkeys: %.0f seconds\n", (float)t1/1000.0);
 	
 	DropField();
+	keydict_close(&dict);
 	free(keyBlock);
+	free(div_keys);
+	free(macs);
 	PrintAndLog("");
 	return 0;
 }
@@ -23,6 +23,7 @@
 #include "crapto1/crapto1.h"
 #include "mifarehost.h"
 #include "mifaredefault.h"
+#include "crypto1_bs.h"
 
 
 enum MifareAuthSeq {
@@ -38,6 +39,27 @@ enum MifareAuthSeq {
 static enum MifareAuthSeq MifareAuthState;
 static TAuthData AuthData;
 
+#define MAX_TRACE_KEYS 64
+static uint64_t TraceKeys[MAX_TRACE_KEYS];		// keys recovered from the trace so far
+static uint32_t TraceKeysCount;
+
+void ClearTraceKeys() {
+	TraceKeysCount = 0;
+}
+
+static bool IsTraceKey(uint64_t key) {
+	for (uint32_t i = 0; i < TraceKeysCount; i++) {
+		if (TraceKeys[i] == key)
+			return true;
+	}
+	return false;
+}
+
+static void AddTraceKey(uint64_t key) {
+	if (!IsTraceKey(key) && TraceKeysCount < MAX_TRACE_KEYS)
+		TraceKeys[TraceKeysCount++] = key;
+}
+
 void ClearAuthData() {
 	AuthData.uid = 0;
 	AuthData.nt = 0;
@@ -392,6 +414,7 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
 			AuthData.ks3 = AuthData.at_enc ^ prng_successor(AuthData.nt, 96);
 
 			mfLastKey = GetCrypto1ProbableKey(&AuthData);
+			AddTraceKey(mfLastKey);
 			PrintAndLog("            |          * | key | probable key:%012"PRIx64" Prng:%s   ks2:%08x ks3:%08x |     |", 
 				mfLastKey,
 				validate_prng_nonce(AuthData.nt) ? "WEAK": "HARD",
@@ -419,16 +442,24 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
 				};
 			}
 			
-			// check default keys
+			// check the keys recovered so far and the default keys. All of them are tested at once
+			// against {ar} and {at}, the remaining candidates are verified with the data.
 			if (!traceCrypto1) {
-				for (int defaultKeyCounter = 0; defaultKeyCounter < MifareDefaultKeysSize; defaultKeyCounter++){
-					if (NestedCheckKey(MifareDefaultKeys[defaultKeyCounter], &AuthData, cmd, cmdsize, parity)) {
-						PrintAndLog("            |          * | key | default key:%012"PRIx64"              ks2:%08x ks3:%08x |     |", 
-							MifareDefaultKeys[defaultKeyCounter],
+				uint64_t keys[MAX_TRACE_KEYS + MifareDefaultKeysSize];
+				uint64_t candidates[MAX_TRACE_KEYS + MifareDefaultKeysSize];
+				memcpy(keys, TraceKeys, TraceKeysCount * sizeof(uint64_t));
+				memcpy(keys + TraceKeysCount, MifareDefaultKeys, MifareDefaultKeysSize * sizeof(uint64_t));
+				uint32_t num_candidates = crypto1_bs_test_auth(keys, TraceKeysCount + MifareDefaultKeysSize, AuthData.uid, AuthData.nt_enc, true, AuthData.nr_enc, AuthData.ar_enc, AuthData.at_enc, candidates);
+				for (uint32_t i = 0; i < num_candidates; i++) {
+					if (NestedCheckKey(candidates[i], &AuthData, cmd, cmdsize, parity)) {
+						PrintAndLog("            |          * | key | %s:%012"PRIx64"              ks2:%08x ks3:%08x |     |", 
+							IsTraceKey(candidates[i]) ? "known key  " : "default key",
+							candidates[i],
 							AuthData.ks2,
 							AuthData.ks3);
 
-						mfLastKey = MifareDefaultKeys[defaultKeyCounter];
+						mfLastKey = candidates[i];
+						AddTraceKey(mfLastKey);
 						traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
 						break;
 					};
@@ -455,6 +486,7 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
 
 							AuthData.nt = ntx;
 							mfLastKey = GetCrypto1ProbableKey(&AuthData);
+							AddTraceKey(mfLastKey);
 							PrintAndLog("            |          * | key | nested probable key:%012"PRIx64"      ks2:%08x ks3:%08x |     |", 
 								mfLastKey,
 								AuthData.ks2,
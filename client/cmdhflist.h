@@ -29,6 +29,7 @@ typedef struct {
 	uint32_t ks3;       // at ^ at_enc
 } TAuthData;
 extern void ClearAuthData();
+extern void ClearTraceKeys();
 
 extern uint8_t iso14443A_CRC_check(bool isResponse, uint8_t* data, uint8_t len);
 extern uint8_t mifare_CRC_check(bool isResponse, uint8_t* data, uint8_t len);
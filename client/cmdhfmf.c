@@ -18,14 +18,17 @@
 #include "comms.h"
 #include "cmdmain.h"
 #include "cmdhfmfhard.h"
+#include "cmdhfmfautopwn.h"
 #include "parity.h"
 #include "util.h"
 #include "util_posix.h"
 #include "usb_cmd.h"
 #include "ui.h"
 #include "mifarehost.h"
+#include "keydict.h"
 #include "mifare.h"
 #include "mfkey.h"
+#include "crapto1/crapto1.h"
 #include "hardnested/hardnested_bf_core.h"
 
 #define NESTED_SECTOR_RETRY     10			// how often we try mfested() until we give up
@@ -246,6 +249,43 @@ static int ParamCardSizeBlocks(const char c) {
 	return numBlocks;
 }
 
+static uint16_t ParamHardnestedTargets(const char *Cmd, int paramnum, hardnested_target_t *targets)
+{
+	// either a card memory size (all sectors, key A and key B) or a list of sectors with key types, e.g. 1a,2b,5ab
+	char buf[200] = {0};
+	uint16_t num_targets = 0;
+
+	if (param_getlength(Cmd, paramnum) == 1) {
+		int SectorsCnt = ParamCardSizeSectors(param_getchar(Cmd, paramnum));
+		for (uint8_t sectorNo = 0; sectorNo < SectorsCnt; sectorNo++) {
+			for (uint8_t keyType = 0; keyType < 2; keyType++) {
+				targets[num_targets].blockNo = FirstBlockOfSector(sectorNo);
+				targets[num_targets].keyType = keyType;
+				num_targets++;
+			}
+		}
+		return num_targets;
+	}
+
+	param_getstr(Cmd, paramnum, buf, sizeof(buf));
+	for (char *p = strtok(buf, ","); p != NULL; p = strtok(NULL, ",")) {
+		char *keyTypes;
+		long sectorNo = strtol(p, &keyTypes, 10);
+		if (keyTypes == p || sectorNo < 0 || sectorNo >= 40 || *keyTypes == '\0') {
+			return 0;
+		}
+		for ( ; *keyTypes != '\0'; keyTypes++) {
+			if (num_targets == 80 || (tolower(*keyTypes) != 'a' && tolower(*keyTypes) != 'b')) {
+				return 0;
+			}
+			targets[num_targets].blockNo = FirstBlockOfSector(sectorNo);
+			targets[num_targets].keyType = tolower(*keyTypes) == 'b';
+			num_targets++;
+		}
+	}
+	return num_targets;
+}
+
 int CmdHF14AMfDump(const char *Cmd)
 {
 	uint8_t sectorNo, blockNo;
@@ -842,6 +882,76 @@ int CmdHF14AMfNested(const char *Cmd)
 }
 
 
+static int NestedHardBatch(uint8_t blockNo, uint8_t keyType, uint8_t *key, hardnested_target_t *targets, uint16_t num_targets, bool slow, bool createDumpFile)
+{
+	sector_t e_sector[40];
+	uint8_t SectorsCnt = 0;
+	uint8_t keySector = blockNo < 32*4 ? blockNo / 4 : 32 + (blockNo - 32*4) / 16;
+
+	PrintAndLog("--block no:%3d, key type:%c, key:%s, targets:%d, Slow: %s",
+			blockNo, keyType?'B':'A', sprint_hex(key, 6), num_targets, slow?"Yes":"No");
+
+	memset(e_sector, 0, sizeof(e_sector));
+	for (uint16_t i = 0; i < num_targets; i++) {
+		targets[i].found = false;
+		targets[i].key = 0;
+		if (FirstBlockOfSector(keySector) == targets[i].blockNo && keyType == targets[i].keyType) {
+			targets[i].found = true;		// no need to attack the known key
+			targets[i].key = bytes_to_num(key, 6);
+		}
+	}
+
+	uint64_t msclock1 = msclock();
+	int16_t isOK = mfnestedhard_batch(blockNo, keyType, key, targets, num_targets, slow);
+
+	if (isOK) {
+		switch (isOK) {
+			case 1 : PrintAndLog("Error: No response from Proxmark.\n"); break;
+			case 2 : PrintAndLog("Button pressed. Aborted.\n"); break;
+			default : break;
+		}
+	}
+
+	// print result
+	for (uint16_t i = 0; i < num_targets; i++) {
+		uint8_t sectorNo = targets[i].blockNo < 32*4 ? targets[i].blockNo / 4 : 32 + (targets[i].blockNo - 32*4) / 16;
+		SectorsCnt = MAX(SectorsCnt, sectorNo + 1);
+		if (targets[i].found) {
+			e_sector[sectorNo].foundKey[targets[i].keyType] = 1;
+			e_sector[sectorNo].Key[targets[i].keyType] = targets[i].key;
+		}
+	}
+	PrintAndLog("\nTime in hardnested: %1.0f seconds", ((float)(msclock() - msclock1))/1000.0);
+	PrintAndLog("|---|----------------|---|----------------|---|");
+	PrintAndLog("|sec|key A           |res|key B           |res|");
+	PrintAndLog("|---|----------------|---|----------------|---|");
+	for (uint8_t i = 0; i < SectorsCnt; i++) {
+		PrintAndLog("|%03d|  %012" PRIx64 "  | %d |  %012" PRIx64 "  | %d |", i,
+			e_sector[i].Key[0], e_sector[i].foundKey[0], e_sector[i].Key[1], e_sector[i].foundKey[1]);
+	}
+	PrintAndLog("|---|----------------|---|----------------|---|");
+
+	if (createDumpFile) {
+		FILE *fkeys;
+		uint8_t tempkey[6];
+		if ((fkeys = fopen("dumpkeys.bin","wb")) == NULL) {
+			PrintAndLog("Could not create file dumpkeys.bin");
+			return 1;
+		}
+		PrintAndLog("Printing keys to binary file dumpkeys.bin...");
+		for (uint8_t keyType = 0; keyType < 2; keyType++) {
+			for (uint8_t i = 0; i < SectorsCnt; i++) {
+				num_to_bytes(e_sector[i].foundKey[keyType] ? e_sector[i].Key[keyType] : 0xffffffffffff, 6, tempkey);
+				fwrite(tempkey, 1, 6, fkeys);
+			}
+		}
+		fclose(fkeys);
+	}
+
+	return isOK ? 2 : 0;
+}
+
+
 int CmdHF14AMfNestedHard(const char *Cmd)
 {
 	uint8_t blockNo = 0;
@@ -854,31 +964,55 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 	char ctmp;
 	ctmp = param_getchar(Cmd, 0);
 
-	if (ctmp != 'R' && ctmp != 'r' && ctmp != 'T' && ctmp != 't' && strlen(Cmd) < 20) {
+	if (ctmp != 'R' && ctmp != 'r' && ctmp != 'T' && ctmp != 't' && ctmp != 'U' && ctmp != 'u' && ctmp != 'B' && ctmp != 'b' && strlen(Cmd) < 20) {
 		PrintAndLog("Usage:");
 		PrintAndLog("      hf mf hardnested <block number> <key A|B> <key (12 hex symbols)>");
-		PrintAndLog("                       <target block number> <target key A|B> [known target key (12 hex symbols)] [w] [s]");
-		PrintAndLog("  or  hf mf hardnested r [known target key]");
+		PrintAndLog("                       <target block number> <target key A|B> [known target key (12 hex symbols)] [w] [s] [c] [x <directory>]");
+		PrintAndLog("  or  hf mf hardnested r [known target key] [c] [x <directory>]");
+		PrintAndLog("  or  hf mf hardnested u [known target key] [c] [x <directory>]");
+		PrintAndLog("  or  hf mf hardnested <block number> <key A|B> <key (12 hex symbols)> * <card memory>|<target list> [s] [d]");
+		PrintAndLog("  or  hf mf hardnested b [j <json file>] [nonce files]");
 		PrintAndLog(" ");
 		PrintAndLog("Options: ");
 		PrintAndLog("      w: Acquire nonces and write them to binary file nonces.bin");
 		PrintAndLog("      s: Slower acquisition (required by some non standard cards)");
+		PrintAndLog("      c: Write checkpoints to file hardnested_checkpoint.bin");
 		PrintAndLog("      r: Read nonces.bin and start attack");
+		PrintAndLog("      u: Resume an interrupted attack from hardnested_checkpoint.bin. Add c to keep writing checkpoints");
+		PrintAndLog("      *: Attack several keys of the card. Nonces for the next key are acquired while the current key is brute forced");
+		PrintAndLog("         card memory - 0 - MINI(320 bytes), 1 - 1K, 2 - 2K, 4 - 4K, <other> - 1K. Attacks key A and key B of all sectors");
+		PrintAndLog("         target list - comma separated list of sectors and key types, e.g. 1a,2b,5ab");
+		PrintAndLog("      d: (with *) Write keys to binary file dumpkeys.bin");
+		PrintAndLog("      x: Distribute the brute force phase. Write work units to <directory> and wait for the results of");
+		PrintAndLog("         hardnested_worker processes (e.g. hardnested_worker -w <directory> on several machines sharing the directory)");
+		PrintAndLog("         Press a key to stop waiting and brute force the remaining work units locally. This is also done");
+		PrintAndLog("         after twice the local brute force time, and for units which a worker reported as invalid");
+		PrintAndLog("      b: Offline benchmark. Run the attack phases on the nonce files (default nonces.bin) with each SIMD instruction set");
+		PrintAndLog("         and write the timings to hardnested_bench.json. Only a limited number of keys is brute forced");
+		PrintAndLog("      j: (with b) Write the timings to <json file>");
 		PrintAndLog("      iX: set type of SIMD instructions. Without this flag programs autodetect it.");
 		PrintAndLog("        i5: AVX512");
 		PrintAndLog("        i2: AVX2");
 		PrintAndLog("        ia: AVX");
 		PrintAndLog("        is: SSE2");
 		PrintAndLog("        im: MMX");
+		PrintAndLog("        iv: SVE (256 bit, aarch64)");
+		PrintAndLog("        ie: NEON (aarch64)");
 		PrintAndLog("        in: none (use CPU regular instruction set)");
 		PrintAndLog(" ");
 		PrintAndLog("      sample1: hf mf hardnested 0 A FFFFFFFFFFFF 4 A");
 		PrintAndLog("      sample2: hf mf hardnested 0 A FFFFFFFFFFFF 4 A w");
 		PrintAndLog("      sample3: hf mf hardnested 0 A FFFFFFFFFFFF 4 A w s");
 		PrintAndLog("      sample4: hf mf hardnested r");
+		PrintAndLog("      sample5: hf mf hardnested 0 A FFFFFFFFFFFF 4 A c");
+		PrintAndLog("      sample6: hf mf hardnested u c");
+		PrintAndLog("      sample7: hf mf hardnested 0 A FFFFFFFFFFFF * 1 d");
+		PrintAndLog("      sample8: hf mf hardnested 0 A FFFFFFFFFFFF * 1a,2b,15ab");
+		PrintAndLog("      sample9: hf mf hardnested b j bench.json nonces1.bin nonces2.bin");
+		PrintAndLog("      sample10: hf mf hardnested r x /mnt/share/hardnested");
 		PrintAndLog(" ");
 		PrintAndLog("Add the known target key to check if it is present in the remaining key space:");
-		PrintAndLog("      sample5: hf mf hardnested 0 A A0A1A2A3A4A5 4 A FFFFFFFFFFFF");
+		PrintAndLog("      sample11: hf mf hardnested 0 A A0A1A2A3A4A5 4 A FFFFFFFFFFFF");
 		return 0;
 	}
 
@@ -886,7 +1020,19 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 	bool nonce_file_read = false;
 	bool nonce_file_write = false;
 	bool slow = false;
+	bool write_checkpoints = false;
+	bool resume = false;
+	bool batch = false;
+	bool createDumpFile = false;
+	hardnested_target_t targets[80];
+	uint16_t num_targets = 0;
 	int tests = 0;
+	bool benchmark = false;
+	bool all_instruction_sets = true;
+	char nonce_files[16][FILE_PATH_SIZE];
+	uint16_t num_nonce_files = 0;
+	char json_filename[FILE_PATH_SIZE] = "hardnested_bench.json";
+	char work_directory[FILE_PATH_SIZE] = "";
 
 
 	uint16_t iindx = 0;
@@ -897,6 +1043,34 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 			know_target_key = true;
 			iindx = 2;
 		}
+	} else if (ctmp == 'U' || ctmp == 'u') {
+		resume = true;
+		iindx = 1;
+		if (!param_gethex(Cmd, 1, trgkey, 12)) {
+			know_target_key = true;
+			iindx = 2;
+		}
+	} else if (ctmp == 'B' || ctmp == 'b') {
+		benchmark = true;
+		iindx = 1;
+		for (uint16_t i = 1; (ctmp = param_getchar(Cmd, i)); i++) {
+			if (param_getlength(Cmd, i) == 2 && ctmp == 'i') {
+				all_instruction_sets = false;
+			} else if (param_getlength(Cmd, i) == 1 && (ctmp == 'j' || ctmp == 'J')) {
+				if (param_getstr(Cmd, ++i, json_filename, FILE_PATH_SIZE) == 0) {
+					PrintAndLog("Missing json file name");
+					return 1;
+				}
+			} else if (num_nonce_files < 16) {
+				param_getstr(Cmd, i, nonce_files[num_nonce_files++], FILE_PATH_SIZE);
+			} else {
+				PrintAndLog("Too many nonce files");
+				return 1;
+			}
+		}
+		if (num_nonce_files == 0) {
+			strcpy(nonce_files[num_nonce_files++], "nonces.bin");
+		}
 	} else if (ctmp == 'T' || ctmp == 't') {
 		tests = param_get32ex(Cmd, 1, 100, 10);
 		iindx = 2;
@@ -920,33 +1094,54 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 			return 1;
 		}
 
-		trgBlockNo = param_get8(Cmd, 3);
-		ctmp = param_getchar(Cmd, 4);
-		if (ctmp != 'a' && ctmp != 'A' && ctmp != 'b' && ctmp != 'B') {
-			PrintAndLog("Target key type must be A or B");
-			return 1;
-		}
-		if (ctmp != 'A' && ctmp != 'a') {
-			trgKeyType = 1;
-		}
+		uint16_t i;
 
-		uint16_t i = 5;
+		if (param_getchar(Cmd, 3) == '*') {
+			batch = true;
+			num_targets = ParamHardnestedTargets(Cmd, 4, targets);
+			if (num_targets == 0) {
+				PrintAndLog("Invalid card memory or target list");
+				return 1;
+			}
+			i = 5;
+		} else {
+			trgBlockNo = param_get8(Cmd, 3);
+			ctmp = param_getchar(Cmd, 4);
+			if (ctmp != 'a' && ctmp != 'A' && ctmp != 'b' && ctmp != 'B') {
+				PrintAndLog("Target key type must be A or B");
+				return 1;
+			}
+			if (ctmp != 'A' && ctmp != 'a') {
+				trgKeyType = 1;
+			}
 
-		if (!param_gethex(Cmd, 5, trgkey, 12)) {
-			know_target_key = true;
-			i++;
+			i = 5;
+
+			if (!param_gethex(Cmd, 5, trgkey, 12)) {
+				know_target_key = true;
+				i++;
+			}
 		}
 		iindx = i;
 
 		while ((ctmp = param_getchar(Cmd, i))) {
 			if (ctmp == 's' || ctmp == 'S') {
 				slow = true;
-			} else if (ctmp == 'w' || ctmp == 'W') {
+			} else if (!batch && (ctmp == 'w' || ctmp == 'W')) {
 				nonce_file_write = true;
+			} else if (!batch && (ctmp == 'c' || ctmp == 'C')) {
+				write_checkpoints = true;
+			} else if (batch && (ctmp == 'd' || ctmp == 'D')) {
+				createDumpFile = true;
+			} else if (!batch && param_getlength(Cmd, i) == 1 && (ctmp == 'x' || ctmp == 'X')) {
+				if (param_getstr(Cmd, ++i, work_directory, FILE_PATH_SIZE) == 0) {
+					PrintAndLog("Missing work unit directory");
+					return 1;
+				}
 			} else if (param_getlength(Cmd, i) == 2 && ctmp == 'i') {
 				iindx = i;
 			} else {
-				PrintAndLog("Possible options are w , s and/or iX");
+				PrintAndLog(batch ? "Possible options are s , d and/or iX" : "Possible options are w , s , c , x and/or iX");
 				return 1;
 			}
 			i++;
@@ -973,6 +1168,12 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 					case 'm':
 						SetSIMDInstr(SIMD_MMX);
 						break;
+					case 'v':
+						SetSIMDInstr(SIMD_SVE);
+						break;
+					case 'e':
+						SetSIMDInstr(SIMD_NEON);
+						break;
 					case 'n':
 						SetSIMDInstr(SIMD_NONE);
 						break;
@@ -980,21 +1181,42 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 						PrintAndLog("Unknown SIMD type. %c", param_getchar_indx(Cmd, 1, iindx));
 						return 1;
 				}
+			} else if (!batch && !benchmark && param_getlength(Cmd, iindx) == 1 && (ctmp == 'x' || ctmp == 'X')) {
+				if (param_getstr(Cmd, ++iindx, work_directory, FILE_PATH_SIZE) == 0) {
+					PrintAndLog("Missing work unit directory");
+					return 1;
+				}
+			} else if (!batch && !benchmark && param_getlength(Cmd, iindx) == 1 && (ctmp == 'c' || ctmp == 'C')) {
+				write_checkpoints = true;
 			}
 			iindx++;
 		}	
 	}
 
-	PrintAndLog("--target block no:%3d, target key type:%c, known target key: 0x%02x%02x%02x%02x%02x%02x%s, file action: %s, Slow: %s, Tests: %d ",
+	if (benchmark) {
+		char *nonce_file_names[16];
+		for (uint16_t i = 0; i < num_nonce_files; i++) {
+			nonce_file_names[i] = nonce_files[i];
+		}
+		return mfnestedhard_benchmark(nonce_file_names, num_nonce_files, all_instruction_sets, json_filename);
+	}
+
+	if (batch) {
+		return NestedHardBatch(blockNo, keyType, key, targets, num_targets, slow, createDumpFile);
+	}
+
+	PrintAndLog("--target block no:%3d, target key type:%c, known target key: 0x%02x%02x%02x%02x%02x%02x%s, file action: %s, Slow: %s, Checkpoints: %s, Work units: %s, Tests: %d ",
 			trgBlockNo,
 			trgKeyType?'B':'A',
 			trgkey[0], trgkey[1], trgkey[2], trgkey[3], trgkey[4], trgkey[5],
 			know_target_key?"":" (not set)",
-			nonce_file_write?"write":nonce_file_read?"read":"none",
+			nonce_file_write?"write":nonce_file_read?"read":resume?"resume":"none",
 			slow?"Yes":"No",
+			write_checkpoints?"Yes":"No",
+			work_directory[0]?work_directory:"none",
 			tests);
 
-	int16_t isOK = mfnestedhard(blockNo, keyType, key, trgBlockNo, trgKeyType, know_target_key?trgkey:NULL, nonce_file_read, nonce_file_write, slow, tests);
+	int16_t isOK = mfnestedhard(blockNo, keyType, key, trgBlockNo, trgKeyType, know_target_key?trgkey:NULL, nonce_file_read, nonce_file_write, slow, tests, write_checkpoints, resume, work_directory[0]?work_directory:NULL);
 
 	if (isOK) {
 		switch (isOK) {
@@ -1009,6 +1231,64 @@ int CmdHF14AMfNestedHard(const char *Cmd)
 }
 
 
+int CmdHF14AMfAutoPwn(const char *Cmd)
+{
+	uint8_t SectorsCnt = 0;
+	uint8_t btimeout14a = MF_CHKKEYS_DEFTIMEOUT;
+	bool slow = false;
+	bool transferToEml = false;
+	bool createDumpFile = false;
+	char filename[FILE_PATH_SIZE] = {0};
+
+	for (int i = 0; param_getlength(Cmd, i) > 0; i++) {
+		char ctmp = tolower(param_getchar(Cmd, i));
+		if (param_getlength(Cmd, i) == 1 && ctmp == 'f') {
+			if (param_getstr(Cmd, ++i, filename, sizeof(filename)) == 0) {
+				PrintAndLog("Dictionary file name missing");
+				return 1;
+			}
+		} else if (param_getlength(Cmd, i) == 1 && (ctmp == '0' || ctmp == '1' || ctmp == '2' || ctmp == '4')) {
+			SectorsCnt = ParamCardSizeSectors(ctmp);
+		} else if (param_getlength(Cmd, i) == 1 && ctmp == 't') {
+			transferToEml = true;
+		} else if (param_getlength(Cmd, i) == 1 && ctmp == 'd') {
+			createDumpFile = true;
+		} else if (param_getlength(Cmd, i) == 1 && ctmp == 's') {
+			slow = true;
+			btimeout14a = 11; // slow
+		} else if (param_getlength(Cmd, i) == 2 && ctmp == 's' && tolower(param_getchar_indx(Cmd, 1, i)) == 's') {
+			slow = true;
+			btimeout14a = 53; // very slow
+		} else {
+			PrintAndLog("Usage:  hf mf autopwn [<card memory>] [f <dictionary file>] [t] [d] [s|ss]");
+			PrintAndLog("Recover all keys of a card. The PRNG of the card is probed and the cheapest attacks are chained:");
+			PrintAndLog("dictionary, darkside (if no key is known), reading key B from the sector trailers, nested or hardnested.");
+			PrintAndLog("      card memory - 0 - MINI(320 bytes), 1 - 1K, 2 - 2K, 4 - 4K. Default: detected from SAK");
+			PrintAndLog("      f  - additional dictionary file (*.dic) for the dictionary phase");
+			PrintAndLog("      t  - transfer keys to emulator memory");
+			PrintAndLog("      d  - write keys to binary file dumpkeys.bin");
+			PrintAndLog("      s  - Slow (1ms) check keys and slower hardnested acquisition (required by some non standard cards)");
+			PrintAndLog("      ss - Very slow (5ms) check keys");
+			PrintAndLog("");
+			PrintAndLog("      sample: hf mf autopwn");
+			PrintAndLog("              hf mf autopwn f default_keys.dic d");
+			return 0;
+		}
+	}
+
+	return mfautopwn(SectorsCnt, filename[0] ? filename : NULL, btimeout14a, slow, transferToEml, createDumpFile);
+}
+
+
+static void free_dicts(keydict_t *dicts, uint32_t num_dicts)
+{
+	for (uint32_t i = 0; i < num_dicts; i++) {
+		keydict_close(&dicts[i]);
+	}
+	free(dicts);
+}
+
+
 int CmdHF14AMfChk(const char *Cmd)
 {
 	if (strlen(Cmd)<3) {
@@ -1027,11 +1307,11 @@ int CmdHF14AMfChk(const char *Cmd)
 		return 0;
 	}
 
-	FILE * f;
 	char filename[FILE_PATH_SIZE]={0};
-	char buf[13];
 	uint8_t *keyBlock = NULL, *p;
-	uint16_t stKeyBlock = 20;
+	uint32_t stKeyBlock = 20;
+	keydict_t *dicts = NULL;
+	uint32_t num_dicts = 0;
 
 	int i, res;
 	int	keycnt = 0;
@@ -1130,48 +1410,39 @@ int CmdHF14AMfChk(const char *Cmd)
 			// May be a dic file
 			if ( param_getstr(Cmd, 2 + i, filename, sizeof(filename)) >= FILE_PATH_SIZE ) {
 				PrintAndLog("File name too long");
+				free_dicts(dicts, num_dicts);
 				free(keyBlock);
 				return 2;
 			}
 
-			if ( (f = fopen( filename , "r")) ) {
-				while( fgets(buf, sizeof(buf), f) ){
-					if (strlen(buf) < 12 || buf[11] == '\n')
-						continue;
-
-					while (fgetc(f) != '\n' && !feof(f)) ;  //goto next line
-
-					if( buf[0]=='#' ) continue;	//The line start with # is comment, skip
-
-					if (!isxdigit((unsigned char)buf[0])){
-						PrintAndLog("File content error. '%s' must include 12 HEX symbols",buf);
-						continue;
-					}
-
-					buf[12] = 0;
-
-					if ( stKeyBlock - keycnt < 2) {
-						p = realloc(keyBlock, 6*(stKeyBlock+=10));
-						if (!p) {
-							PrintAndLog("Cannot allocate memory for defKeys");
-							free(keyBlock);
-							fclose(f);
-							return 2;
-						}
-						keyBlock = p;
+			keydict_t *p_dicts = realloc(dicts, (num_dicts + 1) * sizeof(keydict_t));
+			if (p_dicts == NULL) {
+				PrintAndLog("Cannot allocate memory for dictionary");
+				free_dicts(dicts, num_dicts);
+				free(keyBlock);
+				return 2;
+			}
+			dicts = p_dicts;
+			if (keydict_load(filename, 6, &dicts[num_dicts])) {
+				keydict_t *dict = &dicts[num_dicts++];
+				if (stKeyBlock < keycnt + dict->count) {
+					p = realloc(keyBlock, 6*(stKeyBlock = keycnt + dict->count + 10));
+					if (!p) {
+						PrintAndLog("Cannot allocate memory for defKeys");
+						free_dicts(dicts, num_dicts);
+						free(keyBlock);
+						return 2;
 					}
-					memset(keyBlock + 6 * keycnt, 0, 6);
-					num_to_bytes(strtoll(buf, NULL, 16), 6, keyBlock + 6*keycnt);
-					PrintAndLog("chk custom key[%2d] %012" PRIx64 , keycnt, bytes_to_num(keyBlock + 6*keycnt, 6));
-					keycnt++;
-					memset(buf, 0, sizeof(buf));
+					keyBlock = p;
 				}
-				fclose(f);
+				keydict_get_keys(dict, keyBlock + 6*keycnt);
+				keycnt += dict->count;
+				PrintAndLog("Loaded %" PRIu32 " keys from %s", dict->count, filename);
 			} else {
 				PrintAndLog("File: %s: not found or locked.", filename);
+				free_dicts(dicts, num_dicts);
 				free(keyBlock);
 				return 1;
-
 			}
 		}
 	}
@@ -1185,9 +1456,13 @@ int CmdHF14AMfChk(const char *Cmd)
 				(keyBlock + 6*keycnt)[3], (keyBlock + 6*keycnt)[4],	(keyBlock + 6*keycnt)[5], 6);
 	}
 
+	// the same key may be in several dictionaries
+	keycnt = keydict_dedup(keyBlock, keycnt, 6);
+
 	// initialize storage for found keys
 	e_sector = calloc(SectorsCnt, sizeof(sector_t));
 	if (e_sector == NULL) {
+		free_dicts(dicts, num_dicts);
 		free(keyBlock);
 		return 1;
 	}
@@ -1200,47 +1475,43 @@ int CmdHF14AMfChk(const char *Cmd)
 	printf("\n");
 
 	bool foundAKey = false;
-	uint32_t max_keys = keycnt > USB_CMD_DATA_SIZE / 6 ? USB_CMD_DATA_SIZE / 6 : keycnt;
 	if (SectorsCnt) {
 		PrintAndLog("To cancel this operation press the button on the proxmark...");
 		printf("--");
-		for (uint32_t c = 0; c < keycnt; c += max_keys) {
-
-			uint32_t size = keycnt-c > max_keys ? max_keys : keycnt-c;
-			res = mfCheckKeysSec(SectorsCnt, keyType, timeout14a * 1.06 / 100, true, size, &keyBlock[6 * c], e_sector); // timeout is (ms * 106)/10 or us*0.0106
-
-			if (res != 1) {
-				if (!res) {
-					printf("o");
-					foundAKey = true;
-				} else {
-					printf(".");
-				}
-			} else {
-				printf("\n");
-				PrintAndLog("Command execute timeout");
-			}
+		res = mfCheckKeysSecStream(SectorsCnt, keyType, timeout14a * 1.06 / 100, true, keycnt, keyBlock, e_sector); // timeout is (ms * 106)/10 or us*0.0106
+		if (res == 1) {
+			printf("\n");
+			PrintAndLog("Command execute timeout");
 		}
+		foundAKey = (res == 0);
 	} else {
 		int keyAB = keyType;
 		do {
-			for (uint32_t c = 0; c < keycnt; c+=max_keys) {
-
-				uint32_t size = keycnt-c > max_keys ? max_keys : keycnt-c;
-				res = mfCheckKeys(blockNo, keyAB & 0x01, true, size, &keyBlock[6 * c], &key64); 
-
-				if (res != 1) {
-					if (!res) {
-						PrintAndLog("Found valid key:[%d:%c]%012" PRIx64, blockNo, (keyAB & 0x01)?'B':'A', key64);
-						foundAKey = true;
-					}
-				} else {
-					PrintAndLog("Command execute timeout");
+			res = mfCheckKeysStream(blockNo, keyAB & 0x01, true, keycnt, keyBlock, &key64);
+			if (res == 0) {
+				PrintAndLog("Found valid key:[%d:%c]%012" PRIx64, blockNo, (keyAB & 0x01)?'B':'A', key64);
+				foundAKey = true;
+				for (uint32_t d = 0; d < num_dicts; d++) {
+					keydict_add_hit(&dicts[d], key64);
 				}
+			} else if (res == 1) {
+				PrintAndLog("Command execute timeout");
 			}
 		} while(--keyAB > 0);
 	}
-	
+
+	// update the dictionaries' statistics. Keys which have been found often are tried first next time.
+	for (uint16_t sectorNo = 0; sectorNo < SectorsCnt; sectorNo++) {
+		for (uint8_t keyAB = 0; keyAB < 2; keyAB++) {
+			if (e_sector[sectorNo].foundKey[keyAB]) {
+				for (uint32_t d = 0; d < num_dicts; d++) {
+					keydict_add_hit(&dicts[d], e_sector[sectorNo].Key[keyAB]);
+				}
+			}
+		}
+	}
+	free_dicts(dicts, num_dicts);
+
 	// print result
 	if (foundAKey) {
 		if (SectorsCnt) {
@@ -1316,10 +1587,31 @@ void readerAttack(nonces_t ar_resp[], bool setEmulatorMem, bool doStandardAttack
 	uint8_t key_cnt[ATTACK_KEY_COUNT];
 	memset(key_cnt, 0x00, sizeof(key_cnt));
 
+	// recover all keys at once using all CPU cores. The moebius attack is only needed if the standard attack failed.
+	mfkey_job_t standard_jobs[ATTACK_KEY_COUNT];
+	mfkey_job_t moebius_jobs[ATTACK_KEY_COUNT];
+	uint8_t num_jobs = 0;
 	for (uint8_t i = 0; i<ATTACK_KEY_COUNT; i++) {
+		if (ar_resp[i].ar2 > 0 && doStandardAttack) {
+			standard_jobs[num_jobs].data = ar_resp[i];
+			standard_jobs[num_jobs++].attack = MFKEY32;
+		}
+	}
+	mfkey_batch(standard_jobs, num_jobs, num_CPUs());
+	num_jobs = 0;
+	for (uint8_t i = 0, j = 0; i<ATTACK_KEY_COUNT; i++) {
+		if (ar_resp[i].ar2 > 0 && !(doStandardAttack && standard_jobs[j++].found)) {
+			moebius_jobs[num_jobs].data = ar_resp[i+ATTACK_KEY_COUNT];
+			moebius_jobs[num_jobs++].attack = MFKEY32_MOEBIUS;
+		}
+	}
+	mfkey_batch(moebius_jobs, num_jobs, num_CPUs());
+
+	for (uint8_t i = 0, j = 0, k = 0; i<ATTACK_KEY_COUNT; i++) {
 		if (ar_resp[i].ar2 > 0) {
 			//PrintAndLog("DEBUG: Trying sector %d, cuid %08x, nt %08x, ar %08x, nr %08x, ar2 %08x, nr2 %08x",ar_resp[i].sector, ar_resp[i].cuid,ar_resp[i].nonce,ar_resp[i].ar,ar_resp[i].nr,ar_resp[i].ar2,ar_resp[i].nr2);
-			if (doStandardAttack && mfkey32(ar_resp[i], &key)) {
+			if (doStandardAttack && standard_jobs[j++].found) {
+				key = standard_jobs[j-1].key;
 				PrintAndLog("  Found Key%s for sector %02d: [%04x%08x]", (ar_resp[i].keytype) ? "B" : "A", ar_resp[i].sector, (uint32_t) (key>>32), (uint32_t) (key &0xFFFFFFFF));
 
 				for (uint8_t ii = 0; ii<ATTACK_KEY_COUNT; ii++) {
@@ -1339,7 +1631,8 @@ void readerAttack(nonces_t ar_resp[], bool setEmulatorMem, bool doStandardAttack
 						}
 					}
 				}
-			} else if (mfkey32_moebius(ar_resp[i+ATTACK_KEY_COUNT], &key)) {
+			} else if (moebius_jobs[k++].found) {
+				key = moebius_jobs[k-1].key;
 				uint8_t sectorNum = ar_resp[i+ATTACK_KEY_COUNT].sector;
 				uint8_t keyType = ar_resp[i+ATTACK_KEY_COUNT].keytype;
 
@@ -1570,6 +1863,7 @@ int CmdHF14AMf1kSim(const char *Cmd) {
 			if ((bool)resp.arg[1]) {
 				PrintAndLog("Device button pressed - quitting");
 				fclose(f);
+				crapto1_free_arenas();
 				return 4;
 			}
 			count++;
@@ -1604,6 +1898,7 @@ int CmdHF14AMf1kSim(const char *Cmd) {
 		}
 	}
 
+	crapto1_free_arenas();				// the memory of the key recoveries of all readerAttack() calls
 	return 0;
 }
 
@@ -2646,6 +2941,7 @@ static command_t CommandTable[] =
   {"chk",              CmdHF14AMfChk,           0, "Test block keys"},
   {"mifare",           CmdHF14AMifare,          0, "Read parity error messages."},
   {"hardnested",       CmdHF14AMfNestedHard,    0, "Nested attack for hardened Mifare cards"},
+  {"autopwn",          CmdHF14AMfAutoPwn,       0, "Recover all keys with the cheapest attacks (dictionary, darkside, nested, hardnested)"},
   {"nested",           CmdHF14AMfNested,        0, "Test nested authentication"},
   {"sniff",            CmdHF14AMfSniff,         0, "Sniff card-reader communication"},
   {"sim",              CmdHF14AMf1kSim,         0, "Simulate MIFARE card"},
@@ -27,6 +27,7 @@ extern int CmdHF14AMfUWrBl(const char* cmd);
 extern int CmdHF14AMfChk(const char* cmd);
 extern int CmdHF14AMifare(const char* cmd);
 extern int CmdHF14AMfNested(const char* cmd);
+extern int CmdHF14AMfAutoPwn(const char* cmd);
 extern int CmdHF14AMfSniff(const char* cmd);
 extern int CmdHF14AMf1kSim(const char* cmd);
 extern int CmdHF14AMfEClear(const char* cmd);
@@ -44,4 +45,7 @@ extern int CmdHF14AMfCGetSc(const char* cmd);
 extern int CmdHF14AMfCLoad(const char* cmd);
 extern int CmdHF14AMfCSave(const char* cmd);
 
+extern uint8_t FirstBlockOfSector(uint8_t sectorNo);
+extern uint8_t NumBlocksPerSector(uint8_t sectorNo);
+
 #endif
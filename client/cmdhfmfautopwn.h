@@ -0,0 +1,17 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// hf mf autopwn command. Recover all keys of a card with the cheapest attacks.
+//-----------------------------------------------------------------------------
+
+#ifndef CMDHFMFAUTOPWN_H__
+#define CMDHFMFAUTOPWN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+int mfautopwn(uint8_t num_sectors, const char *dict_filename, uint8_t timeout14a, bool slow, bool transferToEml, bool createDumpFile);
+
+#endif
@@ -30,12 +30,21 @@
 #include "ui.h"
 #include "util.h"
 #include "util_posix.h"
+#include "mifarehost.h"
 #include "crapto1/crapto1.h"
 #include "parity.h"
 #include "hardnested/hardnested_bruteforce.h"
 #include "hardnested/hardnested_bf_core.h"
 #include "hardnested/hardnested_bitarray_core.h"
+#include "hardnested/hardnested_workunit.h"
 #include "zlib.h"
+#include <jansson.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define NUM_CHECK_BITFLIPS_THREADS		(num_CPUs())
 #define NUM_REDUCTION_WORKING_THREADS	(num_CPUs())
@@ -89,6 +98,12 @@ static void get_SIMD_instruction_set(char* instruction_set) {
 		case SIMD_MMX:
 			strcpy(instruction_set, "MMX");
 			break;
+		case SIMD_SVE:
+			strcpy(instruction_set, "SVE");
+			break;
+		case SIMD_NEON:
+			strcpy(instruction_set, "NEON");
+			break;
 		default:
 			strcpy(instruction_set, "no");
 			break;
@@ -111,7 +126,7 @@ static void print_progress_header(void) {
 
 void hardnested_print_progress(uint32_t nonces, char *activity, float brute_force, uint64_t min_diff_print_time) {
 	static uint64_t last_print_time = 0;
-	if (msclock() - last_print_time > min_diff_print_time) {
+	if (msclock() - last_print_time >= min_diff_print_time) {
 		last_print_time = msclock();
 		uint64_t total_time = msclock() - start_time;
 		float brute_force_time = brute_force / brute_force_per_second;
@@ -151,6 +166,12 @@ static inline void set_bit24(uint32_t *bitarray, uint32_t index)
 }
 
 
+static inline void clear_bit24(uint32_t *bitarray, uint32_t index)
+{
+	bitarray[index>>5] &= ~(0x80000000>>(index&0x0000001f));
+}
+
+
 static inline uint32_t test_bit24(uint32_t *bitarray, uint32_t index)
 {
 	return 	bitarray[index>>5] & (0x80000000>>(index&0x0000001f));
@@ -243,7 +264,197 @@ static void init_inflate(z_streamp compressed_stream, uint8_t *input_buffer, uin
 }
 
 
-static void init_bitflip_bitarrays(void)
+#if !defined(_WIN32)
+//----------------------------------------------------------------------------
+// Persistent cache of the decompressed bitflip tables. The effective tables are
+// stored uncompressed and page aligned in a single file in the user's cache
+// directory (see get_user_cache_path()) which is mmap'd read-only.
+// Concurrent client processes therefore share one copy in the page cache and
+// don't need to inflate the tables again on each run.
+//----------------------------------------------------------------------------
+#define BITFLIP_CACHE_FILENAME			"bitflip_cache.bin"
+#define BITFLIP_CACHE_MAGIC				"PM3BFTC"
+#define BITFLIP_CACHE_VERSION			2
+#define BITFLIP_CACHE_ALIGNMENT			0x10000		// covers 4k, 16k and 64k page sizes
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_tables;
+	uint64_t fingerprint;		// of the compressed tables the cache was built from
+} bitflip_cache_header_t;
+
+typedef struct {
+	uint16_t odd_even;
+	uint16_t bitflip;
+	uint32_t count;
+	uint64_t offset;
+} bitflip_cache_entry_t;
+
+#define BITFLIP_CACHE_DATA_START		(((sizeof(bitflip_cache_header_t) + 2 * 0x400 * sizeof(bitflip_cache_entry_t)) + BITFLIP_CACHE_ALIGNMENT - 1) & ~(BITFLIP_CACHE_ALIGNMENT - 1))
+
+static void *bitflip_cache_map = NULL;
+static size_t bitflip_cache_map_size = 0;
+
+
+static void get_state_file_path(char *path, odd_even_t odd_even, uint16_t bitflip)
+{
+	strcpy(path, get_my_executable_directory());
+	strcat(path, STATE_FILES_DIRECTORY);
+	sprintf(path + strlen(path), STATE_FILE_TEMPLATE, odd_even, bitflip);
+}
+
+
+static uint64_t bitflip_tables_fingerprint(void)
+{
+	// FNV-1a over the threshold which selects the effective tables and the names and contents
+	// of all existing compressed tables (8MB, takes a few ms)
+	char state_file_path[strlen(get_my_executable_directory()) + strlen(STATE_FILES_DIRECTORY) + strlen(STATE_FILE_TEMPLATE) + 1];
+	uint64_t fingerprint = FNV1A_64_INIT;
+	double threshold = IGNORE_BITFLIP_THRESHOLD;
+	uint8_t buf[0x4000];
+	fingerprint = fnv1a_64(fingerprint, &threshold, sizeof(threshold));
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+		for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+			get_state_file_path(state_file_path, odd_even, bitflip);
+			FILE *statesfile = fopen(state_file_path, "rb");
+			if (statesfile == NULL) {
+				continue;
+			}
+			uint16_t id = odd_even << 10 | bitflip;
+			fingerprint = fnv1a_64(fingerprint, &id, sizeof(id));
+			size_t len;
+			while ((len = fread(buf, 1, sizeof(buf), statesfile)) > 0) {
+				fingerprint = fnv1a_64(fingerprint, buf, len);
+			}
+			fclose(statesfile);
+		}
+	}
+	return fingerprint;
+}
+
+
+static bool map_bitflip_cache(uint64_t fingerprint)
+{
+	char cache_path[FILENAME_MAX];
+	if (!get_user_cache_path(BITFLIP_CACHE_FILENAME, cache_path, sizeof(cache_path))) {
+		return false;
+	}
+
+	int fd = open(cache_path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < BITFLIP_CACHE_DATA_START) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	bitflip_cache_header_t *header = (bitflip_cache_header_t *)map;
+	bitflip_cache_entry_t *entries = (bitflip_cache_entry_t *)(header + 1);
+	if (memcmp(header->magic, BITFLIP_CACHE_MAGIC, sizeof(BITFLIP_CACHE_MAGIC)) != 0
+		|| header->version != BITFLIP_CACHE_VERSION
+		|| header->fingerprint != fingerprint
+		|| header->num_tables > 2 * 0x400
+		|| BITFLIP_CACHE_DATA_START + (uint64_t)header->num_tables * sizeof(uint32_t) * (1<<19) > (uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	// every table must lie within the file, and a side can have each bitflip only once and at most 0x3fe of
+	// them (effective_bitflip[] needs room for the end of list marker). Otherwise the cache is corrupt.
+	bool seen[2][0x400] = {{false}};
+	uint16_t num_tables[2] = {0, 0};
+	for (uint32_t i = 0; i < header->num_tables; i++) {
+		if (entries[i].odd_even > ODD_STATE || entries[i].bitflip >= 0x400 || entries[i].offset % BITFLIP_CACHE_ALIGNMENT
+			|| entries[i].offset > (uint64_t)st.st_size - sizeof(uint32_t) * (1<<19)
+			|| seen[entries[i].odd_even][entries[i].bitflip]
+			|| ++num_tables[entries[i].odd_even] >= 0x3ff) {
+			munmap(map, st.st_size);
+			return false;
+		}
+		seen[entries[i].odd_even][entries[i].bitflip] = true;
+	}
+	for (uint32_t i = 0; i < header->num_tables; i++) {
+		odd_even_t odd_even = entries[i].odd_even;
+		uint16_t bitflip = entries[i].bitflip;
+		bitflip_bitarrays[odd_even][bitflip] = (uint32_t *)((uint8_t *)map + entries[i].offset);
+		count_bitflip_bitarrays[odd_even][bitflip] = entries[i].count;
+		effective_bitflip[odd_even][num_effective_bitflips[odd_even]++] = bitflip;
+	}
+
+	bitflip_cache_map = map;
+	bitflip_cache_map_size = st.st_size;
+	return true;
+}
+
+
+static void write_bitflip_cache(uint64_t fingerprint)
+{
+	char cache_path[FILENAME_MAX];
+	if (!get_user_cache_path(BITFLIP_CACHE_FILENAME, cache_path, sizeof(cache_path))) {
+		return;		// no cache directory. We just don't have a cache then.
+	}
+	char tmp_path[sizeof(cache_path) + 16];
+	sprintf(tmp_path, "%s.%d", cache_path, (int)getpid());
+
+	// write to a temporary file first and rename it afterwards. Other processes will
+	// therefore never map a partially written cache.
+	FILE *fcache = fopen(tmp_path, "wb");
+	if (fcache == NULL) {
+		return;		// e.g. no write permission. We just don't have a cache then.
+	}
+
+	uint8_t *header_buf = calloc(1, BITFLIP_CACHE_DATA_START);
+	if (header_buf == NULL) {
+		fclose(fcache);
+		remove(tmp_path);
+		return;
+	}
+	bitflip_cache_header_t *header = (bitflip_cache_header_t *)header_buf;
+	bitflip_cache_entry_t *entries = (bitflip_cache_entry_t *)(header + 1);
+	memcpy(header->magic, BITFLIP_CACHE_MAGIC, sizeof(BITFLIP_CACHE_MAGIC));
+	header->version = BITFLIP_CACHE_VERSION;
+	header->fingerprint = fingerprint;
+	header->num_tables = 0;
+	uint64_t offset = BITFLIP_CACHE_DATA_START;
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+		for (uint16_t i = 0; i < num_effective_bitflips[odd_even]; i++) {
+			uint16_t bitflip = effective_bitflip[odd_even][i];
+			entries[header->num_tables].odd_even = odd_even;
+			entries[header->num_tables].bitflip = bitflip;
+			entries[header->num_tables].count = count_bitflip_bitarrays[odd_even][bitflip];
+			entries[header->num_tables].offset = offset;
+			header->num_tables++;
+			offset += sizeof(uint32_t) * (1<<19);
+		}
+	}
+
+	bool write_ok = (fwrite(header_buf, 1, BITFLIP_CACHE_DATA_START, fcache) == BITFLIP_CACHE_DATA_START);
+	free(header_buf);
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE && write_ok; odd_even++) {
+		for (uint16_t i = 0; i < num_effective_bitflips[odd_even] && write_ok; i++) {
+			uint16_t bitflip = effective_bitflip[odd_even][i];
+			write_ok = (fwrite(bitflip_bitarrays[odd_even][bitflip], sizeof(uint32_t), 1<<19, fcache) == 1<<19);
+		}
+	}
+	if (fclose(fcache) != 0) {
+		write_ok = false;
+	}
+	if (!write_ok || rename(tmp_path, cache_path) != 0) {
+		remove(tmp_path);
+	}
+}
+#endif
+
+
+static void inflate_bitflip_bitarrays(void)
 {
 #if defined (DEBUG_REDUCTION)
 	uint8_t line = 0;
@@ -256,10 +467,7 @@ static void init_bitflip_bitarrays(void)
 	char state_file_name[strlen(STATE_FILE_TEMPLATE)+1];
 	
 	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
-		num_effective_bitflips[odd_even] = 0;
 		for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
-			bitflip_bitarrays[odd_even][bitflip] = NULL;
-			count_bitflip_bitarrays[odd_even][bitflip] = 1<<24;
 			sprintf(state_file_name, STATE_FILE_TEMPLATE, odd_even, bitflip);
 			strcpy(state_files_path, get_my_executable_directory());
 			strcat(state_files_path, STATE_FILES_DIRECTORY);
@@ -307,6 +515,31 @@ static void init_bitflip_bitarrays(void)
 				inflateEnd(&compressed_stream);
 			}
 		}
+	}
+}
+
+
+static void init_bitflip_bitarrays(void)
+{
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+		num_effective_bitflips[odd_even] = 0;
+		for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+			bitflip_bitarrays[odd_even][bitflip] = NULL;
+			count_bitflip_bitarrays[odd_even][bitflip] = 1<<24;
+		}
+	}
+
+#if !defined(_WIN32)
+	uint64_t fingerprint = bitflip_tables_fingerprint();
+	if (!map_bitflip_cache(fingerprint)) {
+		inflate_bitflip_bitarrays();
+		write_bitflip_cache(fingerprint);
+	}
+#else
+	inflate_bitflip_bitarrays();
+#endif
+
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
 		effective_bitflip[odd_even][num_effective_bitflips[odd_even]] = 0x400;	// EndOfList marker
 	}
 
@@ -351,6 +584,18 @@ static void init_bitflip_bitarrays(void)
 
 static void	free_bitflip_bitarrays(void)
 {
+#if !defined(_WIN32)
+	if (bitflip_cache_map != NULL) {
+		munmap(bitflip_cache_map, bitflip_cache_map_size);
+		bitflip_cache_map = NULL;
+		for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+			for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+				bitflip_bitarrays[odd_even][bitflip] = NULL;
+			}
+		}
+		return;
+	}
+#endif
 	for (int16_t bitflip = 0x3ff; bitflip > 0x000; bitflip--) {
 		free_bitarray(bitflip_bitarrays[ODD_STATE][bitflip]);
 	}
@@ -452,6 +697,50 @@ static void free_part_sum_bitarrays(void)
 }
 
 
+// batch mode: the partial sum bitarrays are reduced during each attack. Keep a copy of the initial
+// ones instead of recalculating them for every target.
+static uint32_t *saved_part_sum_a0_bitarrays[2][NUM_PART_SUMS];
+static uint32_t *saved_part_sum_a8_bitarrays[2][NUM_PART_SUMS];
+
+static void save_part_sum_bitarrays(void)
+{
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+		for (uint16_t part_sum = 0; part_sum < NUM_PART_SUMS; part_sum++) {
+			saved_part_sum_a0_bitarrays[odd_even][part_sum] = (uint32_t *)malloc_bitarray(sizeof(uint32_t) * (1<<19));
+			saved_part_sum_a8_bitarrays[odd_even][part_sum] = (uint32_t *)malloc_bitarray(sizeof(uint32_t) * (1<<19));
+			if (saved_part_sum_a0_bitarrays[odd_even][part_sum] == NULL || saved_part_sum_a8_bitarrays[odd_even][part_sum] == NULL) {
+				printf("Out of memory error in save_part_sum_bitarrays(). Aborting...\n");
+				exit(4);
+			}
+			memcpy(saved_part_sum_a0_bitarrays[odd_even][part_sum], part_sum_a0_bitarrays[odd_even][part_sum], sizeof(uint32_t) * (1<<19));
+			memcpy(saved_part_sum_a8_bitarrays[odd_even][part_sum], part_sum_a8_bitarrays[odd_even][part_sum], sizeof(uint32_t) * (1<<19));
+		}
+	}
+}
+
+
+static void restore_part_sum_bitarrays(void)
+{
+	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+		for (uint16_t part_sum = 0; part_sum < NUM_PART_SUMS; part_sum++) {
+			memcpy(part_sum_a0_bitarrays[odd_even][part_sum], saved_part_sum_a0_bitarrays[odd_even][part_sum], sizeof(uint32_t) * (1<<19));
+			memcpy(part_sum_a8_bitarrays[odd_even][part_sum], saved_part_sum_a8_bitarrays[odd_even][part_sum], sizeof(uint32_t) * (1<<19));
+		}
+	}
+}
+
+
+static void free_saved_part_sum_bitarrays(void)
+{
+	for (int16_t part_sum = (NUM_PART_SUMS-1); part_sum >= 0; part_sum--) {
+		free_bitarray(saved_part_sum_a8_bitarrays[ODD_STATE][part_sum]);
+		free_bitarray(saved_part_sum_a8_bitarrays[EVEN_STATE][part_sum]);
+		free_bitarray(saved_part_sum_a0_bitarrays[ODD_STATE][part_sum]);
+		free_bitarray(saved_part_sum_a0_bitarrays[EVEN_STATE][part_sum]);
+	}
+}
+
+
 static void init_sum_bitarrays(void)
 {
 	for (uint16_t sum_a0 = 0; sum_a0 < NUM_SUMS; sum_a0++) {
@@ -1083,7 +1372,7 @@ static void estimate_sum_a8(void)
 }	
 
 
-static int read_nonce_file(void)
+static int read_nonce_file(char *filename)
 {
 	FILE *fnonces = NULL;
 	size_t bytes_read;
@@ -1094,12 +1383,14 @@ static int read_nonce_file(void)
 	uint8_t par_enc;
 	
 	num_acquired_nonces = 0;
-	if ((fnonces = fopen("nonces.bin","rb")) == NULL) { 
-		PrintAndLog("Could not open file nonces.bin");
+	if ((fnonces = fopen(filename,"rb")) == NULL) { 
+		PrintAndLog("Could not open file %s", filename);
 		return 1;
 	}
 
-	hardnested_print_progress(0, "Reading nonces from file nonces.bin...", (float)(1LL<<47), 0);
+	char progress_string[80];
+	snprintf(progress_string, sizeof(progress_string), "Reading nonces from file %s...", filename);
+	hardnested_print_progress(0, progress_string, (float)(1LL<<47), 0);
 	bytes_read = fread(read_buf, 1, 6, fnonces);
 	if (bytes_read != 6) {
 		PrintAndLog("File reading error.");
@@ -1122,7 +1413,6 @@ static int read_nonce_file(void)
 	}
 	fclose(fnonces);
 	
-	char progress_string[80];
 	sprintf(progress_string, "Read %d nonces from file. cuid=%08x", num_acquired_nonces, cuid); 
 	hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL<<47), 0);
 	sprintf(progress_string, "Target Block=%d, Keytype=%c", trgBlockNo, trgKeyType==0?'A':'B');
@@ -1416,185 +1706,799 @@ static void simulate_acquire_nonces()
 }
 
 
-static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, bool nonce_file_write, bool slow)
-{
-	last_sample_clock = msclock();
-	sample_period = 2000;	// initial rough estimate. Will be refined.
-	bool initialize = true;
-	bool field_off = false;
-	hardnested_stage = CHECK_1ST_BYTES;
-	bool acquisition_completed = false;
-	uint32_t flags = 0;
-	uint8_t write_buf[9];
-	uint32_t total_num_nonces = 0;
-	float brute_force;
-	bool reported_suma8 = false;
-	FILE *fnonces = NULL;
-	UsbCommand resp;
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// checkpoint and resume
+//
+// With option 'c' the state of the attack is saved to hardnested_checkpoint.bin from time to time:
+//  - while acquiring: the card and key parameters and the nonces collected so far
+//  - before each brute force pass: additionally the Sum(a8) guesses already tested and the candidate statelists
+//  - while brute forcing: a bitmap of the completed brute force work units, which is updated in place
+// The statelists are written once at the start of each brute force pass. A resumed pass only updates the bitmap.
+// "hf mf hardnested u" continues an interrupted attack from this file. Add 'c' to keep writing checkpoints.
+
+#define CHECKPOINT_FILENAME				"hardnested_checkpoint.bin"
+#define CHECKPOINT_MAGIC				"PM3HNCP"
+#define CHECKPOINT_VERSION				2
+#define CHECKPOINT_INTERVAL				30000		// minimum time between two checkpoints (ms)
+#define CHECKPOINT_NO_SUM_A8			0xff		// Sum(a8) ignored, brute forcing the bitflip candidates only
 
-	num_acquired_nonces = 0;
-	
-	clearCommandBuffer();
+typedef enum {
+	CHECKPOINT_ACQUIRING = 0,
+	CHECKPOINT_BRUTE_FORCING = 1
+} checkpoint_stage_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t cuid;
+	uint8_t blockNo;
+	uint8_t keyType;
+	uint8_t key[6];
+	uint8_t trgBlockNo;
+	uint8_t trgKeyType;
+	uint8_t slow;
+	uint8_t stage;
+	uint32_t num_nonces;
+	uint32_t sum_a8_tested;			// bitmask of the Sum(a8) indices which have been brute forced without success
+	// the current brute force pass:
+	uint8_t best_first_byte;
+	uint8_t sum_a8_idx;
+	uint16_t reserved;
+	uint32_t num_statelists;
+	uint32_t num_buckets;
+	uint32_t num_work_units;
+	uint32_t bf_chunk_states;		// the work units bitmap is only valid for the same work unit sizes
+	uint32_t bf_chunk_even_states;
+} checkpoint_header_t;
+
+// file layout: header, work units bitmap, nonces (num_nonces * 5 bytes), 
+// statelists (num_statelists * (length, states)), buckets (num_buckets * (odd statelist idx, even statelist idx))
+#define CHECKPOINT_BITMAP_OFFSET		(sizeof(checkpoint_header_t))
+#define CHECKPOINT_NO_STATELIST			0xffffffff
+#define CHECKPOINT_UNPACK_STATES		(1<<16)
+
+static bool checkpoint_enabled = false;			// the attack state is tracked (new attack with checkpoints or resumed attack)
+static bool checkpoint_write = false;			// the state is written to CHECKPOINT_FILENAME
+static checkpoint_header_t checkpoint;
+static uint8_t *checkpoint_work_units_done = NULL;
+static uint64_t last_checkpoint_time = 0;
+static pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static packed_statelist_t **resumed_statelists = NULL;
+static uint32_t num_resumed_statelists = 0;
+
+
+static void set_packed_states(statelist_t *candidates, packed_statelist_t *sl, odd_even_t odd_even)
+{
+	candidates->packed[odd_even] = sl;
+	candidates->states[odd_even] = NULL;
+	candidates->start[odd_even] = 0;
+	candidates->len[odd_even] = sl == NULL ? 0 : sl->len;
+}
 
-	do {
-		flags = 0;
-		flags |= initialize ? 0x0001 : 0;
-		flags |= slow ? 0x0002 : 0;
-		flags |= field_off ? 0x0004 : 0;
-		UsbCommand c = {CMD_MIFARE_ACQUIRE_ENCRYPTED_NONCES, {blockNo + keyType * 0x100, trgBlockNo + trgKeyType * 0x100, flags}};
-		memcpy(c.d.asBytes, key, 6);
 
-		SendCommand(&c);
-		
-		if (field_off) break;
-		
-		if (initialize) {
-			if (!WaitForResponseTimeout(CMD_ACK, &resp, 3000)) return 1;
+static uint32_t checkpoint_bitmap_size(void)
+{
+	return (checkpoint.num_work_units + 7) / 8;
+}
 
-			if (resp.arg[0]) return resp.arg[0];  // error during nested_hard
 
-			cuid = resp.arg[1];
-			// PrintAndLog("Acquiring nonces for CUID 0x%08x", cuid); 
-			if (nonce_file_write && fnonces == NULL) {
-				if ((fnonces = fopen("nonces.bin","wb")) == NULL) { 
-					PrintAndLog("Could not create file nonces.bin");
-					return 3;
-				}
-				hardnested_print_progress(0, "Writing acquired nonces to binary file nonces.bin", (float)(1LL<<47), 0);
-				num_to_bytes(cuid, 4, write_buf);
-				fwrite(write_buf, 1, 4, fnonces);
-				fwrite(&trgBlockNo, 1, 1, fnonces);
-				fwrite(&trgKeyType, 1, 1, fnonces);
-			}
+static void write_checkpoint_nonces(FILE *f, bool xored)
+{
+	// the nonces are stored as received from the card, i.e. before pre_XOR_nonces()
+	uint8_t cuid_par = oddparity8(cuid >> 0 & 0xff) << 0
+					 | oddparity8(cuid >> 8 & 0xff) << 1
+					 | oddparity8(cuid >> 16 & 0xff) << 2
+					 | oddparity8(cuid >> 24 & 0xff) << 3;
+	uint8_t buf[5];
+	for (uint16_t i = 0; i < 256; i++) {
+		for (noncelistentry_t *p = nonces[i].first; p != NULL; p = p->next) {
+			num_to_bytes(xored ? p->nonce_enc ^ cuid : p->nonce_enc, 4, buf);
+			buf[4] = xored ? p->par_enc ^ cuid_par : p->par_enc;
+			fwrite(buf, 1, 5, f);
 		}
+	}
+}
 
-		if (!initialize) {
-			uint32_t nt_enc1, nt_enc2;
-			uint8_t par_enc;
-			uint16_t num_sampled_nonces = resp.arg[2];
-			uint8_t *bufp = resp.d.asBytes;
-			for (uint16_t i = 0; i < num_sampled_nonces; i+=2) {
-				nt_enc1 = bytes_to_num(bufp, 4);
-				nt_enc2 = bytes_to_num(bufp+4, 4);
-				par_enc = bytes_to_num(bufp+8, 1);
-				
-				//printf("Encrypted nonce: %08x, encrypted_parity: %02x\n", nt_enc1, par_enc >> 4);
-				num_acquired_nonces += add_nonce(nt_enc1, par_enc >> 4);
-				//printf("Encrypted nonce: %08x, encrypted_parity: %02x\n", nt_enc2, par_enc & 0x0f);
-				num_acquired_nonces += add_nonce(nt_enc2, par_enc & 0x0f);
-
-				if (nonce_file_write) {
-					fwrite(bufp, 1, 9, fnonces);
-				}
-				bufp += 9;
-			}
-			total_num_nonces += num_sampled_nonces;
-		
-			if (first_byte_num == 256 ) {
-				if (hardnested_stage == CHECK_1ST_BYTES) {
-					for (uint16_t i = 0; i < NUM_SUMS; i++) {
-						if (first_byte_Sum == sums[i]) {
-							first_byte_Sum = i;
-							break;
-						}
-					}
-					hardnested_stage |= CHECK_2ND_BYTES;
-					apply_sum_a0();
-				}
-				update_nonce_data(true);
-				acquisition_completed = shrink_key_space(&brute_force);
-				if (!reported_suma8) {
-					char progress_string[80];
-					sprintf(progress_string, "Apply Sum property. Sum(a0) = %d", sums[first_byte_Sum]);
-					hardnested_print_progress(num_acquired_nonces, progress_string, brute_force, 0);
-					reported_suma8 = true;
-				} else {
-					hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force, 0);
-				}
-			} else {
-				update_nonce_data(true);
-				acquisition_completed = shrink_key_space(&brute_force);
-				hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force, 0);
-			}
+
+static uint32_t statelist_index(packed_statelist_t **statelists, uint32_t *num_statelists, packed_statelist_t *states)
+{
+	if (states == NULL) {
+		return CHECKPOINT_NO_STATELIST;
+	}
+	for (uint32_t i = 0; i < *num_statelists; i++) {
+		if (statelists[i] == states) {
+			return i;
 		}
-		
-		if (acquisition_completed) {
-			field_off = true;	// switch off field with next SendCommand and then finish
+	}
+	statelists[*num_statelists] = states;
+	return (*num_statelists)++;
+}
+
+
+static void save_checkpoint(bool xored)
+{
+	// write the complete checkpoint to a temporary file and replace the old one only when successful
+	char tmp_filename[] = CHECKPOINT_FILENAME ".tmp";
+	FILE *f = fopen(tmp_filename, "wb");
+	if (f == NULL) {
+		hardnested_print_progress(num_acquired_nonces, "Could not write checkpoint file " CHECKPOINT_FILENAME, (float)(1LL<<47), 0);
+		return;
+	}
+
+	// statelists may be shared between buckets. Save them only once.
+	uint32_t num_buckets = 0;
+	for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+		num_buckets++;
+	}
+	packed_statelist_t **statelists = (packed_statelist_t **)malloc(MAX(2 * num_buckets, 1) * sizeof(packed_statelist_t *));
+	uint32_t *bucket_idx = (uint32_t *)malloc(MAX(2 * num_buckets, 1) * sizeof(uint32_t));
+	if (statelists == NULL || bucket_idx == NULL) {
+		printf("Out of memory error in save_checkpoint(). Aborting...\n");
+		exit(4);
+	}
+	uint32_t num_statelists = 0;
+	if (checkpoint.stage == CHECKPOINT_BRUTE_FORCING) {
+		uint32_t i = 0;
+		for (statelist_t *sl = candidates; sl != NULL; sl = sl->next, i++) {
+			bucket_idx[2*i] = statelist_index(statelists, &num_statelists, sl->packed[ODD_STATE]);
+			bucket_idx[2*i+1] = statelist_index(statelists, &num_statelists, sl->packed[EVEN_STATE]);
 		}
+	} else {
+		num_buckets = 0;
+	}
 
-		if (!initialize) {
-			if (!WaitForResponseTimeout(CMD_ACK, &resp, 3000)) {
-				if (nonce_file_write) {
-					fclose(fnonces);
-				}
-				return 1;
-			}
-			if (resp.arg[0]) {
-				if (nonce_file_write) {
-					fclose(fnonces);
-				}
-				return resp.arg[0];  // error during nested_hard
-			}
+	memcpy(checkpoint.magic, CHECKPOINT_MAGIC, sizeof(checkpoint.magic));
+	checkpoint.version = CHECKPOINT_VERSION;
+	checkpoint.cuid = cuid;
+	checkpoint.num_nonces = 0;
+	for (uint16_t i = 0; i < 256; i++) {
+		checkpoint.num_nonces += nonces[i].num;
+	}
+	checkpoint.num_statelists = num_statelists;
+	checkpoint.num_buckets = num_buckets;
+	checkpoint.bf_chunk_states = BF_CHUNK_STATES;
+	checkpoint.bf_chunk_even_states = BF_CHUNK_EVEN_STATES;
+	if (checkpoint.stage == CHECKPOINT_ACQUIRING) {
+		checkpoint.num_work_units = 0;
+	}
+
+	fwrite(&checkpoint, 1, sizeof(checkpoint), f);
+	fwrite(checkpoint_work_units_done, 1, checkpoint_bitmap_size(), f);
+	write_checkpoint_nonces(f, xored);
+	// the statelists are stored unpacked
+	uint32_t *states = (uint32_t *)malloc(CHECKPOINT_UNPACK_STATES * sizeof(uint32_t));
+	if (states == NULL) {
+		printf("Out of memory error in save_checkpoint(). Aborting...\n");
+		exit(4);
+	}
+	for (uint32_t i = 0; i < num_statelists; i++) {
+		uint32_t len = statelists[i]->len;
+		fwrite(&len, 1, sizeof(len), f);
+		for (uint32_t start = 0; start < len; start += CHECKPOINT_UNPACK_STATES) {
+			uint32_t n = unpack_states(statelists[i], start, CHECKPOINT_UNPACK_STATES, states);
+			fwrite(states, sizeof(uint32_t), n, f);
 		}
+	}
+	free(states);
+	fwrite(bucket_idx, sizeof(uint32_t), 2 * num_buckets, f);
+	free(statelists);
+	free(bucket_idx);
+
+	bool write_error = ferror(f);
+	if (fclose(f) != 0 || write_error || rename(tmp_filename, CHECKPOINT_FILENAME) != 0) {
+		remove(tmp_filename);
+		hardnested_print_progress(num_acquired_nonces, "Could not write checkpoint file " CHECKPOINT_FILENAME, (float)(1LL<<47), 0);
+		return;
+	}
+	last_checkpoint_time = msclock();
+}
 
-		initialize = false;
 
-		if (msclock() - last_sample_clock < sample_period) {
-			sample_period = msclock() - last_sample_clock;
+static void save_checkpoint_progress(void)
+{
+	// called by the brute force threads. Update the work units bitmap in place, at most every CHECKPOINT_INTERVAL.
+	if (!checkpoint_write || msclock() - last_checkpoint_time < CHECKPOINT_INTERVAL) {
+		return;
+	}
+	pthread_mutex_lock(&checkpoint_mutex);
+	if (msclock() - last_checkpoint_time >= CHECKPOINT_INTERVAL) {
+		FILE *f = fopen(CHECKPOINT_FILENAME, "r+b");
+		if (f != NULL) {
+			fseek(f, CHECKPOINT_BITMAP_OFFSET, SEEK_SET);
+			fwrite(checkpoint_work_units_done, 1, checkpoint_bitmap_size(), f);
+			fclose(f);
 		}
-		last_sample_clock = msclock();
+		last_checkpoint_time = msclock();
+	}
+	pthread_mutex_unlock(&checkpoint_mutex);
+}
 
-	} while (!acquisition_completed || field_off);
 
-	if (nonce_file_write) {
-		fclose(fnonces);
+static void checkpoint_acquisition(bool force)
+{
+	if (checkpoint_write && (force || msclock() - last_checkpoint_time >= CHECKPOINT_INTERVAL)) {
+		checkpoint.stage = CHECKPOINT_ACQUIRING;
+		save_checkpoint(false);
 	}
-	
-	// PrintAndLog("Sampled a total of %d nonces in %d seconds (%0.0f nonces/minute)", 
-		// total_num_nonces, 
-		// time(NULL)-time1, 
-		// (float)total_num_nonces*60.0/(time(NULL)-time1));
-	
-	return 0;
 }
 
 
-static inline bool invariant_holds(uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, uint_fast8_t bit, uint_fast8_t state_bit)
+static void checkpoint_brute_force(uint8_t sum_a8_idx)
 {
-	uint_fast8_t j_1_bit_mask = 0x01 << (bit-1);
-	uint_fast8_t bit_diff = byte_diff & j_1_bit_mask;							 			// difference of (j-1)th bit
-	uint_fast8_t filter_diff = filter(state1 >> (4-state_bit)) ^ filter(state2 >> (4-state_bit));	// difference in filter function
-	uint_fast8_t mask_y12_y13 = 0xc0 >> state_bit;
-	uint_fast8_t state_bits_diff = (state1 ^ state2) & mask_y12_y13;						// difference in state bits 12 and 13
-	uint_fast8_t all_diff = evenparity8(bit_diff ^ state_bits_diff ^ filter_diff);			// use parity function to XOR all bits
-	return !all_diff;
+	// called before each brute force pass (with pre-XORed nonces). Keep the work units bitmap if we are 
+	// resuming exactly this pass, otherwise start with a clean one.
+	if (!checkpoint_enabled) {
+		return;
+	}
+	uint32_t num_work_units = bf_num_work_units(candidates);
+	if (checkpoint.stage == CHECKPOINT_BRUTE_FORCING
+		&& checkpoint.sum_a8_idx == sum_a8_idx
+		&& checkpoint.best_first_byte == best_first_bytes[0]
+		&& checkpoint.num_work_units == num_work_units) {
+		// the checkpoint file already holds the nonces and statelists of this pass
+		return;
+	}
+	checkpoint.stage = CHECKPOINT_BRUTE_FORCING;
+	checkpoint.sum_a8_idx = sum_a8_idx;
+	checkpoint.best_first_byte = best_first_bytes[0];
+	checkpoint.num_work_units = num_work_units;
+	free(checkpoint_work_units_done);
+	checkpoint_work_units_done = (uint8_t *)calloc(MAX(checkpoint_bitmap_size(), 1), 1);
+	if (checkpoint_work_units_done == NULL) {
+		printf("Out of memory error in checkpoint_brute_force(). Aborting...\n");
+		exit(4);
+	}
+	if (checkpoint_write) {
+		save_checkpoint(true);
+	}
 }
 
 
-static inline bool invalid_state(uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, uint_fast8_t bit, uint_fast8_t state_bit)
+static void checkpoint_sum_a8_tested(uint8_t sum_a8_idx)
 {
-	uint_fast8_t j_bit_mask = 0x01 << bit;
-	uint_fast8_t bit_diff = byte_diff & j_bit_mask;											// difference of jth bit
-	uint_fast8_t mask_y13_y16 = 0x48 >> state_bit;
-	uint_fast8_t state_bits_diff = (state1 ^ state2) & mask_y13_y16;						// difference in state bits 13 and 16
-	uint_fast8_t all_diff = evenparity8(bit_diff ^ state_bits_diff);						// use parity function to XOR all bits
-	return all_diff;
+	if (checkpoint_enabled) {
+		checkpoint.sum_a8_tested |= 1 << sum_a8_idx;
+	}
 }
 
 
-static inline bool remaining_bits_match(uint_fast8_t num_common_bits, uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, odd_even_t odd_even)
+static void init_checkpoint(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, bool slow)
 {
-	if (odd_even) {
-		// odd bits
-		switch (num_common_bits) {
-			case 0: if (!invariant_holds(byte_diff, state1, state2, 1, 0)) return true;
-			case 1: if (invalid_state(byte_diff, state1, state2, 1, 0)) return false;
-			case 2: if (!invariant_holds(byte_diff, state1, state2, 3, 1)) return true;
-			case 3: if (invalid_state(byte_diff, state1, state2, 3, 1)) return false;
-			case 4: if (!invariant_holds(byte_diff, state1, state2, 5, 2)) return true;
-			case 5: if (invalid_state(byte_diff, state1, state2, 5, 2)) return false;
-			case 6: if (!invariant_holds(byte_diff, state1, state2, 7, 3)) return true;
-			case 7: if (invalid_state(byte_diff, state1, state2, 7, 3)) return false;
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	checkpoint.blockNo = blockNo;
+	checkpoint.keyType = keyType;
+	memcpy(checkpoint.key, key, 6);
+	checkpoint.trgBlockNo = trgBlockNo;
+	checkpoint.trgKeyType = trgKeyType;
+	checkpoint.slow = slow;
+	checkpoint.stage = CHECKPOINT_ACQUIRING;
+	checkpoint.sum_a8_idx = CHECKPOINT_NO_SUM_A8;
+	free(checkpoint_work_units_done);
+	checkpoint_work_units_done = NULL;
+	last_checkpoint_time = msclock();
+	checkpoint_enabled = true;
+	checkpoint_write = true;
+}
+
+
+static void free_resumed_statelists(void)
+{
+	for (uint32_t i = 0; i < num_resumed_statelists; i++) {
+		free_packed_statelist(resumed_statelists[i]);
+	}
+	free(resumed_statelists);
+	resumed_statelists = NULL;
+	num_resumed_statelists = 0;
+}
+
+
+static void free_checkpoint(void)
+{
+	free(checkpoint_work_units_done);
+	checkpoint_work_units_done = NULL;
+	free_resumed_statelists();
+	checkpoint_enabled = false;
+	checkpoint_write = false;
+}
+
+
+static int read_checkpoint(void)
+{
+	FILE *f = fopen(CHECKPOINT_FILENAME, "rb");
+	if (f == NULL) {
+		PrintAndLog("Could not open file " CHECKPOINT_FILENAME);
+		return 1;
+	}
+	if (fread(&checkpoint, 1, sizeof(checkpoint), f) != sizeof(checkpoint)
+		|| memcmp(checkpoint.magic, CHECKPOINT_MAGIC, sizeof(checkpoint.magic)) != 0
+		|| checkpoint.version != CHECKPOINT_VERSION) {
+		PrintAndLog("File " CHECKPOINT_FILENAME " is not a valid checkpoint.");
+		fclose(f);
+		return 1;
+	}
+	if (checkpoint.bf_chunk_states != BF_CHUNK_STATES || checkpoint.bf_chunk_even_states != BF_CHUNK_EVEN_STATES) {
+		PrintAndLog("File " CHECKPOINT_FILENAME " was written with different brute force work units (%" PRIu32 "/%" PRIu32 " states instead of %" PRIu32 "/%" PRIu32 ").",
+			checkpoint.bf_chunk_states, checkpoint.bf_chunk_even_states, (uint32_t)BF_CHUNK_STATES, (uint32_t)BF_CHUNK_EVEN_STATES);
+		fclose(f);
+		return 1;
+	}
+
+	checkpoint_work_units_done = (uint8_t *)calloc(MAX(checkpoint_bitmap_size(), 1), 1);
+	if (checkpoint_work_units_done == NULL) {
+		printf("Out of memory error in read_checkpoint(). Aborting...\n");
+		exit(4);
+	}
+	bool read_error = fread(checkpoint_work_units_done, 1, checkpoint_bitmap_size(), f) != checkpoint_bitmap_size();
+
+	cuid = checkpoint.cuid;
+	num_acquired_nonces = 0;
+	uint8_t buf[5];
+	for (uint32_t i = 0; i < checkpoint.num_nonces && !read_error; i++) {
+		if (fread(buf, 1, 5, f) != 5) {
+			read_error = true;
+			break;
+		}
+		num_acquired_nonces += add_nonce(bytes_to_num(buf, 4), buf[4]);
+	}
+
+	if (checkpoint.num_statelists > 2 * checkpoint.num_buckets) {
+		checkpoint.num_statelists = 0;
+		read_error = true;
+	}
+	resumed_statelists = (packed_statelist_t **)calloc(MAX(checkpoint.num_statelists, 1), sizeof(packed_statelist_t *));
+	if (resumed_statelists == NULL) {
+		printf("Out of memory error in read_checkpoint(). Aborting...\n");
+		exit(4);
+	}
+	for (uint32_t i = 0; i < checkpoint.num_statelists && !read_error; i++) {
+		uint32_t len;
+		if (fread(&len, 1, sizeof(len), f) != sizeof(len)) {
+			read_error = true;
+			break;
+		}
+		if (len > 1<<24) {
+			read_error = true;
+			break;
+		}
+		uint32_t *states = (uint32_t *)malloc(MAX(len, 1) * sizeof(uint32_t));
+		if (states == NULL) {
+			printf("Out of memory error in read_checkpoint(). Aborting...\n");
+			exit(4);
+		}
+		read_error = fread(states, sizeof(uint32_t), len, f) != len;
+		if (!read_error) {
+			resumed_statelists[i] = pack_statelist(states, len);
+			read_error = resumed_statelists[i] == NULL;
+		}
+		free(states);
+		if (!read_error) {
+			num_resumed_statelists++;
+		}
+	}
+
+	statelist_t **next = &candidates;
+	for (uint32_t i = 0; i < checkpoint.num_buckets && !read_error; i++) {
+		uint32_t idx[2];
+		if (fread(idx, sizeof(uint32_t), 2, f) != 2) {
+			read_error = true;
+			break;
+		}
+		statelist_t *sl = (statelist_t *)malloc(sizeof(statelist_t));
+		if (sl == NULL) {
+			printf("Out of memory error in read_checkpoint(). Aborting...\n");
+			exit(4);
+		}
+		for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+			uint32_t j = idx[odd_even == ODD_STATE ? 0 : 1];
+			bool valid = j < checkpoint.num_statelists;
+			set_packed_states(sl, valid ? resumed_statelists[j] : NULL, odd_even);
+		}
+		sl->next = NULL;
+		*next = sl;
+		next = (statelist_t **)&sl->next;
+	}
+	fclose(f);
+
+	if (read_error) {
+		PrintAndLog("File " CHECKPOINT_FILENAME " is truncated.");
+		return 1;
+	}
+
+	last_checkpoint_time = msclock();
+	checkpoint_enabled = true;
+
+	char progress_string[80];
+	sprintf(progress_string, "Resuming from checkpoint: %d nonces, cuid=%08x", num_acquired_nonces, cuid);
+	hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL<<47), 0);
+	sprintf(progress_string, "Target Block=%d, Keytype=%c", checkpoint.trgBlockNo, checkpoint.trgKeyType==0?'A':'B');
+	hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL<<47), 0);
+
+	return 0;
+}
+
+
+static void add_nonce_batch(uint8_t *bufp, uint16_t num_sampled_nonces, FILE *fnonces)
+{
+	// add a batch of nonces as received from the Proxmark (9 bytes for each pair of nonces)
+	uint32_t nt_enc1, nt_enc2;
+	uint8_t par_enc;
+
+	for (uint16_t i = 0; i < num_sampled_nonces; i+=2) {
+		nt_enc1 = bytes_to_num(bufp, 4);
+		nt_enc2 = bytes_to_num(bufp+4, 4);
+		par_enc = bytes_to_num(bufp+8, 1);
+		
+		//printf("Encrypted nonce: %08x, encrypted_parity: %02x\n", nt_enc1, par_enc >> 4);
+		num_acquired_nonces += add_nonce(nt_enc1, par_enc >> 4);
+		//printf("Encrypted nonce: %08x, encrypted_parity: %02x\n", nt_enc2, par_enc & 0x0f);
+		num_acquired_nonces += add_nonce(nt_enc2, par_enc & 0x0f);
+
+		if (fnonces != NULL) {
+			fwrite(bufp, 1, 9, fnonces);
+		}
+		bufp += 9;
+	}
+}
+
+
+static bool evaluate_nonces(bool *reported_suma8)
+{
+	// update the statistics with the nonces added since the last call. Returns true if no more nonces are required.
+	float brute_force;
+	bool acquisition_completed;
+
+	if (first_byte_num == 256 ) {
+		if (hardnested_stage == CHECK_1ST_BYTES) {
+			for (uint16_t i = 0; i < NUM_SUMS; i++) {
+				if (first_byte_Sum == sums[i]) {
+					first_byte_Sum = i;
+					break;
+				}
+			}
+			hardnested_stage |= CHECK_2ND_BYTES;
+			apply_sum_a0();
+		}
+		update_nonce_data(true);
+		acquisition_completed = shrink_key_space(&brute_force);
+		if (!*reported_suma8) {
+			char progress_string[80];
+			sprintf(progress_string, "Apply Sum property. Sum(a0) = %d", sums[first_byte_Sum]);
+			hardnested_print_progress(num_acquired_nonces, progress_string, brute_force, 0);
+			*reported_suma8 = true;
+		} else {
+			hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force, 0);
+		}
+	} else {
+		update_nonce_data(true);
+		acquisition_completed = shrink_key_space(&brute_force);
+		hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force, 0);
+	}
+
+	return acquisition_completed;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// nonce acquisition.
+// A separate thread talks to the Proxmark and always keeps the request for the next batch of nonces in flight.
+// It passes the received batches through a single producer / single consumer queue. Both sides sleep on a
+// condition variable while the queue is full or empty. The evaluation takes all batches which arrived in the
+// meantime and updates the statistics once for all of them.
+
+#define ACQUISITION_QUEUE_LEN			128		// batches of up to 112 nonces
+
+typedef struct {
+	uint16_t num_nonces;
+	uint8_t data[USB_CMD_DATA_SIZE];
+} nonce_batch_t;
+
+typedef struct {
+	uint8_t blockNo;
+	uint8_t keyType;
+	uint8_t key[6];
+	uint8_t trgBlockNo;
+	uint8_t trgKeyType;
+	bool slow;
+	bool cuid_valid;					// the card's UID is known. A different card is rejected.
+	uint32_t cuid;
+	uint32_t card_cuid;					// UID of a rejected card
+	nonce_batch_t queue[ACQUISITION_QUEUE_LEN];
+	pthread_mutex_t lock;				// protects head, tail, stop and running
+	pthread_cond_t changed;				// signalled whenever one of them changes
+	uint32_t head;						// next batch to evaluate. Written by the evaluation only.
+	uint32_t tail;						// next batch to fill. Written by the acquisition thread only.
+	bool stop;							// no more nonces required (for now)
+	bool running;
+	volatile int result;
+	volatile uint64_t sample_period;	// time the Proxmark needs to acquire one batch
+	bool thread_started;
+	pthread_t thread;
+} nonce_acquisition_t;
+
+
+static void set_acquisition_state(nonce_acquisition_t *acq, uint32_t *field, uint32_t value)
+{
+	pthread_mutex_lock(&acq->lock);
+	*field = value;
+	pthread_cond_broadcast(&acq->changed);
+	pthread_mutex_unlock(&acq->lock);
+}
+
+
+static void set_acquisition_flag(nonce_acquisition_t *acq, bool *flag, bool value)
+{
+	pthread_mutex_lock(&acq->lock);
+	*flag = value;
+	pthread_cond_broadcast(&acq->changed);
+	pthread_mutex_unlock(&acq->lock);
+}
+
+
+static uint32_t queued_batches(nonce_acquisition_t *acq)
+{
+	pthread_mutex_lock(&acq->lock);
+	uint32_t num_batches = acq->tail - acq->head;
+	pthread_mutex_unlock(&acq->lock);
+	return num_batches;
+}
+
+
+static void* 
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer)) 
+#endif
+#endif
+acquire_nonces_thread(void *args)
+{
+	nonce_acquisition_t *acq = (nonce_acquisition_t *)args;
+	bool initialize = true;
+	bool field_off = false;
+	uint32_t flags = 0;
+	uint64_t last_clock = 0;
+	UsbCommand resp;
+
+	clearCommandBuffer();
+
+	do {
+		flags = 0;
+		flags |= initialize ? 0x0001 : 0;
+		flags |= acq->slow ? 0x0002 : 0;
+		flags |= field_off ? 0x0004 : 0;
+		UsbCommand c = {CMD_MIFARE_ACQUIRE_ENCRYPTED_NONCES, {acq->blockNo + acq->keyType * 0x100, acq->trgBlockNo + acq->trgKeyType * 0x100, flags}};
+		memcpy(c.d.asBytes, acq->key, 6);
+
+		SendCommand(&c);
+
+		if (!initialize) {
+			// the Proxmark is already working on the next batch. Pass on the previous one.
+			pthread_mutex_lock(&acq->lock);
+			while (acq->tail - acq->head == ACQUISITION_QUEUE_LEN && !acq->stop) {
+				pthread_cond_wait(&acq->changed, &acq->lock);
+			}
+			bool queue_full = (acq->tail - acq->head == ACQUISITION_QUEUE_LEN);
+			uint32_t tail = acq->tail;
+			pthread_mutex_unlock(&acq->lock);
+			if (!queue_full) {
+				nonce_batch_t *batch = &acq->queue[tail % ACQUISITION_QUEUE_LEN];
+				batch->num_nonces = resp.arg[2];
+				memcpy(batch->data, resp.d.asBytes, sizeof(batch->data));
+				set_acquisition_state(acq, &acq->tail, tail + 1);
+			}
+		}
+
+		// the answer to the final (field off) request isn't needed. Wait for it anyway, so that it doesn't confuse the next command.
+		if (!WaitForResponseTimeoutW(CMD_ACK, &resp, 3000, !field_off)) {
+			if (!field_off) {
+				acq->result = 1;
+			}
+			break;
+		}
+		if (field_off) {
+			break;
+		}
+		if (resp.arg[0]) {
+			acq->result = resp.arg[0];  // error during nested_hard
+			break;
+		}
+
+		if (initialize) {
+			if (acq->cuid_valid && resp.arg[1] != acq->cuid) {
+				acq->card_cuid = resp.arg[1];
+				acq->result = 3;
+				break;
+			}
+			acq->cuid = resp.arg[1];
+			acq->cuid_valid = true;
+			// PrintAndLog("Acquiring nonces for CUID 0x%08x", cuid); 
+		} else if (msclock() - last_clock < acq->sample_period) {
+			acq->sample_period = msclock() - last_clock;
+		}
+		last_clock = msclock();
+		initialize = false;
+
+		pthread_mutex_lock(&acq->lock);
+		if (acq->stop) {
+			field_off = true;	// switch off field with next SendCommand and then finish
+		}
+		pthread_mutex_unlock(&acq->lock);
+	} while (true);
+
+	set_acquisition_flag(acq, &acq->running, false);
+	return NULL;
+}
+
+
+static nonce_acquisition_t *init_acquisition(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, bool slow)
+{
+	nonce_acquisition_t *acq = (nonce_acquisition_t *)calloc(1, sizeof(nonce_acquisition_t));
+	if (acq == NULL) {
+		printf("Out of memory error in init_acquisition(). Aborting...\n");
+		exit(4);
+	}
+	acq->blockNo = blockNo;
+	acq->keyType = keyType;
+	memcpy(acq->key, key, 6);
+	acq->trgBlockNo = trgBlockNo;
+	acq->trgKeyType = trgKeyType;
+	acq->slow = slow;
+	acq->sample_period = 2000;	// initial rough estimate. Will be refined.
+	pthread_mutex_init(&acq->lock, NULL);
+	pthread_cond_init(&acq->changed, NULL);
+	return acq;
+}
+
+
+static void free_acquisition(nonce_acquisition_t *acq)
+{
+	pthread_cond_destroy(&acq->changed);
+	pthread_mutex_destroy(&acq->lock);
+	free(acq);
+}
+
+
+static void start_acquisition_thread(nonce_acquisition_t *acq)
+{
+	acq->stop = false;
+	acq->result = 0;
+	acq->running = true;
+	acq->thread_started = true;
+	pthread_create(&acq->thread, NULL, acquire_nonces_thread, acq);
+}
+
+
+static int stop_acquisition_thread(nonce_acquisition_t *acq)
+{
+	// switch off the field. Batches already in the queue are kept.
+	if (acq->thread_started) {
+		set_acquisition_flag(acq, &acq->stop, true);
+		pthread_join(acq->thread, NULL);
+		acq->thread_started = false;
+	}
+	return acq->result;
+}
+
+
+static int acquire_nonces(nonce_acquisition_t *acq, bool nonce_file_write, bool resume)
+{
+	bool acquisition_completed = false;
+	uint8_t write_buf[9];
+	bool reported_suma8 = false;
+	FILE *fnonces = NULL;
+
+	if (resume) {			// continue with the nonces from the checkpoint
+		reported_suma8 = (hardnested_stage & CHECK_2ND_BYTES);
+		acq->cuid_valid = true;
+		acq->cuid = cuid;
+	} else {
+		hardnested_stage = CHECK_1ST_BYTES;
+		num_acquired_nonces = 0;
+	}
+	
+	do {
+		pthread_mutex_lock(&acq->lock);
+		bool restart = (acq->head == acq->tail && !acq->running);
+		pthread_mutex_unlock(&acq->lock);
+		if (restart) {
+			if (stop_acquisition_thread(acq) != 0) {
+				break;
+			}
+			start_acquisition_thread(acq);
+		}
+		pthread_mutex_lock(&acq->lock);
+		while (acq->head == acq->tail && acq->running) {
+			pthread_cond_wait(&acq->changed, &acq->lock);
+		}
+		uint32_t head = acq->head;
+		uint32_t tail = acq->tail;
+		pthread_mutex_unlock(&acq->lock);
+		if (head == tail) {
+			continue;
+		}
+
+		cuid = acq->cuid;
+		if (nonce_file_write && fnonces == NULL) {
+			if ((fnonces = fopen("nonces.bin","wb")) == NULL) { 
+				PrintAndLog("Could not create file nonces.bin");
+				stop_acquisition_thread(acq);
+				return 3;
+			}
+			hardnested_print_progress(0, "Writing acquired nonces to binary file nonces.bin", (float)(1LL<<47), 0);
+			num_to_bytes(cuid, 4, write_buf);
+			fwrite(write_buf, 1, 4, fnonces);
+			fwrite(&acq->trgBlockNo, 1, 1, fnonces);
+			fwrite(&acq->trgKeyType, 1, 1, fnonces);
+		}
+
+		uint32_t num_batches = 0;
+		for ( ; head != tail; head++) {
+			nonce_batch_t *batch = &acq->queue[head % ACQUISITION_QUEUE_LEN];
+			add_nonce_batch(batch->data, batch->num_nonces, fnonces);
+			set_acquisition_state(acq, &acq->head, head + 1);
+			num_batches++;
+		}
+
+		// the time budget for the evaluation and the expected reduction cover all batches evaluated at once
+		last_sample_clock = msclock();
+		sample_period = acq->sample_period * num_batches;
+		acquisition_completed = evaluate_nonces(&reported_suma8);
+		checkpoint_acquisition(acquisition_completed);
+	} while (!acquisition_completed);
+
+	int result = stop_acquisition_thread(acq);
+
+	if (!acquisition_completed) {
+		checkpoint_acquisition(true);		// e.g. the card has been removed. Keep the nonces acquired so far.
+	}
+
+	if (nonce_file_write && fnonces != NULL) {
+		fclose(fnonces);
+	}
+
+	if (!acquisition_completed && result == 3) {
+		PrintAndLog("Card UID %08x doesn't match the expected UID %08x.", acq->card_cuid, acq->cuid);
+	}
+	
+	return acquisition_completed ? 0 : result;
+}
+
+
+static inline bool invariant_holds(uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, uint_fast8_t bit, uint_fast8_t state_bit)
+{
+	uint_fast8_t j_1_bit_mask = 0x01 << (bit-1);
+	uint_fast8_t bit_diff = byte_diff & j_1_bit_mask;							 			// difference of (j-1)th bit
+	uint_fast8_t filter_diff = filter(state1 >> (4-state_bit)) ^ filter(state2 >> (4-state_bit));	// difference in filter function
+	uint_fast8_t mask_y12_y13 = 0xc0 >> state_bit;
+	uint_fast8_t state_bits_diff = (state1 ^ state2) & mask_y12_y13;						// difference in state bits 12 and 13
+	uint_fast8_t all_diff = evenparity8(bit_diff ^ state_bits_diff ^ filter_diff);			// use parity function to XOR all bits
+	return !all_diff;
+}
+
+
+static inline bool invalid_state(uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, uint_fast8_t bit, uint_fast8_t state_bit)
+{
+	uint_fast8_t j_bit_mask = 0x01 << bit;
+	uint_fast8_t bit_diff = byte_diff & j_bit_mask;											// difference of jth bit
+	uint_fast8_t mask_y13_y16 = 0x48 >> state_bit;
+	uint_fast8_t state_bits_diff = (state1 ^ state2) & mask_y13_y16;						// difference in state bits 13 and 16
+	uint_fast8_t all_diff = evenparity8(bit_diff ^ state_bits_diff);						// use parity function to XOR all bits
+	return all_diff;
+}
+
+
+static inline bool remaining_bits_match(uint_fast8_t num_common_bits, uint_fast8_t byte_diff, uint_fast32_t state1, uint_fast32_t state2, odd_even_t odd_even)
+{
+	if (odd_even) {
+		// odd bits
+		switch (num_common_bits) {
+			case 0: if (!invariant_holds(byte_diff, state1, state2, 1, 0)) return true;
+			case 1: if (invalid_state(byte_diff, state1, state2, 1, 0)) return false;
+			case 2: if (!invariant_holds(byte_diff, state1, state2, 3, 1)) return true;
+			case 3: if (invalid_state(byte_diff, state1, state2, 3, 1)) return false;
+			case 4: if (!invariant_holds(byte_diff, state1, state2, 5, 2)) return true;
+			case 5: if (invalid_state(byte_diff, state1, state2, 5, 2)) return false;
+			case 6: if (!invariant_holds(byte_diff, state1, state2, 7, 3)) return true;
+			case 7: if (invalid_state(byte_diff, state1, state2, 7, 3)) return false;
 		}
 	} else {
 		// even bits
@@ -1613,26 +2517,24 @@ static inline bool remaining_bits_match(uint_fast8_t num_common_bits, uint_fast8
 }
 
 
-static pthread_mutex_t statelist_cache_mutex;
-static pthread_mutex_t book_of_work_mutex;
-
-
 typedef enum {
 	TO_BE_DONE,
 	WORK_IN_PROGRESS,
 	COMPLETED
 } work_status_t;
 
+// The statelist cache is shared by the candidate generation threads without locks. Each entry is calculated once:
+// the thread which changes its status from TO_BE_DONE to WORK_IN_PROGRESS calculates it, and sl and len are valid
+// when the status is COMPLETED.
 static struct sl_cache_entry {
-	uint32_t *sl;
+	packed_statelist_t *sl;
 	uint32_t len;
-	work_status_t cache_status;
+	volatile work_status_t cache_status;
 	} sl_cache[NUM_PART_SUMS][NUM_PART_SUMS][2];
 
 
 static void init_statelist_cache(void)
 {
-	pthread_mutex_lock(&statelist_cache_mutex);
 	for (uint16_t i = 0; i < NUM_PART_SUMS; i++) {
 		for (uint16_t j = 0; j < NUM_PART_SUMS; j++) {
 			for (uint16_t k = 0; k < 2; k++) {
@@ -1642,21 +2544,18 @@ static void init_statelist_cache(void)
 			}
 		}
 	}		
-	pthread_mutex_unlock(&statelist_cache_mutex);
 }
 
 
 static void free_statelist_cache(void)
 {
-	pthread_mutex_lock(&statelist_cache_mutex);
 	for (uint16_t i = 0; i < NUM_PART_SUMS; i++) {
 		for (uint16_t j = 0; j < NUM_PART_SUMS; j++) {
 			for (uint16_t k = 0; k < 2; k++) {
-				free(sl_cache[i][j][k].sl);
+				free_packed_statelist(sl_cache[i][j][k].sl);
 			}
 		}
 	}		
-	pthread_mutex_unlock(&statelist_cache_mutex);
 }
 
 
@@ -1738,40 +2637,43 @@ static bool all_bitflips_match(uint8_t byte, uint32_t state, odd_even_t odd_even
 }
 
 
-static void	bitarray_to_list(uint8_t byte, uint32_t *bitarray, uint32_t *state_list, uint32_t *len, odd_even_t odd_even)
+static void filter_bitarray(uint8_t byte, uint32_t *bitarray, odd_even_t odd_even)
 {
-	uint32_t *p = state_list;
+	// remove all states from bitarray which don't match the bitflip properties of the other first bytes
 	for (uint32_t state = next_state(bitarray, -1L); state < (1<<24); state = next_state(bitarray, state)) {
-		if (all_bitflips_match(byte, state, odd_even)) {
-			*p++ = state;
+		if (!all_bitflips_match(byte, state, odd_even)) {
+			clear_bit24(bitarray, state);
 		}
 	}
-	// add End Of List marker
-	*p = 0xffffffff;
-	*len = p - state_list;
+}
+
+
+static work_status_t claim_cached_states(uint16_t part_sum_a0, uint16_t part_sum_a8, odd_even_t odd_even)
+{
+	// TO_BE_DONE: the calling thread is now responsible to calculate the states.
+	// WORK_IN_PROGRESS: another thread is calculating them. COMPLETED: the states can be used.
+	struct sl_cache_entry *entry = &sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even];
+	if (__sync_bool_compare_and_swap(&entry->cache_status, TO_BE_DONE, WORK_IN_PROGRESS)) {
+		return TO_BE_DONE;
+	}
+	work_status_t cache_status = entry->cache_status;
+	__sync_synchronize();		// don't read sl and len before the status
+	return cache_status;
 }
 
 
 static void add_cached_states(statelist_t *candidates, uint16_t part_sum_a0, uint16_t part_sum_a8, odd_even_t odd_even)
 {
-	candidates->states[odd_even] = sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].sl;
-	candidates->len[odd_even] = sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].len;
+	set_packed_states(candidates, sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].sl, odd_even);
 	return;
 }
 
 
 static void add_matching_states(statelist_t *candidates, uint8_t part_sum_a0, uint8_t part_sum_a8, odd_even_t odd_even)
 {
-	uint32_t worstcase_size = 1<<20;
-	candidates->states[odd_even] = (uint32_t *)malloc(sizeof(uint32_t) * worstcase_size);
-	if (candidates->states[odd_even] == NULL) {
-		PrintAndLog("Out of memory error in add_matching_states() - statelist.\n");
-		exit(4);
-	}
 	uint32_t *candidates_bitarray = (uint32_t *)malloc_bitarray(sizeof(uint32_t) * (1<<19));
 	if (candidates_bitarray == NULL) {
 		PrintAndLog("Out of memory error in add_matching_states() - bitarray.\n");
-		free(candidates->states[odd_even]);
 		exit(4);
 	}
 	
@@ -1784,21 +2686,20 @@ static void add_matching_states(statelist_t *candidates, uint8_t part_sum_a0, ui
 	// }
 	bitarray_AND4(candidates_bitarray, bitarray_a0, bitarray_a8, bitarray_bitflips);
 	
-	bitarray_to_list(best_first_bytes[0], candidates_bitarray, candidates->states[odd_even], &(candidates->len[odd_even]), odd_even);
-	if (candidates->len[odd_even] == 0) {
-		free(candidates->states[odd_even]);
-		candidates->states[odd_even] = NULL;
-	} else if (candidates->len[odd_even] + 1 < worstcase_size) {
-		candidates->states[odd_even] = realloc(candidates->states[odd_even], sizeof(uint32_t) * (candidates->len[odd_even] + 1));
+	filter_bitarray(best_first_bytes[0], candidates_bitarray, odd_even);
+	packed_statelist_t *sl = pack_bitarray(candidates_bitarray);
+	if (sl->len == 0) {
+		free_packed_statelist(sl);
+		sl = NULL;
 	}
 	free_bitarray(candidates_bitarray);
+	set_packed_states(candidates, sl, odd_even);
 
-
-	pthread_mutex_lock(&statelist_cache_mutex);
-	sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].sl = candidates->states[odd_even];
+	// publish the result
+	sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].sl = sl;
 	sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].len = candidates->len[odd_even];
+	__sync_synchronize();
 	sl_cache[part_sum_a0/2][part_sum_a8/2][odd_even].cache_status = COMPLETED;
-	pthread_mutex_unlock(&statelist_cache_mutex);
 
 	return;
 }
@@ -1822,6 +2723,10 @@ static statelist_t *add_more_candidates(void)
 	new_candidates->len[EVEN_STATE] = 0;
 	new_candidates->states[ODD_STATE] = NULL;
 	new_candidates->states[EVEN_STATE] = NULL;
+	new_candidates->packed[ODD_STATE] = NULL;
+	new_candidates->packed[EVEN_STATE] = NULL;
+	new_candidates->start[ODD_STATE] = 0;
+	new_candidates->start[EVEN_STATE] = 0;
 	return new_candidates;
 }
 
@@ -1831,18 +2736,15 @@ static void add_bitflip_candidates(uint8_t byte)
 	statelist_t *candidates = add_more_candidates();
 
 	for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
-		uint32_t worstcase_size = nonces[byte].num_states_bitarray[odd_even] + 1;
-		candidates->states[odd_even] = (uint32_t *)malloc(sizeof(uint32_t) * worstcase_size);
-		if (candidates->states[odd_even] == NULL) {
+		uint32_t *bitarray = (uint32_t *)malloc_bitarray(sizeof(uint32_t) * (1<<19));
+		if (bitarray == NULL) {
 			PrintAndLog("Out of memory error in add_bitflip_candidates().\n");
 			exit(4);
 		}
-	
-		bitarray_to_list(byte, nonces[byte].states_bitarray[odd_even], candidates->states[odd_even], &(candidates->len[odd_even]), odd_even);
-
-		if (candidates->len[odd_even] + 1 < worstcase_size) {
-			candidates->states[odd_even] = realloc(candidates->states[odd_even], sizeof(uint32_t) * (candidates->len[odd_even] + 1));
-		}
+		memcpy(bitarray, nonces[byte].states_bitarray[odd_even], sizeof(uint32_t) * (1<<19));
+		filter_bitarray(byte, bitarray, odd_even);
+		set_packed_states(candidates, pack_bitarray(bitarray), odd_even);
+		free_bitarray(bitarray);
 	}
 	return;
 }
@@ -1861,23 +2763,11 @@ static bool TestIfKeyExists(uint64_t key)
 	for (statelist_t *p = candidates; p != NULL; p = p->next) {
 		bool found_odd = false;
 		bool found_even = false;
-		uint32_t *p_odd = p->states[ODD_STATE];
-		uint32_t *p_even = p->states[EVEN_STATE];
-		if (p_odd != NULL && p_even != NULL) {
-			while (*p_odd != 0xffffffff) {
-				if ((*p_odd & 0x00ffffff) == state_odd) {
-					found_odd = true;
-					break;
-				}
-				p_odd++;
-			}
-			while (*p_even != 0xffffffff) {
-				if ((*p_even & 0x00ffffff) == state_even) {
-					found_even = true;
-				}
-				p_even++;
-			}
-			count += (uint64_t)(p_odd - p->states[ODD_STATE]) * (uint64_t)(p_even - p->states[EVEN_STATE]);
+		if (p->packed[ODD_STATE] != NULL && p->packed[EVEN_STATE] != NULL) {
+			uint32_t index_odd, index_even;
+			found_odd = find_packed_state(p->packed[ODD_STATE], state_odd, &index_odd);
+			found_even = find_packed_state(p->packed[EVEN_STATE], state_even, &index_even);
+			count += (uint64_t)(found_odd ? index_odd : p->len[ODD_STATE]) * (uint64_t)p->len[EVEN_STATE];
 		}
 		if (found_odd && found_even) {
 			num_keys_tested += count;
@@ -1895,7 +2785,8 @@ static bool TestIfKeyExists(uint64_t key)
 }
 
 
-static work_status_t book_of_work[NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS];
+static volatile work_status_t book_of_work[NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS];
+static statelist_t *candidates_of_work[NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS][NUM_PART_SUMS];
 
 
 static void init_book_of_work(void)
@@ -1905,6 +2796,7 @@ static void init_book_of_work(void)
 			for (uint8_t r = 0; r < NUM_PART_SUMS; r++) {
 				for (uint8_t s = 0; s < NUM_PART_SUMS; s++) {
 					book_of_work[p][q][r][s] = TO_BE_DONE;
+					candidates_of_work[p][q][r][s] = NULL;
 				}
 			}
 		}
@@ -1936,103 +2828,66 @@ __attribute__((force_align_arg_pointer))
 					for (uint8_t r = 0; r < NUM_PART_SUMS; r++) {
 						for (uint8_t s = 0; s < NUM_PART_SUMS; s++) {
 							if (2*r*(16-2*s) + (16-2*r)*2*s == sum_a8) {
-								pthread_mutex_lock(&book_of_work_mutex);
-								if (book_of_work[p][q][r][s] != TO_BE_DONE) {  // this has been done or is currently been done by another thread. Look for some other work.
-									pthread_mutex_unlock(&book_of_work_mutex);
-									continue;
+								if (!__sync_bool_compare_and_swap(&book_of_work[p][q][r][s], TO_BE_DONE, WORK_IN_PROGRESS)) {
+									continue;	// this has been done or is currently been done by another thread. Look for some other work.
 								}
 
-								pthread_mutex_lock(&statelist_cache_mutex);
-								if (sl_cache[p][r][ODD_STATE].cache_status == WORK_IN_PROGRESS
-									|| sl_cache[q][s][EVEN_STATE].cache_status == WORK_IN_PROGRESS) { // defer until not blocked by another thread.
-									pthread_mutex_unlock(&statelist_cache_mutex);
-									pthread_mutex_unlock(&book_of_work_mutex);
-									there_might_be_more_work = true;
-									continue;
-								}
+								statelist_t current_candidates = {{NULL, NULL}, {0, 0}, NULL};
+								bool deferred = false;
 
-								// we finally can do some work.
-								book_of_work[p][q][r][s] = WORK_IN_PROGRESS;
-								statelist_t *current_candidates = add_more_candidates();
+								// if there is a cached empty result for the even states, there is no need to calculate the odd states
+								bool even_empty = sl_cache[q][s][EVEN_STATE].cache_status == COMPLETED;
+								__sync_synchronize();
+								even_empty = even_empty && sl_cache[q][s][EVEN_STATE].len == 0;
 
-								// Check for cached results and add them first
-								bool odd_completed = false;
-								if (sl_cache[p][r][ODD_STATE].cache_status == COMPLETED) {
-									add_cached_states(current_candidates, 2*p, 2*r, ODD_STATE);
-									odd_completed = true;
-								}
-								bool even_completed = false;
-								if (sl_cache[q][s][EVEN_STATE].cache_status == COMPLETED) {
-									add_cached_states(current_candidates, 2*q, 2*s, EVEN_STATE);
-									even_completed = true;
-								}
-								
-								bool work_required = true;
-
-								// if there had been two cached results, there is no more work to do
-								if (even_completed && odd_completed) {
-									work_required = false;
-								}	
-
-								// if there had been one cached empty result, there is no need to calculate the other part:
-								if (work_required) {
-									if (even_completed && !current_candidates->len[EVEN_STATE]) {
-										current_candidates->len[ODD_STATE] = 0;
-										current_candidates->states[ODD_STATE] = NULL;
-										work_required = false;
-									}									
-									if (odd_completed && !current_candidates->len[ODD_STATE]) {
-										current_candidates->len[EVEN_STATE] = 0;
-										current_candidates->states[EVEN_STATE] = NULL;
-										work_required = false;
+								if (!even_empty) {
+									work_status_t odd_status = claim_cached_states(2*p, 2*r, ODD_STATE);
+									if (odd_status == TO_BE_DONE) {
+										// printf("Thread #%u: start working on  odd states p=%2d, r=%2d...\n", my_thread_number, p, r);
+										add_matching_states(&current_candidates, 2*p, 2*r, ODD_STATE);
+									} else if (odd_status == COMPLETED) {
+										add_cached_states(&current_candidates, 2*p, 2*r, ODD_STATE);
+									} else { 		// defer until not blocked by another thread.
+										deferred = true;
 									}
 								}
 
-								if (!work_required) {
-									pthread_mutex_unlock(&statelist_cache_mutex);
-									pthread_mutex_unlock(&book_of_work_mutex);
-								} else {
-									// we really need to calculate something
-									if (even_completed) { // we had one cache hit with non-zero even states
-										// printf("Thread #%u: start working on  odd states p=%2d, r=%2d...\n", my_thread_number, p, r);
-										sl_cache[p][r][ODD_STATE].cache_status = WORK_IN_PROGRESS;
-										pthread_mutex_unlock(&statelist_cache_mutex);
-										pthread_mutex_unlock(&book_of_work_mutex);
-										add_matching_states(current_candidates, 2*p, 2*r, ODD_STATE);
-										work_required = false;
-									} else if (odd_completed) { // we had one cache hit with non-zero odd_states
+								// no need to calculate the even states if there are no odd states
+								if (!deferred && current_candidates.len[ODD_STATE]) {
+									work_status_t even_status = claim_cached_states(2*q, 2*s, EVEN_STATE);
+									if (even_status == TO_BE_DONE) {
 										// printf("Thread #%u: start working on even states q=%2d, s=%2d...\n", my_thread_number, q, s);
-										sl_cache[q][s][EVEN_STATE].cache_status = WORK_IN_PROGRESS;
-										pthread_mutex_unlock(&statelist_cache_mutex);
-										pthread_mutex_unlock(&book_of_work_mutex);
-										add_matching_states(current_candidates, 2*q, 2*s, EVEN_STATE);
-										work_required = false;
+										add_matching_states(&current_candidates, 2*q, 2*s, EVEN_STATE);
+									} else if (even_status == COMPLETED) {
+										add_cached_states(&current_candidates, 2*q, 2*s, EVEN_STATE);
+									} else {		// the odd states are cached now. Come back later for the even states.
+										deferred = true;
 									}
 								}
-									
-								if (work_required) { // we had no cached result. Need to calculate both odd and even
-									sl_cache[p][r][ODD_STATE].cache_status = WORK_IN_PROGRESS;
-									sl_cache[q][s][EVEN_STATE].cache_status = WORK_IN_PROGRESS;
-									pthread_mutex_unlock(&statelist_cache_mutex);
-									pthread_mutex_unlock(&book_of_work_mutex);
-
-									add_matching_states(current_candidates, 2*p, 2*r, ODD_STATE);
-									if(current_candidates->len[ODD_STATE]) {
-										// printf("Thread #%u: start working on even states q=%2d, s=%2d...\n", my_thread_number, q, s);
-										add_matching_states(current_candidates, 2*q, 2*s, EVEN_STATE);
-									} else { // no need to calculate even states yet
-										pthread_mutex_lock(&statelist_cache_mutex);
-										sl_cache[q][s][EVEN_STATE].cache_status = TO_BE_DONE;
-										pthread_mutex_unlock(&statelist_cache_mutex);
-										current_candidates->len[EVEN_STATE] = 0;
-										current_candidates->states[EVEN_STATE] = NULL;
-									}
+
+								if (deferred) {
+									book_of_work[p][q][r][s] = TO_BE_DONE;
+									there_might_be_more_work = true;
+									continue;
 								}
 
+								if (current_candidates.len[EVEN_STATE] == 0) {
+									current_candidates.len[ODD_STATE] = 0;
+									current_candidates.states[ODD_STATE] = NULL;
+									current_candidates.packed[ODD_STATE] = NULL;
+								}
+
+								// each piece of work has its own slot for the resulting candidates. They are linked after all threads are done.
+								statelist_t *new_candidates = (statelist_t *)malloc(sizeof(statelist_t));
+								if (new_candidates == NULL) {
+									printf("Out of memory error in generate_candidates_worker_thread(). Aborting...\n");
+									exit(4);
+								}
+								*new_candidates = current_candidates;
+								candidates_of_work[p][q][r][s] = new_candidates;
+
 								// update book of work
-								pthread_mutex_lock(&book_of_work_mutex);
 								book_of_work[p][q][r][s] = COMPLETED;
-								pthread_mutex_unlock(&book_of_work_mutex);
 
 								// if ((uint64_t)current_candidates->len[ODD_STATE] * current_candidates->len[EVEN_STATE]) {
 									// printf("Candidates for p=%2u, q=%2u, r=%2u, s=%2u: %" PRIu32 " * %" PRIu32 " = %" PRIu64 " (2^%0.1f)\n",
@@ -2079,10 +2934,6 @@ static void generate_candidates(uint8_t sum_a0_idx, uint8_t sum_a8_idx)
 	init_statelist_cache();
 	init_book_of_work();
 
-	// create mutexes for accessing the statelist cache and our "book of work"
-	pthread_mutex_init(&statelist_cache_mutex, NULL);
-	pthread_mutex_init(&book_of_work_mutex, NULL);
-
 	// create and run worker threads
 	pthread_t thread_id[NUM_REDUCTION_WORKING_THREADS];
 		
@@ -2098,63 +2949,317 @@ static void generate_candidates(uint8_t sum_a0_idx, uint8_t sum_a8_idx)
 	for (uint16_t i = 0; i < NUM_REDUCTION_WORKING_THREADS; i++) {
 		pthread_join(thread_id[i], NULL);
 	}
-
-	// clean up mutex
-	pthread_mutex_destroy(&statelist_cache_mutex);
-	
-	maximum_states = 0;
-	for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
-		maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+
+	// append the candidates in the order of the book of work
+	statelist_t **next = &candidates;
+	while (*next != NULL) {
+		next = (statelist_t **)&(*next)->next;
+	}
+	for (uint8_t p = 0; p < NUM_PART_SUMS; p++) {
+		for (uint8_t q = 0; q < NUM_PART_SUMS; q++) {
+			for (uint8_t r = 0; r < NUM_PART_SUMS; r++) {
+				for (uint8_t s = 0; s < NUM_PART_SUMS; s++) {
+					if (candidates_of_work[p][q][r][s] != NULL) {
+						*next = candidates_of_work[p][q][r][s];
+						next = (statelist_t **)&(*next)->next;
+					}
+				}
+			}
+		}
+	}
+
+	maximum_states = 0;
+	for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+		maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+	}
+
+	for (uint8_t i = 0; i < NUM_SUMS; i++) {
+		if (nonces[best_first_bytes[0]].sum_a8_guess[i].sum_a8_idx == sum_a8_idx) {
+			nonces[best_first_bytes[0]].sum_a8_guess[i].num_states = maximum_states;
+			break;
+		}
+	}
+	update_expected_brute_force(best_first_bytes[0]);
+
+	hardnested_print_progress(num_acquired_nonces, "Apply Sum(a8) and all bytes bitflip properties", nonces[best_first_bytes[0]].expected_num_brute_force, 0);
+}
+
+
+static void	free_candidates_memory(statelist_t *sl)
+{
+	if (sl == NULL) {
+		return;
+	} else {
+		free_candidates_memory(sl->next);
+		free(sl);
+	}
+}
+
+
+static void pre_XOR_nonces(void)
+{
+	// prepare acquired nonces for faster brute forcing. 
+	
+	// XOR the cryptoUID and its parity
+	for (uint16_t i = 0; i < 256; i++) {
+		noncelistentry_t *test_nonce = nonces[i].first;
+		while (test_nonce != NULL) {
+			test_nonce->nonce_enc ^= cuid;
+			test_nonce->par_enc ^= oddparity8(cuid >>  0 & 0xff) << 0;
+			test_nonce->par_enc ^= oddparity8(cuid >>  8 & 0xff) << 1;
+			test_nonce->par_enc ^= oddparity8(cuid >> 16 & 0xff) << 2;
+			test_nonce->par_enc ^= oddparity8(cuid >> 24 & 0xff) << 3;
+			test_nonce = test_nonce->next;
+		}
+	}
+}
+	
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// distributed brute force. The candidates are written to work unit files in a (shared) directory. They are
+// processed by hardnested_worker processes which write a result file for each unit.
+
+#define DISTRIBUTED_NUM_UNITS			256			// maximum number of work unit files per Sum(a8) guess
+#define DISTRIBUTED_POLL_INTERVAL		1000		// ms between two checks for results
+#define DISTRIBUTED_LEASE_TIME			300000		// ms without a heartbeat from a worker until its unit is handed out again
+#define DISTRIBUTED_MIN_TIMEOUT			600000		// ms to wait for the workers at least. See distributed_timeout().
+
+static char work_directory[FILE_PATH_SIZE] = "";	// a copy, the caller's buffer doesn't outlive the command
+static bool distributed = false;
+static uint32_t last_job_id = 0;
+
+
+static bool chunk_done(bf_checkpoint_t *bf_checkpoint, uint32_t chunk)
+{
+	return bf_checkpoint->work_units_done[chunk/8] & (1 << (chunk%8));
+}
+
+
+static uint64_t distributed_timeout(void)
+{
+	// stop waiting for the workers when a local brute force would have taken twice as long
+	uint64_t local_time = brute_force_per_second > 0.0 ? (float)maximum_states / brute_force_per_second * 1000.0 : 0;
+	return MAX(2 * local_time, DISTRIBUTED_MIN_TIMEOUT);
+}
+
+
+static void cancel_work_units(uint32_t job_id, uint32_t num_units, bool *unit_done)
+{
+	// remove the units and results not yet processed. Workers discard the results of units in progress.
+	char filename[FILE_PATH_SIZE];
+	for (uint32_t unit = 0; unit < num_units; unit++) {
+		if (!unit_done[unit]) {
+			work_unit_filename(filename, work_directory, job_id, unit, WORK_UNIT_SUFFIX);
+			remove(filename);
+			work_unit_filename(filename, work_directory, job_id, unit, WORK_UNIT_SUFFIX WORK_UNIT_CLAIMED_SUFFIX);
+			remove(filename);
+			work_unit_filename(filename, work_directory, job_id, unit, WORK_RESULT_SUFFIX);
+			remove(filename);
+		}
+	}
+}
+
+
+static void check_lease(uint32_t job_id, uint32_t unit, time_t *lease_mtime, uint64_t *lease_time)
+{
+	// A worker touches its .work file regularly. If it stops doing so (crashed, machine switched off, ...)
+	// the unit is handed out again. Only the local clock is used, the worker's clock may differ.
+	char work_filename[FILE_PATH_SIZE];
+	struct stat st;
+	work_unit_filename(work_filename, work_directory, job_id, unit, WORK_UNIT_SUFFIX WORK_UNIT_CLAIMED_SUFFIX);
+	if (stat(work_filename, &st) != 0) {
+		lease_mtime[unit] = 0;
+		return;
+	}
+	if (lease_mtime[unit] == 0 || st.st_mtime != lease_mtime[unit]) {
+		lease_mtime[unit] = st.st_mtime;
+		lease_time[unit] = msclock();
+		return;
+	}
+	if (msclock() - lease_time[unit] >= DISTRIBUTED_LEASE_TIME) {
+		char unit_filename[FILE_PATH_SIZE];
+		work_unit_filename(unit_filename, work_directory, job_id, unit, WORK_UNIT_SUFFIX);
+		if (rename(work_filename, unit_filename) == 0) {
+			PrintAndLog("No heartbeat from the worker of work unit %" PRIu32 " for %ds. Handing it out again.", unit, DISTRIBUTED_LEASE_TIME/1000);
+		}
+		lease_mtime[unit] = 0;
+	}
+}
+
+
+static bool distributed_brute_force(uint64_t *found_key, bool *key_found, bf_checkpoint_t *bf_checkpoint)
+{
+	// Returns true if all work units have been processed by workers or the key has been found. Otherwise the
+	// remaining chunks (not marked in bf_checkpoint) need to be brute forced locally. If the work units couldn't
+	// be written, the user aborted or the workers timed out, the following brute force phases are done locally.
+	char progress_text[80];
+	*key_found = false;
+
+	// use the brute forcer's work units (chunks) and combine consecutive chunks to a work unit file
+	uint32_t num_chunks = bf_num_work_units(candidates);
+	statelist_t *chunks = (statelist_t *)malloc(MAX(num_chunks, 1) * sizeof(statelist_t));
+	uint32_t num_units = MIN(num_chunks, DISTRIBUTED_NUM_UNITS);
+	uint32_t *first_chunk = (uint32_t *)malloc((num_units + 1) * sizeof(uint32_t));
+	bool *unit_done = (bool *)calloc(MAX(num_units, 1), sizeof(bool));
+	time_t *lease_mtime = (time_t *)calloc(MAX(num_units, 1), sizeof(time_t));
+	uint64_t *lease_time = (uint64_t *)calloc(MAX(num_units, 1), sizeof(uint64_t));
+	if (chunks == NULL || first_chunk == NULL || unit_done == NULL || lease_mtime == NULL || lease_time == NULL) {
+		printf("Out of memory error in distributed_brute_force(). Aborting...\n");
+		exit(4);
+	}
+	bf_get_work_units(candidates, chunks);
+	for (uint32_t unit = 0; unit <= num_units; unit++) {
+		first_chunk[unit] = (uint64_t)unit * num_chunks / MAX(num_units, 1);
 	}
 
-	for (uint8_t i = 0; i < NUM_SUMS; i++) {
-		if (nonces[best_first_bytes[0]].sum_a8_guess[i].sum_a8_idx == sum_a8_idx) {
-			nonces[best_first_bytes[0]].sum_a8_guess[i].num_states = maximum_states;
-			break;
+	uint32_t job_id = MAX((uint32_t)time(NULL), last_job_id + 1);
+	last_job_id = job_id;
+	work_unit_t wu;
+	wu.job_id = job_id;
+	wu.num_units = num_units;
+	wu.cuid = cuid;
+	wu.num_acquired_nonces = num_acquired_nonces;
+	memcpy(wu.best_first_bytes, best_first_bytes, sizeof(wu.best_first_bytes));
+	wu.nonces = nonces;
+	uint64_t states_done = 0;
+	uint32_t num_done = 0;
+	uint32_t num_failed = 0;
+	bool write_error = false;
+	for (uint32_t unit = 0; unit < num_units && !write_error; unit++) {
+		// chunks already brute forced before a checkpoint was written are left out
+		wu.unit = unit;
+		wu.buckets = NULL;
+		wu.num_buckets = 0;
+		statelist_t **next = &wu.buckets;
+		for (uint32_t i = first_chunk[unit]; i < first_chunk[unit+1]; i++) {
+			if (chunk_done(bf_checkpoint, i)) {
+				states_done += (uint64_t)chunks[i].len[ODD_STATE] * chunks[i].len[EVEN_STATE];
+				continue;
+			}
+			chunks[i].next = NULL;
+			*next = &chunks[i];
+			next = (statelist_t **)&chunks[i].next;
+			wu.num_buckets++;
+		}
+		if (wu.num_buckets == 0) {
+			unit_done[unit] = true;
+			num_done++;
+			continue;
+		}
+		char filename[FILE_PATH_SIZE];
+		work_unit_filename(filename, work_directory, job_id, unit, WORK_UNIT_SUFFIX);
+		if (!write_work_unit(filename, &wu)) {
+			PrintAndLog("Could not write work unit %s. Brute forcing locally.", filename);
+			cancel_work_units(job_id, unit, unit_done);
+			write_error = true;
 		}
 	}
-	update_expected_brute_force(best_first_bytes[0]);
 
-	hardnested_print_progress(num_acquired_nonces, "Apply Sum(a8) and all bytes bitflip properties", nonces[best_first_bytes[0]].expected_num_brute_force, 0);
-}
+	bool aborted = false;
+	if (!write_error) {
+		sprintf(progress_text, "Waiting for workers: %" PRIu32 " work units in %.40s", num_units - num_done, work_directory);
+		hardnested_print_progress(num_acquired_nonces, progress_text, nonces[best_first_bytes[0]].expected_num_brute_force, 0);
+	}
 
+	uint64_t timeout = distributed_timeout();
+	uint64_t start_time = msclock();
+	while (!write_error && num_done < num_units && !*key_found) {
+		msleep(DISTRIBUTED_POLL_INTERVAL);
+		if (ukbhit() > 0) {		// not -1, stdin may be no terminal (scripts)
+			getchar();
+			PrintAndLog("\nAborted waiting for the workers. Brute forcing the remaining work units locally.");
+			aborted = true;
+			break;
+		}
+		if (msclock() - start_time > timeout) {
+			PrintAndLog("\nThe workers didn't finish within %" PRIu64 "s. Brute forcing the remaining work units locally.", timeout/1000);
+			aborted = true;
+			break;
+		}
+		for (uint32_t unit = 0; unit < num_units && !*key_found; unit++) {
+			if (unit_done[unit]) {
+				continue;
+			}
+			char filename[FILE_PATH_SIZE];
+			work_result_t result;
+			work_unit_filename(filename, work_directory, job_id, unit, WORK_RESULT_SUFFIX);
+			if (!read_work_result(filename, &result) || result.job_id != job_id || result.unit != unit) {
+				check_lease(job_id, unit, lease_mtime, lease_time);
+				continue;
+			}
+			remove(filename);
+			unit_done[unit] = true;
+			num_done++;
+			if (result.status == WORK_RESULT_KEY_FOUND) {
+				*key_found = true;
+				if (found_key != NULL) {
+					*found_key = result.key;
+				}
+				sprintf(progress_text, "Brute force phase completed. Key found: %012" PRIx64, result.key);
+				hardnested_print_progress(num_acquired_nonces, progress_text, 0.0, 0);
+			} else if (result.status == WORK_RESULT_DONE) {
+				states_done += result.num_keys_tested;
+				for (uint32_t i = first_chunk[unit]; i < first_chunk[unit+1]; i++) {
+					bf_checkpoint->work_units_done[i/8] |= 1 << (i%8);
+				}
+				bf_checkpoint->save();
+			} else {
+				// the chunks of this unit remain unmarked and are brute forced locally afterwards
+				PrintAndLog("\nA worker couldn't process work unit %" PRIu32 ". It will be brute forced locally.", unit);
+				num_failed++;
+			}
+		}
+		if (!*key_found) {
+			sprintf(progress_text, "Distributed brute force: %6.02f%% (%" PRIu32 " of %" PRIu32 " work units)", 100.0*(float)states_done/(float)maximum_states, num_done, num_units);
+			hardnested_print_progress(num_acquired_nonces, progress_text, nonces[best_first_bytes[0]].expected_num_brute_force - (float)states_done/2, 5000);
+		}
+	}
 
-static void	free_candidates_memory(statelist_t *sl)
-{
-	if (sl == NULL) {
-		return;
-	} else {
-		free_candidates_memory(sl->next);
-		free(sl);
+	if (!write_error) {
+		cancel_work_units(job_id, num_units, unit_done);
+	}
+	free(chunks);
+	free(first_chunk);
+	free(unit_done);
+	free(lease_mtime);
+	free(lease_time);
+
+	if (write_error || aborted) {
+		distributed = false;
+		return false;
 	}
+	return *key_found || num_failed == 0;
 }
 
 
-static void pre_XOR_nonces(void)
+static void no_checkpoint_progress(void)
 {
-	// prepare acquired nonces for faster brute forcing. 
-	
-	// XOR the cryptoUID and its parity
-	for (uint16_t i = 0; i < 256; i++) {
-		noncelistentry_t *test_nonce = nonces[i].first;
-		while (test_nonce != NULL) {
-			test_nonce->nonce_enc ^= cuid;
-			test_nonce->par_enc ^= oddparity8(cuid >>  0 & 0xff) << 0;
-			test_nonce->par_enc ^= oddparity8(cuid >>  8 & 0xff) << 1;
-			test_nonce->par_enc ^= oddparity8(cuid >> 16 & 0xff) << 2;
-			test_nonce->par_enc ^= oddparity8(cuid >> 24 & 0xff) << 3;
-			test_nonce = test_nonce->next;
-		}
-	}
 }
-	
 
-static bool brute_force(void)
+
+static bool brute_force(uint64_t *found_key)
 {
 	if (known_target_key != -1) {
 		TestIfKeyExists(known_target_key);
 	}
-	return brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes);
+	// the work units done are tracked even without checkpoints. They may have been processed by workers already.
+	bf_checkpoint_t bf_checkpoint = {checkpoint_work_units_done, save_checkpoint_progress};
+	if (!checkpoint_enabled) {
+		bf_checkpoint.work_units_done = (uint8_t *)calloc(MAX((bf_num_work_units(candidates) + 7) / 8, 1), 1);
+		if (bf_checkpoint.work_units_done == NULL) {
+			printf("Out of memory error in brute_force(). Aborting...\n");
+			exit(4);
+		}
+		bf_checkpoint.save = no_checkpoint_progress;
+	}
+	bool key_found = false;
+	if (!distributed || !distributed_brute_force(found_key, &key_found, &bf_checkpoint)) {
+		key_found = brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes, found_key, &bf_checkpoint);
+	}
+	if (!checkpoint_enabled) {
+		free(bf_checkpoint.work_units_done);
+	}
+	return key_found;
 }
 
 
@@ -2503,9 +3608,136 @@ static void set_test_state(uint8_t byte)
 }
 
 
-int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests) 
+static bool brute_force_phase(bool resume_brute_force, uint64_t *found_key)
+{
+	// generate the key candidates from the acquired nonces and brute force them.
+	// Try the Sum(a8) guesses in order of their probability until the key is found.
+	char progress_text[80];
+	bool key_found = false;
+	num_keys_tested = 0;
+	uint32_t num_odd = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[ODD_STATE];
+	uint32_t num_even = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[EVEN_STATE];
+	float expected_brute_force1 = (float)num_odd * num_even / 2.0;
+	float expected_brute_force2 = nonces[best_first_bytes[0]].expected_num_brute_force;
+	bool ignore_sum_a8 = expected_brute_force1 < expected_brute_force2;
+	if (resume_brute_force) {
+		ignore_sum_a8 = (checkpoint.sum_a8_idx == CHECKPOINT_NO_SUM_A8);
+	}
+	if (ignore_sum_a8) {
+		hardnested_print_progress(num_acquired_nonces, "(Ignoring Sum(a8) properties)", expected_brute_force1, 0);
+		if (resume_brute_force) {
+			best_first_byte_smallest_bitarray = checkpoint.best_first_byte;
+		} else {
+			set_test_state(best_first_byte_smallest_bitarray);
+			add_bitflip_candidates(best_first_byte_smallest_bitarray);
+			Tests2();
+		}
+		maximum_states = 0;
+		for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+			maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+		}
+		// printf("Number of remaining possible keys: %" PRIu64 " (2^%1.1f)\n", maximum_states, log(maximum_states)/log(2.0));
+		best_first_bytes[0] = best_first_byte_smallest_bitarray;
+		pre_XOR_nonces();
+		prepare_bf_test_nonces(nonces, best_first_bytes[0]);
+		checkpoint_brute_force(CHECKPOINT_NO_SUM_A8);
+		hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force1, 0);
+		key_found = brute_force(found_key);
+		if (resume_brute_force) {
+			free_resumed_statelists();
+		} else {
+			free_packed_statelist(candidates->packed[ODD_STATE]);
+			free_packed_statelist(candidates->packed[EVEN_STATE]);
+		}
+		free_candidates_memory(candidates);
+		candidates = NULL;
+	} else {
+		if (resume_brute_force) {
+			// continue with the first byte of the interrupted brute force pass
+			for (uint16_t i = 1; i < 256; i++) {
+				if (best_first_bytes[i] == checkpoint.best_first_byte) {
+					best_first_bytes[i] = best_first_bytes[0];
+					best_first_bytes[0] = checkpoint.best_first_byte;
+					break;
+				}
+			}
+		}
+		pre_XOR_nonces();
+		prepare_bf_test_nonces(nonces, best_first_bytes[0]);
+		for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
+			uint8_t sum_a8_idx = nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx;
+			if (checkpoint_enabled && (checkpoint.sum_a8_tested & (1 << sum_a8_idx))) {
+				// already brute forced before the checkpoint was written
+				nonces[best_first_bytes[0]].sum_a8_guess[j].prob = 0;
+				nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
+				update_expected_brute_force(best_first_bytes[0]);
+				continue;
+			}
+			float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
+			sprintf(progress_text, "(%d. guess: Sum(a8) = %" PRIu16 ")", j+1, sums[sum_a8_idx]);
+			hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0); 
+			if (known_target_key != -1 && sums[sum_a8_idx] != real_sum_a8) {
+				sprintf(progress_text, "(Estimated Sum(a8) is WRONG! Correct Sum(a8) = %" PRIu16 ")", real_sum_a8);
+				hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
+			}
+			bool use_resumed_candidates = resume_brute_force && candidates != NULL && checkpoint.sum_a8_idx == sum_a8_idx;
+			if (use_resumed_candidates) {
+				maximum_states = 0;
+				for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+					maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+				}
+				nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = maximum_states;
+				update_expected_brute_force(best_first_bytes[0]);
+				expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
+			} else {
+				if (candidates != NULL) {		// restored candidates belong to another Sum(a8) guess
+					free_resumed_statelists();
+					free_candidates_memory(candidates);
+					candidates = NULL;
+				}
+				// printf("Estimated remaining states: %" PRIu64 " (2^%1.1f)\n", nonces[best_first_bytes[0]].sum_a8_guess[j].num_states, log(nonces[best_first_bytes[0]].sum_a8_guess[j].num_states)/log(2.0));
+				generate_candidates(first_byte_Sum, sum_a8_idx);
+				// printf("Time for generating key candidates list: %1.0f sec (%1.1f sec CPU)\n", difftime(time(NULL), start_time), (float)(msclock() - start_clock)/1000.0);
+			}
+			checkpoint_brute_force(sum_a8_idx);
+			hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force, 0);
+			key_found = brute_force(found_key);
+			if (use_resumed_candidates) {
+				free_resumed_statelists();
+			} else {
+				free_statelist_cache();
+			}
+			free_candidates_memory(candidates);
+			candidates = NULL;
+			if (!key_found) {
+				// update the statistics
+				nonces[best_first_bytes[0]].sum_a8_guess[j].prob = 0;
+				nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
+				// and calculate new expected number of brute forces
+				update_expected_brute_force(best_first_bytes[0]);
+				checkpoint_sum_a8_tested(sum_a8_idx);
+			}
+
+		}
+		if (candidates != NULL) {
+			free_resumed_statelists();
+			free_candidates_memory(candidates);
+			candidates = NULL;
+		}
+	}
+
+	return key_found;
+}
+
+
+int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, bool write_checkpoints, bool resume, char *work_dir) 
 {
 	char progress_text[80];
+	distributed = (work_dir != NULL);
+	if (distributed) {
+		strncpy(work_directory, work_dir, FILE_PATH_SIZE - 1);
+		work_directory[FILE_PATH_SIZE - 1] = '\0';
+	}
 	
 	char instr_set[12] = {0};
 	get_SIMD_instruction_set(instr_set);
@@ -2579,9 +3811,9 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 				pre_XOR_nonces();
 				prepare_bf_test_nonces(nonces, best_first_bytes[0]);
 				hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force1, 0);
-				key_found = brute_force();
-				free(candidates->states[ODD_STATE]);
-				free(candidates->states[EVEN_STATE]);
+				key_found = brute_force(NULL);
+				free_packed_statelist(candidates->packed[ODD_STATE]);
+				free_packed_statelist(candidates->packed[EVEN_STATE]);
 				free_candidates_memory(candidates);
 				candidates = NULL;
 			} else {
@@ -2599,7 +3831,7 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 					generate_candidates(first_byte_Sum, nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx);
 					// printf("Time for generating key candidates list: %1.0f sec (%1.1f sec CPU)\n", difftime(time(NULL), start_time), (float)(msclock() - start_clock)/1000.0);
 					hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force, 0);
-					key_found = brute_force();
+					key_found = brute_force(NULL);
 					free_statelist_cache();
 					free_candidates_memory(candidates);
 					candidates = NULL;
@@ -2637,8 +3869,46 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 		init_nonce_memory();
 		update_reduction_rate(0.0, true);
 
+		if (resume) {				// continue an interrupted attack from the checkpoint file
+			if (read_checkpoint() != 0) {
+				free_candidates_memory(candidates);
+				candidates = NULL;
+				free_checkpoint();
+				free_bitflip_bitarrays();
+				free_nonces_memory();
+				free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+				free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
+				free_sum_bitarrays();
+				free_part_sum_bitarrays();
+				return 3;
+			}
+			checkpoint_write = write_checkpoints;
+			blockNo = checkpoint.blockNo;
+			keyType = checkpoint.keyType;
+			key = checkpoint.key;
+			trgBlockNo = checkpoint.trgBlockNo;
+			trgKeyType = checkpoint.trgKeyType;
+			slow = checkpoint.slow;
+			hardnested_stage = CHECK_1ST_BYTES;
+			if (first_byte_num == 256) {
+				for (uint16_t i = 0; i < NUM_SUMS; i++) {
+					if (first_byte_Sum == sums[i]) {
+						first_byte_Sum = i;
+						break;
+					}
+				}
+				hardnested_stage |= CHECK_2ND_BYTES;
+				apply_sum_a0();
+			}
+			update_nonce_data(false);
+			float brute_force;
+			shrink_key_space(&brute_force);
+		} else if (write_checkpoints) {
+			init_checkpoint(blockNo, keyType, key, trgBlockNo, trgKeyType, slow);
+		}
+
 		if (nonce_file_read) {  	// use pre-acquired data from file nonces.bin
-			if (read_nonce_file() != 0) {
+			if (read_nonce_file("nonces.bin") != 0) {
 				free_bitflip_bitarrays();
 				free_nonces_memory();
 				free_bitarray(all_bitflips_bitarray[ODD_STATE]);
@@ -2651,9 +3921,12 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 			update_nonce_data(false);
 			float brute_force;
 			shrink_key_space(&brute_force);
-		} else {					// acquire nonces.
-			uint16_t is_OK = acquire_nonces(blockNo, keyType, key, trgBlockNo, trgKeyType, nonce_file_write, slow);
+		} else if (!resume || checkpoint.stage == CHECKPOINT_ACQUIRING) {		// acquire nonces.
+			nonce_acquisition_t *acq = init_acquisition(blockNo, keyType, key, trgBlockNo, trgKeyType, slow);
+			uint16_t is_OK = acquire_nonces(acq, nonce_file_write, resume);
+			free_acquisition(acq);
 			if (is_OK != 0) {
+				free_checkpoint();
 				free_bitflip_bitarrays();
 				free_nonces_memory();
 				free_bitarray(all_bitflips_bitarray[ODD_STATE]);
@@ -2664,6 +3937,9 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 			}
 		}
 
+		// candidates restored from the checkpoint are used if the interrupted brute force pass is repeated
+		bool resume_brute_force = resume && checkpoint.stage == CHECKPOINT_BRUTE_FORCING && candidates != NULL;
+
 		if (trgkey != NULL) {
 			known_target_key = bytes_to_num(trgkey, 6);
 			set_test_state(best_first_bytes[0]);
@@ -2674,67 +3950,339 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 		Tests();
 
 		free_bitflip_bitarrays();
-		bool key_found = false;
-		num_keys_tested = 0;
-		uint32_t num_odd = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[ODD_STATE];
-		uint32_t num_even = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[EVEN_STATE];
-		float expected_brute_force1 = (float)num_odd * num_even / 2.0;
-		float expected_brute_force2 = nonces[best_first_bytes[0]].expected_num_brute_force;
-		if (expected_brute_force1 < expected_brute_force2) {
-			hardnested_print_progress(num_acquired_nonces, "(Ignoring Sum(a8) properties)", expected_brute_force1, 0);
-			set_test_state(best_first_byte_smallest_bitarray);
-			add_bitflip_candidates(best_first_byte_smallest_bitarray);
-			Tests2();
-			maximum_states = 0;
-			for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
-				maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
-			}
-			// printf("Number of remaining possible keys: %" PRIu64 " (2^%1.1f)\n", maximum_states, log(maximum_states)/log(2.0));
-			best_first_bytes[0] = best_first_byte_smallest_bitarray;
-			pre_XOR_nonces();
-			prepare_bf_test_nonces(nonces, best_first_bytes[0]);
-			hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force1, 0);
-			key_found = brute_force();
-			free(candidates->states[ODD_STATE]);
-			free(candidates->states[EVEN_STATE]);
-			free_candidates_memory(candidates);
-			candidates = NULL;
+		bool key_found = brute_force_phase(resume_brute_force, NULL);
+
+		if (key_found && checkpoint_write) {
+			remove(CHECKPOINT_FILENAME);
+		}
+		free_checkpoint();
+		free_nonces_memory();
+		free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+		free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
+		free_sum_bitarrays();
+		free_part_sum_bitarrays();
+	}
+
+	return 0;
+}
+
+
+int mfnestedhard_batch(uint8_t blockNo, uint8_t keyType, uint8_t *key, hardnested_target_t *targets, uint16_t num_targets, bool slow)
+{
+	// attack several target keys of the same card. The tables and the brute force benchmark are
+	// loaded only once, and the nonces for the next target are acquired while the current one
+	// is brute forced.
+	char progress_text[80];
+	int is_OK = 0;
+	nonce_acquisition_t *acq = NULL;
+	distributed = false;						// the batch always brute forces locally
+
+	char instr_set[12] = {0};
+	get_SIMD_instruction_set(instr_set);
+	PrintAndLog("Using %s SIMD core.", instr_set);
+
+	brute_force_per_second = brute_force_benchmark();
+	write_stats = false;
+	known_target_key = -1;
+
+	start_time = msclock();
+	print_progress_header();
+	sprintf(progress_text, "Brute force benchmark: %1.0f million (2^%1.1f) keys/s", brute_force_per_second/1000000, log(brute_force_per_second)/log(2.0));
+	hardnested_print_progress(0, progress_text, (float)(1LL<<47), 0);
+	init_bitflip_bitarrays();
+	init_part_sum_bitarrays();
+	init_sum_bitarrays();
+	save_part_sum_bitarrays();
+
+	for (uint16_t t = 0; t < num_targets && is_OK == 0; t++) {
+		hardnested_target_t *target = &targets[t];
+		if (target->found) {
+			continue;
+		}
+
+		start_time = msclock();
+		PrintAndLog("\n--target %d of %d: block no:%3d, key type:%c", t+1, num_targets, target->blockNo, target->keyType?'B':'A');
+		print_progress_header();
+		restore_part_sum_bitarrays();
+		memset(part_sum_count, 0, sizeof(part_sum_count));
+		init_allbitflips_array();
+		init_nonce_memory();
+		update_reduction_rate(0.0, true);
+
+		if (acq != NULL && (acq->trgBlockNo != target->blockNo || acq->trgKeyType != target->keyType)) {
+			stop_acquisition_thread(acq);
+			free_acquisition(acq);
+			acq = NULL;
+		}
+		if (acq == NULL) {
+			acq = init_acquisition(blockNo, keyType, key, target->blockNo, target->keyType, slow);
 		} else {
-			pre_XOR_nonces();
-			prepare_bf_test_nonces(nonces, best_first_bytes[0]);
-			for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
-				float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
-				sprintf(progress_text, "(%d. guess: Sum(a8) = %" PRIu16 ")", j+1, sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx]);
-				hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0); 
-				if (trgkey != NULL && sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx] != real_sum_a8) {
-					sprintf(progress_text, "(Estimated Sum(a8) is WRONG! Correct Sum(a8) = %" PRIu16 ")", real_sum_a8);
-					hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
-				}
-				// printf("Estimated remaining states: %" PRIu64 " (2^%1.1f)\n", nonces[best_first_bytes[0]].sum_a8_guess[j].num_states, log(nonces[best_first_bytes[0]].sum_a8_guess[j].num_states)/log(2.0));
-				generate_candidates(first_byte_Sum, nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx);
-				// printf("Time for generating key candidates list: %1.0f sec (%1.1f sec CPU)\n", difftime(time(NULL), start_time), (float)(msclock() - start_clock)/1000.0);
-				hardnested_print_progress(num_acquired_nonces, "Starting brute force...", expected_brute_force, 0);
-				key_found = brute_force();
-				free_statelist_cache();
-				free_candidates_memory(candidates);
-				candidates = NULL;
-				if (!key_found) {
-					// update the statistics
-					nonces[best_first_bytes[0]].sum_a8_guess[j].prob = 0;
-					nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
-					// and calculate new expected number of brute forces
-					update_expected_brute_force(best_first_bytes[0]);
+			uint32_t num_prefetched = 0;
+			uint32_t num_batches = queued_batches(acq);
+			for (uint32_t i = acq->head; i != acq->head + num_batches; i++) {
+				num_prefetched += acq->queue[i % ACQUISITION_QUEUE_LEN].num_nonces;
+			}
+			sprintf(progress_text, "Using %" PRIu32 " nonces acquired during the previous brute force", num_prefetched);
+			hardnested_print_progress(0, progress_text, (float)(1LL<<47), 0);
+		}
+		is_OK = acquire_nonces(acq, false, false);
+		free_acquisition(acq);
+		acq = NULL;
+
+		if (is_OK == 0) {
+			// start acquiring the nonces for the next target
+			for (uint16_t next = t+1; next < num_targets; next++) {
+				if (!targets[next].found) {
+					acq = init_acquisition(blockNo, keyType, key, targets[next].blockNo, targets[next].keyType, slow);
+					start_acquisition_thread(acq);
+					break;
 				}
+			}
+			target->found = brute_force_phase(false, &target->key);
+			if (target->found && acq != NULL) {
+				stop_acquisition_thread(acq);		// the Proxmark is needed to check the found key
+			}
+		}
+
+		free_nonces_memory();
+		free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+		free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
 
+		if (target->found) {
+			// keys are often used for more than one sector. Check the found key for the remaining targets.
+			uint8_t keyBlock[6];
+			num_to_bytes(target->key, 6, keyBlock);
+			for (uint16_t other = t+1; other < num_targets; other++) {
+				uint64_t key64;
+				if (!targets[other].found && mfCheckKeys(targets[other].blockNo, targets[other].keyType, false, 1, keyBlock, &key64) == 0) {
+					targets[other].found = true;
+					targets[other].key = key64;
+					PrintAndLog("Found key is also valid for block no:%3d, key type:%c", targets[other].blockNo, targets[other].keyType?'B':'A');
+				}
 			}
 		}
-		
+	}
+
+	if (acq != NULL) {
+		stop_acquisition_thread(acq);
+		free_acquisition(acq);
+	}
+	free_saved_part_sum_bitarrays();
+	free_bitflip_bitarrays();
+	free_sum_bitarrays();
+	free_part_sum_bitarrays();
+
+	return is_OK;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// offline benchmark: replay recorded nonce files through all phases of the attack
+
+#define BENCHMARK_BF_STATES				(1LL<<28)	// number of keys brute forced per nonce file and instruction set
+
+
+static statelist_t *limit_candidates(statelist_t *sl, uint64_t max_states, uint64_t *num_states)
+{
+	// return a list with the first max_states keys of the candidates. The state lists are shared with the original list.
+	statelist_t *limited = NULL;
+	statelist_t **next = &limited;
+	*num_states = 0;
+	for ( ; sl != NULL && *num_states < max_states; sl = sl->next) {
+		if (sl->len[ODD_STATE] == 0 || sl->len[EVEN_STATE] == 0) {
+			continue;
+		}
+		statelist_t *p = (statelist_t *)malloc(sizeof(statelist_t));
+		if (p == NULL) {
+			printf("Out of memory error in limit_candidates(). Aborting...\n");
+			exit(4);
+		}
+		*p = *sl;
+		p->next = NULL;
+		uint64_t remaining = max_states - *num_states;
+		if ((uint64_t)p->len[ODD_STATE] * p->len[EVEN_STATE] > remaining) {
+			p->len[EVEN_STATE] = MAX(1, MIN(p->len[EVEN_STATE], remaining / p->len[ODD_STATE]));
+			p->len[ODD_STATE] = MIN(p->len[ODD_STATE], remaining / p->len[EVEN_STATE]);
+		}
+		*num_states += (uint64_t)p->len[ODD_STATE] * p->len[EVEN_STATE];
+		*next = p;
+		next = (statelist_t **)&p->next;
+	}
+	return limited;
+}
+
+
+static json_t *benchmark_nonce_file(char *filename)
+{
+	// run all phases of the attack on the nonces of one file. Return the timings or NULL if the file can't be read.
+	uint64_t time1 = msclock();
+	init_bitflip_bitarrays();
+	init_part_sum_bitarrays();
+	init_sum_bitarrays();
+	uint64_t table_load_time = msclock() - time1;
+
+	time1 = msclock();
+	init_allbitflips_array();
+	init_nonce_memory();
+	update_reduction_rate(0.0, true);
+	if (read_nonce_file(filename) != 0) {
+		free_bitflip_bitarrays();
 		free_nonces_memory();
 		free_bitarray(all_bitflips_bitarray[ODD_STATE]);
 		free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
 		free_sum_bitarrays();
 		free_part_sum_bitarrays();
+		return NULL;
+	}
+	hardnested_stage = CHECK_1ST_BYTES | CHECK_2ND_BYTES;
+	update_nonce_data(false);
+	float brute_force;
+	shrink_key_space(&brute_force);
+	free_bitflip_bitarrays();
+	uint64_t filter_time = msclock() - time1;
+
+	// generate the candidates for the most probable Sum(a8) only
+	time1 = msclock();
+	uint32_t num_odd = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[ODD_STATE];
+	uint32_t num_even = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[EVEN_STATE];
+	bool ignore_sum_a8 = (float)num_odd * num_even / 2.0 < nonces[best_first_bytes[0]].expected_num_brute_force;
+	if (ignore_sum_a8) {
+		add_bitflip_candidates(best_first_byte_smallest_bitarray);
+		best_first_bytes[0] = best_first_byte_smallest_bitarray;
+	} else {
+		generate_candidates(first_byte_Sum, nonces[best_first_bytes[0]].sum_a8_guess[0].sum_a8_idx);
+	}
+	uint64_t candidate_states = 0;
+	for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+		candidate_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+	}
+	uint64_t candidates_time = msclock() - time1;
+	uint64_t candidate_bytes = 0;
+	if (ignore_sum_a8) {
+		for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+			candidate_bytes += packed_statelist_size(candidates->packed[odd_even]);
+		}
+	} else {
+		for (uint16_t i = 0; i < NUM_PART_SUMS; i++) {
+			for (uint16_t j = 0; j < NUM_PART_SUMS; j++) {
+				for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+					if (sl_cache[i][j][odd_even].sl != NULL) {
+						candidate_bytes += packed_statelist_size(sl_cache[i][j][odd_even].sl);
+					}
+				}
+			}
+		}
 	}
 
-	return 0;
+	// brute force a limited number of the candidates
+	time1 = msclock();
+	pre_XOR_nonces();
+	prepare_bf_test_nonces(nonces, best_first_bytes[0]);
+	uint64_t bf_states;
+	statelist_t *bf_candidates = limit_candidates(candidates, BENCHMARK_BF_STATES, &bf_states);
+	float bf_rate = 0.0;
+	uint64_t found_key = 0;
+	bool key_found = brute_force_bs(&bf_rate, bf_candidates, cuid, num_acquired_nonces, bf_states, nonces, best_first_bytes, &found_key, NULL);
+	uint64_t bf_time = msclock() - time1;
+	free_candidates_memory(bf_candidates);
+
+	if (ignore_sum_a8) {
+		free_packed_statelist(candidates->packed[ODD_STATE]);
+		free_packed_statelist(candidates->packed[EVEN_STATE]);
+	} else {
+		free_statelist_cache();
+	}
+	free_candidates_memory(candidates);
+	candidates = NULL;
+
+	json_t *result = json_object();
+	json_object_set_new(result, "file", json_string(filename));
+	json_object_set_new(result, "cuid", json_integer(cuid));
+	json_object_set_new(result, "nonces", json_integer(num_acquired_nonces));
+	json_object_set_new(result, "table_load_ms", json_integer(table_load_time));
+	json_object_set_new(result, "bitflip_filter_ms", json_integer(filter_time));
+	json_object_set_new(result, "sum_a8_ignored", json_boolean(ignore_sum_a8));
+	json_object_set_new(result, "candidates_ms", json_integer(candidates_time));
+	json_object_set_new(result, "candidate_states", json_integer(candidate_states));
+	json_object_set_new(result, "candidate_bytes", json_integer(candidate_bytes));
+	json_object_set_new(result, "brute_force_ms", json_integer(bf_time));
+	json_object_set_new(result, "brute_force_states", json_integer(bf_states));
+	json_object_set_new(result, "brute_force_states_per_sec", json_real(bf_rate));
+	if (key_found) {
+		char key_string[13];
+		sprintf(key_string, "%012" PRIx64, found_key);
+		json_object_set_new(result, "key", json_string(key_string));
+	} else {
+		json_object_set_new(result, "key", json_null());
+	}
+
+	PrintAndLog("Tables: %" PRIu64 "ms, bitflip filter: %" PRIu64 "ms, candidates: %" PRIu64 "ms (2^%1.1f states), brute force: %" PRIu64 "ms (%1.0f million keys/s)",
+		table_load_time, filter_time, candidates_time, log(candidate_states)/log(2.0), bf_time, bf_rate/1000000);
+
+	free_nonces_memory();
+	free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+	free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
+	free_sum_bitarrays();
+	free_part_sum_bitarrays();
+
+	return result;
+}
+
+
+int mfnestedhard_benchmark(char **nonce_files, uint16_t num_files, bool all_instruction_sets, char *json_filename)
+{
+	// all instruction sets supported by this CPU, the best first. Otherwise only the selected one.
+	SIMDExecInstr first_instr = all_instruction_sets ? GetSIMDInstr() : GetSIMDInstrAuto();
+	SIMDExecInstr last_instr = all_instruction_sets ? SIMD_NONE : first_instr;
+	int is_OK = 0;
+
+	write_stats = false;
+	known_target_key = -1;
+
+	json_t *root = json_object();
+	json_object_set_new(root, "cpus", json_integer(num_CPUs()));
+	json_object_set_new(root, "brute_force_limit", json_integer(BENCHMARK_BF_STATES));
+	json_t *runs = json_array();
+	json_object_set_new(root, "runs", runs);
+
+	for (SIMDExecInstr instr = first_instr; instr <= last_instr && is_OK == 0; instr++) {
+		if (instr != SIMD_NONE && (instr <= SIMD_MMX) != (first_instr <= SIMD_MMX)) {
+			continue;	// no x86 cores on ARM and vice versa
+		}
+		SetSIMDInstr(instr);
+		char instr_set[12] = {0};
+		get_SIMD_instruction_set(instr_set);
+		brute_force_per_second = brute_force_benchmark();
+		json_t *run = json_object();
+		json_object_set_new(run, "simd", json_string(instr_set));
+		json_object_set_new(run, "bf_benchmark_states_per_sec", json_real(brute_force_per_second));
+		json_t *results = json_array();
+		json_object_set_new(run, "files", results);
+		json_array_append_new(runs, run);
+
+		for (uint16_t i = 0; i < num_files; i++) {
+			PrintAndLog("\n--benchmark: %s SIMD core, file %s", instr_set, nonce_files[i]);
+			start_time = msclock();
+			print_progress_header();
+			json_t *result = benchmark_nonce_file(nonce_files[i]);
+			if (result == NULL) {
+				is_OK = 3;
+				break;
+			}
+			json_array_append_new(results, result);
+		}
+	}
+	SetSIMDInstr(SIMD_AUTO);
+
+	if (is_OK == 0) {
+		if (json_dump_file(root, json_filename, JSON_INDENT(2)) != 0) {
+			PrintAndLog("Could not write file %s", json_filename);
+			is_OK = 3;
+		} else {
+			PrintAndLog("\nBenchmark results written to %s", json_filename);
+		}
+	}
+	json_decref(root);
+
+	return is_OK;
 }
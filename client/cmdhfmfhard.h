@@ -41,7 +41,16 @@ typedef struct noncelist {
 	noncelistentry_t *first;
 } noncelist_t;
 
-int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests);
+typedef struct hardnested_target {
+	uint8_t blockNo;
+	uint8_t keyType;
+	bool found;
+	uint64_t key;
+} hardnested_target_t;
+
+int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, bool write_checkpoints, bool resume, char *work_dir);
+int mfnestedhard_batch(uint8_t blockNo, uint8_t keyType, uint8_t *key, hardnested_target_t *targets, uint16_t num_targets, bool slow);
+int mfnestedhard_benchmark(char **nonce_files, uint16_t num_files, bool all_instruction_sets, char *json_filename);
 void hardnested_print_progress(uint32_t nonces, char *activity, float brute_force, uint64_t min_diff_print_time);
 
 #endif
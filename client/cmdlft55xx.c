@@ -25,6 +25,7 @@
 #include "lfdemod.h"
 #include "cmdhf14a.h" //for getTagInfo
 #include "protocols.h"
+#include "keydict.h"
 
 #define T55x7_CONFIGURATION_BLOCK 0x00
 #define T55x7_PAGE0 0x00
@@ -1394,9 +1395,8 @@ int CmdT55xxWipe(const char *Cmd) {
 int CmdT55xxBruteForce(const char *Cmd) {
 
 	// load a default pwd file.
-	char buf[9];
 	char filename[FILE_PATH_SIZE]={0};
-	int keycnt = 0;
+	uint32_t keycnt = 0;
 	int ch;
 	uint8_t stKeyBlock = 20;
 	uint8_t *keyBlock = NULL, *p = NULL;
@@ -1416,62 +1416,41 @@ int CmdT55xxBruteForce(const char *Cmd) {
 		if (len > FILE_PATH_SIZE) len = FILE_PATH_SIZE;
 		memcpy(filename, Cmd+2, len);
 
-		FILE * f = fopen( filename , "r");
-
-		if ( !f ) {
+		keydict_t dict;
+		if (!keydict_load(filename, 4, &dict)) {
 			PrintAndLog("File: %s: not found or locked.", filename);
 			free(keyBlock);
 			return 1;
 		}
 
-		while( fgets(buf, sizeof(buf), f) ) {
-			if (strlen(buf) < 8 || buf[7] == '\n') continue;
-
-			while (fgetc(f) != '\n' && !feof(f)) ;  //goto next line
-
-			//The line start with # is comment, skip
-			if( buf[0]=='#' ) continue;
-
-			if (!isxdigit((unsigned char)buf[0])) {
-				PrintAndLog("File content error. '%s' must include 8 HEX symbols", buf);
-				continue;
-			}
-			
-			buf[8] = 0;
-
-			if ( stKeyBlock - keycnt < 2) {
-				p = realloc(keyBlock, 6*(stKeyBlock+=10));
-				if (!p) {
-					PrintAndLog("Cannot allocate memory for defaultKeys");
-					free(keyBlock);
-					fclose(f);
-					return 2;
-				}
-				keyBlock = p;
-			}
-			memset(keyBlock + 4 * keycnt, 0, 4);
-			num_to_bytes(strtoll(buf, NULL, 16), 4, keyBlock + 4*keycnt);
-			PrintAndLog("chk custom pwd[%2d] %08X", keycnt, bytes_to_num(keyBlock + 4*keycnt, 4));
-			keycnt++;
-			memset(buf, 0, sizeof(buf));
-		}
-		fclose(f);
-		
-		if (keycnt == 0) {
+		if (dict.count == 0) {
 			PrintAndLog("No keys found in file");
+			keydict_close(&dict);
 			free(keyBlock);
 			return 1;
 		}
-		PrintAndLog("Loaded %d keys", keycnt);
+
+		keycnt = dict.count;
+		p = realloc(keyBlock, 4 * keycnt);
+		if (!p) {
+			PrintAndLog("Cannot allocate memory for defaultKeys");
+			keydict_close(&dict);
+			free(keyBlock);
+			return 2;
+		}
+		keyBlock = p;
+		keydict_get_keys(&dict, keyBlock);
+		PrintAndLog("Loaded %" PRIu32 " keys", keycnt);
 		
 		// loop
 		uint64_t testpwd = 0x00;
-		for (uint16_t c = 0; c < keycnt; ++c ) {
+		for (uint32_t c = 0; c < keycnt; ++c ) {
 
 			if (ukbhit()) {
 				ch = getchar();
 				(void)ch;
 				printf("\naborted via keyboard!\n");
+				keydict_close(&dict);
 				free(keyBlock);
 				return 0;
 			}
@@ -1482,6 +1461,7 @@ int CmdT55xxBruteForce(const char *Cmd) {
 
 			if ( !AquireData(T55x7_PAGE0, T55x7_CONFIGURATION_BLOCK, true, testpwd)) {
 				PrintAndLog("Aquireing data from device failed. Quitting");
+				keydict_close(&dict);
 				free(keyBlock);
 				return 0;
 			}
@@ -1490,11 +1470,14 @@ int CmdT55xxBruteForce(const char *Cmd) {
 
 			if ( found ) {
 				PrintAndLog("Found valid password: [%08X]", testpwd);
+				keydict_add_hit(&dict, testpwd);
+				keydict_close(&dict);
 				free(keyBlock);
 				return 0;
 			}
 		}
 		PrintAndLog("Password NOT found.");
+		keydict_close(&dict);
 		free(keyBlock);
 		return 0;
 	}
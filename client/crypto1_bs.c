@@ -0,0 +1,137 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Bitsliced Crypto1. Tests many keys against a sniffed authentication at once.
+//
+// Each LFSR bit is held in a vector with one bit per key (lane). The LFSR is
+// not shifted. Instead new bits are appended to an array of bit vectors, i.e.
+// the state after t steps is x[t] (oldest) ... x[t+47] (newest).
+//-----------------------------------------------------------------------------
+
+#include "crypto1_bs.h"
+
+#include <string.h>
+#include "crapto1/crapto1.h"
+
+#define AUTH_STEPS						128			// {nt}, {nr}, {ar} and {at}
+#define PRNG_STEPS						96			// nt to at
+
+typedef uint64_t bitslice_t __attribute__((vector_size(CRYPTO1_BS_LANES/8)));
+
+// the filter functions in the representation of the hardnested bitsliced brute forcer
+#define f20a(a,b,c,d) (((a|b)^(a&d))^(c&((a^b)|d)))
+#define f20b(a,b,c,d) (((a&b)|c)^((a^b)&(c|d)))
+#define f20c(a,b,c,d,e) ((a|((b|e)&(d^e)))^((a^(b&d))&((c^d)|(b&e))))
+
+
+static inline bitslice_t bs_filter(const bitslice_t *x)
+{
+	return f20c(f20a(x[9], x[11], x[13], x[15]),
+	            f20b(x[17], x[19], x[21], x[23]),
+	            f20b(x[25], x[27], x[29], x[31]),
+	            f20a(x[33], x[35], x[37], x[39]),
+	            f20b(x[41], x[43], x[45], x[47]));
+}
+
+
+static inline bitslice_t bs_feedback(const bitslice_t *x)
+{
+	// LF_POLY_ODD and LF_POLY_EVEN
+	return x[0] ^ x[5] ^ x[9] ^ x[10] ^ x[12] ^ x[14] ^ x[15] ^ x[17] ^ x[19]
+		^ x[24] ^ x[25] ^ x[27] ^ x[29] ^ x[35] ^ x[39] ^ x[41] ^ x[42] ^ x[43];
+}
+
+
+static inline bitslice_t bs_const(uint32_t bit)
+{
+	bitslice_t v;
+	memset(&v, bit ? 0xff : 0x00, sizeof(v));
+	return v;
+}
+
+
+static inline bool bs_all_set(bitslice_t v)
+{
+	for (uint32_t i = 0; i < CRYPTO1_BS_LANES/64; i++) {
+		if (~v[i]) return false;
+	}
+	return true;
+}
+
+
+static void bs_load_keys(bitslice_t *x, const uint64_t *keys, uint32_t num_lanes)
+{
+	// same bit order as crypto1_create()
+	memset(x, 0, 48 * sizeof(bitslice_t));
+	for (uint32_t lane = 0; lane < num_lanes; lane++) {
+		for (uint32_t j = 0; j < 48; j++) {
+			x[j][lane/64] |= (uint64_t)BIT(keys[lane], (47 - j) ^ 7) << (lane % 64);
+		}
+	}
+}
+
+
+uint32_t crypto1_bs_test_auth(const uint64_t *keys, uint32_t num_keys, uint32_t uid, uint32_t nt, bool nt_encrypted, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc, uint64_t *candidates)
+{
+	uint32_t num_candidates = 0;
+	uint32_t ar = prng_successor(nt, 64);
+	uint32_t at = prng_successor(nt, 96);
+
+	for (uint32_t base = 0; base < num_keys; base += CRYPTO1_BS_LANES) {
+		uint32_t num_lanes = num_keys - base < CRYPTO1_BS_LANES ? num_keys - base : CRYPTO1_BS_LANES;
+		bitslice_t x[48 + AUTH_STEPS];
+		bitslice_t prng[32 + PRNG_STEPS];		// nested only. prng[n] ... prng[n+31] is the byte swapped nonce after n steps
+		bs_load_keys(x, keys + base, num_lanes);
+
+		// unused lanes count as mismatches from the start
+		bitslice_t mismatch = bs_const(0);
+		for (uint32_t lane = num_lanes; lane < CRYPTO1_BS_LANES; lane++) {
+			mismatch[lane/64] |= 1ULL << (lane % 64);
+		}
+
+		// nt. In a nested authentication the keystream decrypts the tag nonce and is fed back.
+		for (uint32_t t = 0; t < 32; t++) {
+			bitslice_t in = bs_const(BEBIT(uid ^ nt, t));
+			if (nt_encrypted) {
+				bitslice_t ks = bs_filter(&x[t]);
+				x[t+48] = bs_feedback(&x[t]) ^ in ^ ks;
+				prng[t] = ks ^ bs_const(BEBIT(nt, t));		// the decrypted nonce
+			} else {
+				x[t+48] = bs_feedback(&x[t]) ^ in;
+			}
+		}
+		if (nt_encrypted) {
+			for (uint32_t n = 0; n < PRNG_STEPS; n++) {
+				prng[n+32] = prng[n+16] ^ prng[n+18] ^ prng[n+19] ^ prng[n+21];
+			}
+		}
+
+		// {nr}
+		for (uint32_t t = 32; t < 64; t++) {
+			x[t+48] = bs_feedback(&x[t]) ^ bs_const(BEBIT(nr_enc, t - 32)) ^ bs_filter(&x[t]);
+		}
+
+		// {ar} and {at}. Stop as soon as all keys are eliminated.
+		for (uint32_t t = 64; t < AUTH_STEPS && !bs_all_set(mismatch); t++) {
+			uint32_t i = t & 0x1f;
+			bitslice_t expected;
+			if (nt_encrypted) {
+				expected = prng[t];
+			} else {
+				expected = bs_const(BEBIT(t < 96 ? ar : at, i));
+			}
+			mismatch |= bs_filter(&x[t]) ^ bs_const(BEBIT(t < 96 ? ar_enc : at_enc, i)) ^ expected;
+			x[t+48] = bs_feedback(&x[t]);
+		}
+
+		for (uint32_t lane = 0; lane < num_lanes; lane++) {
+			if (!(mismatch[lane/64] >> (lane % 64) & 1)) {
+				candidates[num_candidates++] = keys[base + lane];
+			}
+		}
+	}
+
+	return num_candidates;
+}
@@ -0,0 +1,22 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Bitsliced Crypto1. Tests many keys against a sniffed authentication at once.
+//-----------------------------------------------------------------------------
+
+#ifndef CRYPTO1_BS_H__
+#define CRYPTO1_BS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CRYPTO1_BS_LANES				128			// keys processed in parallel
+
+// Test keys against a MIFARE Classic authentication. If nt_encrypted is set, nt is the encrypted
+// tag nonce of a nested authentication. Keys which reproduce {ar} and {at} are copied to candidates
+// (which must have room for num_keys keys). Returns the number of candidates.
+extern uint32_t crypto1_bs_test_auth(const uint64_t *keys, uint32_t num_keys, uint32_t uid, uint32_t nt, bool nt_encrypted, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc, uint64_t *candidates);
+
+#endif
@@ -59,13 +59,23 @@ THE SOFTWARE.
 #include <string.h>
 #include "crapto1/crapto1.h"
 #include "parity.h"
+#include "hardnested_bitarray_core.h"		// reset_bitarray_dispatch()
+#if defined (__aarch64__) && defined (__linux__)
+#include <sys/auxv.h>
+#include <sys/prctl.h>
+#endif
 
 // bitslice type
 // while AVX supports 256 bit vector floating point operations, we need integer operations for boolean logic
 // same for AVX2 and 512 bit vectors
 // using larger vectors works but seems to generate more register pressure
+// on aarch64 the SVE version is compiled for a fixed vector length of 256 bits (-msve-vector-bits=256)
 #if defined(__AVX512F__)
 #define MAX_BITSLICES 512
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_SVE)
+#define MAX_BITSLICES 256
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define MAX_BITSLICES 128
 #elif defined(__AVX2__)
 #define MAX_BITSLICES 256
 #elif defined(__AVX__)
@@ -107,6 +117,12 @@ typedef union {
 #if defined (__AVX512F__)
 #define BITSLICE_TEST_NONCES bitslice_test_nonces_AVX512
 #define CRACK_STATES_BITSLICED crack_states_bitsliced_AVX512
+#elif defined (__aarch64__) && defined (__ARM_FEATURE_SVE)
+#define BITSLICE_TEST_NONCES bitslice_test_nonces_SVE
+#define CRACK_STATES_BITSLICED crack_states_bitsliced_SVE
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+#define BITSLICE_TEST_NONCES bitslice_test_nonces_NEON
+#define CRACK_STATES_BITSLICED crack_states_bitsliced_NEON
 #elif defined (__AVX2__)
 #define BITSLICE_TEST_NONCES bitslice_test_nonces_AVX2
 #define CRACK_STATES_BITSLICED crack_states_bitsliced_AVX2
@@ -131,6 +147,8 @@ crack_states_bitsliced_t crack_states_bitsliced_AVX2;
 crack_states_bitsliced_t crack_states_bitsliced_AVX;
 crack_states_bitsliced_t crack_states_bitsliced_SSE2;
 crack_states_bitsliced_t crack_states_bitsliced_MMX;
+crack_states_bitsliced_t crack_states_bitsliced_SVE;
+crack_states_bitsliced_t crack_states_bitsliced_NEON;
 crack_states_bitsliced_t crack_states_bitsliced_NOSIMD;
 crack_states_bitsliced_t crack_states_bitsliced_dispatch;
 
@@ -140,6 +158,8 @@ bitslice_test_nonces_t bitslice_test_nonces_AVX2;
 bitslice_test_nonces_t bitslice_test_nonces_AVX;
 bitslice_test_nonces_t bitslice_test_nonces_SSE2;
 bitslice_test_nonces_t bitslice_test_nonces_MMX;
+bitslice_test_nonces_t bitslice_test_nonces_SVE;
+bitslice_test_nonces_t bitslice_test_nonces_NEON;
 bitslice_test_nonces_t bitslice_test_nonces_NOSIMD;
 bitslice_test_nonces_t bitslice_test_nonces_dispatch;
 
@@ -436,6 +456,12 @@ const uint64_t CRACK_STATES_BITSLICED(uint32_t cuid, uint8_t *best_first_bytes,
 #if MAX_BITSLICES > 128
                            && results.bytes64[2] == 0
                            && results.bytes64[3] == 0
+#endif
+#if MAX_BITSLICES > 256
+                           && results.bytes64[4] == 0
+                           && results.bytes64[5] == 0
+                           && results.bytes64[6] == 0
+                           && results.bytes64[7] == 0
 #endif
                           ) {
 #if defined (DEBUG_BRUTE_FORCE)						  
@@ -542,7 +568,7 @@ out:
 
 
 
-#ifndef __MMX__
+#if !defined (__MMX__) && !(defined (__aarch64__) && defined (__ARM_NEON))
 
 // pointers to functions:
 crack_states_bitsliced_t *crack_states_bitsliced_function_p = &crack_states_bitsliced_dispatch;
@@ -555,7 +581,21 @@ void SetSIMDInstr(SIMDExecInstr instr) {
 	
 	crack_states_bitsliced_function_p = &crack_states_bitsliced_dispatch;
 	bitslice_test_nonces_function_p = &bitslice_test_nonces_dispatch;
+	reset_bitarray_dispatch();
+}
+
+#if defined (__aarch64__) && defined (HARDNESTED_SVE)
+// the SVE core is compiled for a fixed vector length of 256 bits. Use it only if the CPU provides exactly this length.
+static bool sve256_supported(void) {
+#if defined (__linux__) && defined (HWCAP_SVE) && defined (PR_SVE_GET_VL)
+	if (!(getauxval(AT_HWCAP) & HWCAP_SVE)) return false;
+	int vl = prctl(PR_SVE_GET_VL);
+	return vl >= 0 && (vl & PR_SVE_VL_LEN_MASK) == 256/8;
+#else
+	return false;
+#endif
 }
+#endif
 
 SIMDExecInstr GetSIMDInstr() {
 	SIMDExecInstr instr = SIMD_NONE;
@@ -573,8 +613,14 @@ SIMDExecInstr GetSIMDInstr() {
 		else if (__builtin_cpu_supports("mmx")) instr = SIMD_MMX;
 		else
 	#endif
-#endif
 		instr = SIMD_NONE;
+#elif defined (__aarch64__)
+	#if defined (HARDNESTED_SVE)
+	if (sve256_supported()) instr = SIMD_SVE;
+	else
+	#endif
+	instr = SIMD_NEON;		// Advanced SIMD is mandatory on ARMv8-A
+#endif
 		
 	return instr;
 }
@@ -610,6 +656,16 @@ const uint64_t crack_states_bitsliced_dispatch(uint32_t cuid, uint8_t *best_firs
 			crack_states_bitsliced_function_p = &crack_states_bitsliced_MMX;
 			break;
 #endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			crack_states_bitsliced_function_p = &crack_states_bitsliced_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			crack_states_bitsliced_function_p = &crack_states_bitsliced_NEON;
+			break;
 #endif
 		default:
 			crack_states_bitsliced_function_p = &crack_states_bitsliced_NOSIMD;
@@ -642,6 +698,16 @@ void bitslice_test_nonces_dispatch(uint32_t nonces_to_bruteforce, uint32_t *bf_t
 			bitslice_test_nonces_function_p = &bitslice_test_nonces_MMX;
 			break;
 #endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitslice_test_nonces_function_p = &bitslice_test_nonces_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitslice_test_nonces_function_p = &bitslice_test_nonces_NEON;
+			break;
 #endif
 		default:
 			bitslice_test_nonces_function_p = &bitslice_test_nonces_NOSIMD;
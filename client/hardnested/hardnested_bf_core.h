@@ -59,9 +59,12 @@ typedef enum {
 	SIMD_AVX,
 	SIMD_SSE2,
 	SIMD_MMX,
+	SIMD_SVE,
+	SIMD_NEON,
 	SIMD_NONE,
 } SIMDExecInstr;
 extern void SetSIMDInstr(SIMDExecInstr instr);
+extern SIMDExecInstr GetSIMDInstr();
 extern SIMDExecInstr GetSIMDInstrAuto();
 
 extern const uint64_t crack_states_bitsliced(uint32_t cuid, uint8_t *best_first_bytes, statelist_t *p, uint32_t *keys_found, uint64_t *num_keys_tested, uint32_t nonces_to_bruteforce, uint8_t *bf_test_nonces_2nd_byte, noncelist_t *nonces);
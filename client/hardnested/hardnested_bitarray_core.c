@@ -17,6 +17,7 @@
 //
 
 #include "hardnested_bitarray_core.h"
+#include "hardnested_bf_core.h"			// GetSIMDInstr()
 
 #include <stdint.h>
 #include <stdio.h>
@@ -41,6 +42,34 @@
 #define COUNT_BITARRAY_AND2 count_bitarray_AND2_AVX512
 #define COUNT_BITARRAY_AND3 count_bitarray_AND3_AVX512
 #define COUNT_BITARRAY_AND4 count_bitarray_AND4_AVX512
+#elif defined (__aarch64__) && defined (__ARM_FEATURE_SVE)
+#define MALLOC_BITARRAY malloc_bitarray_SVE
+#define FREE_BITARRAY free_bitarray_SVE
+#define BITCOUNT bitcount_SVE
+#define COUNT_STATES count_states_SVE
+#define BITARRAY_AND bitarray_AND_SVE
+#define BITARRAY_LOW20_AND bitarray_low20_AND_SVE
+#define COUNT_BITARRAY_AND count_bitarray_AND_SVE
+#define COUNT_BITARRAY_LOW20_AND count_bitarray_low20_AND_SVE
+#define BITARRAY_AND4 bitarray_AND4_SVE
+#define BITARRAY_OR bitarray_OR_SVE
+#define COUNT_BITARRAY_AND2 count_bitarray_AND2_SVE
+#define COUNT_BITARRAY_AND3 count_bitarray_AND3_SVE
+#define COUNT_BITARRAY_AND4 count_bitarray_AND4_SVE
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+#define MALLOC_BITARRAY malloc_bitarray_NEON
+#define FREE_BITARRAY free_bitarray_NEON
+#define BITCOUNT bitcount_NEON
+#define COUNT_STATES count_states_NEON
+#define BITARRAY_AND bitarray_AND_NEON
+#define BITARRAY_LOW20_AND bitarray_low20_AND_NEON
+#define COUNT_BITARRAY_AND count_bitarray_AND_NEON
+#define COUNT_BITARRAY_LOW20_AND count_bitarray_low20_AND_NEON
+#define BITARRAY_AND4 bitarray_AND4_NEON
+#define BITARRAY_OR bitarray_OR_NEON
+#define COUNT_BITARRAY_AND2 count_bitarray_AND2_NEON
+#define COUNT_BITARRAY_AND3 count_bitarray_AND3_NEON
+#define COUNT_BITARRAY_AND4 count_bitarray_AND4_NEON
 #elif defined (__AVX2__)
 #define MALLOC_BITARRAY malloc_bitarray_AVX2
 #define FREE_BITARRAY free_bitarray_AVX2
@@ -116,31 +145,31 @@
 
 // typedefs and declaration of functions:
 typedef uint32_t* malloc_bitarray_t(uint32_t);
-malloc_bitarray_t malloc_bitarray_AVX512, malloc_bitarray_AVX2, malloc_bitarray_AVX, malloc_bitarray_SSE2, malloc_bitarray_MMX, malloc_bitarray_NOSIMD, malloc_bitarray_dispatch;
+malloc_bitarray_t malloc_bitarray_AVX512, malloc_bitarray_AVX2, malloc_bitarray_AVX, malloc_bitarray_SSE2, malloc_bitarray_MMX, malloc_bitarray_SVE, malloc_bitarray_NEON, malloc_bitarray_NOSIMD, malloc_bitarray_dispatch;
 typedef void free_bitarray_t(uint32_t*);
-free_bitarray_t free_bitarray_AVX512, free_bitarray_AVX2, free_bitarray_AVX, free_bitarray_SSE2, free_bitarray_MMX, free_bitarray_NOSIMD, free_bitarray_dispatch;
+free_bitarray_t free_bitarray_AVX512, free_bitarray_AVX2, free_bitarray_AVX, free_bitarray_SSE2, free_bitarray_MMX, free_bitarray_SVE, free_bitarray_NEON, free_bitarray_NOSIMD, free_bitarray_dispatch;
 typedef uint32_t bitcount_t(uint32_t);
-bitcount_t bitcount_AVX512, bitcount_AVX2, bitcount_AVX, bitcount_SSE2, bitcount_MMX, bitcount_NOSIMD, bitcount_dispatch;
+bitcount_t bitcount_AVX512, bitcount_AVX2, bitcount_AVX, bitcount_SSE2, bitcount_MMX, bitcount_SVE, bitcount_NEON, bitcount_NOSIMD, bitcount_dispatch;
 typedef uint32_t count_states_t(uint32_t*);
-count_states_t count_states_AVX512, count_states_AVX2, count_states_AVX, count_states_SSE2, count_states_MMX, count_states_NOSIMD, count_states_dispatch;
+count_states_t count_states_AVX512, count_states_AVX2, count_states_AVX, count_states_SSE2, count_states_MMX, count_states_SVE, count_states_NEON, count_states_NOSIMD, count_states_dispatch;
 typedef void bitarray_AND_t(uint32_t[], uint32_t[]);
-bitarray_AND_t bitarray_AND_AVX512, bitarray_AND_AVX2, bitarray_AND_AVX, bitarray_AND_SSE2, bitarray_AND_MMX, bitarray_AND_NOSIMD, bitarray_AND_dispatch;
+bitarray_AND_t bitarray_AND_AVX512, bitarray_AND_AVX2, bitarray_AND_AVX, bitarray_AND_SSE2, bitarray_AND_MMX, bitarray_AND_SVE, bitarray_AND_NEON, bitarray_AND_NOSIMD, bitarray_AND_dispatch;
 typedef void bitarray_low20_AND_t(uint32_t*, uint32_t*);
-bitarray_low20_AND_t bitarray_low20_AND_AVX512, bitarray_low20_AND_AVX2, bitarray_low20_AND_AVX, bitarray_low20_AND_SSE2, bitarray_low20_AND_MMX, bitarray_low20_AND_NOSIMD, bitarray_low20_AND_dispatch;
+bitarray_low20_AND_t bitarray_low20_AND_AVX512, bitarray_low20_AND_AVX2, bitarray_low20_AND_AVX, bitarray_low20_AND_SSE2, bitarray_low20_AND_MMX, bitarray_low20_AND_SVE, bitarray_low20_AND_NEON, bitarray_low20_AND_NOSIMD, bitarray_low20_AND_dispatch;
 typedef uint32_t count_bitarray_AND_t(uint32_t*, uint32_t*);
-count_bitarray_AND_t count_bitarray_AND_AVX512, count_bitarray_AND_AVX2, count_bitarray_AND_AVX, count_bitarray_AND_SSE2, count_bitarray_AND_MMX, count_bitarray_AND_NOSIMD, count_bitarray_AND_dispatch;
+count_bitarray_AND_t count_bitarray_AND_AVX512, count_bitarray_AND_AVX2, count_bitarray_AND_AVX, count_bitarray_AND_SSE2, count_bitarray_AND_MMX, count_bitarray_AND_SVE, count_bitarray_AND_NEON, count_bitarray_AND_NOSIMD, count_bitarray_AND_dispatch;
 typedef uint32_t count_bitarray_low20_AND_t(uint32_t*, uint32_t*);
-count_bitarray_low20_AND_t count_bitarray_low20_AND_AVX512, count_bitarray_low20_AND_AVX2, count_bitarray_low20_AND_AVX, count_bitarray_low20_AND_SSE2, count_bitarray_low20_AND_MMX, count_bitarray_low20_AND_NOSIMD, count_bitarray_low20_AND_dispatch;
+count_bitarray_low20_AND_t count_bitarray_low20_AND_AVX512, count_bitarray_low20_AND_AVX2, count_bitarray_low20_AND_AVX, count_bitarray_low20_AND_SSE2, count_bitarray_low20_AND_MMX, count_bitarray_low20_AND_SVE, count_bitarray_low20_AND_NEON, count_bitarray_low20_AND_NOSIMD, count_bitarray_low20_AND_dispatch;
 typedef void bitarray_AND4_t(uint32_t*, uint32_t*, uint32_t*, uint32_t*);
-bitarray_AND4_t bitarray_AND4_AVX512, bitarray_AND4_AVX2, bitarray_AND4_AVX, bitarray_AND4_SSE2, bitarray_AND4_MMX, bitarray_AND4_NOSIMD, bitarray_AND4_dispatch;
+bitarray_AND4_t bitarray_AND4_AVX512, bitarray_AND4_AVX2, bitarray_AND4_AVX, bitarray_AND4_SSE2, bitarray_AND4_MMX, bitarray_AND4_SVE, bitarray_AND4_NEON, bitarray_AND4_NOSIMD, bitarray_AND4_dispatch;
 typedef void bitarray_OR_t(uint32_t[], uint32_t[]);
-bitarray_OR_t bitarray_OR_AVX512, bitarray_OR_AVX2, bitarray_OR_AVX, bitarray_OR_SSE2, bitarray_OR_MMX, bitarray_OR_NOSIMD, bitarray_OR_dispatch;
+bitarray_OR_t bitarray_OR_AVX512, bitarray_OR_AVX2, bitarray_OR_AVX, bitarray_OR_SSE2, bitarray_OR_MMX, bitarray_OR_SVE, bitarray_OR_NEON, bitarray_OR_NOSIMD, bitarray_OR_dispatch;
 typedef uint32_t count_bitarray_AND2_t(uint32_t*, uint32_t*);
-count_bitarray_AND2_t count_bitarray_AND2_AVX512, count_bitarray_AND2_AVX2, count_bitarray_AND2_AVX, count_bitarray_AND2_SSE2, count_bitarray_AND2_MMX, count_bitarray_AND2_NOSIMD, count_bitarray_AND2_dispatch;
+count_bitarray_AND2_t count_bitarray_AND2_AVX512, count_bitarray_AND2_AVX2, count_bitarray_AND2_AVX, count_bitarray_AND2_SSE2, count_bitarray_AND2_MMX, count_bitarray_AND2_SVE, count_bitarray_AND2_NEON, count_bitarray_AND2_NOSIMD, count_bitarray_AND2_dispatch;
 typedef uint32_t count_bitarray_AND3_t(uint32_t*, uint32_t*, uint32_t*);
-count_bitarray_AND3_t count_bitarray_AND3_AVX512, count_bitarray_AND3_AVX2, count_bitarray_AND3_AVX, count_bitarray_AND3_SSE2, count_bitarray_AND3_MMX, count_bitarray_AND3_NOSIMD, count_bitarray_AND3_dispatch;
+count_bitarray_AND3_t count_bitarray_AND3_AVX512, count_bitarray_AND3_AVX2, count_bitarray_AND3_AVX, count_bitarray_AND3_SSE2, count_bitarray_AND3_MMX, count_bitarray_AND3_SVE, count_bitarray_AND3_NEON, count_bitarray_AND3_NOSIMD, count_bitarray_AND3_dispatch;
 typedef uint32_t count_bitarray_AND4_t(uint32_t*, uint32_t*, uint32_t*, uint32_t*);
-count_bitarray_AND4_t count_bitarray_AND4_AVX512, count_bitarray_AND4_AVX2, count_bitarray_AND4_AVX, count_bitarray_AND4_SSE2, count_bitarray_AND4_MMX, count_bitarray_AND4_NOSIMD, count_bitarray_AND4_dispatch;
+count_bitarray_AND4_t count_bitarray_AND4_AVX512, count_bitarray_AND4_AVX2, count_bitarray_AND4_AVX, count_bitarray_AND4_SSE2, count_bitarray_AND4_MMX, count_bitarray_AND4_SVE, count_bitarray_AND4_NEON, count_bitarray_AND4_NOSIMD, count_bitarray_AND4_dispatch;
 
 
 inline uint32_t *MALLOC_BITARRAY(uint32_t x)
@@ -299,7 +328,7 @@ inline uint32_t COUNT_BITARRAY_AND4(uint32_t *restrict A, uint32_t *restrict B,
 }
 
 
-#ifndef __MMX__
+#if !defined (__MMX__) && !(defined (__aarch64__) && defined (__ARM_NEON))
 
 // pointers to functions:
 malloc_bitarray_t *malloc_bitarray_function_p = &malloc_bitarray_dispatch;
@@ -316,275 +345,565 @@ count_bitarray_AND2_t *count_bitarray_AND2_function_p = &count_bitarray_AND2_dis
 count_bitarray_AND3_t *count_bitarray_AND3_function_p = &count_bitarray_AND3_dispatch;
 count_bitarray_AND4_t *count_bitarray_AND4_function_p = &count_bitarray_AND4_dispatch;
 
+// use the dispatchers again after the instruction set has been changed
+void reset_bitarray_dispatch(void) {
+	malloc_bitarray_function_p = &malloc_bitarray_dispatch;
+	free_bitarray_function_p = &free_bitarray_dispatch;
+	bitcount_function_p = &bitcount_dispatch;
+	count_states_function_p = &count_states_dispatch;
+	bitarray_AND_function_p = &bitarray_AND_dispatch;
+	bitarray_low20_AND_function_p = &bitarray_low20_AND_dispatch;
+	count_bitarray_AND_function_p = &count_bitarray_AND_dispatch;
+	count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_dispatch;
+	bitarray_AND4_function_p = &bitarray_AND4_dispatch;
+	bitarray_OR_function_p = &bitarray_OR_dispatch;
+	count_bitarray_AND2_function_p = &count_bitarray_AND2_dispatch;
+	count_bitarray_AND3_function_p = &count_bitarray_AND3_dispatch;
+	count_bitarray_AND4_function_p = &count_bitarray_AND4_dispatch;
+}
+
 // determine the available instruction set at runtime and call the correct function
 uint32_t *malloc_bitarray_dispatch(uint32_t x) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) malloc_bitarray_function_p = &malloc_bitarray_AVX512;
-	else if (__builtin_cpu_supports("avx2")) malloc_bitarray_function_p = &malloc_bitarray_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) malloc_bitarray_function_p = &malloc_bitarray_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) malloc_bitarray_function_p = &malloc_bitarray_AVX;
-	else if (__builtin_cpu_supports("sse2")) malloc_bitarray_function_p = &malloc_bitarray_SSE2;
-	else if (__builtin_cpu_supports("mmx")) malloc_bitarray_function_p = &malloc_bitarray_MMX;
-	else
-	#endif
-#endif		
-		malloc_bitarray_function_p = &malloc_bitarray_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			malloc_bitarray_function_p = &malloc_bitarray_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			malloc_bitarray_function_p = &malloc_bitarray_AVX2;
+			break;
+		case SIMD_AVX:
+			malloc_bitarray_function_p = &malloc_bitarray_AVX;
+			break;
+		case SIMD_SSE2:
+			malloc_bitarray_function_p = &malloc_bitarray_SSE2;
+			break;
+		case SIMD_MMX:
+			malloc_bitarray_function_p = &malloc_bitarray_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			malloc_bitarray_function_p = &malloc_bitarray_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			malloc_bitarray_function_p = &malloc_bitarray_NEON;
+			break;
+#endif
+		default:
+			malloc_bitarray_function_p = &malloc_bitarray_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*malloc_bitarray_function_p)(x);
 }
 
 void free_bitarray_dispatch(uint32_t *x) {
+	switch(GetSIMDInstrAuto()) {
 #if defined (__i386__) || defined (__x86_64__)
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) free_bitarray_function_p = &free_bitarray_AVX512;
-	else if (__builtin_cpu_supports("avx2")) free_bitarray_function_p = &free_bitarray_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) free_bitarray_function_p = &free_bitarray_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) free_bitarray_function_p = &free_bitarray_AVX;
-	else if (__builtin_cpu_supports("sse2")) free_bitarray_function_p = &free_bitarray_SSE2;
-	else if (__builtin_cpu_supports("mmx")) free_bitarray_function_p = &free_bitarray_MMX;
-	else
-	#endif
-#endif
-		free_bitarray_function_p = &free_bitarray_NOSIMD;
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			free_bitarray_function_p = &free_bitarray_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			free_bitarray_function_p = &free_bitarray_AVX2;
+			break;
+		case SIMD_AVX:
+			free_bitarray_function_p = &free_bitarray_AVX;
+			break;
+		case SIMD_SSE2:
+			free_bitarray_function_p = &free_bitarray_SSE2;
+			break;
+		case SIMD_MMX:
+			free_bitarray_function_p = &free_bitarray_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			free_bitarray_function_p = &free_bitarray_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			free_bitarray_function_p = &free_bitarray_NEON;
+			break;
+#endif
+		default:
+			free_bitarray_function_p = &free_bitarray_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     (*free_bitarray_function_p)(x);
 }
 
 uint32_t bitcount_dispatch(uint32_t a) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) bitcount_function_p = &bitcount_AVX512;
-	else if (__builtin_cpu_supports("avx2")) bitcount_function_p = &bitcount_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) bitcount_function_p = &bitcount_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) bitcount_function_p = &bitcount_AVX;
-	else if (__builtin_cpu_supports("sse2")) bitcount_function_p = &bitcount_SSE2;
-	else if (__builtin_cpu_supports("mmx")) bitcount_function_p = &bitcount_MMX;
-	else
-	#endif
-#endif
-		bitcount_function_p = &bitcount_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			bitcount_function_p = &bitcount_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			bitcount_function_p = &bitcount_AVX2;
+			break;
+		case SIMD_AVX:
+			bitcount_function_p = &bitcount_AVX;
+			break;
+		case SIMD_SSE2:
+			bitcount_function_p = &bitcount_SSE2;
+			break;
+		case SIMD_MMX:
+			bitcount_function_p = &bitcount_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitcount_function_p = &bitcount_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitcount_function_p = &bitcount_NEON;
+			break;
+#endif
+		default:
+			bitcount_function_p = &bitcount_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*bitcount_function_p)(a);
 }
 
 uint32_t count_states_dispatch(uint32_t *bitarray) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_states_function_p = &count_states_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_states_function_p = &count_states_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_states_function_p = &count_states_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_states_function_p = &count_states_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_states_function_p = &count_states_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_states_function_p = &count_states_MMX;
-	else
-	#endif 
-#endif
-		count_states_function_p = &count_states_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_states_function_p = &count_states_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_states_function_p = &count_states_AVX2;
+			break;
+		case SIMD_AVX:
+			count_states_function_p = &count_states_AVX;
+			break;
+		case SIMD_SSE2:
+			count_states_function_p = &count_states_SSE2;
+			break;
+		case SIMD_MMX:
+			count_states_function_p = &count_states_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_states_function_p = &count_states_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_states_function_p = &count_states_NEON;
+			break;
+#endif
+		default:
+			count_states_function_p = &count_states_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_states_function_p)(bitarray);
 }
 
 void bitarray_AND_dispatch(uint32_t *A, uint32_t *B) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) bitarray_AND_function_p = &bitarray_AND_AVX512;
-	else if (__builtin_cpu_supports("avx2")) bitarray_AND_function_p = &bitarray_AND_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) bitarray_AND_function_p = &bitarray_AND_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) bitarray_AND_function_p = &bitarray_AND_AVX;
-	else if (__builtin_cpu_supports("sse2")) bitarray_AND_function_p = &bitarray_AND_SSE2;
-	else if (__builtin_cpu_supports("mmx")) bitarray_AND_function_p = &bitarray_AND_MMX;
-	else
-	#endif
-#endif
-		bitarray_AND_function_p = &bitarray_AND_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			bitarray_AND_function_p = &bitarray_AND_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			bitarray_AND_function_p = &bitarray_AND_AVX2;
+			break;
+		case SIMD_AVX:
+			bitarray_AND_function_p = &bitarray_AND_AVX;
+			break;
+		case SIMD_SSE2:
+			bitarray_AND_function_p = &bitarray_AND_SSE2;
+			break;
+		case SIMD_MMX:
+			bitarray_AND_function_p = &bitarray_AND_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitarray_AND_function_p = &bitarray_AND_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitarray_AND_function_p = &bitarray_AND_NEON;
+			break;
+#endif
+		default:
+			bitarray_AND_function_p = &bitarray_AND_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     (*bitarray_AND_function_p)(A,B);
 }
 
 void bitarray_low20_AND_dispatch(uint32_t *A, uint32_t *B) {
+	switch(GetSIMDInstrAuto()) {
 #if defined (__i386__) || defined (__x86_64__)
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX512;
-	else if (__builtin_cpu_supports("avx2")) bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX;
-	else if (__builtin_cpu_supports("sse2")) bitarray_low20_AND_function_p = &bitarray_low20_AND_SSE2;
-	else if (__builtin_cpu_supports("mmx")) bitarray_low20_AND_function_p = &bitarray_low20_AND_MMX;
-	else
-	#endif
-#endif
-		bitarray_low20_AND_function_p = &bitarray_low20_AND_NOSIMD;
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX2;
+			break;
+		case SIMD_AVX:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_AVX;
+			break;
+		case SIMD_SSE2:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_SSE2;
+			break;
+		case SIMD_MMX:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_NEON;
+			break;
+#endif
+		default:
+			bitarray_low20_AND_function_p = &bitarray_low20_AND_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     (*bitarray_low20_AND_function_p)(A, B);
 }
 
 uint32_t count_bitarray_AND_dispatch(uint32_t *A, uint32_t *B) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_bitarray_AND_function_p = &count_bitarray_AND_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_bitarray_AND_function_p = &count_bitarray_AND_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_bitarray_AND_function_p = &count_bitarray_AND_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_bitarray_AND_function_p = &count_bitarray_AND_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_bitarray_AND_function_p = &count_bitarray_AND_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_bitarray_AND_function_p = &count_bitarray_AND_MMX;
-	else
-	#endif
-#endif
-		count_bitarray_AND_function_p = &count_bitarray_AND_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_bitarray_AND_function_p = &count_bitarray_AND_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_bitarray_AND_function_p = &count_bitarray_AND_AVX2;
+			break;
+		case SIMD_AVX:
+			count_bitarray_AND_function_p = &count_bitarray_AND_AVX;
+			break;
+		case SIMD_SSE2:
+			count_bitarray_AND_function_p = &count_bitarray_AND_SSE2;
+			break;
+		case SIMD_MMX:
+			count_bitarray_AND_function_p = &count_bitarray_AND_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_bitarray_AND_function_p = &count_bitarray_AND_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_bitarray_AND_function_p = &count_bitarray_AND_NEON;
+			break;
+#endif
+		default:
+			count_bitarray_AND_function_p = &count_bitarray_AND_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND_function_p)(A, B);
 }
 
 uint32_t count_bitarray_low20_AND_dispatch(uint32_t *A, uint32_t *B) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_MMX;
-	else
-	#endif
-#endif
-		count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX2;
+			break;
+		case SIMD_AVX:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_AVX;
+			break;
+		case SIMD_SSE2:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_SSE2;
+			break;
+		case SIMD_MMX:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NEON;
+			break;
+#endif
+		default:
+			count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_bitarray_low20_AND_function_p)(A, B);
 }
 
 void bitarray_AND4_dispatch(uint32_t *A, uint32_t *B, uint32_t *C, uint32_t *D) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) bitarray_AND4_function_p = &bitarray_AND4_AVX512;
-	else if (__builtin_cpu_supports("avx2")) bitarray_AND4_function_p = &bitarray_AND4_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) bitarray_AND4_function_p = &bitarray_AND4_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) bitarray_AND4_function_p = &bitarray_AND4_AVX;
-	else if (__builtin_cpu_supports("sse2")) bitarray_AND4_function_p = &bitarray_AND4_SSE2;
-	else if (__builtin_cpu_supports("mmx")) bitarray_AND4_function_p = &bitarray_AND4_MMX;
-	else
-	#endif
-#endif
-		bitarray_AND4_function_p = &bitarray_AND4_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			bitarray_AND4_function_p = &bitarray_AND4_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			bitarray_AND4_function_p = &bitarray_AND4_AVX2;
+			break;
+		case SIMD_AVX:
+			bitarray_AND4_function_p = &bitarray_AND4_AVX;
+			break;
+		case SIMD_SSE2:
+			bitarray_AND4_function_p = &bitarray_AND4_SSE2;
+			break;
+		case SIMD_MMX:
+			bitarray_AND4_function_p = &bitarray_AND4_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitarray_AND4_function_p = &bitarray_AND4_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitarray_AND4_function_p = &bitarray_AND4_NEON;
+			break;
+#endif
+		default:
+			bitarray_AND4_function_p = &bitarray_AND4_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     (*bitarray_AND4_function_p)(A, B, C, D);
 }
 
 void bitarray_OR_dispatch(uint32_t *A, uint32_t *B) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) bitarray_OR_function_p = &bitarray_OR_AVX512;
-	else if (__builtin_cpu_supports("avx2")) bitarray_OR_function_p = &bitarray_OR_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) bitarray_OR_function_p = &bitarray_OR_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) bitarray_OR_function_p = &bitarray_OR_AVX;
-	else if (__builtin_cpu_supports("sse2")) bitarray_OR_function_p = &bitarray_OR_SSE2;
-	else if (__builtin_cpu_supports("mmx")) bitarray_OR_function_p = &bitarray_OR_MMX;
-	else
-	#endif
-#endif
-		bitarray_OR_function_p = &bitarray_OR_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			bitarray_OR_function_p = &bitarray_OR_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			bitarray_OR_function_p = &bitarray_OR_AVX2;
+			break;
+		case SIMD_AVX:
+			bitarray_OR_function_p = &bitarray_OR_AVX;
+			break;
+		case SIMD_SSE2:
+			bitarray_OR_function_p = &bitarray_OR_SSE2;
+			break;
+		case SIMD_MMX:
+			bitarray_OR_function_p = &bitarray_OR_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			bitarray_OR_function_p = &bitarray_OR_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			bitarray_OR_function_p = &bitarray_OR_NEON;
+			break;
+#endif
+		default:
+			bitarray_OR_function_p = &bitarray_OR_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     (*bitarray_OR_function_p)(A,B);
 }
 
 uint32_t count_bitarray_AND2_dispatch(uint32_t *A, uint32_t *B) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_bitarray_AND2_function_p = &count_bitarray_AND2_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_bitarray_AND2_function_p = &count_bitarray_AND2_MMX;
-	else
-	#endif
-#endif
-		count_bitarray_AND2_function_p = &count_bitarray_AND2_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX2;
+			break;
+		case SIMD_AVX:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_AVX;
+			break;
+		case SIMD_SSE2:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_SSE2;
+			break;
+		case SIMD_MMX:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_NEON;
+			break;
+#endif
+		default:
+			count_bitarray_AND2_function_p = &count_bitarray_AND2_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND2_function_p)(A, B);
 }
 
 uint32_t count_bitarray_AND3_dispatch(uint32_t *A, uint32_t *B, uint32_t *C) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_bitarray_AND3_function_p = &count_bitarray_AND3_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_bitarray_AND3_function_p = &count_bitarray_AND3_MMX;
-	else
-	#endif
-#endif
-		count_bitarray_AND3_function_p = &count_bitarray_AND3_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX2;
+			break;
+		case SIMD_AVX:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_AVX;
+			break;
+		case SIMD_SSE2:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_SSE2;
+			break;
+		case SIMD_MMX:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_NEON;
+			break;
+#endif
+		default:
+			count_bitarray_AND3_function_p = &count_bitarray_AND3_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND3_function_p)(A, B, C);
 }
 
 uint32_t count_bitarray_AND4_dispatch(uint32_t *A, uint32_t *B, uint32_t *C, uint32_t *D) {
-#if defined (__i386__) || defined (__x86_64__)	
-	#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
-		#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
-	if (__builtin_cpu_supports("avx512f")) count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX512;
-	else if (__builtin_cpu_supports("avx2")) count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX2;
-		#else
-	if (__builtin_cpu_supports("avx2")) count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX2;
-		#endif
-	else if (__builtin_cpu_supports("avx")) count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX;
-	else if (__builtin_cpu_supports("sse2")) count_bitarray_AND4_function_p = &count_bitarray_AND4_SSE2;
-	else if (__builtin_cpu_supports("mmx")) count_bitarray_AND4_function_p = &count_bitarray_AND4_MMX;
-	else
-	#endif
-#endif
-		count_bitarray_AND4_function_p = &count_bitarray_AND4_NOSIMD;
+	switch(GetSIMDInstrAuto()) {
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+		case SIMD_AVX512:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX512;
+			break;
+#endif
+		case SIMD_AVX2:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX2;
+			break;
+		case SIMD_AVX:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_AVX;
+			break;
+		case SIMD_SSE2:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_SSE2;
+			break;
+		case SIMD_MMX:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_MMX;
+			break;
+#endif
+#endif
+#if defined (__aarch64__)
+#if defined (HARDNESTED_SVE)
+		case SIMD_SVE:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_SVE;
+			break;
+#endif
+		case SIMD_NEON:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_NEON;
+			break;
+#endif
+		default:
+			count_bitarray_AND4_function_p = &count_bitarray_AND4_NOSIMD;
+			break;
+	}
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND4_function_p)(A, B, C, D);
@@ -52,6 +52,7 @@ THE SOFTWARE.
 
 #include <stdint.h>
 
+extern void reset_bitarray_dispatch(void);
 extern uint32_t *malloc_bitarray(uint32_t x);
 extern void free_bitarray(uint32_t *x);
 extern uint32_t bitcount(uint32_t a);
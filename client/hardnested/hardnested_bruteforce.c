@@ -68,6 +68,7 @@ THE SOFTWARE.
 #define DEFAULT_BRUTE_FORCE_RATE		(120000000.0)		// if benchmark doesn't succeed
 #define TEST_BENCH_SIZE					(6000)				// number of odd and even states for brute force benchmark
 #define TEST_BENCH_FILENAME				"hardnested/bf_bench_data.bin"
+#define BF_UNPACK_ODD_STATES			(1<<16)				// number of odd states of a packed statelist unpacked at once
 //#define WRITE_BENCH_FILE
 
 // debugging options
@@ -83,12 +84,178 @@ static uint32_t nonces_to_bruteforce = 0;
 static uint32_t bf_test_nonce[256];
 static uint8_t bf_test_nonce_2nd_byte[256];
 static uint8_t bf_test_nonce_par[256];
-static uint32_t bucket_count = 0;
-static statelist_t* buckets[128];
+static uint32_t chunk_count = 0;
+static statelist_t *chunks = NULL;
 static uint32_t keys_found = 0;
+static uint64_t found_bs_key = 0;
 static uint64_t num_keys_tested;
 
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// work stealing for the brute force phase.
+// The odd x even product of each bucket is split into chunks of roughly equal size. Each thread owns a deque
+// of chunks and takes work from its head. A thread which runs out of work steals from the tail of another
+// thread's deque. This keeps all threads busy until the very end, even with heavily varying bucket sizes.
+
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t *chunk_idx;
+	uint32_t head;
+	uint32_t tail;
+} bf_deque_t;
+
+typedef struct {
+	uint32_t chunks_done;
+	uint32_t chunks_stolen;
+	uint64_t finish_time;
+} bf_thread_stats_t;
+
+static bf_deque_t *deques = NULL;
+static bf_checkpoint_t *bf_checkpoint = NULL;
+
+
+static inline bool statelist_empty(statelist_t *p, odd_even_t odd_even)
+{
+	return p->len[odd_even] == 0 || (p->states[odd_even] == NULL && p->packed[odd_even] == NULL);
+}
+
+
+static void sub_statelist(statelist_t *chunk, statelist_t *p, odd_even_t odd_even, uint32_t start, uint32_t len)
+{
+	chunk->packed[odd_even] = p->packed[odd_even];
+	if (p->packed[odd_even] != NULL) {
+		chunk->states[odd_even] = NULL;
+		chunk->start[odd_even] = p->start[odd_even] + start;
+	} else {
+		chunk->states[odd_even] = p->states[odd_even] + start;
+		chunk->start[odd_even] = 0;
+	}
+	chunk->len[odd_even] = len;
+}
+
+
+static uint32_t split_into_chunks(statelist_t *candidates, statelist_t *chunk_list)
+{
+	uint32_t num_chunks = 0;
+	for (statelist_t *p = candidates; p != NULL; p = p->next) {
+		if (statelist_empty(p, ODD_STATE) || statelist_empty(p, EVEN_STATE)) {
+			continue;
+		}
+		uint32_t even_per_chunk = MIN(p->len[EVEN_STATE], BF_CHUNK_EVEN_STATES);
+		uint32_t odd_per_chunk = MAX(1, MIN(p->len[ODD_STATE], BF_CHUNK_STATES / even_per_chunk));
+		for (uint32_t even = 0; even < p->len[EVEN_STATE]; even += even_per_chunk) {
+			for (uint32_t odd = 0; odd < p->len[ODD_STATE]; odd += odd_per_chunk) {
+				if (chunk_list != NULL) {
+					statelist_t *chunk = &chunk_list[num_chunks];
+					sub_statelist(chunk, p, EVEN_STATE, even, MIN(even_per_chunk, p->len[EVEN_STATE] - even));
+					sub_statelist(chunk, p, ODD_STATE, odd, MIN(odd_per_chunk, p->len[ODD_STATE] - odd));
+					chunk->next = NULL;
+				}
+				num_chunks++;
+			}
+		}
+	}
+	return num_chunks;
+}
+
+
+uint32_t bf_num_work_units(statelist_t *candidates)
+{
+	return split_into_chunks(candidates, NULL);
+}
+
+
+void bf_get_work_units(statelist_t *candidates, statelist_t *work_units)
+{
+	// work_units[] must have room for bf_num_work_units(candidates) entries
+	split_into_chunks(candidates, work_units);
+}
+
+
+static void init_deques(uint32_t num_threads)
+{
+	deques = (bf_deque_t *)malloc(num_threads * sizeof(bf_deque_t));
+	if (deques == NULL) {
+		printf("Out of memory error in brute_force. Aborting...");
+		exit(4);
+	}
+	for (uint32_t t = 0; t < num_threads; t++) {
+		pthread_mutex_init(&deques[t].lock, NULL);
+		deques[t].chunk_idx = (uint32_t *)malloc((chunk_count / num_threads + 1) * sizeof(uint32_t));
+		if (deques[t].chunk_idx == NULL) {
+			printf("Out of memory error in brute_force. Aborting...");
+			exit(4);
+		}
+		deques[t].head = 0;
+		deques[t].tail = 0;
+	}
+	// deal out the chunks round robin. This keeps the original order of buckets as much as possible.
+	// Chunks which have been completed in an earlier (interrupted) run are skipped.
+	uint32_t num_dealt = 0;
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		if (bf_checkpoint != NULL && (bf_checkpoint->work_units_done[i/8] & (1 << (i%8)))) {
+			num_keys_tested += (uint64_t)chunks[i].len[ODD_STATE] * chunks[i].len[EVEN_STATE];
+			continue;
+		}
+		bf_deque_t *d = &deques[num_dealt++ % num_threads];
+		d->chunk_idx[d->tail++] = i;
+	}
+}
+
+
+static void free_deques(uint32_t num_threads)
+{
+	for (uint32_t t = 0; t < num_threads; t++) {
+		pthread_mutex_destroy(&deques[t].lock);
+		free(deques[t].chunk_idx);
+	}
+	free(deques);
+	deques = NULL;
+}
+
+
+static bool get_own_chunk(uint32_t thread_id, uint32_t *chunk)
+{
+	bool found = false;
+	bf_deque_t *d = &deques[thread_id];
+	pthread_mutex_lock(&d->lock);
+	if (d->head < d->tail) {
+		*chunk = d->chunk_idx[d->head++];
+		found = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+
+static bool steal_chunk(uint32_t thread_id, uint32_t num_threads, uint32_t *chunk)
+{
+	// steal from the thread with the most remaining work
+	while (true) {
+		uint32_t victim = thread_id;
+		uint32_t most_remaining = 0;
+		for (uint32_t t = 0; t < num_threads; t++) {
+			uint32_t remaining = deques[t].tail - deques[t].head;	// unlocked read, only a hint
+			if (t != thread_id && remaining > most_remaining) {
+				most_remaining = remaining;
+				victim = t;
+			}
+		}
+		if (victim == thread_id) {
+			return false;
+		}
+		bf_deque_t *d = &deques[victim];
+		pthread_mutex_lock(&d->lock);
+		if (d->head < d->tail) {
+			*chunk = d->chunk_idx[--d->tail];
+			pthread_mutex_unlock(&d->lock);
+			return true;
+		}
+		pthread_mutex_unlock(&d->lock);
+	}
+}
+
+
 uint8_t trailing_zeros(uint8_t byte) 
 {
 	static const uint8_t trailing_zeros_LUT[256] = {
@@ -150,42 +317,76 @@ crack_states_thread(void* x){
 	struct arg {
 		bool silent;
 		int thread_ID;
+		uint32_t num_threads;
 		uint32_t cuid;
 		uint32_t num_acquired_nonces;
 		uint64_t maximum_states;
 		noncelist_t *nonces;
 		uint8_t* best_first_bytes;
+		bf_thread_stats_t stats;
 	} *thread_arg;
 
 	thread_arg = (struct arg *)x;
     const int thread_id = thread_arg->thread_ID;
-    uint32_t current_bucket = thread_id;
-    while(current_bucket < bucket_count){
-        statelist_t *bucket = buckets[current_bucket];
-        if(bucket){
+    uint32_t current_chunk;
+	uint32_t *unpacked_states[2];
+	unpacked_states[EVEN_STATE] = (uint32_t *)malloc(BF_CHUNK_EVEN_STATES * sizeof(uint32_t));
+	unpacked_states[ODD_STATE] = (uint32_t *)malloc(BF_UNPACK_ODD_STATES * sizeof(uint32_t));
+	if (unpacked_states[EVEN_STATE] == NULL || unpacked_states[ODD_STATE] == NULL) {
+		printf("Out of memory error in crack_states_thread(). Aborting...\n");
+		exit(4);
+	}
+    while (!keys_found) {
+		if (!get_own_chunk(thread_id, &current_chunk)) {
+			if (!steal_chunk(thread_id, thread_arg->num_threads, &current_chunk)) {
+				break;
+			}
+			thread_arg->stats.chunks_stolen++;
+		}
+        statelist_t *chunk = &chunks[current_chunk];
 #if defined (DEBUG_BRUTE_FORCE)	
-			printf("Thread %u starts working on bucket %u\n", thread_id, current_bucket);
+		printf("Thread %u starts working on chunk %u\n", thread_id, current_chunk);
 #endif			
-            const uint64_t key = crack_states_bitsliced(thread_arg->cuid, thread_arg->best_first_bytes, bucket, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
-            if(key != -1){
-                __sync_fetch_and_add(&keys_found, 1);
+		// packed statelists are unpacked piecewise. All even states of a chunk at once, the odd states in parts.
+		statelist_t bucket = *chunk;
+		if (chunk->packed[EVEN_STATE] != NULL) {
+			unpack_states(chunk->packed[EVEN_STATE], chunk->start[EVEN_STATE], chunk->len[EVEN_STATE], unpacked_states[EVEN_STATE]);
+			bucket.states[EVEN_STATE] = unpacked_states[EVEN_STATE];
+		}
+		uint64_t key = -1;
+		for (uint32_t odd = 0; odd < chunk->len[ODD_STATE] && key == -1 && !keys_found; odd += bucket.len[ODD_STATE]) {
+			if (chunk->packed[ODD_STATE] != NULL) {
+				bucket.len[ODD_STATE] = unpack_states(chunk->packed[ODD_STATE], chunk->start[ODD_STATE] + odd, MIN(BF_UNPACK_ODD_STATES, chunk->len[ODD_STATE] - odd), unpacked_states[ODD_STATE]);
+				bucket.states[ODD_STATE] = unpacked_states[ODD_STATE];
+			}
+			key = crack_states_bitsliced(thread_arg->cuid, thread_arg->best_first_bytes, &bucket, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
+		}
+		thread_arg->stats.chunks_done++;
+        if(key != -1){
+            __sync_fetch_and_add(&keys_found, 1);
+			found_bs_key = key;
+			char progress_text[80];
+			sprintf(progress_text, "Brute force phase completed. Key found: %012" PRIx64, key);
+			hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
+            break;
+        } else if(keys_found){
+            break;
+        } else {
+			if (bf_checkpoint != NULL) {
+				__sync_fetch_and_or(&bf_checkpoint->work_units_done[current_chunk/8], 1 << (current_chunk%8));
+				bf_checkpoint->save();
+			}
+			if (!thread_arg->silent) {
 				char progress_text[80];
-				sprintf(progress_text, "Brute force phase completed. Key found: %012" PRIx64, key);
-				hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
-                break;
-            } else if(keys_found){
-                break;
-            } else {
-				if (!thread_arg->silent) {
-					char progress_text[80];
-					sprintf(progress_text, "Brute force phase: %6.02f%%", 100.0*(float)num_keys_tested/(float)(thread_arg->maximum_states));
-					float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested/2;
-					hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
-				}
-            }
+				sprintf(progress_text, "Brute force phase: %6.02f%%", 100.0*(float)num_keys_tested/(float)(thread_arg->maximum_states));
+				float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested/2;
+				hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
+			}
         }
-        current_bucket += NUM_BRUTE_FORCE_THREADS;
     }
+	free(unpacked_states[EVEN_STATE]);
+	free(unpacked_states[ODD_STATE]);
+	thread_arg->stats.finish_time = msclock();
     return NULL;
 }
 
@@ -271,23 +472,22 @@ static void write_benchfile(statelist_t *candidates) {
 		fwrite(&(bf_test_nonce[i]), 1, sizeof(bf_test_nonce[i]), benchfile);
 		fwrite(&(bf_test_nonce_par[i]), 1, sizeof(bf_test_nonce_par[i]), benchfile);
 	}
+	uint32_t states[TEST_BENCH_SIZE];
 	uint32_t num_states = MIN(candidates->len[EVEN_STATE], TEST_BENCH_SIZE);
+	unpack_states(candidates->packed[EVEN_STATE], candidates->start[EVEN_STATE], num_states, states);
 	fwrite(&num_states, 1, sizeof(num_states), benchfile);
-	for (uint32_t i = 0; i < num_states; i++) {
-		fwrite(&(candidates->states[EVEN_STATE][i]), 1, sizeof(uint32_t), benchfile);
-	}
+	fwrite(states, sizeof(uint32_t), num_states, benchfile);
 	num_states = MIN(candidates->len[ODD_STATE], TEST_BENCH_SIZE);
+	unpack_states(candidates->packed[ODD_STATE], candidates->start[ODD_STATE], num_states, states);
 	fwrite(&num_states, 1, sizeof(num_states), benchfile);
-	for (uint32_t i = 0; i < num_states; i++) {
-		fwrite(&(candidates->states[ODD_STATE][i]), 1, sizeof(uint32_t), benchfile);
-	}
+	fwrite(states, sizeof(uint32_t), num_states, benchfile);
 	fclose(benchfile);
 	printf("done.\n");
 }
 #endif
 
 
-bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes)
+bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key, bf_checkpoint_t *checkpoint)
 {
 #if defined (WRITE_BENCH_FILE)
 	write_benchfile(candidates);
@@ -301,16 +501,24 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
 	
 	keys_found = 0;
 	num_keys_tested = 0;
+	bf_checkpoint = checkpoint;
 
 	bitslice_test_nonces(nonces_to_bruteforce, bf_test_nonce, bf_test_nonce_par);
 	
-	// count number of states to go
-	bucket_count = 0;
-	for (statelist_t *p = candidates; p != NULL; p = p->next) {
-		if (p->states[ODD_STATE] != NULL && p->states[EVEN_STATE] != NULL) {
-			buckets[bucket_count] = p;
-			bucket_count++;
-		}
+	// split the buckets into chunks of similar size
+	chunk_count = split_into_chunks(candidates, NULL);
+	chunks = (statelist_t *)malloc(MAX(chunk_count, 1) * sizeof(statelist_t));
+	if (chunks == NULL) {
+		printf("Out of memory error in brute_force. Aborting...");
+		exit(4);
+	}
+	split_into_chunks(candidates, chunks);
+	uint32_t num_threads = NUM_BRUTE_FORCE_THREADS;
+	init_deques(num_threads);
+	if (!silent && num_keys_tested > 0) {
+		char progress_text[80];
+		sprintf(progress_text, "Resuming brute force: %6.02f%% already done", 100.0*(float)num_keys_tested/(float)maximum_states);
+		hardnested_print_progress(num_acquired_nonces, progress_text, nonces[best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested/2, 0);
 	}
 
 	uint64_t start_time = msclock();
@@ -323,33 +531,58 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
 			// trailing_zeros(bf_test_nonce_2nd_byte[3] ^ bf_test_nonce_2nd_byte[2]));
 	// }
 
-	pthread_t threads[NUM_BRUTE_FORCE_THREADS];
+	pthread_t threads[num_threads];
 	struct args {
 		bool silent;
 		int thread_ID;
+		uint32_t num_threads;
 		uint32_t cuid;
 		uint32_t num_acquired_nonces;
 		uint64_t maximum_states;
 		noncelist_t *nonces;
 		uint8_t *best_first_bytes;
-	} thread_args[NUM_BRUTE_FORCE_THREADS];
+		bf_thread_stats_t stats;
+	} thread_args[num_threads];
 	
-	for(uint32_t i = 0; i < NUM_BRUTE_FORCE_THREADS; i++){
+	for(uint32_t i = 0; i < num_threads; i++){
 		thread_args[i].thread_ID = i;
+		thread_args[i].num_threads = num_threads;
 		thread_args[i].silent = silent;
 		thread_args[i].cuid = cuid;
 		thread_args[i].num_acquired_nonces = num_acquired_nonces;
 		thread_args[i].maximum_states = maximum_states;
 		thread_args[i].nonces = nonces;
 		thread_args[i].best_first_bytes = best_first_bytes;
+		memset(&thread_args[i].stats, 0, sizeof(bf_thread_stats_t));
 		pthread_create(&threads[i], NULL, crack_states_thread, (void*)&thread_args[i]);
 	}
-	for(uint32_t i = 0; i < NUM_BRUTE_FORCE_THREADS; i++){
+	for(uint32_t i = 0; i < num_threads; i++){
 		pthread_join(threads[i], 0);
 	}
 
 	uint64_t elapsed_time = msclock() - start_time;
 
+	// report how well the work was balanced: the average time the threads were busy
+	// relative to the time the slowest thread needed.
+	if (!silent && !keys_found && chunk_count > 0) {
+		uint64_t sum_busy = 0;
+		uint32_t num_stolen = 0;
+		for (uint32_t i = 0; i < num_threads; i++) {
+			sum_busy += thread_args[i].stats.finish_time - start_time;
+			num_stolen += thread_args[i].stats.chunks_stolen;
+		}
+		float balance = elapsed_time ? 100.0 * (float)sum_busy / (num_threads * elapsed_time) : 100.0;
+		char progress_text[80];
+		sprintf(progress_text, "Load balance %5.1f%% (%" PRIu32 " work units, %" PRIu32 " stolen)", balance, chunk_count, num_stolen);
+		float remaining_bruteforce = nonces[best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested/2;
+		hardnested_print_progress(num_acquired_nonces, progress_text, remaining_bruteforce, 0);
+	}
+
+	free_deques(num_threads);
+	free(chunks);
+	chunks = NULL;
+	bf_checkpoint = NULL;
+
 	// if (!silent) {
 		// printf("Brute force completed after testing %" PRIu64" (2^%1.1f) keys in %1.1f seconds at a rate of %1.0f (2^%1.1f) keys per second.\n", 
 			// num_keys_tested,
@@ -362,6 +595,10 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
 	if (bf_rate != NULL) {
 		*bf_rate = (float)num_keys_tested / ((float)elapsed_time / 1000.0);
 	}
+
+	if (found_key != NULL && keys_found) {
+		*found_key = found_bs_key;
+	}
 	
 	return (keys_found != 0);
 }
@@ -457,6 +694,8 @@ float brute_force_benchmark()
 	}
 
 	for (uint8_t i = 0; i < NUM_BRUTE_FORCE_THREADS; i++) {
+		test_candidates[i].packed[ODD_STATE] = NULL;
+		test_candidates[i].packed[EVEN_STATE] = NULL;
 		test_candidates[i].len[ODD_STATE] = TEST_BENCH_SIZE;
 		test_candidates[i].len[EVEN_STATE] = TEST_BENCH_SIZE;
 		test_candidates[i].states[ODD_STATE][TEST_BENCH_SIZE] = -1;
@@ -466,7 +705,7 @@ float brute_force_benchmark()
 	uint64_t maximum_states = TEST_BENCH_SIZE*TEST_BENCH_SIZE*(uint64_t)NUM_BRUTE_FORCE_THREADS;
 
 	float bf_rate;
-	brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0);
+	brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0, NULL, NULL);
 	
 	free(test_candidates[0].states[ODD_STATE]);
 	free(test_candidates[0].states[EVEN_STATE]);
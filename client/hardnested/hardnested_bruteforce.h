@@ -20,15 +20,28 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "cmdhfmfhard.h"
+#include "hardnested_statelist.h"
+
+#define BF_CHUNK_STATES					(1LL<<26)			// approx. number of keys in one brute force work unit
+#define BF_CHUNK_EVEN_STATES			(1<<16)				// maximum number of even states in one work unit. Multiple of all bitslice sizes.
 
 typedef struct {
 	uint32_t *states[2];
 	uint32_t len[2];
 	void* next;
+	packed_statelist_t *packed[2];	// if not NULL, the states are read from the packed list instead of states[]...
+	uint32_t start[2];				// ...beginning with this index
 } statelist_t;
 
+typedef struct {
+	uint8_t *work_units_done;		// one bit per brute force work unit. Work units already marked as done are skipped.
+	void (*save)(void);				// called whenever a work unit has been completed
+} bf_checkpoint_t;
+
 extern void prepare_bf_test_nonces(noncelist_t *nonces, uint8_t best_first_byte);
-extern bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes);
+extern uint32_t bf_num_work_units(statelist_t *candidates);
+extern void bf_get_work_units(statelist_t *candidates, statelist_t *work_units);
+extern bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key, bf_checkpoint_t *checkpoint);
 extern float brute_force_benchmark();
 extern uint8_t trailing_zeros(uint8_t byte); 
 extern bool verify_key(uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t odd, uint32_t even);
@@ -0,0 +1,283 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Compact storage of sorted lists of 24 bit crypto1 half states
+//
+// The state space is split into 256 containers of 2^16 states each (similar to
+// roaring bitmaps). Each container is stored either as a dense bitmap (8kBytes)
+// or as a list of the distances between consecutive states, whatever is smaller.
+// A list with all containers being bitmaps is the dense 2^24 bit bitarray.
+// Lists are read in ranges of states, i.e. they never need to be expanded
+// completely. Bitmap containers start at 4 byte aligned offsets and are read as
+// uint32_t words.
+//-----------------------------------------------------------------------------
+
+#include "hardnested_statelist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_CONTAINERS					256
+#define CONTAINER_WORDS					((1<<16) / 32)
+#define BITMAP_SIZE						(CONTAINER_WORDS * sizeof(uint32_t))
+#define BITMAP_OFFSET(offset)			(((offset) + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1))
+
+
+static inline uint32_t delta_size(uint32_t delta)
+{
+	// number of bytes of a delta. 7 bits per byte, the highest bit flags a following byte
+	return delta < 0x80 ? 1 : delta < 0x4000 ? 2 : 3;
+}
+
+
+static inline uint8_t *put_delta(uint8_t *p, uint32_t delta)
+{
+	while (delta >= 0x80) {
+		*p++ = (delta & 0x7f) | 0x80;
+		delta >>= 7;
+	}
+	*p++ = delta;
+	return p;
+}
+
+
+static inline const uint8_t *get_delta(const uint8_t *p, uint32_t *delta)
+{
+	uint32_t d = 0;
+	uint_fast8_t shift = 0;
+	while (*p & 0x80) {
+		d |= (uint32_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	*delta = d | (uint32_t)*p++ << shift;
+	return p;
+}
+
+
+packed_statelist_t *pack_bitarray(uint32_t *bitarray)
+{
+	// bitarray: 2^24 bits, the MSB of bitarray[0] represents state 0.
+	uint32_t count[NUM_CONTAINERS];
+	uint32_t size[NUM_CONTAINERS];
+	uint32_t num_containers = 0;
+	uint32_t data_size = 0;
+
+	// first pass: determine the size of each container
+	for (uint32_t block = 0; block < NUM_CONTAINERS; block++) {
+		uint32_t *words = bitarray + block * CONTAINER_WORDS;
+		count[block] = 0;
+		size[block] = 0;
+		uint32_t last = -1;
+		for (uint32_t i = 0; i < CONTAINER_WORDS; i++) {
+			uint32_t word = words[i];
+			while (word) {
+				uint32_t state = i * 32 + __builtin_clz(word);
+				word &= ~(0x80000000 >> (state & 0x1f));
+				size[block] += delta_size(state - last);
+				last = state;
+				count[block]++;
+			}
+		}
+		if (count[block]) {
+			num_containers++;
+			data_size = size[block] < BITMAP_SIZE ? data_size + size[block] : BITMAP_OFFSET(data_size) + BITMAP_SIZE;
+		}
+	}
+
+	packed_statelist_t *sl = (packed_statelist_t *)malloc(sizeof(packed_statelist_t) + num_containers * sizeof(packed_container_t) + data_size);
+	if (sl == NULL) {
+		printf("Out of memory error in pack_bitarray(). Aborting...\n");
+		exit(4);
+	}
+	sl->num_containers = num_containers;
+	sl->data_size = data_size;
+	sl->containers = (packed_container_t *)(sl + 1);
+	sl->data = (uint8_t *)(sl->containers + num_containers);		// 4 byte aligned, containers are 16 bytes
+
+	// second pass: encode the containers
+	uint32_t len = 0;
+	uint32_t offset = 0;
+	packed_container_t *c = sl->containers;
+	for (uint32_t block = 0; block < NUM_CONTAINERS; block++) {
+		if (count[block] == 0) {
+			continue;
+		}
+		uint32_t *words = bitarray + block * CONTAINER_WORDS;
+		c->block = block;
+		c->reserved = 0;
+		c->first = len;
+		c->count = count[block];
+		if (size[block] < BITMAP_SIZE) {
+			c->type = CONTAINER_DELTA;
+			c->offset = offset;
+			uint8_t *p = sl->data + offset;
+			uint32_t last = -1;
+			for (uint32_t i = 0; i < CONTAINER_WORDS; i++) {
+				uint32_t word = words[i];
+				while (word) {
+					uint32_t state = i * 32 + __builtin_clz(word);
+					word &= ~(0x80000000 >> (state & 0x1f));
+					p = put_delta(p, state - last);
+					last = state;
+				}
+			}
+			offset += size[block];
+		} else {
+			c->type = CONTAINER_BITMAP;
+			offset = BITMAP_OFFSET(offset);
+			c->offset = offset;
+			memcpy(sl->data + offset, words, BITMAP_SIZE);
+			offset += BITMAP_SIZE;
+		}
+		len += count[block];
+		c++;
+	}
+	sl->len = len;
+
+	return sl;
+}
+
+
+packed_statelist_t *pack_statelist(uint32_t *states, uint32_t len)
+{
+	// pack a list of distinct states in ascending order. Returns NULL if the list is invalid.
+	uint32_t *bitarray = (uint32_t *)calloc(1<<19, sizeof(uint32_t));
+	if (bitarray == NULL) {
+		printf("Out of memory error in pack_statelist(). Aborting...\n");
+		exit(4);
+	}
+	for (uint32_t i = 0; i < len; i++) {
+		if (states[i] >= 1<<24 || (i > 0 && states[i] <= states[i-1])) {
+			free(bitarray);
+			return NULL;
+		}
+		bitarray[states[i] >> 5] |= 0x80000000 >> (states[i] & 0x1f);
+	}
+	packed_statelist_t *sl = pack_bitarray(bitarray);
+	free(bitarray);
+	return sl;
+}
+
+
+void free_packed_statelist(packed_statelist_t *sl)
+{
+	free(sl);
+}
+
+
+static uint32_t unpack_container(packed_statelist_t *sl, packed_container_t *c, uint32_t skip, uint32_t len, uint32_t *states)
+{
+	// write up to len states of the container to states[], beginning with the skip-th state of the container
+	uint32_t high = (uint32_t)c->block << 16;
+	uint32_t n = 0;
+	if (c->type == CONTAINER_DELTA) {
+		const uint8_t *p = sl->data + c->offset;
+		uint32_t state = -1;
+		for (uint32_t i = 0; i < c->count && n < len; i++) {
+			uint32_t delta;
+			p = get_delta(p, &delta);
+			state += delta;
+			if (i >= skip) {
+				states[n++] = high | state;
+			}
+		}
+	} else {
+		const uint32_t *words = (const uint32_t *)(sl->data + c->offset);
+		for (uint32_t i = 0; i < CONTAINER_WORDS && n < len; i++) {
+			uint32_t word = words[i];
+			uint32_t bits = __builtin_popcount(word);
+			if (skip >= bits) {
+				skip -= bits;
+				continue;
+			}
+			while (word && n < len) {
+				uint32_t state = i * 32 + __builtin_clz(word);
+				word &= ~(0x80000000 >> (state & 0x1f));
+				if (skip) {
+					skip--;
+				} else {
+					states[n++] = high | state;
+				}
+			}
+		}
+	}
+	return n;
+}
+
+
+uint32_t unpack_states(packed_statelist_t *sl, uint32_t start, uint32_t len, uint32_t *states)
+{
+	// write the states with index start ... start+len-1 to states[]. Returns the number of states written.
+	if (start >= sl->len) {
+		return 0;
+	}
+	// find the container holding the first requested state
+	uint32_t lo = 0;
+	uint32_t hi = sl->num_containers - 1;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi + 1) / 2;
+		if (sl->containers[mid].first <= start) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	uint32_t n = 0;
+	for (uint32_t i = lo; i < sl->num_containers && n < len; i++) {
+		packed_container_t *c = &sl->containers[i];
+		uint32_t skip = start + n - c->first;
+		n += unpack_container(sl, c, skip, len - n, states + n);
+	}
+	return n;
+}
+
+
+bool find_packed_state(packed_statelist_t *sl, uint32_t state, uint32_t *index)
+{
+	// check if state is in the list. Return its index if found.
+	for (uint32_t i = 0; i < sl->num_containers; i++) {
+		packed_container_t *c = &sl->containers[i];
+		if (c->block != state >> 16) {
+			continue;
+		}
+		uint32_t low = state & 0xffff;
+		if (c->type == CONTAINER_DELTA) {
+			const uint8_t *p = sl->data + c->offset;
+			uint32_t s = -1;
+			for (uint32_t j = 0; j < c->count; j++) {
+				uint32_t delta;
+				p = get_delta(p, &delta);
+				s += delta;
+				if (s == low) {
+					*index = c->first + j;
+					return true;
+				}
+				if (s > low) {
+					break;
+				}
+			}
+		} else {
+			const uint32_t *words = (const uint32_t *)(sl->data + c->offset);
+			if (words[low >> 5] & (0x80000000 >> (low & 0x1f))) {
+				uint32_t j = 0;
+				for (uint32_t w = 0; w < low >> 5; w++) {
+					j += __builtin_popcount(words[w]);
+				}
+				j += __builtin_popcount(words[low >> 5] & ~(0xffffffff >> (low & 0x1f)));
+				*index = c->first + j;
+				return true;
+			}
+		}
+		break;
+	}
+	return false;
+}
+
+
+size_t packed_statelist_size(packed_statelist_t *sl)
+{
+	return sizeof(packed_statelist_t) + sl->num_containers * sizeof(packed_container_t) + sl->data_size;
+}
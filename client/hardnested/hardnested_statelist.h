@@ -0,0 +1,45 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Compact storage of sorted lists of 24 bit crypto1 half states
+//-----------------------------------------------------------------------------
+
+#ifndef HARDNESTED_STATELIST_H__
+#define HARDNESTED_STATELIST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	CONTAINER_DELTA,					// sorted list, each state encoded as distance to its predecessor (1-3 bytes)
+	CONTAINER_BITMAP					// dense bitarray of all 2^16 states of the container
+} container_type_t;
+
+typedef struct {
+	uint8_t block;						// bits 16..23 of all states in this container
+	uint8_t type;
+	uint16_t reserved;
+	uint32_t first;						// index of the first state of this container in the whole list
+	uint32_t count;						// number of states in this container
+	uint32_t offset;					// start of the container data
+} packed_container_t;
+
+typedef struct {
+	uint32_t len;						// number of states
+	uint32_t num_containers;			// only non empty containers are stored
+	uint32_t data_size;
+	packed_container_t *containers;
+	uint8_t *data;
+} packed_statelist_t;
+
+extern packed_statelist_t *pack_bitarray(uint32_t *bitarray);
+extern packed_statelist_t *pack_statelist(uint32_t *states, uint32_t len);
+extern void free_packed_statelist(packed_statelist_t *sl);
+extern uint32_t unpack_states(packed_statelist_t *sl, uint32_t start, uint32_t len, uint32_t *states);
+extern bool find_packed_state(packed_statelist_t *sl, uint32_t state, uint32_t *index);
+extern size_t packed_statelist_size(packed_statelist_t *sl);
+
+#endif
@@ -0,0 +1,351 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Work unit files for distributing the hardnested brute force phase
+//
+// A work unit file holds everything which is needed to brute force a part of
+// the key candidates on another machine: the cuid, the order of first bytes,
+// all nonces (to verify keys) and the candidate states of some buckets.
+// A worker (see hardnested_worker.c) writes a result file for each unit.
+// Files are written to a temporary file first and then renamed, i.e. a reader
+// never sees partially written files.
+//-----------------------------------------------------------------------------
+
+#include "hardnested_workunit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#define WORK_UNIT_MAGIC					"HNWU"
+#define WORK_RESULT_MAGIC				"HNWR"
+#define WORK_UNIT_VERSION				2
+#define WORK_UNIT_UNPACK_STATES			(1<<16)
+#define WORK_UNIT_TMP_SUFFIX			".tmp"
+#define WORK_UNIT_MAX_BUCKETS			(1<<20)
+
+typedef enum {
+	EVEN_STATE = 0,
+	ODD_STATE = 1
+} odd_even_t;
+
+// All numbers are stored big endian (num_to_bytes()) at fixed offsets.
+// work unit: header, nonces (256 * (number of nonces, number * (nonce, parity bits (1 byte)))),
+// buckets (num_buckets * (odd length, even length, odd states, even states))
+#define WU_MAGIC						0
+#define WU_VERSION						4
+#define WU_HEADER_SIZE					8
+#define WU_JOB_ID						12
+#define WU_UNIT							16
+#define WU_NUM_UNITS					20
+#define WU_CUID							24
+#define WU_NUM_ACQUIRED_NONCES			28
+#define WU_NUM_BUCKETS					32
+#define WU_BEST_FIRST_BYTES				36
+#define WORK_UNIT_HEADER_SIZE			(WU_BEST_FIRST_BYTES + 256)
+
+// result
+#define WR_MAGIC						0
+#define WR_VERSION						4
+#define WR_SIZE							8
+#define WR_JOB_ID						12
+#define WR_UNIT							16
+#define WR_STATUS						20
+#define WR_KEY							24
+#define WR_NUM_KEYS_TESTED				32
+#define WR_ELAPSED_TIME					40
+#define WORK_RESULT_SIZE				48
+
+
+void work_unit_filename(char *filename, char *directory, uint32_t job_id, uint32_t unit, char *suffix)
+{
+	snprintf(filename, FILE_PATH_SIZE, "%s/hardnested_%08x_%05u%s", directory, job_id, unit, suffix);
+}
+
+
+static bool finish_file(FILE *f, char *tmp_filename, char *filename)
+{
+	// close the temporary file and give it its final name
+	bool write_error = ferror(f);
+	if (fclose(f) != 0 || write_error || rename(tmp_filename, filename) != 0) {
+		remove(tmp_filename);
+		return false;
+	}
+	return true;
+}
+
+
+static void write_states(FILE *f, statelist_t *bucket, odd_even_t odd_even)
+{
+	uint32_t *states = (uint32_t *)malloc(WORK_UNIT_UNPACK_STATES * sizeof(uint32_t));
+	uint8_t *buf = (uint8_t *)malloc(WORK_UNIT_UNPACK_STATES * 4);
+	if (states == NULL || buf == NULL) {
+		printf("Out of memory error in write_work_unit(). Aborting...\n");
+		exit(4);
+	}
+	for (uint32_t i = 0; i < bucket->len[odd_even]; i += WORK_UNIT_UNPACK_STATES) {
+		uint32_t n = MIN(WORK_UNIT_UNPACK_STATES, bucket->len[odd_even] - i);
+		if (bucket->packed[odd_even] == NULL) {
+			memcpy(states, bucket->states[odd_even] + i, n * sizeof(uint32_t));
+		} else {
+			n = unpack_states(bucket->packed[odd_even], bucket->start[odd_even] + i, n, states);
+		}
+		for (uint32_t j = 0; j < n; j++) {
+			num_to_bytes(states[j], 4, buf + 4*j);
+		}
+		fwrite(buf, 4, n, f);
+	}
+	free(buf);
+	free(states);
+}
+
+
+bool write_work_unit(char *filename, work_unit_t *wu)
+{
+	char tmp_filename[FILE_PATH_SIZE];
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s" WORK_UNIT_TMP_SUFFIX, filename);
+	FILE *f = fopen(tmp_filename, "wb");
+	if (f == NULL) {
+		return false;
+	}
+
+	uint8_t header[WORK_UNIT_HEADER_SIZE];
+	memcpy(header + WU_MAGIC, WORK_UNIT_MAGIC, 4);
+	num_to_bytes(WORK_UNIT_VERSION, 4, header + WU_VERSION);
+	num_to_bytes(WORK_UNIT_HEADER_SIZE, 4, header + WU_HEADER_SIZE);
+	num_to_bytes(wu->job_id, 4, header + WU_JOB_ID);
+	num_to_bytes(wu->unit, 4, header + WU_UNIT);
+	num_to_bytes(wu->num_units, 4, header + WU_NUM_UNITS);
+	num_to_bytes(wu->cuid, 4, header + WU_CUID);
+	num_to_bytes(wu->num_acquired_nonces, 4, header + WU_NUM_ACQUIRED_NONCES);
+	num_to_bytes(wu->num_buckets, 4, header + WU_NUM_BUCKETS);
+	memcpy(header + WU_BEST_FIRST_BYTES, wu->best_first_bytes, 256);
+	fwrite(header, 1, sizeof(header), f);
+
+	uint8_t buf[5];
+	for (uint16_t i = 0; i < 256; i++) {
+		uint32_t num = 0;
+		for (noncelistentry_t *p = wu->nonces[i].first; p != NULL && num < wu->nonces[i].num; p = p->next) {
+			num++;
+		}
+		num_to_bytes(num, 4, buf);
+		fwrite(buf, 1, 4, f);
+		for (noncelistentry_t *p = wu->nonces[i].first; p != NULL && num > 0; p = p->next, num--) {
+			num_to_bytes(p->nonce_enc, 4, buf);
+			buf[4] = p->par_enc;
+			fwrite(buf, 1, 5, f);
+		}
+	}
+
+	statelist_t *bucket = wu->buckets;
+	for (uint32_t i = 0; i < wu->num_buckets; i++, bucket = bucket->next) {
+		num_to_bytes(bucket->len[ODD_STATE], 4, buf);
+		fwrite(buf, 1, 4, f);
+		num_to_bytes(bucket->len[EVEN_STATE], 4, buf);
+		fwrite(buf, 1, 4, f);
+		write_states(f, bucket, ODD_STATE);
+		write_states(f, bucket, EVEN_STATE);
+	}
+
+	return finish_file(f, tmp_filename, filename);
+}
+
+
+static bool read_states(FILE *f, statelist_t *bucket, odd_even_t odd_even)
+{
+	uint32_t len = bucket->len[odd_even];
+	if (len > 1<<24) {
+		return false;
+	}
+	bucket->states[odd_even] = (uint32_t *)malloc((len + 1) * sizeof(uint32_t));
+	uint8_t *buf = (uint8_t *)malloc(WORK_UNIT_UNPACK_STATES * 4);
+	if (bucket->states[odd_even] == NULL || buf == NULL) {
+		printf("Out of memory error in read_work_unit(). Aborting...\n");
+		exit(4);
+	}
+	bool read_error = false;
+	for (uint32_t i = 0; i < len && !read_error; i += WORK_UNIT_UNPACK_STATES) {
+		uint32_t n = MIN(WORK_UNIT_UNPACK_STATES, len - i);
+		read_error = fread(buf, 4, n, f) != n;
+		for (uint32_t j = 0; j < n && !read_error; j++) {
+			bucket->states[odd_even][i + j] = bytes_to_num(buf + 4*j, 4);
+		}
+	}
+	free(buf);
+	bucket->states[odd_even][len] = 0xffffffff;		// End Of List marker
+	return !read_error;
+}
+
+
+bool read_work_unit(char *filename, work_unit_t *wu)
+{
+	memset(wu, 0, sizeof(work_unit_t));
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	uint8_t header[WORK_UNIT_HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header)
+		|| memcmp(header + WU_MAGIC, WORK_UNIT_MAGIC, 4) != 0
+		|| bytes_to_num(header + WU_VERSION, 4) != WORK_UNIT_VERSION
+		|| bytes_to_num(header + WU_HEADER_SIZE, 4) != WORK_UNIT_HEADER_SIZE) {
+		fclose(f);
+		return false;
+	}
+	wu->job_id = bytes_to_num(header + WU_JOB_ID, 4);
+	wu->unit = bytes_to_num(header + WU_UNIT, 4);
+	wu->num_units = bytes_to_num(header + WU_NUM_UNITS, 4);
+	wu->cuid = bytes_to_num(header + WU_CUID, 4);
+	wu->num_acquired_nonces = bytes_to_num(header + WU_NUM_ACQUIRED_NONCES, 4);
+	uint32_t num_buckets = bytes_to_num(header + WU_NUM_BUCKETS, 4);
+	memcpy(wu->best_first_bytes, header + WU_BEST_FIRST_BYTES, 256);
+	if (wu->unit >= wu->num_units || num_buckets > WORK_UNIT_MAX_BUCKETS) {
+		fclose(f);
+		return false;
+	}
+
+	wu->nonces = (noncelist_t *)calloc(256, sizeof(noncelist_t));
+	if (wu->nonces == NULL) {
+		printf("Out of memory error in read_work_unit(). Aborting...\n");
+		exit(4);
+	}
+	bool read_error = false;
+	uint8_t buf[5];
+	for (uint16_t i = 0; i < 256 && !read_error; i++) {
+		if (fread(buf, 1, 4, f) != 4) {
+			read_error = true;
+			break;
+		}
+		uint32_t num = bytes_to_num(buf, 4);
+		if (num > wu->num_acquired_nonces) {
+			read_error = true;
+			break;
+		}
+		noncelistentry_t **next = &wu->nonces[i].first;
+		for (uint32_t j = 0; j < num; j++) {
+			if (fread(buf, 1, 5, f) != 5) {
+				read_error = true;
+				break;
+			}
+			noncelistentry_t *p = (noncelistentry_t *)malloc(sizeof(noncelistentry_t));
+			if (p == NULL) {
+				printf("Out of memory error in read_work_unit(). Aborting...\n");
+				exit(4);
+			}
+			p->nonce_enc = bytes_to_num(buf, 4);
+			p->par_enc = buf[4];
+			p->next = NULL;
+			*next = p;
+			next = (noncelistentry_t **)&p->next;
+			wu->nonces[i].num++;
+		}
+	}
+
+	statelist_t **next = &wu->buckets;
+	for (uint32_t i = 0; i < num_buckets && !read_error; i++) {
+		statelist_t *bucket = (statelist_t *)calloc(1, sizeof(statelist_t));
+		if (bucket == NULL) {
+			printf("Out of memory error in read_work_unit(). Aborting...\n");
+			exit(4);
+		}
+		*next = bucket;
+		next = (statelist_t **)&bucket->next;
+		wu->num_buckets++;
+		if (fread(buf, 1, 4, f) != 4) {
+			read_error = true;
+			break;
+		}
+		bucket->len[ODD_STATE] = bytes_to_num(buf, 4);
+		if (fread(buf, 1, 4, f) != 4) {
+			read_error = true;
+			break;
+		}
+		bucket->len[EVEN_STATE] = bytes_to_num(buf, 4);
+		read_error = !read_states(f, bucket, ODD_STATE) || !read_states(f, bucket, EVEN_STATE);
+	}
+	fclose(f);
+
+	if (read_error) {
+		free_work_unit(wu);
+		return false;
+	}
+	return true;
+}
+
+
+void free_work_unit(work_unit_t *wu)
+{
+	if (wu->nonces != NULL) {
+		for (uint16_t i = 0; i < 256; i++) {
+			noncelistentry_t *p = wu->nonces[i].first;
+			while (p != NULL) {
+				noncelistentry_t *q = p->next;
+				free(p);
+				p = q;
+			}
+		}
+		free(wu->nonces);
+		wu->nonces = NULL;
+	}
+	statelist_t *bucket = wu->buckets;
+	while (bucket != NULL) {
+		statelist_t *next = bucket->next;
+		free(bucket->states[ODD_STATE]);
+		free(bucket->states[EVEN_STATE]);
+		free(bucket);
+		bucket = next;
+	}
+	wu->buckets = NULL;
+	wu->num_buckets = 0;
+}
+
+
+bool write_work_result(char *filename, work_result_t *result)
+{
+	char tmp_filename[FILE_PATH_SIZE];
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s" WORK_UNIT_TMP_SUFFIX, filename);
+	FILE *f = fopen(tmp_filename, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	uint8_t buf[WORK_RESULT_SIZE];
+	memcpy(buf + WR_MAGIC, WORK_RESULT_MAGIC, 4);
+	num_to_bytes(WORK_UNIT_VERSION, 4, buf + WR_VERSION);
+	num_to_bytes(WORK_RESULT_SIZE, 4, buf + WR_SIZE);
+	num_to_bytes(result->job_id, 4, buf + WR_JOB_ID);
+	num_to_bytes(result->unit, 4, buf + WR_UNIT);
+	num_to_bytes(result->status, 4, buf + WR_STATUS);
+	num_to_bytes(result->key, 8, buf + WR_KEY);
+	num_to_bytes(result->num_keys_tested, 8, buf + WR_NUM_KEYS_TESTED);
+	num_to_bytes(result->elapsed_time, 8, buf + WR_ELAPSED_TIME);
+	fwrite(buf, 1, sizeof(buf), f);
+	return finish_file(f, tmp_filename, filename);
+}
+
+
+bool read_work_result(char *filename, work_result_t *result)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	uint8_t buf[WORK_RESULT_SIZE];
+	bool valid = fread(buf, 1, sizeof(buf), f) == sizeof(buf)
+				&& memcmp(buf + WR_MAGIC, WORK_RESULT_MAGIC, 4) == 0
+				&& bytes_to_num(buf + WR_VERSION, 4) == WORK_UNIT_VERSION
+				&& bytes_to_num(buf + WR_SIZE, 4) == WORK_RESULT_SIZE;
+	fclose(f);
+	if (!valid) {
+		return false;
+	}
+	result->job_id = bytes_to_num(buf + WR_JOB_ID, 4);
+	result->unit = bytes_to_num(buf + WR_UNIT, 4);
+	result->status = bytes_to_num(buf + WR_STATUS, 4);
+	result->key = bytes_to_num(buf + WR_KEY, 8);
+	result->num_keys_tested = bytes_to_num(buf + WR_NUM_KEYS_TESTED, 8);
+	result->elapsed_time = bytes_to_num(buf + WR_ELAPSED_TIME, 8);
+	return true;
+}
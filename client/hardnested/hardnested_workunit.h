@@ -0,0 +1,55 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Work unit files for distributing the hardnested brute force phase
+//-----------------------------------------------------------------------------
+
+#ifndef HARDNESTED_WORKUNIT_H__
+#define HARDNESTED_WORKUNIT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cmdhfmfhard.h"
+#include "hardnested_bruteforce.h"
+
+#define WORK_UNIT_SUFFIX				".unit"
+#define WORK_UNIT_CLAIMED_SUFFIX		".work"		// appended to a unit file by the worker processing it
+#define WORK_RESULT_SUFFIX				".result"
+
+typedef struct {
+	uint32_t job_id;					// identifies one set of candidates. Results of other jobs are ignored.
+	uint32_t unit;
+	uint32_t num_units;
+	uint32_t cuid;
+	uint32_t num_acquired_nonces;
+	uint8_t best_first_bytes[256];
+	noncelist_t *nonces;				// 256 nonce lists, cuid already XORed (see pre_XOR_nonces())
+	statelist_t *buckets;				// linked list of the buckets to brute force
+	uint32_t num_buckets;
+} work_unit_t;
+
+typedef enum {
+	WORK_RESULT_DONE = 0,				// all keys of the unit tested, key not found
+	WORK_RESULT_KEY_FOUND = 1,
+	WORK_RESULT_INVALID_UNIT = 2		// the worker couldn't read the unit. The client has to brute force it itself.
+} work_result_status_t;
+
+typedef struct {
+	uint32_t job_id;
+	uint32_t unit;
+	work_result_status_t status;
+	uint64_t key;
+	uint64_t num_keys_tested;
+	uint64_t elapsed_time;				// in ms
+} work_result_t;
+
+extern void work_unit_filename(char *filename, char *directory, uint32_t job_id, uint32_t unit, char *suffix);	// filename[FILE_PATH_SIZE]
+extern bool write_work_unit(char *filename, work_unit_t *wu);
+extern bool read_work_unit(char *filename, work_unit_t *wu);
+extern void free_work_unit(work_unit_t *wu);
+extern bool write_work_result(char *filename, work_result_t *result);
+extern bool read_work_result(char *filename, work_result_t *result);
+
+#endif
@@ -0,0 +1,233 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Headless worker for the hardnested brute force phase. Processes the work
+// units written by "hf mf hardnested ... x <directory>" and writes a result
+// file for each of them. Several workers on several machines can share one
+// directory (e.g. a network share).
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <utime.h>
+#include "proxmark3.h"
+#include "util.h"
+#include "util_posix.h"
+#include "whereami.h"
+#include "cmdhfmfhard.h"
+#include "hardnested/hardnested_bruteforce.h"
+#include "hardnested/hardnested_workunit.h"
+
+#define WORKER_POLL_INTERVAL			1000		// ms between two scans of the directory when waiting for work
+#define WORKER_HEARTBEAT_INTERVAL		10000		// ms between two updates of the work file's modification time
+
+typedef enum {
+	EVEN_STATE = 0,
+	ODD_STATE = 1
+} odd_even_t;
+
+
+static char *my_executable_directory = NULL;
+
+const char *get_my_executable_directory(void)
+{
+	return my_executable_directory;
+}
+
+
+static void set_my_executable_directory(void)
+{
+	int path_length = wai_getExecutablePath(NULL, 0, NULL);
+	if (path_length != -1) {
+		char *my_executable_path = (char *)malloc(path_length + 1);
+		int dirname_length = 0;
+		if (wai_getExecutablePath(my_executable_path, path_length, &dirname_length) != -1) {
+			my_executable_directory = (char *)malloc(dirname_length + 2);
+			strncpy(my_executable_directory, my_executable_path, dirname_length+1);
+			my_executable_directory[dirname_length+1] = '\0';
+		}
+		free(my_executable_path);
+	}
+}
+
+
+void hardnested_print_progress(uint32_t nonces, char *activity, float brute_force, uint64_t min_diff_print_time)
+{
+	// called by the brute forcer. The results are reported per work unit instead.
+}
+
+
+static char *heartbeat_filename = NULL;
+static uint64_t last_heartbeat_time;
+static pthread_mutex_t heartbeat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void heartbeat(void)
+{
+	// called by the brute force threads after each chunk. Touch the work file to show the client
+	// that the unit is still being processed. Otherwise it would hand it out again after its lease time.
+	if (msclock() - last_heartbeat_time < WORKER_HEARTBEAT_INTERVAL) {
+		return;
+	}
+	pthread_mutex_lock(&heartbeat_mutex);
+	if (msclock() - last_heartbeat_time >= WORKER_HEARTBEAT_INTERVAL) {
+		utime(heartbeat_filename, NULL);
+		last_heartbeat_time = msclock();
+	}
+	pthread_mutex_unlock(&heartbeat_mutex);
+}
+
+
+static void write_result(char *directory, work_result_t *result)
+{
+	char result_filename[FILE_PATH_SIZE];
+	work_unit_filename(result_filename, directory, result->job_id, result->unit, WORK_RESULT_SUFFIX);
+	if (!write_work_result(result_filename, result)) {
+		printf("Could not write %s\n", result_filename);
+	}
+}
+
+
+static bool process_work_unit(char *directory, char *unit_name, char *unit_filename)
+{
+	// returns false if unit_filename has been claimed by another worker meanwhile
+	char work_filename[FILE_PATH_SIZE + sizeof(WORK_UNIT_CLAIMED_SUFFIX)];
+	snprintf(work_filename, sizeof(work_filename), "%s" WORK_UNIT_CLAIMED_SUFFIX, unit_filename);
+	if (rename(unit_filename, work_filename) != 0) {
+		return false;
+	}
+	utime(work_filename, NULL);		// start of the lease, rename() keeps the modification time
+
+	work_unit_t wu;
+	if (!read_work_unit(work_filename, &wu)) {
+		// tell the client, which brute forces the unit itself then. Job and unit are taken from the file name.
+		work_result_t result = {0, 0, WORK_RESULT_INVALID_UNIT, 0, 0, 0};
+		printf("%s is not a valid work unit.\n", unit_filename);
+		if (sscanf(unit_name, "hardnested_%08" SCNx32 "_%05" SCNu32, &result.job_id, &result.unit) != 2) {
+			return true;
+		}
+		if (remove(work_filename) == 0) {
+			write_result(directory, &result);
+		}
+		return true;
+	}
+
+	uint64_t num_states = 0;
+	for (statelist_t *p = wu.buckets; p != NULL; p = p->next) {
+		num_states += (uint64_t)p->len[ODD_STATE] * p->len[EVEN_STATE];
+	}
+	wu.nonces[wu.best_first_bytes[0]].expected_num_brute_force = num_states / 2;
+	printf("Job %08x, unit %u of %u: brute forcing 2^%1.1f keys... ", wu.job_id, wu.unit + 1, wu.num_units, log(num_states)/log(2.0));
+	fflush(stdout);
+
+	uint64_t start_time = msclock();
+	prepare_bf_test_nonces(wu.nonces, wu.best_first_bytes[0]);
+	float bf_rate = 0.0;
+	work_result_t result = {wu.job_id, wu.unit, WORK_RESULT_DONE, 0, num_states, 0};
+	// the bitmap isn't used to skip anything. The checkpoint callback only serves as a heartbeat.
+	bf_checkpoint_t checkpoint;
+	checkpoint.work_units_done = (uint8_t *)calloc((bf_num_work_units(wu.buckets) + 7) / 8, 1);
+	if (checkpoint.work_units_done == NULL) {
+		printf("Out of memory error in process_work_unit(). Aborting...\n");
+		exit(4);
+	}
+	checkpoint.save = heartbeat;
+	heartbeat_filename = work_filename;
+	last_heartbeat_time = msclock();
+	if (brute_force_bs(&bf_rate, wu.buckets, wu.cuid, wu.num_acquired_nonces, num_states, wu.nonces, wu.best_first_bytes, &result.key, &checkpoint)) {
+		result.status = WORK_RESULT_KEY_FOUND;
+	}
+	result.elapsed_time = msclock() - start_time;
+	free(checkpoint.work_units_done);
+	free_work_unit(&wu);
+
+	if (result.status == WORK_RESULT_KEY_FOUND) {
+		printf("Key found: %012" PRIx64 "\n", result.key);
+	} else {
+		printf("done in %1.1fs (%1.0f million keys/s)\n", (float)result.elapsed_time/1000.0, bf_rate/1000000);
+	}
+
+	// the client removes the work file if it isn't interested in the result any more
+	if (remove(work_filename) != 0) {
+		printf("Job %08x has been cancelled.\n", result.job_id);
+		return true;
+	}
+	write_result(directory, &result);
+	return true;
+}
+
+
+static bool process_directory(char *directory)
+{
+	// process all work units currently present in directory. Returns false if there were none.
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		printf("Could not open directory %s\n", directory);
+		exit(1);
+	}
+	bool found_work = false;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		size_t suffix_len = strlen(WORK_UNIT_SUFFIX);
+		if (len <= suffix_len || strcmp(entry->d_name + len - suffix_len, WORK_UNIT_SUFFIX) != 0) {
+			continue;
+		}
+		char unit_filename[FILE_PATH_SIZE];
+		snprintf(unit_filename, sizeof(unit_filename), "%s/%s", directory, entry->d_name);
+		found_work |= process_work_unit(directory, entry->d_name, unit_filename);
+	}
+	closedir(dir);
+	return found_work;
+}
+
+
+static void usage(char *argv0)
+{
+	fprintf(stderr, "Usage:   %s [-w] <directory>\n\n", argv0);
+	fprintf(stderr, "\tProcess the hardnested work units in <directory>\n");
+	fprintf(stderr, "\t-w\tDon't exit when all work units are done. Wait for new ones instead.\n\n");
+	fprintf(stderr, "\nExample:\n\n\t %s -w /mnt/share/hardnested\n", argv0);
+}
+
+
+int main(int argc, char **argv)
+{
+	bool wait = false;
+	char *directory = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0) {
+			wait = true;
+		} else if (directory == NULL) {
+			directory = argv[i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (directory == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	set_my_executable_directory();
+
+	while (true) {
+		if (!process_directory(directory)) {
+			if (!wait) {
+				break;
+			}
+			msleep(WORKER_POLL_INTERVAL);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,448 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Key dictionaries (*.dic) with a compiled index and hit statistics
+//
+// A .dic file is a text file with one hex key per line. Lines starting with #
+// are comments. When a .dic file is used the first time, it is parsed and a
+// compiled index is written to the user's cache directory (see
+// get_user_cache_path()), named after the .dic file and a hash of its full
+// path. The index holds the deduplicated keys in the order they should be
+// tried together with the number of times each key has been found valid.
+// Later runs map the index directly instead of parsing the text file again.
+// The index is rebuilt (keeping the statistics) when the size or the hash of
+// the contents of the .dic file have changed.
+//-----------------------------------------------------------------------------
+
+#if !defined(_WIN32)
+#define _XOPEN_SOURCE 500				// need realpath()
+#endif
+
+#include "keydict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "ui.h"
+#include "util_posix.h"
+
+#define KEYDICT_MAGIC					"PM3KDIX"
+#define KEYDICT_VERSION					2
+#define KEYDICT_TMP_SUFFIX				".tmp"
+#define KEYDICT_MAX_LINE				256
+#define KEYDICT_HASH_BLOCK				65536
+#ifndef PATH_MAX
+#define PATH_MAX						4096
+#endif
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t key_len;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t source_size;				// of the .dic file the index was built from
+	uint64_t source_hash;				// FNV-1a of its contents
+} keydict_header_t;
+
+typedef struct {
+	uint64_t key;
+	uint32_t index;						// in dict->entries
+} keydict_lookup_t;
+
+
+static int compare_key_line(const void *a, const void *b)
+{
+	const keydict_entry_t *e1 = a;
+	const keydict_entry_t *e2 = b;
+	if (e1->key != e2->key) return e1->key < e2->key ? -1 : 1;
+	if (e1->line != e2->line) return e1->line < e2->line ? -1 : 1;
+	return 0;
+}
+
+
+static int compare_hits_line(const void *a, const void *b)
+{
+	const keydict_entry_t *e1 = a;
+	const keydict_entry_t *e2 = b;
+	if (e1->hits != e2->hits) return e1->hits > e2->hits ? -1 : 1;
+	if (e1->line != e2->line) return e1->line < e2->line ? -1 : 1;
+	return 0;
+}
+
+
+static int compare_lookup(const void *a, const void *b)
+{
+	const keydict_lookup_t *e1 = a;
+	const keydict_lookup_t *e2 = b;
+	if (e1->key != e2->key) return e1->key < e2->key ? -1 : 1;
+	return 0;
+}
+
+
+static bool hash_file(const char *filename, uint64_t *hash)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	uint8_t *buf = (uint8_t *)malloc(KEYDICT_HASH_BLOCK);
+	if (buf == NULL) {
+		printf("Out of memory error in hash_file(). Aborting...\n");
+		exit(4);
+	}
+	*hash = FNV1A_64_INIT;
+	size_t len;
+	while ((len = fread(buf, 1, KEYDICT_HASH_BLOCK, f)) > 0) {
+		*hash = fnv1a_64(*hash, buf, len);
+	}
+	bool read_error = ferror(f);
+	fclose(f);
+	free(buf);
+	return !read_error;
+}
+
+
+static bool get_index_filename(const char *filename, char *index_filename, size_t size)
+{
+	// <cache directory>/<name of the .dic file>_<hash of its full path>.idx. Different files with the same name get different indexes.
+	char path[PATH_MAX];
+#if defined(_WIN32)
+	if (_fullpath(path, filename, sizeof(path)) == NULL) {
+		return false;
+	}
+	const char *name = strrchr(path, '\\');
+	const char *name2 = strrchr(path, '/');
+	if (name2 > name) name = name2;
+#else
+	if (realpath(filename, path) == NULL) {
+		return false;
+	}
+	const char *name = strrchr(path, '/');
+#endif
+	name = name == NULL ? path : name + 1;
+	char cache_filename[FILE_PATH_SIZE];
+	if (snprintf(cache_filename, sizeof(cache_filename), "%.200s_%016" PRIx64 KEYDICT_INDEX_SUFFIX, name, fnv1a_64(FNV1A_64_INIT, path, strlen(path))) >= (int)sizeof(cache_filename)) {
+		return false;
+	}
+	return get_user_cache_path(cache_filename, index_filename, size);
+}
+
+
+static uint32_t dedup_entries(keydict_entry_t *entries, uint32_t count)
+{
+	// remove duplicate keys, keep the first occurrence. Result is sorted by key.
+	if (count == 0) {
+		return 0;
+	}
+	qsort(entries, count, sizeof(keydict_entry_t), compare_key_line);
+	uint32_t n = 1;
+	for (uint32_t i = 1; i < count; i++) {
+		if (entries[i].key != entries[n-1].key) {
+			entries[n++] = entries[i];
+		}
+	}
+	return n;
+}
+
+
+static keydict_entry_t *parse_dic_file(const char *filename, uint8_t key_len, uint32_t *count)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		return NULL;
+	}
+
+	uint32_t num_entries = 0;
+	uint32_t max_entries = 1024;
+	keydict_entry_t *entries = (keydict_entry_t *)malloc(max_entries * sizeof(keydict_entry_t));
+	if (entries == NULL) {
+		printf("Out of memory error in parse_dic_file(). Aborting...\n");
+		exit(4);
+	}
+
+	char buf[KEYDICT_MAX_LINE];
+	uint32_t line = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		size_t len = strlen(buf);
+		if (len > 0 && buf[len-1] != '\n' && !feof(f)) {
+			int ch;
+			while ((ch = fgetc(f)) != '\n' && ch != EOF) ;  //goto next line
+		}
+		line++;
+
+		if (buf[0] == '#' || buf[0] == '\n' || buf[0] == '\r' || buf[0] == '\0') continue;	// comment or empty line, skip
+
+		bool valid = len >= 2 * key_len;
+		for (uint8_t i = 0; i < 2 * key_len && valid; i++) {
+			valid = isxdigit((unsigned char)buf[i]);
+		}
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if (!valid) {
+			PrintAndLog("File content error. '%s' must include %d HEX symbols", buf, 2 * key_len);
+			continue;
+		}
+		buf[2 * key_len] = '\0';
+
+		if (num_entries == max_entries) {
+			max_entries *= 2;
+			entries = (keydict_entry_t *)realloc(entries, max_entries * sizeof(keydict_entry_t));
+			if (entries == NULL) {
+				printf("Out of memory error in parse_dic_file(). Aborting...\n");
+				exit(4);
+			}
+		}
+		entries[num_entries].key = strtoull(buf, NULL, 16);
+		entries[num_entries].hits = 0;
+		entries[num_entries].line = line;
+		num_entries++;
+	}
+	fclose(f);
+
+	*count = dedup_entries(entries, num_entries);
+	return entries;
+}
+
+
+static void *map_index(keydict_t *dict, keydict_header_t *header, size_t *map_size)
+{
+	// map the index file. The keys are at (keydict_header_t *)map + 1. Changes to the mapping are private.
+	FILE *f = fopen(dict->index_filename, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	if (fread(header, 1, sizeof(keydict_header_t), f) != sizeof(keydict_header_t)
+		|| memcmp(header->magic, KEYDICT_MAGIC, sizeof(KEYDICT_MAGIC)) != 0
+		|| header->version != KEYDICT_VERSION
+		|| header->key_len != dict->key_len) {
+		fclose(f);
+		return NULL;
+	}
+	size_t size = sizeof(keydict_header_t) + (size_t)header->count * sizeof(keydict_entry_t);
+	struct stat st;
+	if (stat(dict->index_filename, &st) != 0 || (size_t)st.st_size != size) {
+		fclose(f);
+		return NULL;
+	}
+#if !defined(_WIN32)
+	fclose(f);
+	int fd = open(dict->index_filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+#else
+	void *map = malloc(size);
+	if (map == NULL) {
+		printf("Out of memory error in map_index(). Aborting...\n");
+		exit(4);
+	}
+	rewind(f);
+	size_t bytes_read = fread(map, 1, size, f);
+	fclose(f);
+	if (bytes_read != size) {
+		free(map);
+		return NULL;
+	}
+#endif
+	*map_size = size;
+	return map;
+}
+
+
+static void unmap_index(void *map, size_t map_size)
+{
+#if !defined(_WIN32)
+	munmap(map, map_size);
+#else
+	free(map);
+#endif
+}
+
+
+static bool write_index(keydict_t *dict)
+{
+	// write to a temporary file first and rename it. Other clients never see a partial index.
+	char tmp_filename[sizeof(dict->index_filename) + sizeof(KEYDICT_TMP_SUFFIX)];
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s" KEYDICT_TMP_SUFFIX, dict->index_filename);
+	FILE *f = fopen(tmp_filename, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	keydict_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KEYDICT_MAGIC, sizeof(KEYDICT_MAGIC));
+	header.version = KEYDICT_VERSION;
+	header.key_len = dict->key_len;
+	header.count = dict->count;
+	header.source_size = dict->source_size;
+	header.source_hash = dict->source_hash;
+	fwrite(&header, 1, sizeof(header), f);
+	fwrite(dict->entries, sizeof(keydict_entry_t), dict->count, f);
+	bool write_error = ferror(f);
+	if (fclose(f) != 0 || write_error) {
+		remove(tmp_filename);
+		return false;
+	}
+#if defined(_WIN32)
+	remove(dict->index_filename);		// rename() doesn't replace existing files on Windows
+#endif
+	if (rename(tmp_filename, dict->index_filename) != 0) {
+		remove(tmp_filename);
+		return false;
+	}
+	return true;
+}
+
+
+bool keydict_load(const char *filename, uint8_t key_len, keydict_t *dict)
+{
+	// load the keys of a .dic file. Returns false if the file can't be read.
+	memset(dict, 0, sizeof(keydict_t));
+	dict->key_len = key_len;
+
+	struct stat st;
+	if (stat(filename, &st) != 0 || !hash_file(filename, &dict->source_hash)) {
+		return false;
+	}
+	dict->source_size = st.st_size;
+	if (!get_index_filename(filename, dict->index_filename, sizeof(dict->index_filename))) {
+		dict->index_filename[0] = '\0';		// no cache directory. Parse the .dic file each time.
+	}
+
+	keydict_header_t header;
+	size_t map_size = 0;
+	void *map = dict->index_filename[0] != '\0' ? map_index(dict, &header, &map_size) : NULL;
+	if (map != NULL && header.source_size == dict->source_size && header.source_hash == dict->source_hash) {
+		dict->map = map;
+		dict->map_size = map_size;
+		dict->count = header.count;
+		dict->entries = (keydict_entry_t *)((keydict_header_t *)map + 1);
+		return true;
+	}
+
+	// no (valid) index. Parse the text file and compile a new index.
+	dict->entries = parse_dic_file(filename, key_len, &dict->count);
+	if (dict->entries == NULL) {
+		if (map != NULL) {
+			unmap_index(map, map_size);
+		}
+		return false;
+	}
+
+	// the .dic file has changed. Keep the statistics of the keys which are still there.
+	if (map != NULL) {
+		keydict_entry_t *old_entries = (keydict_entry_t *)((keydict_header_t *)map + 1);
+		uint32_t old_count = dedup_entries(old_entries, header.count);
+		for (uint32_t i = 0, j = 0; i < dict->count && j < old_count; ) {
+			if (dict->entries[i].key == old_entries[j].key) {
+				dict->entries[i++].hits = old_entries[j++].hits;
+			} else if (dict->entries[i].key < old_entries[j].key) {
+				i++;
+			} else {
+				j++;
+			}
+		}
+		unmap_index(map, map_size);
+	}
+
+	qsort(dict->entries, dict->count, sizeof(keydict_entry_t), compare_hits_line);
+	if (dict->index_filename[0] != '\0') {
+		write_index(dict);		// not fatal if it fails. We just parse again next time.
+	}
+
+	return true;
+}
+
+
+void keydict_get_keys(keydict_t *dict, uint8_t *keyBlock)
+{
+	for (uint32_t i = 0; i < dict->count; i++) {
+		num_to_bytes(dict->entries[i].key, dict->key_len, keyBlock + i * dict->key_len);
+	}
+}
+
+
+bool keydict_add_hit(keydict_t *dict, uint64_t key)
+{
+	// count a successful use of key. Returns false if key isn't in the dictionary.
+	// The entries keep their order until keydict_close(), the lookup table stays valid until then.
+	if (dict->lookup == NULL) {
+		keydict_lookup_t *lookup = (keydict_lookup_t *)malloc(dict->count * sizeof(keydict_lookup_t) + 1);
+		if (lookup == NULL) {
+			printf("Out of memory error in keydict_add_hit(). Aborting...\n");
+			exit(4);
+		}
+		for (uint32_t i = 0; i < dict->count; i++) {
+			lookup[i].key = dict->entries[i].key;
+			lookup[i].index = i;
+		}
+		qsort(lookup, dict->count, sizeof(keydict_lookup_t), compare_lookup);
+		dict->lookup = lookup;
+	}
+	keydict_lookup_t wanted = {key, 0};
+	keydict_lookup_t *found = bsearch(&wanted, dict->lookup, dict->count, sizeof(keydict_lookup_t), compare_lookup);
+	if (found == NULL) {
+		return false;
+	}
+	dict->entries[found->index].hits++;
+	dict->modified = true;
+	return true;
+}
+
+
+void keydict_close(keydict_t *dict)
+{
+	// store the updated statistics and free the dictionary
+	if (dict->modified && dict->index_filename[0] != '\0') {
+		qsort(dict->entries, dict->count, sizeof(keydict_entry_t), compare_hits_line);
+		write_index(dict);
+	}
+	free(dict->lookup);
+	if (dict->map != NULL) {
+		unmap_index(dict->map, dict->map_size);
+	} else {
+		free(dict->entries);
+	}
+	memset(dict, 0, sizeof(keydict_t));
+}
+
+
+uint32_t keydict_dedup(uint8_t *keyBlock, uint32_t keycnt, uint8_t key_len)
+{
+	// remove duplicate keys from keyBlock, keep the first occurrence and the order. Returns the new number of keys.
+	keydict_entry_t *entries = (keydict_entry_t *)malloc(keycnt * sizeof(keydict_entry_t) + 1);
+	if (entries == NULL) {
+		printf("Out of memory error in keydict_dedup(). Aborting...\n");
+		exit(4);
+	}
+	for (uint32_t i = 0; i < keycnt; i++) {
+		entries[i].key = bytes_to_num(keyBlock + i * key_len, key_len);
+		entries[i].line = i;
+	}
+	uint32_t count = dedup_entries(entries, keycnt);
+	for (uint32_t i = 0; i < count; i++) {
+		entries[i].hits = 0;
+	}
+	qsort(entries, count, sizeof(keydict_entry_t), compare_hits_line);		// i.e. in original order
+	for (uint32_t i = 0; i < count; i++) {
+		num_to_bytes(entries[i].key, key_len, keyBlock + i * key_len);
+	}
+	free(entries);
+	return count;
+}
@@ -0,0 +1,44 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Key dictionaries (*.dic) with a compiled index and hit statistics
+//-----------------------------------------------------------------------------
+
+#ifndef KEYDICT_H__
+#define KEYDICT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "util.h"
+
+#define KEYDICT_INDEX_SUFFIX			".idx"
+
+typedef struct {
+	uint64_t key;
+	uint32_t hits;						// number of times the key has been found valid
+	uint32_t line;						// position in the .dic file. Keys with the same number of hits are tried in file order.
+} keydict_entry_t;
+
+typedef struct {
+	uint8_t key_len;					// in bytes
+	uint32_t count;
+	keydict_entry_t *entries;			// deduplicated, in the order the keys should be tried
+	char index_filename[FILE_PATH_SIZE + sizeof(KEYDICT_INDEX_SUFFIX)];
+	uint64_t source_size;
+	uint64_t source_hash;
+	void *map;
+	size_t map_size;
+	bool modified;
+	void *lookup;						// entries sorted by key for keydict_add_hit(), built on first use
+} keydict_t;
+
+extern bool keydict_load(const char *filename, uint8_t key_len, keydict_t *dict);
+extern void keydict_get_keys(keydict_t *dict, uint8_t *keyBlock);		// keyBlock[count * key_len], big endian
+extern bool keydict_add_hit(keydict_t *dict, uint64_t key);
+extern void keydict_close(keydict_t *dict);
+extern uint32_t keydict_dedup(uint8_t *keyBlock, uint32_t keycnt, uint8_t key_len);
+
+#endif
@@ -38,29 +38,19 @@
 
 #include "cipher.h"
 #include "cipherutils.h"
+#include "optimized_cipher.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #ifndef ON_DEVICE
 #include "fileutils.h"
+#include "cipher_bs.h"
 #endif
 
 
-/**
-* Definition 1 (Cipher state). A cipher state of iClass s is an element of F 40/2
-* consisting of the following four components:
-* 	1. the left register l = (l 0 . . . l 7 ) ∈ F 8/2 ;
-* 	2. the right register r = (r 0 . . . r 7 ) ∈ F 8/2 ;
-* 	3. the top register t = (t 0 . . . t 15 ) ∈ F 16/2 .
-* 	4. the bottom register b = (b 0 . . . b 7 ) ∈ F 8/2 .
-**/
-typedef struct {
-	uint8_t l;
-	uint8_t r;
-	uint8_t b;
-	uint16_t t;
-} State;
+// The cipher state (Definition 1) is shared with the optimized implementation
+// in common/optimized_cipher.c
 
 /**
 *	Definition 2. The feedback function for the top register T : F 16/2 → F 2
@@ -220,11 +210,15 @@ void MAC(uint8_t* k, BitstreamIn input, BitstreamOut out)
 	output(k,initState,&input_32_zeroes,&out);
 }
 
-void doMAC(uint8_t *cc_nr_p, uint8_t *div_key_p, uint8_t mac[4])
+#ifndef ON_DEVICE
+/**
+ * Reference implementation of the MAC over the bitstreams above. Only used to
+ * verify the optimized cipher, see testMAC().
+ */
+static void doMAC_reference(uint8_t *cc_nr_p, uint8_t *div_key_p, uint8_t mac[4])
 {
 	uint8_t cc_nr[13] = { 0 };
 	uint8_t div_key[8];
-	//cc_nr=(uint8_t*)malloc(length+1);
 
 	memcpy(cc_nr, cc_nr_p, 12);
 	memcpy(div_key, div_key_p, 8);
@@ -237,28 +231,30 @@ void doMAC(uint8_t *cc_nr_p, uint8_t *div_key_p, uint8_t mac[4])
 	//The output MAC must also be reversed
 	reverse_arraybytes(dest, sizeof(dest));
 	memcpy(mac, dest, 4);
-	//free(cc_nr);
 	return;
 }
-void doMAC_N(uint8_t *address_data_p, uint8_t address_data_size, uint8_t *div_key_p, uint8_t mac[4])
+#endif
+
+void doMAC(uint8_t *cc_nr_p, uint8_t *div_key_p, uint8_t mac[4])
 {
-	uint8_t *address_data;
-	uint8_t div_key[8];
-	address_data = (uint8_t*) malloc(address_data_size);
+	uint8_t cc_nr[12];
+	uint8_t dest[4];
 
-	memcpy(address_data, address_data_p, address_data_size);
-	memcpy(div_key, div_key_p, 8);
+	opt_reverse_arraybytecpy(cc_nr, cc_nr_p, 12);
+	opt_MAC(div_key_p, cc_nr, dest);
+	//The output MAC must also be reversed
+	opt_reverse_arraybytecpy(mac, dest, 4);
+}
 
-	reverse_arraybytes(address_data, address_data_size);
-	BitstreamIn bitstream = {address_data, address_data_size * 8, 0};
-	uint8_t dest []= {0,0,0,0,0,0,0,0};
-	BitstreamOut out = { dest, sizeof(dest)*8, 0 };
-	MAC(div_key, bitstream, out);
+void doMAC_N(uint8_t *address_data_p, uint8_t address_data_size, uint8_t *div_key_p, uint8_t mac[4])
+{
+	uint8_t address_data[UINT8_MAX];		// address_data_size can't be larger
+	uint8_t dest[4];
+
+	opt_reverse_arraybytecpy(address_data, address_data_p, address_data_size);
+	opt_MAC_N(div_key_p, address_data, address_data_size, dest);
 	//The output MAC must also be reversed
-	reverse_arraybytes(dest, sizeof(dest));
-	memcpy(mac, dest, 4);
-	free(address_data);
-	return;
+	opt_reverse_arraybytecpy(mac, dest, 4);
 }
 
 #ifndef ON_DEVICE
@@ -287,6 +283,45 @@ int testMAC()
 		return 1;
 	}
 
+	// the optimized cipher must match the reference implementation
+	uint8_t reference_mac[4] = {0};
+	uint8_t div_keys[256][8];
+	uint8_t macs[256][4];
+	for(int i = 0 ; i < 256 ; i++)
+	{
+		cc_nr[i % 12] ^= i * 0x1d;
+		div_key[i % 8] += i;
+		memcpy(div_keys[i], div_key, 8);
+		doMAC(cc_nr, div_key, calculated_mac);
+		doMAC_reference(cc_nr, div_key, reference_mac);
+		if(memcmp(calculated_mac, reference_mac, 4) != 0)
+		{
+			prnlog("[+] FAILED: optimized MAC differs from reference:");
+			printarr("    cc_nr         ", cc_nr, 12);
+			printarr("    div_key       ", div_key, 8);
+			printarr("    Calculated_MAC", calculated_mac, 4);
+			printarr("    Reference_MAC ", reference_mac, 4);
+			return 1;
+		}
+	}
+	prnlog("[+] Optimized MAC calculation OK!");
+
+	// and so must the bitsliced one
+	doMAC_bs(cc_nr, div_keys[0], 256, macs[0]);
+	for(int i = 0 ; i < 256 ; i++)
+	{
+		doMAC(cc_nr, div_keys[i], calculated_mac);
+		if(memcmp(calculated_mac, macs[i], 4) != 0)
+		{
+			prnlog("[+] FAILED: bitsliced MAC differs from optimized MAC:");
+			printarr("    div_key       ", div_keys[i], 8);
+			printarr("    Calculated_MAC", calculated_mac, 4);
+			printarr("    Bitsliced_MAC ", macs[i], 4);
+			return 1;
+		}
+	}
+	prnlog("[+] Bitsliced MAC calculation OK!");
+
 	return 0;
 }
 #endif
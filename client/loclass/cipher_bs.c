@@ -0,0 +1,159 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Bitsliced iClass cipher. Calculates the MACs of many keys at once.
+//
+// Each bit of the cipher state is held in a vector with one bit per key (lane).
+// Register bit i is (x >> i) & 1, the same as in common/optimized_cipher.c.
+// For a description of the cipher see cipher.c.
+//-----------------------------------------------------------------------------
+
+#include "cipher_bs.h"
+
+#include <string.h>
+
+typedef uint64_t bitslice_t __attribute__((vector_size(ICLASS_BS_LANES/8)));
+
+typedef struct {
+	bitslice_t l[8];
+	bitslice_t r[8];
+	bitslice_t b[8];
+	bitslice_t t[16];
+} bs_state_t;
+
+
+static inline bitslice_t bs_const(uint32_t bit)
+{
+	bitslice_t v;
+	memset(&v, bit ? 0xff : 0x00, sizeof(v));
+	return v;
+}
+
+
+static inline bitslice_t bs_mux(bitslice_t a, bitslice_t b, bitslice_t sel)
+{
+	return a ^ ((a ^ b) & sel);
+}
+
+
+// sum = a + b mod 256
+static inline void bs_add(const bitslice_t *a, const bitslice_t *b, bitslice_t *sum)
+{
+	bitslice_t carry = bs_const(0);
+	for (int i = 0; i < 8; i++) {
+		bitslice_t a_xor_b = a[i] ^ b[i];
+		bitslice_t s = a_xor_b ^ carry;
+		carry = (a[i] & b[i]) | (carry & a_xor_b);
+		sum[i] = s;
+	}
+}
+
+
+static inline void bs_set_byte(bitslice_t *x, uint8_t val)
+{
+	for (int i = 0; i < 8; i++) {
+		x[i] = bs_const(val >> i & 1);
+	}
+}
+
+
+static void bs_successor(const bitslice_t k[8][8], bs_state_t *s, bitslice_t y)
+{
+	const bitslice_t *r = s->r;
+	bitslice_t Tt = s->t[15] ^ s->t[14] ^ s->t[10] ^ s->t[8] ^ s->t[5] ^ s->t[4] ^ s->t[1] ^ s->t[0];
+	bitslice_t Bb = s->b[6] ^ s->b[5] ^ s->b[4] ^ s->b[0];
+
+	// select(T(t), y, r). r0 of the paper is the most significant bit.
+	bitslice_t z0 = (r[7] & r[5]) ^ (r[6] & ~r[4]) ^ (r[5] | r[3]);
+	bitslice_t z1 = (r[7] | r[5]) ^ (r[2] | r[0]) ^ r[6] ^ r[1] ^ Tt ^ y;
+	bitslice_t z2 = (r[4] & ~r[2]) ^ (r[3] & r[1]) ^ r[0] ^ Tt;
+
+	bitslice_t t15 = Tt ^ r[7] ^ r[3];
+	bitslice_t b7 = Bb ^ r[0];
+	memmove(&s->t[0], &s->t[1], 15 * sizeof(bitslice_t));
+	s->t[15] = t15;
+	memmove(&s->b[0], &s->b[1], 7 * sizeof(bitslice_t));
+	s->b[7] = b7;
+
+	// k[select()] ^ b'
+	bitslice_t v[8];
+	for (int i = 0; i < 8; i++) {
+		bitslice_t m01 = bs_mux(k[0][i], k[1][i], z2);
+		bitslice_t m23 = bs_mux(k[2][i], k[3][i], z2);
+		bitslice_t m45 = bs_mux(k[4][i], k[5][i], z2);
+		bitslice_t m67 = bs_mux(k[6][i], k[7][i], z2);
+		bitslice_t m03 = bs_mux(m01, m23, z1);
+		bitslice_t m47 = bs_mux(m45, m67, z1);
+		v[i] = bs_mux(m03, m47, z0) ^ s->b[i];
+	}
+
+	// r' = v + l, l' = r' + r
+	bitslice_t r_old[8];
+	memcpy(r_old, s->r, sizeof(r_old));
+	bs_add(v, s->l, s->r);
+	bs_add(s->r, r_old, s->l);
+}
+
+
+static void bs_load_keys(bitslice_t k[8][8], const uint8_t *div_keys, uint32_t num_lanes)
+{
+	memset(k, 0, 64 * sizeof(bitslice_t));
+	for (uint32_t lane = 0; lane < num_lanes; lane++) {
+		for (int j = 0; j < 8; j++) {
+			uint8_t key_byte = div_keys[lane * 8 + j];
+			for (int i = 0; i < 8; i++) {
+				k[j][i][lane/64] |= (uint64_t)(key_byte >> i & 1) << (lane % 64);
+			}
+		}
+	}
+}
+
+
+void doMAC_bs(const uint8_t *cc_nr, const uint8_t *div_keys, uint32_t num_keys, uint8_t *macs)
+{
+	for (uint32_t base = 0; base < num_keys; base += ICLASS_BS_LANES) {
+		uint32_t num_lanes = num_keys - base < ICLASS_BS_LANES ? num_keys - base : ICLASS_BS_LANES;
+		bitslice_t k[8][8];
+		bitslice_t tmp[8];
+		bitslice_t out[32];
+		bs_state_t s;
+
+		bs_load_keys(k, div_keys + base * 8, num_lanes);
+
+		// init(k): l = (k[0] ^ 0x4c) + 0xEC, r = (k[0] ^ 0x4c) + 0x21, b = 0x4c, t = 0xE012
+		bitslice_t k0[8];
+		for (int i = 0; i < 8; i++) {
+			k0[i] = k[0][i] ^ bs_const(0x4c >> i & 1);
+		}
+		bs_set_byte(tmp, 0xEC);
+		bs_add(k0, tmp, s.l);
+		bs_set_byte(tmp, 0x21);
+		bs_add(k0, tmp, s.r);
+		bs_set_byte(s.b, 0x4c);
+		bs_set_byte(s.t, 0x12);
+		bs_set_byte(s.t + 8, 0xE0);
+
+		// cc_nr, least significant bit of each byte first
+		for (int n = 0; n < 12 * 8; n++) {
+			bs_successor(k, &s, bs_const(cc_nr[n / 8] >> (n % 8) & 1));
+		}
+
+		// output: 32 times r5 (bit 2), feeding zeroes. No successor after the last bit.
+		for (int n = 0; n < 32; n++) {
+			out[n] = s.r[2];
+			if (n < 31) {
+				bs_successor(k, &s, bs_const(0));
+			}
+		}
+
+		for (uint32_t lane = 0; lane < num_lanes; lane++) {
+			uint8_t *mac = macs + (base + lane) * 4;
+			memset(mac, 0, 4);
+			for (int n = 0; n < 32; n++) {
+				mac[n / 8] |= (out[n][lane/64] >> (lane % 64) & 1) << (n % 8);
+			}
+		}
+	}
+}
@@ -0,0 +1,19 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Bitsliced iClass cipher. Calculates the MACs of many keys at once.
+//-----------------------------------------------------------------------------
+
+#ifndef CIPHER_BS_H
+#define CIPHER_BS_H
+
+#include <stdint.h>
+
+#define ICLASS_BS_LANES					128			// keys processed in parallel
+
+// Same as doMAC() for num_keys diversified keys (8 bytes each). The MACs (4 bytes each) are written to macs.
+void doMAC_bs(const uint8_t *cc_nr, const uint8_t *div_keys, uint32_t num_keys, uint8_t *macs);
+
+#endif // CIPHER_BS_H
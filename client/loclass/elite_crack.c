@@ -39,6 +39,8 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "util.h"
 #include "util_posix.h"
 #include "cipherutils.h"
@@ -47,6 +49,22 @@
 #include "elite_crack.h"
 #include "fileutils.h"
 #include "polarssl/des.h"
+#include "cipher_bs.h"
+
+/*
+ * The key permutations are 8x8 bit matrix transpositions. permute_spread[v] holds bit 7-i of v
+ * in bit 0 of byte i (little endian), so that a transposition is eight lookups and shifts.
+ * The table is generated by the compiler.
+ */
+#define SPREAD(v)	((uint64_t)((v) >> 7 & 1)       | (uint64_t)((v) >> 6 & 1) << 8  | \
+					 (uint64_t)((v) >> 5 & 1) << 16 | (uint64_t)((v) >> 4 & 1) << 24 | \
+					 (uint64_t)((v) >> 3 & 1) << 32 | (uint64_t)((v) >> 2 & 1) << 40 | \
+					 (uint64_t)((v) >> 1 & 1) << 48 | (uint64_t)((v) & 1) << 56)
+#define SPREAD4(v)	SPREAD(v), SPREAD(v+1), SPREAD(v+2), SPREAD(v+3)
+#define SPREAD16(v)	SPREAD4(v), SPREAD4(v+4), SPREAD4(v+8), SPREAD4(v+12)
+#define SPREAD64(v)	SPREAD16(v), SPREAD16(v+16), SPREAD16(v+32), SPREAD16(v+48)
+
+static const uint64_t permute_spread[256] = { SPREAD64(0), SPREAD64(64), SPREAD64(128), SPREAD64(192) };
 
 /**
  * @brief Permutes a key from standard NIST format to Iclass specific format
@@ -71,21 +89,12 @@
  */
 void permutekey(uint8_t key[8], uint8_t dest[8])
 {
-
+	uint64_t x = 0;
 	int i;
 	for(i = 0 ; i < 8 ; i++)
-	{
-		dest[i] =	(((key[7] & (0x80 >> i)) >> (7-i)) << 7) |
-					(((key[6] & (0x80 >> i)) >> (7-i)) << 6) |
-					(((key[5] & (0x80 >> i)) >> (7-i)) << 5) |
-					(((key[4] & (0x80 >> i)) >> (7-i)) << 4) |
-					(((key[3] & (0x80 >> i)) >> (7-i)) << 3) |
-					(((key[2] & (0x80 >> i)) >> (7-i)) << 2) |
-					(((key[1] & (0x80 >> i)) >> (7-i)) << 1) |
-					(((key[0] & (0x80 >> i)) >> (7-i)) << 0);
-	}
-
-	return;
+		x |= permute_spread[key[i]] << i;
+	for(i = 0 ; i < 8 ; i++)
+		dest[i] = x >> (8*i);
 }
 /**
  * Permutes  a key from iclass specific format to NIST format
@@ -95,18 +104,12 @@ void permutekey(uint8_t key[8], uint8_t dest[8])
  */
 void permutekey_rev(uint8_t key[8], uint8_t dest[8])
 {
+	uint64_t x = 0;
 	int i;
 	for(i = 0 ; i < 8 ; i++)
-	{
-		dest[7-i] =	(((key[0] & (0x80 >> i)) >> (7-i)) << 7) |
-					(((key[1] & (0x80 >> i)) >> (7-i)) << 6) |
-					(((key[2] & (0x80 >> i)) >> (7-i)) << 5) |
-					(((key[3] & (0x80 >> i)) >> (7-i)) << 4) |
-					(((key[4] & (0x80 >> i)) >> (7-i)) << 3) |
-					(((key[5] & (0x80 >> i)) >> (7-i)) << 2) |
-					(((key[6] & (0x80 >> i)) >> (7-i)) << 1) |
-					(((key[7] & (0x80 >> i)) >> (7-i)) << 0);
-	}
+		x |= permute_spread[key[i]] << (7-i);
+	for(i = 0 ; i < 8 ; i++)
+		dest[7-i] = x >> (8*i);
 }
 
 /**
@@ -168,13 +171,11 @@ rk(x [0] . . . x [7] , n + 1) = rk(rl(x [0] ) . . . rl(x [7] ), n)
 void rk(uint8_t *key, uint8_t n, uint8_t *outp_key)
 {
 
-    memcpy(outp_key, key, 8);
-
     uint8_t j;
 
-    while(n-- > 0)
-        for(j=0; j < 8 ; j++)
-            outp_key[j] = rl(outp_key[j]);
+    n &= 7;
+    for(j=0; j < 8 ; j++)
+        outp_key[j] = key[j] << n | key[j] >> ((8 - n) & 7);
 
     return;
 }
@@ -295,12 +296,124 @@ int _readFromDump(uint8_t dump[], dumpdata* item, uint8_t i)
 }
 
 static uint32_t startvalue = 0;
+static uint64_t bruteforce_candidates = 0;		// candidates tried by bruteforceItem(), for statistics
+
+/*
+ * The DES key schedule only selects bits from the key, and permutekey_rev() only moves bits
+ * around. The DES round keys of a key_sel are therefore the XOR of the round keys of its
+ * single bytes, which are precomputed here for every position and value.
+ */
+static uint32_t key_sel_subkeys[8][256][32];
+static pthread_once_t key_sel_subkeys_once = PTHREAD_ONCE_INIT;
+
+static void init_key_sel_subkeys(void)
+{
+	des_context ctx = {DES_ENCRYPT,{0}};
+	uint8_t key_sel[8];
+	uint8_t key_sel_p[8];
+	int pos, val;
+
+	for(pos = 0 ; pos < 8 ; pos++)
+	{
+		for(val = 0 ; val < 256 ; val++)
+		{
+			memset(key_sel, 0, 8);
+			key_sel[pos] = val;
+			permutekey_rev(key_sel, key_sel_p);
+			des_setkey_enc(&ctx, key_sel_p);
+			memcpy(key_sel_subkeys[pos][val], ctx.sk, sizeof(ctx.sk));
+		}
+	}
+}
+
+// brute force candidates are handed out to the threads in chunks of this size
+#define BRUTEFORCE_CHUNK_SIZE	0x10000
+
+typedef struct {
+	uint8_t csn[8];
+	uint8_t cc_nr[12];
+	uint8_t mac[4];
+	uint8_t numbytes_to_recover;
+	uint32_t base_sk[32];				// round keys of the known key_sel bytes
+	uint32_t (*brute_sk)[256][32];		// round keys of each byte to recover, at all its key_sel positions
+	uint32_t endvalue;
+	uint32_t next_chunk;				// shared, next candidate to hand out
+	uint32_t found_value;				// shared, lowest matching candidate so far
+	uint64_t tested;					// shared, number of candidates tried
+} bruteforce_job_t;
+
+static void *bruteforce_thread(void *arg)
+{
+	bruteforce_job_t *job = (bruteforce_job_t *)arg;
+	des_context ctx = {DES_ENCRYPT,{0}};
+	uint8_t crypted_csn[8];
+	uint8_t div_keys[ICLASS_BS_LANES][8];
+	uint8_t calculated_MACs[ICLASS_BS_LANES][4];
+	uint32_t brute, chunk_end, batch_size, lane;
+	uint64_t tested = 0;
+	int i, j;
+
+	while(true)
+	{
+		brute = __sync_fetch_and_add(&job->next_chunk, BRUTEFORCE_CHUNK_SIZE);
+		// Candidates are tried in ascending order. Once a key has been found, only lower
+		// candidates (in chunks still being worked on by other threads) are of interest.
+		if(brute >= job->endvalue || brute > job->found_value)
+			break;
+		if(brute > startvalue && (brute & 0xFFFF) == 0)
+		{
+			printf("%d",(brute >> 16) & 0xFF);
+			fflush(stdout);
+		}
+		chunk_end = brute + BRUTEFORCE_CHUNK_SIZE < job->endvalue ? brute + BRUTEFORCE_CHUNK_SIZE : job->endvalue;
+
+		for( ; brute < chunk_end ; brute += batch_size)
+		{
+			batch_size = chunk_end - brute < ICLASS_BS_LANES ? chunk_end - brute : ICLASS_BS_LANES;
+
+			//Diversify
+			for(lane = 0 ; lane < batch_size ; lane++)
+			{
+				memcpy(ctx.sk, job->base_sk, sizeof(ctx.sk));
+				for(i = 0 ; i < job->numbytes_to_recover ; i++)
+				{
+					uint32_t *sk = job->brute_sk[i][((brute + lane) >> (i*8)) & 0xFF];
+					for(j = 0 ; j < 32 ; j++)
+						ctx.sk[j] ^= sk[j];
+				}
+				des_crypt_ecb(&ctx, job->csn, crypted_csn);
+				hash0(x_bytes_to_num(crypted_csn, 8), div_keys[lane]);
+			}
+
+			//Calc macs
+			doMAC_bs(job->cc_nr, div_keys[0], batch_size, calculated_MACs[0]);
+			tested += batch_size;
+
+			for(lane = 0 ; lane < batch_size ; lane++)
+			{
+				if(memcmp(calculated_MACs[lane], job->mac, 4) == 0)
+				{
+					uint32_t found = job->found_value;
+					while(brute + lane < found && !__sync_bool_compare_and_swap(&job->found_value, found, brute + lane))
+						found = job->found_value;
+					break;
+				}
+			}
+			if(lane < batch_size)
+				break;
+		}
+	}
+	__sync_fetch_and_add(&job->tested, tested);
+	return NULL;
+}
+
 /**
  * @brief Performs brute force attack against a dump-data item, containing csn, cc_nr and mac.
  *This method calculates the hash1 for the CSN, and determines what bytes need to be bruteforced
  *on the fly. If it finds that more than three bytes need to be bruteforced, it aborts.
  *It updates the keytable with the findings, also using the upper half of the 16-bit ints
  *to signal if the particular byte has been cracked or not.
+ *The candidates are split across all CPUs.
  *
  * @param dump The dumpdata from iclass reader attack.
  * @param keytable where to write found values.
@@ -309,11 +422,7 @@ static uint32_t startvalue = 0;
 int bruteforceItem(dumpdata item, uint16_t keytable[])
 {
 	int errors = 0;
-	uint8_t key_sel_p[8] = { 0 };
-	uint8_t div_key[8] = {0};
 	int found = false;
-	uint8_t key_sel[8] = {0};
-	uint8_t calculated_MAC[4] = { 0 };
 
 	//Get the key index (hash1)
 	uint8_t key_index[8] = {0};
@@ -334,7 +443,7 @@ int bruteforceItem(dumpdata item, uint16_t keytable[])
 	 **/
 	uint8_t bytes_to_recover[3] = {0};
 	uint8_t numbytes_to_recover = 0 ;
-	int i;
+	int i, j, k;
 	for(i =0 ; i < 8 ; i++)
 	{
 		if(keytable[key_index[i]] & (CRACKED | BEING_CRACKED)) continue;
@@ -356,10 +465,14 @@ int bruteforceItem(dumpdata item, uint16_t keytable[])
 		}
 	}
 
-	/*
-	 *A uint32 has room for 4 bytes, we'll only need 24 of those bits to bruteforce up to three bytes,
-	 */
-	uint32_t brute = startvalue;
+	pthread_once(&key_sel_subkeys_once, init_key_sel_subkeys);
+
+	bruteforce_job_t job;
+	memcpy(job.csn, item.csn, 8);
+	memcpy(job.cc_nr, item.cc_nr, 12);
+	memcpy(job.mac, item.mac, 4);
+	job.numbytes_to_recover = numbytes_to_recover;
+
 	/*
 	   Determine where to stop the bruteforce. A 1-byte attack stops after 256 tries,
 	   (when brute reaches 0x100). And so on...
@@ -367,49 +480,63 @@ int bruteforceItem(dumpdata item, uint16_t keytable[])
 	   bytes_to_recover = 2 --> endmask = 0x0010000
 	   bytes_to_recover = 3 --> endmask = 0x1000000
 	*/
+	job.endvalue = 1 << 8*numbytes_to_recover;
+	job.next_chunk = startvalue;
+	job.found_value = UINT32_MAX;
+	job.tested = 0;
+
+	// Piece together the round keys. Positions in key_sel holding a byte to recover
+	// are summed up per byte, all other positions go into the base.
+	job.brute_sk = calloc(numbytes_to_recover ? numbytes_to_recover : 1, sizeof(*job.brute_sk));
+	if(job.brute_sk == NULL)
+	{
+		printf("Out of memory error in bruteforceItem(). Aborting...\n");
+		exit(4);
+	}
+	memset(job.base_sk, 0, sizeof(job.base_sk));
+	for(i = 0 ; i < 8 ; i++)
+	{
+		for(j = 0 ; j < numbytes_to_recover ; j++)
+			if(key_index[i] == bytes_to_recover[j]) break;
 
-	uint32_t endmask =  1 << 8*numbytes_to_recover;
+		if(j < numbytes_to_recover)
+		{
+			for(int val = 0 ; val < 256 ; val++)
+				for(k = 0 ; k < 32 ; k++)
+					job.brute_sk[j][val][k] ^= key_sel_subkeys[i][val][k];
+		}else
+		{
+			for(k = 0 ; k < 32 ; k++)
+				job.base_sk[k] ^= key_sel_subkeys[i][keytable[key_index[i]] & 0xFF][k];
+		}
+	}
 
 	for(i =0 ; i < numbytes_to_recover && numbytes_to_recover > 1; i++)
 		prnlog("Bruteforcing byte %d", bytes_to_recover[i]);
 
-	while(!found && !(brute & endmask))
+	// a single byte is quicker done than threads are started
+	int num_threads = numbytes_to_recover > 1 ? num_CPUs() : 1;
+	pthread_t threads[num_threads];
+	for(i = 1 ; i < num_threads ; i++)
+		pthread_create(&threads[i], NULL, bruteforce_thread, &job);
+	bruteforce_thread(&job);
+	for(i = 1 ; i < num_threads ; i++)
+		pthread_join(threads[i], NULL);
+	free(job.brute_sk);
+	bruteforce_candidates += job.tested;
+
+	if(job.found_value != UINT32_MAX)
 	{
-
 		//Update the keytable with the brute-values
 		for(i =0 ; i < numbytes_to_recover; i++)
 		{
 			keytable[bytes_to_recover[i]] &= 0xFF00;
-			keytable[bytes_to_recover[i]] |= (brute >> (i*8) & 0xFF);
-		}
-
-		// Piece together the key
-		key_sel[0] = keytable[key_index[0]] & 0xFF;key_sel[1] = keytable[key_index[1]] & 0xFF;
-		key_sel[2] = keytable[key_index[2]] & 0xFF;key_sel[3] = keytable[key_index[3]] & 0xFF;
-		key_sel[4] = keytable[key_index[4]] & 0xFF;key_sel[5] = keytable[key_index[5]] & 0xFF;
-		key_sel[6] = keytable[key_index[6]] & 0xFF;key_sel[7] = keytable[key_index[7]] & 0xFF;
-
-		//Permute from iclass format to standard format
-		permutekey_rev(key_sel,key_sel_p);
-		//Diversify
-		diversifyKey(item.csn, key_sel_p, div_key);
-		//Calc mac
-		doMAC(item.cc_nr, div_key,calculated_MAC);
-
-		if(memcmp(calculated_MAC, item.mac, 4) == 0)
-		{
-			for(i =0 ; i < numbytes_to_recover; i++)
-				prnlog("=> %d: 0x%02x", bytes_to_recover[i],0xFF & keytable[bytes_to_recover[i]]);
-			found = true;
-			break;
-		}
-		brute++;
-		if((brute & 0xFFFF) == 0)
-		{
-			printf("%d",(brute >> 16) & 0xFF);
-			fflush(stdout);
+			keytable[bytes_to_recover[i]] |= (job.found_value >> (i*8) & 0xFF);
+			prnlog("=> %d: 0x%02x", bytes_to_recover[i],0xFF & keytable[bytes_to_recover[i]]);
 		}
+		found = true;
 	}
+
 	if(! found)
 	{
 		prnlog("Failed to recover %d bytes using the following CSN",numbytes_to_recover);
@@ -515,6 +642,7 @@ int bruteforceDump(uint8_t dump[], size_t dumpsize, uint16_t keytable[])
 	uint64_t t1 = msclock();
 
 	dumpdata* attack = (dumpdata* ) malloc(itemsize);
+	bruteforce_candidates = 0;
 
 	for(i = 0 ; i * itemsize < dumpsize ; i++ )
 	{
@@ -525,6 +653,8 @@ int bruteforceDump(uint8_t dump[], size_t dumpsize, uint16_t keytable[])
 	t1 = msclock() - t1;
 	float diff = (float)t1 / 1000.0;
 	prnlog("\nPerformed full crack in %f seconds", diff);
+	if(t1 > 0)
+		prnlog("Tried %" PRIu64 " candidates, %.0f candidates/sec", bruteforce_candidates, bruteforce_candidates / diff);
 
 	// Pick out the first 16 bytes of the keytable.
 	// The keytable is now in 16-bit ints, where the upper 8 bits
@@ -600,6 +730,66 @@ int bruteforceFileNoKeys(const char *filename)
 // TEST CODE BELOW
 // ----------------------------------------------------------------------------
 
+// the bit by bit key permutations, to check the table based ones against
+static void _permutekey_bitwise(uint8_t key[8], uint8_t dest[8])
+{
+	int i, j;
+	for(i = 0 ; i < 8 ; i++)
+	{
+		dest[i] = 0;
+		for(j = 0 ; j < 8 ; j++)
+			dest[i] |= ((key[j] & (0x80 >> i)) >> (7-i)) << j;
+	}
+}
+static void _permutekey_rev_bitwise(uint8_t key[8], uint8_t dest[8])
+{
+	int i, j;
+	for(i = 0 ; i < 8 ; i++)
+	{
+		dest[7-i] = 0;
+		for(j = 0 ; j < 8 ; j++)
+			dest[7-i] |= ((key[j] & (0x80 >> i)) >> (7-i)) << (7-j);
+	}
+}
+
+// the benchmarks run for at least this long
+#define SPEEDTEST_MS	500
+
+/*
+ * The brute force loop as it was before the DES round keys were precomputed: one
+ * candidate at a time, with a key permutation, a DES key schedule and a MAC each.
+ * Returns its candidates/sec on one CPU, as a reference for bruteforceItem().
+ */
+static float _bruteforce_reference_speed(void (*permute)(uint8_t key[8], uint8_t dest[8]))
+{
+	uint8_t csn[8] = {0x01,0x02,0x03,0x04,0xF7,0xFF,0x12,0xE0};
+	uint8_t cc_nr[12] = {0};
+	uint8_t key_index[8], key_sel[8], key_sel_p[8], div_key[8], calculated_MAC[4];
+	uint8_t keytable[128] = {0};
+	uint32_t brute = 0;
+	uint64_t t1;
+	int i;
+
+	hash1(csn, key_index);
+	t1 = msclock();
+	do
+	{
+		for(i = 0 ; i < 0x1000 ; i++, brute++)
+		{
+			keytable[key_index[0]] = brute;
+			keytable[key_index[1]] = brute >> 8;
+			keytable[key_index[2]] = brute >> 16;
+			for(int j = 0 ; j < 8 ; j++)
+				key_sel[j] = keytable[key_index[j]];
+			permute(key_sel, key_sel_p);
+			diversifyKey(csn, key_sel_p, div_key);
+			doMAC(cc_nr, div_key, calculated_MAC);
+			cc_nr[brute & 7] ^= calculated_MAC[0];		// keep the result alive
+		}
+	} while(msclock() - t1 < SPEEDTEST_MS);
+	return brute / ((msclock() - t1) / 1000.0);
+}
+
 int _testBruteforce()
 {
 	int errors = 0;
@@ -635,10 +825,70 @@ int _testBruteforce()
 		}else{
 			prnlog("Error: The file iclass_dump.bin was not found!");
 		}
+
+		prnlog("[+] Candidates/sec of the original loop on one CPU: %.0f with bit by bit key permutation, %.0f with table",
+			_bruteforce_reference_speed(_permutekey_rev_bitwise), _bruteforce_reference_speed(permutekey_rev));
+		prnlog("[+] (the crack above uses precomputed DES round keys and %d CPUs)", num_CPUs());
 	}
 	return errors;
 }
 
+int _test_iclass_key_permutation_speed()
+{
+	uint8_t key[8] = {0x6c,0x8d,0x44,0xf9,0x2a,0x2d,0x01,0xbf};
+	uint8_t out_table[8], out_bitwise[8];
+	uint32_t i, n_bitwise = 0, n_table = 0;
+	uint64_t t_bitwise, t_table;
+
+	for(i = 0 ; i < 10000 ; i++)
+	{
+		num_to_bytes(((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ rand(), 8, key);
+		permutekey(key, out_table);
+		_permutekey_bitwise(key, out_bitwise);
+		if(memcmp(out_table, out_bitwise, 8) != 0)
+		{
+			prnlog("Error with iclass key permute table!");
+			printarr("key", key, 8);
+			return 1;
+		}
+		permutekey_rev(key, out_table);
+		_permutekey_rev_bitwise(key, out_bitwise);
+		if(memcmp(out_table, out_bitwise, 8) != 0)
+		{
+			prnlog("Error with reverse iclass key permute table!");
+			printarr("key", key, 8);
+			return 1;
+		}
+	}
+
+	// feed the output back in so that the calls can't be optimized away
+	t_bitwise = msclock();
+	do
+	{
+		for(i = 0 ; i < 0x10000 ; i += 2)
+		{
+			_permutekey_rev_bitwise(key, out_bitwise);
+			_permutekey_rev_bitwise(out_bitwise, key);
+		}
+		n_bitwise += 0x10000;
+	} while(msclock() - t_bitwise < SPEEDTEST_MS);
+	t_bitwise = msclock() - t_bitwise;
+	t_table = msclock();
+	do
+	{
+		for(i = 0 ; i < 0x10000 ; i += 2)
+		{
+			permutekey_rev(key, out_table);
+			permutekey_rev(out_table, key);
+		}
+		n_table += 0x10000;
+	} while(msclock() - t_table < SPEEDTEST_MS);
+	t_table = msclock() - t_table;
+	prnlog("[+] Key permutation: %.0f keys/sec bit by bit, %.0f keys/sec with table",
+		n_bitwise / (t_bitwise / 1000.0), n_table / (t_table / 1000.0));
+	return 0;
+}
+
 int _test_iclass_key_permutation()
 {
 	uint8_t testcase[8] = {0x6c,0x8d,0x44,0xf9,0x2a,0x2d,0x01,0xbf};
@@ -720,6 +970,7 @@ int testElite()
     errors += _testHash1();
     prnlog("[+] Testing key diversification ...");
     errors +=_test_iclass_key_permutation();
+    errors += _test_iclass_key_permutation_speed();
 	errors += _testBruteforce();
 
 	return errors;
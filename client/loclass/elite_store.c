@@ -0,0 +1,279 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Resumable store for iClass reader attack dumps ('hf iclass sim 2').
+//
+// The store keeps all (CSN, CC/NR, MAC) items collected so far together with
+// their hash1 key index and the cracked bytes of the keytable. New reader
+// sessions can be added at any time, and only items which still have unknown
+// key bytes are brute forced.
+//
+// File format:
+//   "LCSTORE" + version (8 bytes)
+//   number of items (4 bytes, little endian)
+//   128 x <key byte><1 if cracked>
+//   N x <8 byte CSN><12 byte CC/NR><4 byte MAC><8 byte hash1><status>
+//-----------------------------------------------------------------------------
+
+#include "elite_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "util.h"
+#include "util_posix.h"
+#include "cipherutils.h"
+#include "fileutils.h"
+
+#define ELITE_STORE_VERSION				1
+#define ELITE_STORE_ITEM_SIZE			(sizeof(dumpdata) + 8 + 1)
+#define ELITE_STORE_TMP_SUFFIX			".tmp"
+
+static const char elite_store_magic[7] = {'L', 'C', 'S', 'T', 'O', 'R', 'E'};
+
+
+// number of different key bytes of an item which are not cracked yet
+static int unknown_bytes(const uint16_t keytable[], const uint8_t key_index[8])
+{
+	int count = 0;
+	for (int i = 0; i < 8; i++) {
+		if (keytable[key_index[i]] & CRACKED) continue;
+		int j;
+		for (j = 0; j < i; j++) {
+			if (key_index[j] == key_index[i]) break;
+		}
+		if (j == i) count++;
+	}
+	return count;
+}
+
+
+int elite_store_load(const char *filename, elite_store_t *store)
+{
+	memset(store, 0, sizeof(*store));
+
+	if (!fileExists(filename)) {
+		return 0;
+	}
+
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		prnlog("Failed to read from file '%s'", filename);
+		return 1;
+	}
+
+	uint8_t header[8 + 4 + 2*128];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header)
+		|| memcmp(header, elite_store_magic, sizeof(elite_store_magic)) != 0
+		|| header[7] != ELITE_STORE_VERSION) {
+		prnlog("'%s' is not a loclass store file", filename);
+		fclose(f);
+		return 1;
+	}
+
+	uint32_t num_items = header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24;
+	for (int i = 0; i < 128; i++) {
+		store->keytable[i] = header[12 + 2*i];
+		if (header[12 + 2*i + 1]) store->keytable[i] |= CRACKED;
+	}
+
+	store->items = calloc(num_items ? num_items : 1, sizeof(elite_store_item_t));
+	if (store->items == NULL) {
+		printf("Out of memory error in elite_store_load(). Aborting...\n");
+		exit(4);
+	}
+
+	for (uint32_t i = 0; i < num_items; i++) {
+		elite_store_item_t *item = &store->items[i];
+		uint8_t buf[ELITE_STORE_ITEM_SIZE];
+		if (fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+			prnlog("Error, '%s' is truncated, read %u of %u items", filename, i, num_items);
+			break;
+		}
+		memcpy(&item->item, buf, sizeof(dumpdata));
+		memcpy(item->key_index, buf + sizeof(dumpdata), 8);
+		item->status = buf[sizeof(dumpdata) + 8];
+		store->num_items++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+int elite_store_save(const char *filename, const elite_store_t *store)
+{
+	uint8_t header[8 + 4 + 2*128];
+	memcpy(header, elite_store_magic, sizeof(elite_store_magic));
+	header[7] = ELITE_STORE_VERSION;
+	for (int i = 0; i < 4; i++) {
+		header[8 + i] = store->num_items >> (8*i);
+	}
+	for (int i = 0; i < 128; i++) {
+		header[12 + 2*i] = store->keytable[i] & 0xFF;
+		header[12 + 2*i + 1] = (store->keytable[i] & CRACKED) ? 1 : 0;
+	}
+
+	// write to <store>.tmp and rename it. An interrupted save never destroys the store.
+	char tmp_filename[FILE_PATH_SIZE + sizeof(ELITE_STORE_TMP_SUFFIX)];
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s" ELITE_STORE_TMP_SUFFIX, filename);
+	FILE *f = fopen(tmp_filename, "wb");
+	if (!f) {
+		prnlog("Failed to write to file '%s'", tmp_filename);
+		return 1;
+	}
+	bool write_error = fwrite(header, 1, sizeof(header), f) != sizeof(header);
+	for (uint32_t i = 0; i < store->num_items && !write_error; i++) {
+		const elite_store_item_t *item = &store->items[i];
+		uint8_t buf[ELITE_STORE_ITEM_SIZE];
+		memcpy(buf, &item->item, sizeof(dumpdata));
+		memcpy(buf + sizeof(dumpdata), item->key_index, 8);
+		buf[sizeof(dumpdata) + 8] = item->status;
+		write_error = fwrite(buf, 1, sizeof(buf), f) != sizeof(buf);
+	}
+	if (fclose(f) != 0 || write_error) {
+		prnlog("Failed to write to file '%s'", tmp_filename);
+		remove(tmp_filename);
+		return 1;
+	}
+#if defined(_WIN32)
+	remove(filename);		// rename() doesn't replace existing files on Windows
+#endif
+	if (rename(tmp_filename, filename) != 0) {
+		prnlog("Failed to rename '%s' to '%s'", tmp_filename, filename);
+		remove(tmp_filename);
+		return 1;
+	}
+	return 0;
+}
+
+
+void elite_store_free(elite_store_t *store)
+{
+	free(store->items);
+	store->items = NULL;
+	store->num_items = 0;
+}
+
+
+uint32_t elite_store_add_dump(elite_store_t *store, const uint8_t *dump, size_t dumpsize)
+{
+	uint32_t num_dump_items = dumpsize / sizeof(dumpdata);
+	uint32_t added = 0;
+
+	elite_store_item_t *items = realloc(store->items, (store->num_items + num_dump_items + 1) * sizeof(elite_store_item_t));
+	if (items == NULL) {
+		printf("Out of memory error in elite_store_add_dump(). Aborting...\n");
+		exit(4);
+	}
+	store->items = items;
+
+	for (uint32_t i = 0; i < num_dump_items; i++) {
+		elite_store_item_t *item = &store->items[store->num_items];
+		memcpy(&item->item, dump + i * sizeof(dumpdata), sizeof(dumpdata));
+		uint32_t j;
+		for (j = 0; j < store->num_items; j++) {
+			if (memcmp(&store->items[j].item, &item->item, sizeof(dumpdata)) == 0) break;
+		}
+		if (j < store->num_items) continue;
+		hash1(item->item.csn, item->key_index);
+		item->status = 0;
+		store->num_items++;
+		added++;
+	}
+
+	return added;
+}
+
+
+int elite_store_crack(elite_store_t *store, const char *filename)
+{
+	int errors = 0;
+	uint64_t t1 = msclock();
+
+	// Always take the item with the fewest unknown bytes. Cracking it may bring other
+	// items down to three or less unknown bytes.
+	while (true) {
+		int32_t best = -1;
+		int best_unknown = 4;
+		for (uint32_t i = 0; i < store->num_items; i++) {
+			if (store->items[i].status & ELITE_STORE_ITEM_FAILED) continue;
+			int unknown = unknown_bytes(store->keytable, store->items[i].key_index);
+			if (unknown > 0 && unknown < best_unknown) {
+				best = i;
+				best_unknown = unknown;
+			}
+		}
+		if (best < 0) break;
+
+		elite_store_item_t *item = &store->items[best];
+		printvar("CSN", item->item.csn, 8);
+		if (bruteforceItem(item->item, store->keytable)) {
+			item->status |= ELITE_STORE_ITEM_FAILED;
+			errors++;
+		}
+		if (elite_store_save(filename, store)) {
+			errors++;
+			break;
+		}
+	}
+
+	t1 = msclock() - t1;
+	prnlog("\nBruteforce of the store took %f seconds", (float)t1 / 1000.0);
+	return errors;
+}
+
+
+void elite_store_report(const elite_store_t *store, const uint8_t *csns, uint32_t num_csns)
+{
+	uint8_t first16bytes[16];
+	int num_missing = 0;
+	char missing[16*4 + 1] = {0};
+
+	for (int i = 0; i < 16; i++) {
+		first16bytes[i] = store->keytable[i] & 0xFF;
+		if (!(store->keytable[i] & CRACKED)) {
+			sprintf(missing + strlen(missing), " %d", i);
+			num_missing++;
+		}
+	}
+
+	prnlog("%u items in store, %d of the 16 bytes needed for the custom key are cracked", store->num_items, 16 - num_missing);
+	if (num_missing == 0) {
+		calculateMasterKey(first16bytes, NULL);
+		return;
+	}
+	prnlog("Missing bytes:%s", missing);
+
+	// CSNs which hit a missing byte and can be brute forced with the bytes cracked so far. Only the
+	// given (attack) CSNs are checked, they are the only ones the reader attack can simulate.
+	int num_suggested = 0;
+	for (uint32_t i = 0; i < num_csns; i++) {
+		const uint8_t *csn = csns + 8*i;
+		uint32_t j;
+		for (j = 0; j < store->num_items; j++) {
+			if (memcmp(store->items[j].item.csn, csn, 8) == 0) break;
+		}
+		if (j < store->num_items) continue;
+
+		uint8_t key_index[8];
+		hash1((uint8_t *)csn, key_index);
+		bool covers_missing = false;
+		for (j = 0; j < 8; j++) {
+			if (key_index[j] < 16 && !(store->keytable[key_index[j]] & CRACKED)) covers_missing = true;
+		}
+		int unknown = unknown_bytes(store->keytable, key_index);
+		if (!covers_missing || unknown > 3) continue;
+
+		char csn_str[3*8 + 1];
+		strcpy(csn_str, sprint_hex(csn, 8));
+		if (num_suggested++ == 0) prnlog("Capture reader responses to these CSNs to recover missing bytes:");
+		prnlog("  %s (hash1 %s, %d byte bruteforce)", csn_str, sprint_hex(key_index, 8), unknown);
+	}
+	if (num_suggested == 0) {
+		prnlog("None of the attack CSNs can recover the missing bytes with the bytes cracked so far");
+	}
+}
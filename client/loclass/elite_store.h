@@ -0,0 +1,45 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Resumable store for iClass reader attack dumps ('hf iclass sim 2').
+//-----------------------------------------------------------------------------
+
+#ifndef ELITE_STORE_H
+#define ELITE_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "elite_crack.h"
+
+#define ELITE_STORE_ITEM_FAILED			0x01		// brute force didn't find a key for this item
+
+typedef struct {
+	dumpdata item;
+	uint8_t key_index[8];						// hash1(csn)
+	uint8_t status;
+} elite_store_item_t;
+
+typedef struct {
+	uint16_t keytable[128];						// same format as for bruteforceItem()
+	uint32_t num_items;
+	elite_store_item_t *items;
+} elite_store_t;
+
+// Load a store. A file which doesn't exist yet gives an empty store. Returns 0 for ok, 1 for failz
+int elite_store_load(const char *filename, elite_store_t *store);
+// Write the store to filename.tmp and rename it to filename. Returns 0 for ok, 1 for failz
+int elite_store_save(const char *filename, const elite_store_t *store);
+void elite_store_free(elite_store_t *store);
+// Add the items of a reader attack dump (N * 24 bytes). Items already in the store are skipped.
+// Returns the number of items added.
+uint32_t elite_store_add_dump(elite_store_t *store, const uint8_t *dump, size_t dumpsize);
+// Brute force the items which have key bytes left to crack, cheapest first. The store is saved
+// after each item so that an interrupted run can be resumed. Returns the number of errors.
+int elite_store_crack(elite_store_t *store, const char *filename);
+// Print the state of the first 16 key bytes and which of the given CSNs would recover missing ones.
+// No other CSNs are searched.
+void elite_store_report(const elite_store_t *store, const uint8_t *csns, uint32_t num_csns);
+
+#endif // ELITE_STORE_H
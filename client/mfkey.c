@@ -12,36 +12,47 @@
 
 #include "mfkey.h"
 
+#include <stdlib.h>
+#include <pthread.h>
 #include "mifare.h"
 #include "crapto1/crapto1.h"
 
 
-// recover key from 2 different reader responses on same tag challenge
-bool mfkey32(nonces_t data, uint64_t *outputkey) {
-	struct Crypto1State *s,*t;
+// check the candidate states of lfsr_recovery32() against the second reader response.
+// The states are not modified, i.e. the same list can be checked for several authentications.
+static bool mfkey32_check_states(struct Crypto1State *s, nonces_t *data, uint32_t nonce2, uint64_t *outputkey) {
+	struct Crypto1State t;
 	uint64_t outkey = 0;
 	uint64_t key = 0;     // recovered key
-	bool isSuccess = false;
 	uint8_t counter = 0;
 
-	s = lfsr_recovery32(data.ar ^ prng_successor(data.nonce, 64), 0);
-
-	for(t = s; t->odd | t->even; ++t) {
-		lfsr_rollback_word(t, 0, 0);
-		lfsr_rollback_word(t, data.nr, 1);
-		lfsr_rollback_word(t, data.cuid ^ data.nonce, 0);
-		crypto1_get_lfsr(t, &key);
-		crypto1_word(t, data.cuid ^ data.nonce, 0);
-		crypto1_word(t, data.nr2, 1);
-		if (data.ar2 == (crypto1_word(t, 0, 0) ^ prng_successor(data.nonce, 64))) {
+	for (struct Crypto1State *p = s; p->odd | p->even; ++p) {
+		t = *p;
+		lfsr_rollback_word(&t, 0, 0);
+		lfsr_rollback_word(&t, data->nr, 1);
+		lfsr_rollback_word(&t, data->cuid ^ data->nonce, 0);
+		crypto1_get_lfsr(&t, &key);
+		crypto1_word(&t, data->cuid ^ nonce2, 0);
+		crypto1_word(&t, data->nr2, 1);
+		if (data->ar2 == (crypto1_word(&t, 0, 0) ^ prng_successor(nonce2, 64))) {
 			//PrintAndLog("Found Key: [%012" PRIx64 "]",key);
 			outkey = key;
 			counter++;
 			if (counter == 20) break;
 		}
 	}
-	isSuccess = (counter == 1);
-	*outputkey = ( isSuccess ) ? outkey : 0;
+	*outputkey = (counter == 1) ? outkey : 0;
+	return (counter == 1);
+}
+
+
+// recover key from 2 different reader responses on same tag challenge
+bool mfkey32(nonces_t data, uint64_t *outputkey) {
+	struct Crypto1State *s;
+	bool isSuccess = false;
+
+	s = lfsr_recovery32(data.ar ^ prng_successor(data.nonce, 64), 0);
+	isSuccess = mfkey32_check_states(s, &data, data.nonce, outputkey);
 	crypto1_destroy(s);
 	/* //un-comment to save all keys to a stats.txt file 
 	FILE *fout;
@@ -57,32 +68,11 @@ bool mfkey32(nonces_t data, uint64_t *outputkey) {
 
 // recover key from 2 reader responses on 2 different tag challenges
 bool mfkey32_moebius(nonces_t data, uint64_t *outputkey) {
-	struct Crypto1State *s, *t;
-	uint64_t outkey  = 0;
-	uint64_t key 	   = 0;			// recovered key
+	struct Crypto1State *s;
 	bool isSuccess = false;
-	int counter = 0;
 	
 	s = lfsr_recovery32(data.ar ^ prng_successor(data.nonce, 64), 0);
-  
-	for(t = s; t->odd | t->even; ++t) {
-		lfsr_rollback_word(t, 0, 0);
-		lfsr_rollback_word(t, data.nr, 1);
-		lfsr_rollback_word(t, data.cuid ^ data.nonce, 0);
-		crypto1_get_lfsr(t, &key);
-		
-		crypto1_word(t, data.cuid ^ data.nonce2, 0);
-		crypto1_word(t, data.nr2, 1);
-		if (data.ar2 == (crypto1_word(t, 0, 0) ^ prng_successor(data.nonce2, 64))) {
-			//PrintAndLog("Found Key: [%012" PRIx64 "]",key);
-			outkey=key;
-			++counter;
-			if (counter==20)
-				break;
-		}
-	}
-	isSuccess	= (counter == 1);
-	*outputkey = ( isSuccess ) ? outkey : 0;
+	isSuccess = mfkey32_check_states(s, &data, data.nonce2, outputkey);
 	crypto1_destroy(s);
 	/* // un-comment to output all keys to stats.txt
 	FILE *fout;
@@ -120,3 +110,140 @@ int mfkey64(nonces_t data, uint64_t *outputkey){
 }
 
 
+//-----------------------------------------------------------------------------
+// batch mode: recover the keys of many authentications using several threads.
+// lfsr_recovery32() only depends on the keystream of the first reader response. Jobs
+// with the same keystream (e.g. repeated authentications with the same nt) share one state list.
+
+typedef struct {
+	uint32_t ks2;						// keystream used to encrypt the (first) reader response
+	uint32_t ks3;						// keystream used to encrypt the tag response (mfkey64 only)
+	uint32_t job;
+} mfkey_batch_entry_t;
+
+static mfkey_job_t *batch_jobs;
+static mfkey_batch_entry_t *batch_entries;
+static uint32_t *batch_groups;			// index of the first entry of each group of entries with the same keystream
+static uint32_t num_batch_groups;
+static uint32_t next_batch_group;
+
+
+static int compare_batch_entries(const void *a, const void *b) {
+	const mfkey_batch_entry_t *e1 = a;
+	const mfkey_batch_entry_t *e2 = b;
+	bool is64_1 = batch_jobs[e1->job].attack == MFKEY64;
+	bool is64_2 = batch_jobs[e2->job].attack == MFKEY64;
+	if (is64_1 != is64_2) return is64_1 ? 1 : -1;
+	if (e1->ks2 != e2->ks2) return e1->ks2 < e2->ks2 ? -1 : 1;
+	if (e1->ks3 != e2->ks3) return e1->ks3 < e2->ks3 ? -1 : 1;
+	return e1->job < e2->job ? -1 : e1->job > e2->job ? 1 : 0;
+}
+
+
+static bool same_job(mfkey_job_t *j1, mfkey_job_t *j2) {
+	return j1->attack == j2->attack
+		&& j1->data.cuid == j2->data.cuid
+		&& j1->data.nonce == j2->data.nonce
+		&& j1->data.nr == j2->data.nr
+		&& j1->data.ar == j2->data.ar
+		&& j1->data.at == j2->data.at
+		&& j1->data.nonce2 == j2->data.nonce2
+		&& j1->data.nr2 == j2->data.nr2
+		&& j1->data.ar2 == j2->data.ar2;
+}
+
+
+static void *mfkey_batch_thread(void *arg) {
+	uint32_t group;
+	while ((group = __sync_fetch_and_add(&next_batch_group, 1)) < num_batch_groups) {
+		uint32_t first = batch_groups[group];
+		uint32_t last = batch_groups[group+1];
+		struct Crypto1State *s = NULL;
+		if (batch_jobs[batch_entries[first].job].attack != MFKEY64) {
+			s = lfsr_recovery32(batch_entries[first].ks2, 0);
+		}
+		for (uint32_t i = first; i < last; i++) {
+			mfkey_job_t *job = &batch_jobs[batch_entries[i].job];
+			if (i > first && same_job(job, &batch_jobs[batch_entries[i-1].job])) {
+				job->found = batch_jobs[batch_entries[i-1].job].found;
+				job->key = batch_jobs[batch_entries[i-1].job].key;
+				continue;
+			}
+			switch (job->attack) {
+				case MFKEY32:
+					job->found = mfkey32_check_states(s, &job->data, job->data.nonce, &job->key);
+					break;
+				case MFKEY32_MOEBIUS:
+					job->found = mfkey32_check_states(s, &job->data, job->data.nonce2, &job->key);
+					break;
+				case MFKEY64:
+					mfkey64(job->data, &job->key);
+					job->found = true;
+					break;
+			}
+		}
+		if (s != NULL) {
+			crypto1_destroy(s);
+		}
+	}
+	return NULL;
+}
+
+
+// recover the keys of num_jobs authentications. Returns the number of distinct keystreams (i.e. the
+// number of expensive state recoveries), or 0 if out of memory.
+uint32_t mfkey_batch(mfkey_job_t *jobs, uint32_t num_jobs, uint32_t num_threads) {
+	if (num_jobs == 0) {
+		return 0;
+	}
+	batch_entries = (mfkey_batch_entry_t *)malloc(num_jobs * sizeof(mfkey_batch_entry_t));
+	batch_groups = (uint32_t *)malloc((num_jobs + 1) * sizeof(uint32_t));
+	if (batch_entries == NULL || batch_groups == NULL) {
+		free(batch_entries);
+		free(batch_groups);
+		return 0;
+	}
+	batch_jobs = jobs;
+	for (uint32_t i = 0; i < num_jobs; i++) {
+		jobs[i].found = false;
+		jobs[i].key = 0;
+		batch_entries[i].job = i;
+		batch_entries[i].ks2 = jobs[i].data.ar ^ prng_successor(jobs[i].data.nonce, 64);
+		batch_entries[i].ks3 = jobs[i].attack == MFKEY64 ? jobs[i].data.at ^ prng_successor(jobs[i].data.nonce, 96) : 0;
+	}
+	qsort(batch_entries, num_jobs, sizeof(mfkey_batch_entry_t), compare_batch_entries);
+
+	// mfkey32 jobs are grouped by their keystream. mfkey64 jobs are cheap, only identical jobs are grouped.
+	num_batch_groups = 0;
+	for (uint32_t i = 0; i < num_jobs; i++) {
+		mfkey_job_t *job = &jobs[batch_entries[i].job];
+		if (i == 0) {
+			batch_groups[num_batch_groups++] = i;
+		} else if (job->attack == MFKEY64) {
+			if (!same_job(job, &jobs[batch_entries[i-1].job])) {
+				batch_groups[num_batch_groups++] = i;
+			}
+		} else if (batch_entries[i].ks2 != batch_entries[i-1].ks2) {
+			batch_groups[num_batch_groups++] = i;
+		}
+	}
+	batch_groups[num_batch_groups] = num_jobs;
+	next_batch_group = 0;
+
+	if (num_threads < 1) num_threads = 1;
+	if (num_threads > num_batch_groups) num_threads = num_batch_groups;
+	pthread_t threads[num_threads];
+	for (uint32_t i = 0; i < num_threads; i++) {
+		pthread_create(&threads[i], NULL, mfkey_batch_thread, NULL);
+	}
+	for (uint32_t i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	uint32_t groups = num_batch_groups;
+	free(batch_entries);
+	free(batch_groups);
+	batch_entries = NULL;
+	batch_groups = NULL;
+	return groups;
+}
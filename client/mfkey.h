@@ -17,8 +17,24 @@
 #include <stdbool.h>
 #include "mifare.h"
 
+typedef enum {
+	MFKEY32,					// 2 reader responses on the same tag challenge
+	MFKEY32_MOEBIUS,			// 2 reader responses on 2 different tag challenges
+	MFKEY64						// reader response and tag response of one authentication
+} mfkey_attack_t;
+
+typedef struct {
+	nonces_t data;
+	mfkey_attack_t attack;
+	bool found;
+	uint64_t key;
+} mfkey_job_t;
+
 extern bool mfkey32(nonces_t data, uint64_t *outputkey);
 extern bool mfkey32_moebius(nonces_t data, uint64_t *outputkey);
 extern int mfkey64(nonces_t data, uint64_t *outputkey);
+extern uint32_t mfkey_batch(mfkey_job_t *jobs, uint32_t num_jobs, uint32_t num_threads);
+// The state recoveries keep their memory pooled for the next call. Call crapto1_free_arenas()
+// when the command is done.
 
 #endif
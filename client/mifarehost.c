@@ -23,6 +23,8 @@
 #include "parity.h"
 #include "util.h"
 #include "iso14443crc.h"
+#include "crypto1_bs.h"
+#include "mifaredefault.h"
 
 #include "mifare.h"
 
@@ -113,14 +115,153 @@ static uint32_t nonce2key(uint32_t uid, uint32_t nt, uint32_t nr, uint32_t ar, u
 }
 
 
+// Darkside attack: hash set of the key candidates of the previous sample
+typedef struct {
+	uint64_t *keys;
+	uint32_t mask;
+} keyset_t;
+
+
+static inline uint32_t keyset_hash(keyset_t *set, uint64_t key) {
+	return (key * 0x9e3779b97f4a7c15) >> 32 & set->mask;
+}
+
+
+static void keyset_set(keyset_t *set, uint64_t *keylist, uint32_t keycount) {
+	// replace the contents of set with the keys in keylist. Empty slots are marked with -1, which is no valid 48 bit key.
+	free(set->keys);
+	uint32_t size = 1;
+	while (size < 2 * keycount) size <<= 1;
+	set->mask = size - 1;
+	set->keys = malloc(size * sizeof(uint64_t));
+	if (set->keys == NULL) {
+		return;
+	}
+	memset(set->keys, 0xff, size * sizeof(uint64_t));
+	for (uint32_t i = 0; i < keycount; i++) {
+		uint32_t h = keyset_hash(set, keylist[i]);
+		while (set->keys[h] != -1 && set->keys[h] != keylist[i]) {
+			h = (h + 1) & set->mask;
+		}
+		set->keys[h] = keylist[i];
+	}
+}
+
+
+static bool keyset_contains(keyset_t *set, uint64_t key) {
+	if (set->keys == NULL) {
+		return false;
+	}
+	uint32_t h = keyset_hash(set, key);
+	while (set->keys[h] != -1) {
+		if (set->keys[h] == key) {
+			return true;
+		}
+		h = (h + 1) & set->mask;
+	}
+	return false;
+}
+
+
+typedef struct {
+	uint32_t uid, nt, nr, ar;
+	uint64_t par_list, ks_list;
+	uint64_t *keylist;
+	uint32_t keycount;
+} darkside_sample_t;
+
+
+// check a key candidate against a sample: with the correct key the card answers with the observed NACK
+// keystreams, and (if the card doesn't NACK on parity errors) only to the observed parity bits.
+static bool darkside_check_key(uint64_t key, darkside_sample_t *sample) {
+	struct Crypto1State *s0 = crypto1_create(key);
+	crypto1_word(s0, sample->uid ^ sample->nt, 0);
+	bool match = true;
+
+	for (uint8_t c = 0; c < 8 && match; c++) {
+		struct Crypto1State s = *s0;
+		uint32_t nr = (sample->nr & 0xffffff1f) | c << 5;
+		uint8_t par = (sample->par_list >> (8 * (7 - c))) & 0xff;
+		uint8_t ks_nack = (sample->ks_list >> (8 * (7 - c))) & 0x0f;
+		for (uint8_t i = 0; i < 8; i++) {
+			uint8_t enc = i < 4 ? (nr >> (24 - 8 * i)) & 0xff : 0x00;
+			uint8_t plain = enc ^ (i < 4 ? crypto1_byte(&s, enc, 1) : crypto1_byte(&s, 0, 0));
+			if (sample->par_list != 0 && (oddparity8(plain) ^ filter(s.odd)) != ((par >> i) & 0x01)) {
+				match = false;
+			}
+		}
+		uint8_t ks = 0;
+		for (uint8_t i = 0; i < 4; i++) {
+			ks |= crypto1_bit(&s, 0, 0) << i;
+		}
+		if (ks != ks_nack) {
+			match = false;
+		}
+	}
+
+	crypto1_destroy(s0);
+	return match;
+}
+
+
+// recover the key candidates of a sample while the device acquires the next one
+static void *darkside_worker_thread(void *arg) {
+	darkside_sample_t *sample = arg;
+	sample->keycount = nonce2key(sample->uid, sample->nt, sample->nr, sample->ar, sample->par_list, sample->ks_list, &sample->keylist);
+	return NULL;
+}
+
+
+static int darkside_get_sample(UsbCommand *c, darkside_sample_t *sample) {
+	clearCommandBuffer();
+	SendCommand(c);
+
+	//flush queue
+	while (ukbhit()) {
+		int c = getchar(); (void) c;
+	}
+
+	// wait cycle
+	while (true) {
+		printf(".");
+		fflush(stdout);
+		if (ukbhit()) {
+			return -5;
+		}
+
+		UsbCommand resp;
+		if (WaitForResponseTimeout(CMD_ACK, &resp, 1000)) {
+			int16_t isOK = resp.arg[0];
+			if (isOK < 0) {
+				return isOK;
+			}
+			sample->uid = (uint32_t)bytes_to_num(resp.d.asBytes +  0, 4);
+			sample->nt =  (uint32_t)bytes_to_num(resp.d.asBytes +  4, 4);
+			sample->par_list = bytes_to_num(resp.d.asBytes +  8, 8);
+			sample->ks_list = bytes_to_num(resp.d.asBytes +  16, 8);
+			sample->nr = (uint32_t)bytes_to_num(resp.d.asBytes + 24, 4);
+			sample->ar = (uint32_t)bytes_to_num(resp.d.asBytes + 28, 4);
+			sample->keylist = NULL;
+			sample->keycount = 0;
+			break;
+		}
+	}
+
+	if (sample->par_list == 0 && c->arg[0] == true) {
+		PrintAndLog("Parity is all zero. Most likely this card sends NACK on every failed authentication.");
+	}
+	c->arg[0] = false;
+
+	return 0;
+}
+
+
 int mfDarkside(uint64_t *key)
 {
-	uint32_t uid = 0;
-	uint32_t nt = 0, nr = 0, ar = 0;
-	uint64_t par_list = 0, ks_list = 0;
-	uint64_t *keylist = NULL, *last_keylist = NULL;
-	uint32_t keycount = 0;
-	int16_t isOK = 0;
+	darkside_sample_t sample, next_sample;
+	keyset_t last_keys = {NULL, 0};
+	pthread_t worker;
+	int res;
 
 	UsbCommand c = {CMD_READER_MIFARE, {true, 0, 0}};
 
@@ -130,96 +271,101 @@ int mfDarkside(uint64_t *key)
 	printf("Press button on the proxmark3 device to abort both proxmark3 and client.\n");
 	printf("-------------------------------------------------------------------------\n");
 
+	res = darkside_get_sample(&c, &sample);
+	if (res) {
+		return res;
+	}
 
 	while (true) {
-		clearCommandBuffer();
-		SendCommand(&c);
-
-		//flush queue
-		while (ukbhit()) {
-			int c = getchar(); (void) c;
+		// the device keeps sampling while the key candidates of the last sample are calculated
+		pthread_create(&worker, NULL, darkside_worker_thread, &sample);
+		res = darkside_get_sample(&c, &next_sample);
+		pthread_join(worker, NULL);
+		if (res) {
+			free(sample.keylist);
+			free(last_keys.keys);
+			return res;
 		}
 
-		// wait cycle
-		while (true) {
-			printf(".");
-			fflush(stdout);
-			if (ukbhit()) {
-				return -5;
-				break;
-			}
-
-			UsbCommand resp;
-			if (WaitForResponseTimeout(CMD_ACK, &resp, 1000)) {
-				isOK  = resp.arg[0];
-				if (isOK < 0) {
-					return isOK;
-				}
-				uid = (uint32_t)bytes_to_num(resp.d.asBytes +  0, 4);
-				nt =  (uint32_t)bytes_to_num(resp.d.asBytes +  4, 4);
-				par_list = bytes_to_num(resp.d.asBytes +  8, 8);
-				ks_list = bytes_to_num(resp.d.asBytes +  16, 8);
-				nr = (uint32_t)bytes_to_num(resp.d.asBytes + 24, 4);
-				ar = (uint32_t)bytes_to_num(resp.d.asBytes + 28, 4);
-				break;
-			}
-		}
-
-		if (par_list == 0 && c.arg[0] == true) {
-			PrintAndLog("Parity is all zero. Most likely this card sends NACK on every failed authentication.");
-		}
-		c.arg[0] = false;
-
-		keycount = nonce2key(uid, nt, nr, ar, par_list, ks_list, &keylist);
+		uint64_t *keylist = sample.keylist;
+		uint32_t keycount = sample.keycount;
 
 		if (keycount == 0) {
-			PrintAndLog("Key not found (lfsr_common_prefix list is null). Nt=%08x", nt);
+			PrintAndLog("Key not found (lfsr_common_prefix list is null). Nt=%08x", sample.nt);
 			PrintAndLog("This is expected to happen in 25%% of all cases. Trying again with a different reader nonce...");
+			sample = next_sample;
 			continue;
 		}
 
-		if (par_list == 0) {
-			qsort(keylist, keycount, sizeof(*keylist), compare_uint64);
-			keycount = intersection(last_keylist, keylist);
-			if (keycount == 0) {
-				free(last_keylist);
-				last_keylist = keylist;
-				continue;
+		// without parity information the key must also be in the candidates of the last sample
+		uint64_t *candidates = keylist;
+		uint32_t num_candidates = keycount;
+		if (sample.par_list == 0 && last_keys.keys != NULL) {
+			candidates = malloc(keycount * sizeof(uint64_t));
+			num_candidates = 0;
+			if (candidates != NULL) {
+				for (uint32_t i = 0; i < keycount; i++) {
+					if (keyset_contains(&last_keys, keylist[i])) {
+						candidates[num_candidates++] = keylist[i];
+					}
+				}
 			}
 		}
 
-		if (keycount > 1) {
-			PrintAndLog("Found %u possible keys. Trying to authenticate with each of them ...\n", keycount);
-		} else {
-			PrintAndLog("Found a possible key. Trying to authenticate...\n");
+		// The next sample is already there. Check the candidates against it on the host and try the
+		// ones which pass first. If none passes, check all of them on the card - unless they are the
+		// unfiltered candidates of the first sample without parity information. There are far too many.
+		if ((num_candidates > 1 || sample.par_list == 0) && next_sample.uid == sample.uid) {
+			uint32_t num_passed = 0;
+			for (uint32_t i = 0; i < num_candidates; i++) {
+				if (darkside_check_key(candidates[i], &next_sample)) {
+					uint64_t tmp = candidates[num_passed];
+					candidates[num_passed++] = candidates[i];
+					candidates[i] = tmp;
+				}
+			}
+			if (num_passed > 0 || (sample.par_list == 0 && last_keys.keys == NULL)) {
+				num_candidates = num_passed;
+			}
+		} else if (sample.par_list == 0 && last_keys.keys == NULL) {
+			num_candidates = 0;
 		}
 
 		*key = -1;
-		uint8_t keyBlock[USB_CMD_DATA_SIZE];
-		int max_keys = USB_CMD_DATA_SIZE/6;
-		for (int i = 0; i < keycount; i += max_keys) {
-			int size = keycount - i > max_keys ? max_keys : keycount - i;
-			for (int j = 0; j < size; j++) {
-				if (par_list == 0) {
-					num_to_bytes(last_keylist[i*max_keys + j], 6, keyBlock+(j*6));
-				} else {
-					num_to_bytes(keylist[i*max_keys + j], 6, keyBlock+(j*6));
-				}
+		if (num_candidates > 0) {
+			if (num_candidates > 1) {
+				PrintAndLog("Found %u possible keys. Trying to authenticate with each of them ...\n", num_candidates);
+			} else {
+				PrintAndLog("Found a possible key. Trying to authenticate...\n");
 			}
-			if (!mfCheckKeys(0, 0, false, size, keyBlock, key)) {
-				break;
+
+			uint8_t keyBlock[USB_CMD_DATA_SIZE];
+			int max_keys = USB_CMD_DATA_SIZE/6;
+			for (int i = 0; i < num_candidates; i += max_keys) {
+				int size = num_candidates - i > max_keys ? max_keys : num_candidates - i;
+				for (int j = 0; j < size; j++) {
+					num_to_bytes(candidates[i + j], 6, keyBlock+(j*6));
+				}
+				if (!mfCheckKeys(0, 0, false, size, keyBlock, key)) {
+					break;
+				}
 			}
 		}
+		if (candidates != keylist) {
+			free(candidates);
+		}
 
 		if (*key != -1) {
-			free(last_keylist);
 			free(keylist);
+			free(last_keys.keys);
 			break;
-		} else {
+		}
+		if (num_candidates > 0) {
 			PrintAndLog("Authentication failed. Trying again...");
-			free(last_keylist);
-			last_keylist = keylist;
 		}
+		keyset_set(&last_keys, keylist, keycount);
+		free(keylist);
+		sample = next_sample;
 	}
 
 	return 0;
@@ -270,13 +416,100 @@ int mfCheckKeysSec(uint8_t sectorCnt, uint8_t keyType, uint8_t timeout14a, bool
 	return foundAKey ? 0 : 3;
 }
 
-// Compare 16 Bits out of cryptostate
-int Compare16Bits(const void * a, const void * b) {
-	if ((*(uint64_t*)b & 0x00ff000000ff0000) == (*(uint64_t*)a & 0x00ff000000ff0000)) return 0;
-	else if ((*(uint64_t*)b & 0x00ff000000ff0000) > (*(uint64_t*)a & 0x00ff000000ff0000)) return 1;
-	else return -1;
+// Check a large number of keys. The keys are sent in batches of up to USB_CMD_DATA_SIZE/6 keys. The next batch is
+// sent before the answer to the current one arrives and the device leaves the field on between the batches,
+// i.e. the device checks keys continuously. Single block mode (e_sector == NULL) stops at the first valid key.
+static int mf_check_keys_stream(uint8_t blockNo, uint8_t keyType, uint16_t flags, uint32_t keycnt, uint8_t *keyBlock, sector_t *e_sector, uint64_t *key)
+{
+	uint32_t max_keys = USB_CMD_DATA_SIZE / 6;
+	uint32_t num_batches = (keycnt + max_keys - 1) / max_keys;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	bool foundAKey = false;
+	UsbCommand resp;
+
+	clearCommandBuffer();
+
+	while (received < num_batches) {
+		// keep two batches queued
+		while (sent < num_batches && sent < received + 2 && !(foundAKey && e_sector == NULL)) {
+			uint32_t size = MIN(keycnt - sent * max_keys, max_keys);
+			uint16_t batch_flags = flags;
+			batch_flags |= sent > 0 ? 0x04 : 0;					// continue stream
+			batch_flags |= sent < num_batches - 1 ? 0x08 : 0;	// keep field on
+			UsbCommand c = {CMD_MIFARE_CHKKEYS, {((blockNo & 0xff) | ((keyType & 0xff) << 8)), batch_flags, size}};
+			memcpy(c.d.asBytes, keyBlock + sent * max_keys * 6, 6 * size);
+			SendCommand(&c);
+			sent++;
+		}
+		if (received == sent) {
+			break;
+		}
+
+		uint32_t size = MIN(keycnt - received * max_keys, max_keys);
+		uint32_t timeout = e_sector == NULL ? 3000 : MAX(3000, 1000 + 13 * blockNo * size * (keyType == 2 ? 2 : 1)); // timeout: 13 ms / fail auth
+		if (!WaitForResponseTimeoutW(CMD_ACK, &resp, timeout, false)) {
+			return 1;
+		}
+		bool batch_found = false;
+		if ((resp.arg[0] & 0xff) == 0x01) {
+			if (e_sector == NULL) {
+				*key = bytes_to_num(resp.d.asBytes, 6);
+				batch_found = true;
+			} else {
+				for (int sec = 0; sec < blockNo; sec++) {
+					for (int keyAB = 0; keyAB < 2; keyAB++) {
+						uint8_t keyPtr = *(resp.d.asBytes + keyAB * 40 + sec);
+						if (keyPtr) {
+							e_sector[sec].foundKey[keyAB] = true;
+							e_sector[sec].Key[keyAB] = bytes_to_num(keyBlock + (received * max_keys + keyPtr - 1) * 6, 6);
+							batch_found = true;
+						}
+					}
+				}
+			}
+		}
+		foundAKey |= batch_found;
+		received++;
+
+		if (e_sector != NULL) {
+			printf(batch_found ? "o" : ".");
+			fflush(stdout);
+		}
+	}
+
+	// stopped early: the last batch left the field on. Switch it off with an empty one.
+	if (sent < num_batches) {
+		UsbCommand c = {CMD_MIFARE_CHKKEYS, {((blockNo & 0xff) | ((keyType & 0xff) << 8)), flags | 0x04, 0}};
+		SendCommand(&c);
+		WaitForResponseTimeoutW(CMD_ACK, &resp, 3000, false);
+	}
+
+	return foundAKey ? 0 : (e_sector == NULL ? 2 : 3);
+}
+
+int mfCheckKeysStream(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint32_t keycnt, uint8_t *keyBlock, uint64_t *key)
+{
+	*key = -1;
+	return mf_check_keys_stream(blockNo, keyType, clear_trace, keycnt, keyBlock, NULL, key);
+}
+
+int mfCheckKeysSecStream(uint8_t sectorCnt, uint8_t keyType, uint8_t timeout14a, bool clear_trace, uint32_t keycnt, uint8_t *keyBlock, sector_t *e_sector)
+{
+	if (e_sector == NULL)
+		return -1;
+
+	return mf_check_keys_stream(sectorCnt, keyType, (clear_trace | 0x02) | ((timeout14a & 0xff) << 8), keycnt, keyBlock, e_sector, NULL);
+}
+
+// the 16 Bits of a cryptostate which are already part of the key (bits 16..23 of odd and even half)
+static inline uint16_t state16bits(struct Crypto1State *s) {
+	return (s->even >> 8 & 0xff00) | (s->odd >> 16 & 0x00ff);
 }
 
+#define NESTED_MAX_PARTS			8		// max. number of parallel lfsr_recovery32_part() per nonce
+#define NESTED_HOST_CHECK_MIN_KEYS	16		// get more nonces and check the candidates on the host if there are more of them
+
 typedef
 	struct {
 		union {
@@ -293,8 +526,18 @@ typedef
 		uint32_t keyType;
 		uint32_t nt;
 		uint32_t ks1;
+		uint32_t num_parts;
+		struct Crypto1State *parts[NESTED_MAX_PARTS];
+		uint32_t bucket[0x10001];			// start of the states with the same 16 Bits
+		bool *common_bucket;				// buckets present in both statelists
 	} StateList_t;
 
+typedef
+	struct {
+		StateList_t *statelist;
+		uint32_t part;
+	} StateListPart_t;
+
 
 // wrapper function for multi-threaded lfsr_recovery32
 void
@@ -305,28 +548,105 @@ __attribute__((force_align_arg_pointer))
 #endif
 *nested_worker_thread(void *arg)
 {
-	struct Crypto1State *p1;
+	StateListPart_t *part = arg;
+	StateList_t *statelist = part->statelist;
+
+	statelist->parts[part->part] = lfsr_recovery32_part(statelist->ks1, statelist->nt ^ statelist->uid, part->part, statelist->num_parts);
+
+	return statelist->parts[part->part];
+}
+
+
+// merge the parts of a statelist and sort them into buckets according to their 16 Bits (counting sort)
+void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer)) 
+#endif
+#endif
+*nested_sort_thread(void *arg)
+{
 	StateList_t *statelist = arg;
+	struct Crypto1State *p1;
+
+	memset(statelist->bucket, 0, sizeof(statelist->bucket));
+	statelist->len = 0;
+	for (uint32_t i = 0; i < statelist->num_parts; i++) {
+		if (statelist->parts[i] == NULL) {
+			continue;
+		}
+		for (p1 = statelist->parts[i]; *(uint64_t *)p1 != 0; p1++) {
+			statelist->bucket[state16bits(p1) + 1]++;
+			statelist->len++;
+		}
+	}
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		statelist->bucket[i+1] += statelist->bucket[i];
+	}
 
-	statelist->head.slhead = lfsr_recovery32(statelist->ks1, statelist->nt ^ statelist->uid);
-	for (p1 = statelist->head.slhead; *(uint64_t *)p1 != 0; p1++);
-	statelist->len = p1 - statelist->head.slhead;
-	statelist->tail.sltail = --p1;
-	qsort(statelist->head.slhead, statelist->len, sizeof(uint64_t), Compare16Bits);
+	statelist->head.slhead = malloc((statelist->len + 1) * sizeof(struct Crypto1State));
+	if (statelist->head.slhead != NULL) {
+		uint32_t *next = malloc(0x10000 * sizeof(uint32_t));
+		if (next == NULL) {
+			free(statelist->head.slhead);
+			statelist->head.slhead = NULL;
+		} else {
+			memcpy(next, statelist->bucket, 0x10000 * sizeof(uint32_t));
+			for (uint32_t i = 0; i < statelist->num_parts; i++) {
+				if (statelist->parts[i] == NULL) {
+					continue;
+				}
+				for (p1 = statelist->parts[i]; *(uint64_t *)p1 != 0; p1++) {
+					statelist->head.slhead[next[state16bits(p1)]++] = *p1;
+				}
+			}
+			free(next);
+		}
+	}
+	for (uint32_t i = 0; i < statelist->num_parts; i++) {
+		free(statelist->parts[i]);
+		statelist->parts[i] = NULL;
+	}
 
 	return statelist->head.slhead;
 }
 
 
-int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate)
+// keep the states in buckets present in both statelists, roll back the cryptostate and sort the result
+void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer)) 
+#endif
+#endif
+*nested_rollback_thread(void *arg)
 {
-	uint16_t i;
-	uint32_t uid;
-	UsbCommand resp;
+	StateList_t *statelist = arg;
+	struct Crypto1State *p1, *p3;
+
+	p3 = statelist->head.slhead;
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		if (!statelist->common_bucket[i]) {
+			continue;
+		}
+		for (p1 = statelist->head.slhead + statelist->bucket[i]; p1 < statelist->head.slhead + statelist->bucket[i+1]; p1++) {
+			*p3 = *p1;
+			lfsr_rollback_word(p3, statelist->nt ^ statelist->uid, 0);
+			p3++;
+		}
+	}
+	*(uint64_t*)p3 = -1;
+	statelist->len = p3 - statelist->head.slhead;
+	statelist->tail.sltail = --p3;
+	qsort(statelist->head.keyhead, statelist->len, sizeof(uint64_t), compare_uint64);
+
+	return statelist->head.slhead;
+}
 
-	StateList_t statelists[2];
-	struct Crypto1State *p1, *p2, *p3, *p4;
 
+// get two nonces of the target sector (nt and the keystream ks1 which encrypted it) from the device
+static int nested_get_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, bool calibrate, UsbCommand *resp)
+{
 	// flush queue
 	(void)WaitForResponseTimeout(CMD_ACK,NULL,100);
 
@@ -334,90 +654,153 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
 	memcpy(c.d.asBytes, key, 6);
 	SendCommand(&c);
 
-	if (!WaitForResponseTimeout(CMD_ACK, &resp, 1500)) {
+	if (!WaitForResponseTimeout(CMD_ACK, resp, 1500)) {
 		return -1;
 	}
 
-	if (resp.arg[0]) {
-		return resp.arg[0];  // error during nested
+	return resp->arg[0];  // != 0: error during nested
+}
+
+
+// check a key candidate against a nonce of the target sector. Returns true if the key encrypts nt with ks1.
+static bool nested_check_key(uint64_t key, uint32_t uid, uint32_t nt, uint32_t ks1)
+{
+	struct Crypto1State *s = crypto1_create(key);
+	bool match = crypto1_word(s, uid ^ nt, 0) == ks1;
+	crypto1_destroy(s);
+	return match;
+}
+
+
+int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate)
+{
+	uint16_t i;
+	uint32_t uid;
+	UsbCommand resp;
+	int res;
+
+	StateList_t *statelists;
+
+	res = nested_get_nonces(blockNo, keyType, key, trgBlockNo, trgKeyType, calibrate, &resp);
+	if (res) {
+		return res;
 	}
 
 	memcpy(&uid, resp.d.asBytes, 4);
 	PrintAndLog("uid:%08x trgbl=%d trgkey=%x", uid, (uint16_t)resp.arg[2] & 0xff, (uint16_t)resp.arg[2] >> 8);
 
+	statelists = calloc(2, sizeof(StateList_t));
+	bool *common_bucket = malloc(0x10000 * sizeof(bool));
+	if (statelists == NULL || common_bucket == NULL) {
+		free(statelists);
+		free(common_bucket);
+		return -1;
+	}
+
+	// split the state recovery of each nonce into parts, using all CPU cores
+	uint32_t num_parts = MAX(1, MIN(NESTED_MAX_PARTS, (num_CPUs() + 1) / 2));
 	for (i = 0; i < 2; i++) {
 		statelists[i].blockNo = resp.arg[2] & 0xff;
 		statelists[i].keyType = (resp.arg[2] >> 8) & 0xff;
 		statelists[i].uid = uid;
 		memcpy(&statelists[i].nt,  (void *)(resp.d.asBytes + 4 + i * 8 + 0), 4);
 		memcpy(&statelists[i].ks1, (void *)(resp.d.asBytes + 4 + i * 8 + 4), 4);
+		statelists[i].num_parts = num_parts;
+		statelists[i].common_bucket = common_bucket;
 	}
 
 	// calc keys
 
-	pthread_t thread_id[2];
+	pthread_t thread_id[2 * NESTED_MAX_PARTS];
+	StateListPart_t parts[2 * NESTED_MAX_PARTS];
 
 	// create and run worker threads
-	for (i = 0; i < 2; i++) {
-		pthread_create(thread_id + i, NULL, nested_worker_thread, &statelists[i]);
+	for (i = 0; i < 2 * num_parts; i++) {
+		parts[i].statelist = &statelists[i / num_parts];
+		parts[i].part = i % num_parts;
+		pthread_create(thread_id + i, NULL, nested_worker_thread, &parts[i]);
 	}
 
 	// wait for threads to terminate:
-	for (i = 0; i < 2; i++) {
-		pthread_join(thread_id[i], (void*)&statelists[i].head.slhead);
+	for (i = 0; i < 2 * num_parts; i++) {
+		pthread_join(thread_id[i], NULL);
 	}
-
+	crapto1_free_arenas();
 
 	// the first 16 Bits of the cryptostate already contain part of our key.
-	// Create the intersection of the two lists based on these 16 Bits and
-	// roll back the cryptostate
-	p1 = p3 = statelists[0].head.slhead;
-	p2 = p4 = statelists[1].head.slhead;
-	while (p1 <= statelists[0].tail.sltail && p2 <= statelists[1].tail.sltail) {
-		if (Compare16Bits(p1, p2) == 0) {
-			struct Crypto1State savestate, *savep = &savestate;
-			savestate = *p1;
-			while(Compare16Bits(p1, savep) == 0 && p1 <= statelists[0].tail.sltail) {
-				*p3 = *p1;
-				lfsr_rollback_word(p3, statelists[0].nt ^ statelists[0].uid, 0);
-				p3++;
-				p1++;
-			}
-			savestate = *p2;
-			while(Compare16Bits(p2, savep) == 0 && p2 <= statelists[1].tail.sltail) {
-				*p4 = *p2;
-				lfsr_rollback_word(p4, statelists[1].nt ^ statelists[1].uid, 0);
-				p4++;
-				p2++;
-			}
-		}
-		else {
-			while (Compare16Bits(p1, p2) == -1) p1++;
-			while (Compare16Bits(p1, p2) == 1) p2++;
-		}
+	// Sort both lists into buckets based on these 16 Bits ...
+	for (i = 0; i < 2; i++) {
+		pthread_create(thread_id + i, NULL, nested_sort_thread, &statelists[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_join(thread_id[i], NULL);
+	}
+	if (statelists[0].head.slhead == NULL || statelists[1].head.slhead == NULL) {
+		free(statelists[0].head.slhead);
+		free(statelists[1].head.slhead);
+		free(statelists);
+		free(common_bucket);
+		return -1;
+	}
+
+	// ... create the intersection of the two lists based on these 16 Bits and roll back the cryptostate
+	for (uint32_t j = 0; j < 0x10000; j++) {
+		common_bucket[j] = statelists[0].bucket[j+1] != statelists[0].bucket[j] && statelists[1].bucket[j+1] != statelists[1].bucket[j];
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_create(thread_id + i, NULL, nested_rollback_thread, &statelists[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_join(thread_id[i], NULL);
 	}
-	*(uint64_t*)p3 = -1;
-	*(uint64_t*)p4 = -1;
-	statelists[0].len = p3 - statelists[0].head.slhead;
-	statelists[1].len = p4 - statelists[1].head.slhead;
-	statelists[0].tail.sltail=--p3;
-	statelists[1].tail.sltail=--p4;
 
 	// the statelists now contain possible keys. The key we are searching for must be in the
 	// intersection of both lists. Create the intersection:
-	qsort(statelists[0].head.keyhead, statelists[0].len, sizeof(uint64_t), compare_uint64);
-	qsort(statelists[1].head.keyhead, statelists[1].len, sizeof(uint64_t), compare_uint64);
 	statelists[0].len = intersection(statelists[0].head.keyhead, statelists[1].head.keyhead);
 
 	memset(resultKey, 0, 6);
-	// The list may still contain several key candidates. Test each of them with mfCheckKeys
-	for (i = 0; i < statelists[0].len; i++) {
-		uint8_t keyBlock[6];
-		uint64_t key64;
-		crypto1_get_lfsr(statelists[0].head.slhead + i, &key64);
-		num_to_bytes(key64, 6, keyBlock);
-		key64 = 0;
-		if (!mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, 1, keyBlock, &key64)) {
+	// The list may still contain several key candidates.
+	uint64_t *keys = statelists[0].head.keyhead;
+	uint32_t num_keys = statelists[0].len;
+	for (uint32_t j = 0; j < num_keys; j++) {
+		struct Crypto1State state = statelists[0].head.slhead[j];
+		crypto1_get_lfsr(&state, &keys[j]);
+	}
+
+	// Checking a key on the card costs a full authentication. If there are many of them, get
+	// two more nonces instead and check the candidates against them on the host first.
+	if (num_keys > NESTED_HOST_CHECK_MIN_KEYS
+		&& nested_get_nonces(blockNo, keyType, key, trgBlockNo, trgKeyType, false, &resp) == 0
+		&& memcmp(resp.d.asBytes, &uid, 4) == 0) {
+		uint32_t nt[2], ks1[2];
+		for (i = 0; i < 2; i++) {
+			memcpy(&nt[i],  (void *)(resp.d.asBytes + 4 + i * 8 + 0), 4);
+			memcpy(&ks1[i], (void *)(resp.d.asBytes + 4 + i * 8 + 4), 4);
+		}
+		uint32_t num_passed = 0;
+		for (uint32_t j = 0; j < num_keys; j++) {
+			if (nested_check_key(keys[j], uid, nt[0], ks1[0]) && nested_check_key(keys[j], uid, nt[1], ks1[1])) {
+				uint64_t tmp = keys[num_passed];
+				keys[num_passed++] = keys[j];
+				keys[j] = tmp;
+			}
+		}
+		// none passed: most likely the device got an ambiguous nonce. Check all candidates on the card.
+		if (num_passed > 0) {
+			num_keys = num_passed;
+		}
+	}
+
+	// Test the remaining candidates in batches with mfCheckKeys
+	uint8_t keyBlock[USB_CMD_DATA_SIZE];
+	uint32_t max_keys = USB_CMD_DATA_SIZE / 6;
+	for (uint32_t j = 0; j < num_keys; j += max_keys) {
+		uint32_t size = num_keys - j > max_keys ? max_keys : num_keys - j;
+		for (uint32_t k = 0; k < size; k++) {
+			num_to_bytes(keys[j + k], 6, keyBlock + k * 6);
+		}
+		uint64_t key64 = 0;
+		if (!mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, size, keyBlock, &key64)) {
 			num_to_bytes(key64, 6, resultKey);
 			break;
 		}
@@ -425,6 +808,8 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
 
 	free(statelists[0].head.slhead);
 	free(statelists[1].head.slhead);
+	free(statelists);
+	free(common_bucket);
 
 	return 0;
 }
@@ -609,7 +994,12 @@ int isBlockEmpty(int blockN) {
 }
 
 int isBlockTrailer(int blockN) {
- return ((blockN & 0x03) == 0x03);
+	// sectors 0..31 have 4 blocks, sectors 32..39 (MIFARE Classic 4K) have 16 blocks
+	if (blockN < 32 * 4) {
+		return ((blockN & 0x03) == 0x03);
+	} else {
+		return ((blockN & 0x0f) == 0x0f);
+	}
 }
 
 int saveTraceCard(void) {
@@ -743,6 +1133,35 @@ bool NTParityCheck(uint32_t ntx) {
 }
 
 
+static bool traceCheckKnownKeys(uint32_t *ntx, uint64_t *key) {
+	// test the keys of the trace card and the default keys against a nested authentication. All keys are
+	// tested at once, the candidates are verified with the parity of the encrypted nonces.
+	uint64_t keys[2 * 64 + MifareDefaultKeysSize];
+	uint64_t candidates[2 * 64 + MifareDefaultKeysSize];
+	uint32_t keycnt = 0;
+
+	for (int block = 0; block < 256; block++) {
+		if (!isBlockTrailer(block) || isBlockEmpty(block)) continue;
+		keys[keycnt++] = bytes_to_num(traceCard + block * 16, 6);
+		keys[keycnt++] = bytes_to_num(traceCard + block * 16 + 10, 6);
+	}
+	memcpy(keys + keycnt, MifareDefaultKeys, MifareDefaultKeysSize * sizeof(uint64_t));
+	keycnt += MifareDefaultKeysSize;
+
+	uint32_t num_candidates = crypto1_bs_test_auth(keys, keycnt, uid, nt_enc, true, nr_enc, ar_enc, at_enc, candidates);
+	for (uint32_t i = 0; i < num_candidates; i++) {
+		struct Crypto1State *pcs = crypto1_create(candidates[i]);
+		uint32_t nt1 = crypto1_word(pcs, nt_enc ^ uid, 1) ^ nt_enc;
+		crypto1_destroy(pcs);
+		if (NTParityCheck(nt1)) {
+			*ntx = nt1;
+			*key = candidates[i];
+			return true;
+		}
+	}
+	return false;
+}
+
 int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEmlFile) {
 	uint8_t data[64];
 
@@ -918,21 +1337,26 @@ int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEml
 					else
 						printf("key> the same key test. check nt parity error.\n");
 					
-					uint32_t ntc = prng_successor(nt, 90);
 					uint32_t ntx = 0;
-					int ntcnt = 0;
-					for (int i = 0; i < 16383; i++) {
-						ntc = prng_successor(ntc, 1);
-						if (NTParityCheck(ntc)){
-							if (!ntcnt)
-								ntx = ntc;
-							ntcnt++;
-						}						
+					uint64_t known_key;
+					if (traceCheckKnownKeys(&ntx, &known_key)) {
+						printf("key> known key=%012" PRIx64 " nt=%08x\n", known_key, ntx);
+					} else {
+						uint32_t ntc = prng_successor(nt, 90);
+						int ntcnt = 0;
+						for (int i = 0; i < 16383; i++) {
+							ntc = prng_successor(ntc, 1);
+							if (NTParityCheck(ntc)){
+								if (!ntcnt)
+									ntx = ntc;
+								ntcnt++;
+							}						
+						}
+						if (ntcnt)
+							printf("key> nt candidate=%08x nonce distance=%d candidates count=%d\n", ntx, nonce_distance(nt, ntx), ntcnt);
+						else
+							printf("key> don't have any nt candidate( \n");
 					}
-					if (ntcnt)
-						printf("key> nt candidate=%08x nonce distance=%d candidates count=%d\n", ntx, nonce_distance(nt, ntx), ntcnt);
-					else
-						printf("key> don't have any nt candidate( \n");
 
 					nt = ntx;
 					ks2 = ar_enc ^ prng_successor(ntx, 64);
@@ -1023,23 +1447,7 @@ int tryDecryptWord(uint32_t nt, uint32_t ar_enc, uint32_t at_enc, uint8_t *data,
  *   false = hardend prng
  */
 bool validate_prng_nonce(uint32_t nonce) {
-	uint16_t *dist = 0;
-	uint16_t x, i;
-
-	dist = malloc(2 << 16);
-	if(!dist)
-		return -1;
-
-	// init prng table:
-	for (x = i = 1; i; ++i) {
-		dist[(x & 0xff) << 8 | x >> 8] = i;
-		x = x >> 1 | (x ^ x >> 2 ^ x >> 3 ^ x >> 5) << 15;
-	}
-	
-	uint32_t res = (65535 - dist[nonce >> 16] + dist[nonce & 0xffff]) % 65535;
-	
-	free(dist);	
-	return (res == 16);
+	return prng_valid_nonce(nonce);
 }
 
 /* Detect Tag Prng, 
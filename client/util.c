@@ -694,3 +694,13 @@ extern int num_CPUs(void)
 #endif
 }
 
+
+uint64_t fnv1a_64(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	while (len--) {
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
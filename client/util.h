@@ -92,4 +92,7 @@ char *strmcopy(char *buf);
 
 extern int num_CPUs(void);			// number of logical CPUs
 
+#define FNV1A_64_INIT		0xcbf29ce484222325ULL
+extern uint64_t fnv1a_64(uint64_t hash, const void *data, size_t len);	// FNV-1a hash. Start with hash = FNV1A_64_INIT.
+
 #endif // UTIL_H__
@@ -16,7 +16,14 @@
 
 #include "util_posix.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
 
 
 // Timer functions
@@ -133,3 +140,39 @@ uint64_t msclock() {
 #endif
 }
 
+
+
+// Path of a file in the user's cache directory: $XDG_CACHE_HOME/proxmark3, ~/.proxmark3 if
+// XDG_CACHE_HOME isn't set, %LOCALAPPDATA%\proxmark3 on Windows. The directory is created if necessary.
+// Returns false if there is no such directory.
+bool get_user_cache_path(const char *filename, char *path, size_t path_size) {
+	const char *base;
+	const char *subdir;
+#if defined(_WIN32)
+	base = getenv("LOCALAPPDATA");
+	subdir = "proxmark3";
+#else
+	base = getenv("XDG_CACHE_HOME");
+	subdir = "proxmark3";
+	if (base == NULL || base[0] == '\0') {
+		base = getenv("HOME");
+		subdir = ".proxmark3";
+	}
+#endif
+	if (base == NULL || base[0] == '\0') {
+		return false;
+	}
+	if (snprintf(path, path_size, "%s/%s", base, subdir) >= (int)path_size) {
+		return false;
+	}
+#if defined(_WIN32)
+	_mkdir(path);
+#else
+	mkdir(path, 0700);
+#endif
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		return false;
+	}
+	return snprintf(path, path_size, "%s/%s/%s", base, subdir, filename) < (int)path_size;
+}
@@ -12,6 +12,8 @@
 #define UTIL_POSIX_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 # include <windows.h>
@@ -22,5 +24,6 @@ extern void msleep(uint32_t n);		// sleep n milliseconds
 #endif // _WIN32
 
 extern uint64_t msclock(); 			// a milliseconds clock
+extern bool get_user_cache_path(const char *filename, char *path, size_t path_size);
 
 #endif
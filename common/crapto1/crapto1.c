@@ -20,6 +20,7 @@
 #include "crapto1.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include "parity.h"
 
 #if !defined LOWMEM && defined __GNUC__
@@ -35,13 +36,6 @@ static void __attribute__((constructor)) fill_lut()
 
 
 
-typedef struct bucket {
-	uint32_t *head;
-	uint32_t *bp;
-} bucket_t;
-
-typedef bucket_t bucket_array_t[2][0x100];
-
 typedef struct bucket_info {
 	struct {
 		uint32_t *head, *tail;
@@ -49,52 +43,165 @@ typedef struct bucket_info {
 		uint32_t numbuckets;
 	} bucket_info_t;
 
+/** crapto1_arena
+ * the tables of lfsr_recovery32 (2 * 8MBytes) and the scratch area for the bucket sort.
+ * Arenas are kept in a small pool and reused by subsequent calls (also from other threads).
+ */
+#define ARENA_POOL_SIZE 4
+typedef struct crapto1_arena {
+	uint32_t *odd;
+	uint32_t *even;
+	uint32_t *scratch;
+} crapto1_arena_t;
+
+static crapto1_arena_t *arena_pool[ARENA_POOL_SIZE];
+
+static void free_arena(crapto1_arena_t *arena)
+{
+	free(arena->odd);
+	free(arena->even);
+	free(arena->scratch);
+	free(arena);
+}
+
+static crapto1_arena_t *get_arena(void)
+{
+	crapto1_arena_t *arena;
+	for (int i = 0; i < ARENA_POOL_SIZE; i++) {
+		arena = arena_pool[i];
+		if (arena && __sync_bool_compare_and_swap(&arena_pool[i], arena, NULL))
+			return arena;
+	}
+	arena = calloc(1, sizeof(crapto1_arena_t));
+	if (!arena)
+		return 0;
+	arena->odd = malloc(sizeof(uint32_t) << 21);
+	arena->even = malloc(sizeof(uint32_t) << 21);
+	arena->scratch = malloc(sizeof(uint32_t) << 21);
+	if (!arena->odd || !arena->even || !arena->scratch) {
+		free_arena(arena);
+		return 0;
+	}
+	return arena;
+}
+
+static void put_arena(crapto1_arena_t *arena)
+{
+	for (int i = 0; i < ARENA_POOL_SIZE; i++)
+		if (__sync_bool_compare_and_swap(&arena_pool[i], NULL, arena))
+			return;
+	free_arena(arena);
+}
 
+/** crapto1_free_arenas
+ * free the pooled arenas (up to 4 * 24MBytes). Call when no more state recoveries
+ * are expected soon. Arenas in use by other threads are pooled again when they are done.
+ */
+void crapto1_free_arenas(void)
+{
+	for (int i = 0; i < ARENA_POOL_SIZE; i++) {
+		crapto1_arena_t *arena = arena_pool[i];
+		if (arena && __sync_bool_compare_and_swap(&arena_pool[i], arena, NULL))
+			free_arena(arena);
+	}
+}
+
+
+/** small_bucket_sort_intersect
+ * bucket_sort_intersect for short lists: insertion sort instead of counting 256 buckets
+ */
+#define SMALL_BUCKET_SORT 64
+static void small_bucket_sort_intersect(uint32_t **start, uint32_t **stop, bucket_info_t *bucket_info)
+{
+	uint32_t *p1, *p2, *p3;
+	uint32_t present[2][8] = {{0}};
+	uint32_t common[8];
+
+	for (uint32_t i = 0; i < 2; i++)
+		for (p1 = start[i]; p1 <= stop[i]; p1++)
+			present[i][*p1 >> 29] |= 1 << (*p1 >> 24 & 0x1f);
+	for (uint32_t k = 0; k < 8; k++)
+		common[k] = present[0][k] & present[1][k];
+
+	uint32_t nonempty_bucket;
+	for (uint32_t i = 0; i < 2; i++) {
+		// drop the non-intersecting entries and sort the others (stable)
+		p3 = start[i];
+		for (p1 = start[i]; p1 <= stop[i]; p1++) {
+			if (!(common[*p1 >> 29] & 1 << (*p1 >> 24 & 0x1f)))
+				continue;
+			uint32_t v = *p1;
+			for (p2 = p3; p2 > start[i] && p2[-1] >> 24 > v >> 24; p2--)
+				*p2 = p2[-1];
+			*p2 = v;
+			p3++;
+		}
+		nonempty_bucket = 0;
+		for (p1 = start[i]; p1 < p3; p1 = p2) {
+			for (p2 = p1 + 1; p2 < p3 && *p2 >> 24 == *p1 >> 24; p2++);
+			bucket_info->bucket_info[i][nonempty_bucket].head = p1;
+			bucket_info->bucket_info[i][nonempty_bucket].tail = p2 - 1;
+			nonempty_bucket++;
+		}
+	}
+	bucket_info->numbuckets = nonempty_bucket;
+}
+
+
+/** bucket_sort_intersect
+ * stable counting sort of both lists by their MSB (contribution bits). Only buckets which are
+ * non-empty in both lists are kept. Fills in bucket_info with head and tail of the bucket
+ * contents in the lists and the number of non-empty intersecting buckets.
+ */
 static void bucket_sort_intersect(uint32_t* const estart, uint32_t* const estop,
 								  uint32_t* const ostart, uint32_t* const ostop,
-								  bucket_info_t *bucket_info, bucket_array_t bucket)
+								  bucket_info_t *bucket_info, uint32_t *scratch)
 {
-	uint32_t *p1, *p2;
+	uint32_t *p1;
 	uint32_t *start[2];
 	uint32_t *stop[2];
+	uint32_t count[2][0x100];
+	uint32_t pos[0x100];
 
 	start[0] = estart;
 	stop[0] = estop;
 	start[1] = ostart;
 	stop[1] = ostop;
 
-	// init buckets to be empty
-	for (uint32_t i = 0; i < 2; i++) {
-		for (uint32_t j = 0x00; j <= 0xff; j++) {
-			bucket[i][j].bp = bucket[i][j].head;
-		}
-	}
-
-	// sort the lists into the buckets based on the MSB (contribution bits)
-	for (uint32_t i = 0; i < 2; i++) {
-		for (p1 = start[i]; p1 <= stop[i]; p1++) {
-			uint32_t bucket_index = (*p1 & 0xff000000) >> 24;
-			*(bucket[i][bucket_index].bp++) = *p1;
-		}
+	if (stop[0] - start[0] + stop[1] - start[1] < SMALL_BUCKET_SORT) {
+		small_bucket_sort_intersect(start, stop, bucket_info);
+		return;
 	}
 
+	memset(count, 0, sizeof(count));
+	for (uint32_t i = 0; i < 2; i++)
+		for (p1 = start[i]; p1 <= stop[i]; p1++)
+			count[i][*p1 >> 24]++;
 
-	// write back intersecting buckets as sorted list.
-	// fill in bucket_info with head and tail of the bucket contents in the list and number of non-empty buckets.
 	uint32_t nonempty_bucket;
 	for (uint32_t i = 0; i < 2; i++) {
-		p1 = start[i];
+		// positions of the intersecting buckets. Other buckets are dropped.
+		uint32_t len = 0;
 		nonempty_bucket = 0;
 		for (uint32_t j = 0x00; j <= 0xff; j++) {
-			if (bucket[0][j].bp != bucket[0][j].head && bucket[1][j].bp != bucket[1][j].head) { // non-empty intersecting buckets only
-				bucket_info->bucket_info[i][nonempty_bucket].head = p1;
-				for (p2 = bucket[i][j].head; p2 < bucket[i][j].bp; *p1++ = *p2++);
-				bucket_info->bucket_info[i][nonempty_bucket].tail = p1 - 1;
+			if (count[0][j] && count[1][j]) {
+				pos[j] = len;
+				bucket_info->bucket_info[i][nonempty_bucket].head = start[i] + len;
+				len += count[i][j];
+				bucket_info->bucket_info[i][nonempty_bucket].tail = start[i] + len - 1;
 				nonempty_bucket++;
+			} else {
+				pos[j] = -1;
 			}
 		}
-		bucket_info->numbuckets = nonempty_bucket;
+		for (p1 = start[i]; p1 <= stop[i]; p1++) {
+			uint32_t *bp = &pos[*p1 >> 24];
+			if (*bp != -1)
+				scratch[(*bp)++] = *p1;
 		}
+		memcpy(start[i], scratch, len * sizeof(uint32_t));
+	}
+	bucket_info->numbuckets = nonempty_bucket;
 }
 /** binsearch
  * Binary search for the first occurence of *stop's MSB in sorted [start,stop]
@@ -169,7 +276,7 @@ static inline void extend_table_simple(uint32_t *tbl, uint32_t **end, int bit)
 static struct Crypto1State*
 recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
 	uint32_t *e_head, uint32_t *e_tail, uint32_t eks, int rem,
-	struct Crypto1State *sl, uint32_t in, bucket_array_t bucket)
+	struct Crypto1State *sl, uint32_t in, uint32_t *scratch)
 {
 	uint32_t *o, *e, i;
 	bucket_info_t bucket_info;
@@ -200,12 +307,12 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
 		if(e_head > e_tail)
 			return sl;
 	}
-	bucket_sort_intersect(e_head, e_tail, o_head, o_tail, &bucket_info, bucket);
+	bucket_sort_intersect(e_head, e_tail, o_head, o_tail, &bucket_info, scratch);
 
 	for (int i = bucket_info.numbuckets - 1; i >= 0; i--) {
 		sl = recover(bucket_info.bucket_info[1][i].head, bucket_info.bucket_info[1][i].tail, oks,
 					 bucket_info.bucket_info[0][i].head, bucket_info.bucket_info[0][i].tail, eks,
-					 rem, sl, in, bucket);
+					 rem, sl, in, scratch);
 	}
 
 	return sl;
@@ -216,44 +323,60 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
  * that was fed into the lfsr at the time the keystream was generated
  */
 struct Crypto1State* lfsr_recovery32(uint32_t ks2, uint32_t in)
+{
+	return lfsr_recovery32_part(ks2, in, 0, 1);
+}
+/** lfsr_recovery32_part
+ * like lfsr_recovery32, but only recover the part-th of num_parts slices of
+ * the result. The odd and the even table are both split, num_parts is
+ * factored into odd_parts * even_parts (as square as possible) and each part
+ * pairs one odd with one even slice. Every state is the combination of one
+ * initial odd and one initial even entry, so the union of the results of all
+ * parts is the result of lfsr_recovery32. Parts are independent and can be
+ * recovered in parallel.
+ */
+struct Crypto1State* lfsr_recovery32_part(uint32_t ks2, uint32_t in, uint32_t part, uint32_t num_parts)
 {
 	struct Crypto1State *statelist;
 	uint32_t *odd_head = 0, *odd_tail = 0, oks = 0;
 	uint32_t *even_head = 0, *even_tail = 0, eks = 0;
 	int i;
+	uint32_t even_parts = 1;
+	for (uint32_t d = 2; d * d <= num_parts; d++)
+		if (num_parts % d == 0)
+			even_parts = d;
+	uint32_t odd_parts = num_parts / even_parts;
+	uint32_t odd_part = part / even_parts, even_part = part % even_parts;
+	int odd_lo = (uint64_t)((1 << 20) + 1) * odd_part / odd_parts;
+	int odd_hi = (uint64_t)((1 << 20) + 1) * (odd_part + 1) / odd_parts;
+	int even_lo = (uint64_t)((1 << 20) + 1) * even_part / even_parts;
+	int even_hi = (uint64_t)((1 << 20) + 1) * (even_part + 1) / even_parts;
 
 	for(i = 31; i >= 0; i -= 2)
 		oks = oks << 1 | BEBIT(ks2, i);
 	for(i = 30; i >= 0; i -= 2)
  		eks = eks << 1 | BEBIT(ks2, i);
 
-	odd_head = odd_tail = malloc(sizeof(uint32_t) << 21);
-	even_head = even_tail = malloc(sizeof(uint32_t) << 21);
+	crapto1_arena_t *arena = get_arena();
 	statelist =  malloc(sizeof(struct Crypto1State) << 18);
-	if(!odd_tail-- || !even_tail-- || !statelist) {
+	if(!arena || !statelist) {
 		free(statelist);
-		statelist = 0;
-		goto out;
+		if (arena)
+			put_arena(arena);
+		return 0;
 	}
 	statelist->odd = statelist->even = 0;
+	odd_head = odd_tail = arena->odd;
+	even_head = even_tail = arena->even;
+	odd_tail--;
+	even_tail--;
 
-	// allocate memory for out of place bucket_sort
-	bucket_array_t bucket;
-	for (uint32_t i = 0; i < 2; i++)
-		for (uint32_t j = 0; j <= 0xff; j++) {
-			bucket[i][j].head = malloc(sizeof(uint32_t)<<14);
-			if (!bucket[i][j].head) {
-				goto out;
-			}
-		}
-
-
-	for(i = 1 << 20; i >= 0; --i) {
+	for(i = odd_hi - 1; i >= odd_lo; --i)
 		if(filter(i) == (oks & 1))
 			*++odd_tail = i;
+	for(i = even_hi - 1; i >= even_lo; --i)
 		if(filter(i) == (eks & 1))
 			*++even_tail = i;
-	}
 
 	for(i = 0; i < 4; i++) {
 		extend_table_simple(odd_head,  &odd_tail, (oks >>= 1) & 1);
@@ -262,14 +385,9 @@ struct Crypto1State* lfsr_recovery32(uint32_t ks2, uint32_t in)
 
 	in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00);
 	recover(odd_head, odd_tail, oks,
-		even_head, even_tail, eks, 11, statelist, in << 1, bucket);
+		even_head, even_tail, eks, 11, statelist, in << 1, arena->scratch);
 
-out:
-	free(odd_head);
-	free(even_head);
-	for (uint32_t i = 0; i < 2; i++)
-		for (uint32_t j = 0; j <= 0xff; j++)
-			free(bucket[i][j].head);
+	put_arena(arena);
 
 	return statelist;
 }
@@ -407,25 +525,6 @@ uint32_t lfsr_rollback_word(struct Crypto1State *s, uint32_t in, int fb)
 	return ret;
 }
 
-/** nonce_distance
- * x,y valid tag nonces, then prng_successor(x, nonce_distance(x, y)) = y
- */
-static uint16_t *dist = 0;
-int nonce_distance(uint32_t from, uint32_t to)
-{
-	uint16_t x, i;
-	if(!dist) {
-		dist = malloc(2 << 16);
-		if(!dist)
-			return -1;
-		for (x = i = 1; i; ++i) {
-			dist[(x & 0xff) << 8 | x >> 8] = i;
-			x = x >> 1 | (x ^ x >> 2 ^ x >> 3 ^ x >> 5) << 15;
-		}
-	}
-	return (65535 + dist[to >> 16] - dist[from >> 16]) % 65535;
-}
-
 static uint32_t fastfwd[2][8] = {
 	{ 0, 0x4BC53, 0xECB1, 0x450E2, 0x25E29, 0x6E27A, 0x2B298, 0x60ECB},
 	{ 0, 0x1D962, 0x4BC53, 0x56531, 0xECB1, 0x135D3, 0x450E2, 0x58980}};
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 #include "parity.h"
+#include "prng_table.h"
 
 #define SWAPENDIAN(x)\
 	(x = (x >> 8 & 0xff00ff) | (x & 0xff00ff) << 8, x = x >> 16 | x << 16)
@@ -81,6 +82,7 @@ uint8_t crypto1_bit(struct Crypto1State *s, uint8_t in, int is_encrypted)
 
 	return ret;
 }
+#if defined(__arm__) && !defined(__linux__) && !defined(_WIN32) && !defined(__APPLE__)
 uint8_t crypto1_byte(struct Crypto1State *s, uint8_t in, int is_encrypted)
 {
 	uint8_t i, ret = 0;
@@ -99,6 +101,83 @@ uint32_t crypto1_word(struct Crypto1State *s, uint32_t in, int is_encrypted)
 
 	return ret;
 }
+#else
+/* Without keystream feedback the 8 bits shifted in during a byte are linear
+ * in the state and the input. They are looked up in byte tables instead of
+ * being computed bit by bit. Table entries hold the new even bits in the high
+ * nibble and the new odd bits in the low nibble, oldest bit first.
+ */
+static uint8_t fb_odd[3][256], fb_even[3][256], fb_in[256];
+
+static uint8_t feedback_byte(uint32_t odd, uint32_t even, uint8_t in)
+{
+	struct Crypto1State s = {odd, even};
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		crypto1_bit(&s, BIT(in, i), 0);
+
+	return (s.even & 0xf) << 4 | (s.odd & 0xf);
+}
+__attribute__((constructor)) static void init_feedback_tables(void)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < 256; ++i) {
+		for (j = 0; j < 3; ++j) {
+			fb_odd[j][i] = feedback_byte(i << 8 * j, 0, 0);
+			fb_even[j][i] = feedback_byte(0, i << 8 * j, 0);
+		}
+		fb_in[i] = feedback_byte(0, 0, i);
+	}
+}
+uint8_t crypto1_byte(struct Crypto1State *s, uint8_t in, int is_encrypted)
+{
+	uint8_t i, ret = 0, fb;
+	uint32_t odd, even;
+
+	if (is_encrypted) {
+		for (i = 0; i < 8; ++i)
+			ret |= crypto1_bit(s, BIT(in, i), is_encrypted) << i;
+		return ret;
+	}
+
+	fb  = fb_in[in];
+	fb ^= fb_odd[0][s->odd & 0xff] ^ fb_odd[1][s->odd >> 8 & 0xff] ^ fb_odd[2][s->odd >> 16 & 0xff];
+	fb ^= fb_even[0][s->even & 0xff] ^ fb_even[1][s->even >> 8 & 0xff] ^ fb_even[2][s->even >> 16 & 0xff];
+	odd = s->odd << 4 | (fb & 0xf);
+	even = s->even << 4 | fb >> 4;
+
+	ret  = filter(odd >> 4);
+	ret |= filter(even >> 3) << 1;
+	ret |= filter(odd >> 3) << 2;
+	ret |= filter(even >> 2) << 3;
+	ret |= filter(odd >> 2) << 4;
+	ret |= filter(even >> 1) << 5;
+	ret |= filter(odd >> 1) << 6;
+	ret |= filter(even) << 7;
+
+	s->odd = odd;
+	s->even = even;
+
+	return ret;
+}
+uint32_t crypto1_word(struct Crypto1State *s, uint32_t in, int is_encrypted)
+{
+	uint32_t i, ret = 0;
+
+	if (is_encrypted) {
+		for (i = 0; i < 32; ++i)
+			ret |= crypto1_bit(s, BEBIT(in, i), is_encrypted) << (i ^ 24);
+		return ret;
+	}
+
+	for (i = 0; i < 32; i += 8)
+		ret |= (uint32_t)crypto1_byte(s, in >> (24 - i), 0) << (24 - i);
+
+	return ret;
+}
+#endif
 
 /* prng_successor
  * helper used to obscure the keystream during authentication
@@ -111,3 +190,59 @@ uint32_t prng_successor(uint32_t x, uint32_t n)
 
 	return SWAPENDIAN(x);
 }
+
+/* prng_position
+ * position of a 16 bit half of a tag nonce in the PRNG sequence, -1 if invalid.
+ * Steps forward to the next anchor state (at most PRNG_ANCHOR_SPACING - 1 steps)
+ */
+static int prng_position(uint16_t n)
+{
+	uint16_t x = n >> 8 | n << 8;
+	int steps;
+
+	if(!x)
+		return -1;
+
+	for(steps = 0; steps < PRNG_ANCHOR_SPACING; ++steps) {
+		int i = prng_anchor_bucket[x >> 8];
+		int end = prng_anchor_bucket[(x >> 8) + 1];
+		for(; i < end; ++i)
+			if(prng_anchor_state[i] == x)
+				return (PRNG_PERIOD + prng_anchor_pos[i] - steps) % PRNG_PERIOD;
+		x = x >> 1 | (x ^ x >> 2 ^ x >> 3 ^ x >> 5) << 15;
+	}
+
+	return -1;
+}
+
+/** nonce_distance
+ * x,y valid tag nonces, then prng_successor(x, nonce_distance(x, y)) = y
+ */
+int nonce_distance(uint32_t from, uint32_t to)
+{
+	int pfrom = prng_position(from >> 16);
+	int pto = prng_position(to >> 16);
+
+	if(pfrom < 0 || pto < 0)
+		return -1;
+
+	return (PRNG_PERIOD + pto - pfrom) % PRNG_PERIOD;
+}
+
+/** prng_valid_nonce
+ * true if nt can have been generated by the tag PRNG, i.e. its lower half
+ * is the 16th successor of its upper half
+ */
+int prng_valid_nonce(uint32_t nt)
+{
+	uint16_t x = (nt >> 16 & 0xff) << 8 | nt >> 24;
+	int i;
+
+	if(!x)
+		return 0;
+
+	for(i = 0; i < 16; ++i)
+		x = x >> 1 | (x ^ x >> 2 ^ x >> 3 ^ x >> 5) << 15;
+
+	return x == ((nt & 0xff) << 8 | (nt >> 8 & 0xff));
+}
@@ -0,0 +1,192 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Anchor states of the MIFARE Classic tag PRNG. Generated by tools/mkprngtable.py,
+// do not edit.
+//-----------------------------------------------------------------------------
+
+#ifndef PRNG_TABLE_H__
+#define PRNG_TABLE_H__
+
+#include <stdint.h>
+
+#define PRNG_PERIOD				65535
+#define PRNG_ANCHOR_SPACING		128
+#define PRNG_ANCHORS			512
+
+// anchors with state >> 8 == i are prng_anchor_state[prng_anchor_bucket[i]] ... [prng_anchor_bucket[i+1] - 1]
+static const uint16_t prng_anchor_bucket[257] = {
+	0x0000, 0x0002, 0x0002, 0x0006, 0x0008, 0x0009, 0x000a, 0x000c,
+	0x000e, 0x000f, 0x0011, 0x0015, 0x0016, 0x0018, 0x001b, 0x001f,
+	0x0022, 0x0022, 0x0022, 0x0028, 0x0029, 0x002b, 0x002b, 0x002e,
+	0x0031, 0x0035, 0x0036, 0x0039, 0x0039, 0x003a, 0x003c, 0x003f,
+	0x0040, 0x0042, 0x0044, 0x0048, 0x004a, 0x004b, 0x004b, 0x004f,
+	0x0050, 0x0053, 0x0054, 0x0055, 0x005a, 0x005d, 0x0060, 0x0060,
+	0x0062, 0x0063, 0x0063, 0x0065, 0x0067, 0x0067, 0x0068, 0x006b,
+	0x006c, 0x006f, 0x0071, 0x0074, 0x0075, 0x0077, 0x0079, 0x007c,
+	0x007f, 0x0082, 0x0085, 0x0089, 0x0089, 0x008b, 0x008c, 0x008e,
+	0x008e, 0x0093, 0x0093, 0x0094, 0x0095, 0x0096, 0x0099, 0x009b,
+	0x009c, 0x009d, 0x00a0, 0x00a2, 0x00a4, 0x00a6, 0x00a9, 0x00ab,
+	0x00ab, 0x00af, 0x00af, 0x00b1, 0x00b9, 0x00bd, 0x00bf, 0x00c0,
+	0x00c0, 0x00c1, 0x00c2, 0x00c4, 0x00c4, 0x00c8, 0x00ca, 0x00cd,
+	0x00d2, 0x00d4, 0x00d5, 0x00d5, 0x00d7, 0x00d9, 0x00db, 0x00db,
+	0x00de, 0x00e0, 0x00e3, 0x00e6, 0x00e8, 0x00eb, 0x00ec, 0x00ed,
+	0x00f2, 0x00f4, 0x00f4, 0x00f5, 0x00f6, 0x00f9, 0x00fb, 0x00fc,
+	0x00ff, 0x0102, 0x0103, 0x0103, 0x0104, 0x0104, 0x0108, 0x010b,
+	0x010f, 0x0110, 0x0114, 0x0118, 0x0119, 0x011d, 0x0121, 0x0121,
+	0x0124, 0x0124, 0x0125, 0x0127, 0x0129, 0x012b, 0x012b, 0x012d,
+	0x012f, 0x0130, 0x0134, 0x0135, 0x0135, 0x0137, 0x0137, 0x0139,
+	0x013b, 0x013c, 0x013f, 0x0141, 0x0145, 0x014a, 0x014a, 0x014a,
+	0x0150, 0x0152, 0x0155, 0x0156, 0x0157, 0x0159, 0x015c, 0x015d,
+	0x015e, 0x0160, 0x0161, 0x0164, 0x0164, 0x0166, 0x0169, 0x016a,
+	0x016a, 0x016c, 0x0174, 0x0178, 0x0179, 0x017a, 0x017c, 0x017e,
+	0x017f, 0x0181, 0x0183, 0x0184, 0x0189, 0x018c, 0x018c, 0x018d,
+	0x018d, 0x018d, 0x018d, 0x0192, 0x0193, 0x0194, 0x0195, 0x0197,
+	0x0199, 0x019b, 0x019e, 0x01a0, 0x01a3, 0x01a5, 0x01a6, 0x01a6,
+	0x01a8, 0x01a8, 0x01a9, 0x01ab, 0x01ad, 0x01af, 0x01b0, 0x01b1,
+	0x01b2, 0x01b2, 0x01b4, 0x01b4, 0x01b5, 0x01b6, 0x01b8, 0x01bc,
+	0x01bf, 0x01bf, 0x01c0, 0x01c3, 0x01c4, 0x01c8, 0x01cc, 0x01cd,
+	0x01d4, 0x01da, 0x01db, 0x01dc, 0x01df, 0x01e3, 0x01e4, 0x01e6,
+	0x01e8, 0x01ea, 0x01ec, 0x01f2, 0x01f4, 0x01f5, 0x01f6, 0x01f9,
+	0x0200,
+};
+
+// LFSR states (not byte swapped), sorted
+static const uint16_t prng_anchor_state[512] = {
+	0x0001, 0x0084, 0x021f, 0x0287, 0x02a2, 0x02b9, 0x0341, 0x03fd,
+	0x0425, 0x0556, 0x061d, 0x067f, 0x0760, 0x07a4, 0x0823, 0x093c,
+	0x0974, 0x0a1d, 0x0aa0, 0x0aab, 0x0aec, 0x0bc9, 0x0c07, 0x0c86,
+	0x0d56, 0x0da5, 0x0de9, 0x0ea1, 0x0ea4, 0x0eeb, 0x0efc, 0x0f2b,
+	0x0f2e, 0x0f62, 0x1221, 0x1227, 0x1259, 0x1266, 0x12b3, 0x12c6,
+	0x13c4, 0x144c, 0x1493, 0x160c, 0x1670, 0x16bb, 0x1708, 0x1719,
+	0x17a3, 0x1828, 0x1870, 0x18b2, 0x18c7, 0x191e, 0x1a6a, 0x1abe,
+	0x1acc, 0x1c01, 0x1d6b, 0x1d94, 0x1e10, 0x1e15, 0x1e17, 0x1f7d,
+	0x202b, 0x203c, 0x2131, 0x21f8, 0x223d, 0x22a6, 0x22de, 0x22e2,
+	0x23af, 0x23dd, 0x2468, 0x2610, 0x262c, 0x263c, 0x26e8, 0x2735,
+	0x2873, 0x28db, 0x28e2, 0x29c1, 0x2afa, 0x2b3c, 0x2b88, 0x2b8a,
+	0x2bb6, 0x2be6, 0x2c17, 0x2c3e, 0x2cfd, 0x2d24, 0x2d63, 0x2dce,
+	0x2f8b, 0x2fb9, 0x3059, 0x3214, 0x32b9, 0x331a, 0x335c, 0x355d,
+	0x3646, 0x3676, 0x368a, 0x374f, 0x3804, 0x3870, 0x38a2, 0x399a,
+	0x39bb, 0x3a1e, 0x3a5d, 0x3aa5, 0x3bb5, 0x3c00, 0x3c02, 0x3d78,
+	0x3d7d, 0x3e52, 0x3ebd, 0x3efc, 0x3f20, 0x3f53, 0x3f8c, 0x4039,
+	0x405c, 0x408a, 0x4121, 0x4130, 0x4180, 0x4248, 0x4254, 0x4278,
+	0x42b1, 0x4402, 0x445d, 0x45e2, 0x4607, 0x4692, 0x4826, 0x486a,
+	0x48c3, 0x48ca, 0x48f5, 0x4af8, 0x4bf6, 0x4c1e, 0x4dab, 0x4dbc,
+	0x4dd2, 0x4ec4, 0x4ef9, 0x4f1d, 0x5036, 0x514c, 0x518f, 0x51af,
+	0x527c, 0x52ca, 0x5343, 0x53b8, 0x5442, 0x54de, 0x555b, 0x55c8,
+	0x55d0, 0x5692, 0x56ca, 0x5806, 0x580b, 0x587e, 0x58d8, 0x5a16,
+	0x5ab9, 0x5b0b, 0x5b27, 0x5b35, 0x5b50, 0x5b70, 0x5bc0, 0x5bd7,
+	0x5bdd, 0x5c56, 0x5c5c, 0x5c74, 0x5cb8, 0x5d1a, 0x5db5, 0x5e6e,
+	0x600c, 0x6158, 0x6269, 0x62b6, 0x645f, 0x6477, 0x649a, 0x64ad,
+	0x6568, 0x65b3, 0x6661, 0x667c, 0x66ed, 0x670e, 0x6732, 0x675f,
+	0x6784, 0x67af, 0x6860, 0x68fb, 0x6905, 0x6b49, 0x6b79, 0x6c79,
+	0x6c7d, 0x6d52, 0x6d6e, 0x6f10, 0x6f8f, 0x6fcd, 0x706a, 0x7092,
+	0x7104, 0x7109, 0x7118, 0x7241, 0x7295, 0x72c1, 0x7353, 0x7356,
+	0x7439, 0x744a, 0x74ed, 0x75e1, 0x7658, 0x770d, 0x771a, 0x7752,
+	0x77a5, 0x77d1, 0x7847, 0x78f7, 0x7a76, 0x7b00, 0x7c1e, 0x7c56,
+	0x7cc9, 0x7d08, 0x7da0, 0x7e5b, 0x7f70, 0x7f82, 0x7fec, 0x801e,
+	0x8076, 0x80d1, 0x81d5, 0x83cf, 0x852a, 0x8593, 0x85a3, 0x85a7,
+	0x864a, 0x8655, 0x868e, 0x8739, 0x87b5, 0x87e2, 0x87f1, 0x8896,
+	0x892e, 0x8975, 0x8980, 0x89f2, 0x8a40, 0x8a66, 0x8ae1, 0x8aea,
+	0x8b85, 0x8c05, 0x8c4d, 0x8c7d, 0x8ce6, 0x8d03, 0x8d26, 0x8d2e,
+	0x8d41, 0x8f11, 0x8f1e, 0x8fda, 0x9183, 0x9294, 0x929e, 0x9341,
+	0x93ed, 0x9477, 0x94bf, 0x961a, 0x96af, 0x970c, 0x976a, 0x98ab,
+	0x9918, 0x9940, 0x9985, 0x9987, 0x9acb, 0x9c5e, 0x9cdb, 0x9e4f,
+	0x9eae, 0x9f51, 0x9f84, 0xa081, 0xa104, 0xa161, 0xa1f4, 0xa216,
+	0xa2dd, 0xa300, 0xa30f, 0xa369, 0xa385, 0xa46e, 0xa48a, 0xa4a5,
+	0xa4b6, 0xa4f1, 0xa707, 0xa71f, 0xa77f, 0xa7af, 0xa7b5, 0xa7fa,
+	0xa855, 0xa891, 0xa93b, 0xa950, 0xa979, 0xaaea, 0xab9a, 0xac25,
+	0xac64, 0xad3b, 0xad49, 0xade2, 0xaee5, 0xafe0, 0xb03f, 0xb08b,
+	0xb1b4, 0xb237, 0xb2e1, 0xb2ef, 0xb44a, 0xb4f9, 0xb50d, 0xb55f,
+	0xb5cb, 0xb609, 0xb845, 0xb8fb, 0xb915, 0xb93f, 0xb962, 0xb986,
+	0xb989, 0xb9c4, 0xb9c9, 0xb9e4, 0xba6d, 0xba7a, 0xba8a, 0xbab1,
+	0xbb03, 0xbc4a, 0xbd08, 0xbd68, 0xbe44, 0xbedb, 0xbf1b, 0xc047,
+	0xc070, 0xc102, 0xc10f, 0xc2e3, 0xc334, 0xc373, 0xc39f, 0xc3af,
+	0xc3bc, 0xc414, 0xc463, 0xc4cd, 0xc63f, 0xca56, 0xca9e, 0xcab1,
+	0xcae9, 0xcafe, 0xcbfd, 0xcc32, 0xcd19, 0xce56, 0xcead, 0xcf81,
+	0xcf95, 0xd030, 0xd0a1, 0xd160, 0xd190, 0xd1fd, 0xd241, 0xd255,
+	0xd34a, 0xd3a2, 0xd3cf, 0xd4a2, 0xd4f3, 0xd5aa, 0xd766, 0xd779,
+	0xd98b, 0xda43, 0xdaa1, 0xdbb2, 0xdbdb, 0xdc09, 0xdcf7, 0xdd9a,
+	0xde0c, 0xdfc2, 0xe15a, 0xe1c6, 0xe3b3, 0xe4f8, 0xe539, 0xe5eb,
+	0xe60b, 0xe6ec, 0xe6ee, 0xe6fb, 0xe714, 0xe785, 0xe7bf, 0xe928,
+	0xeacf, 0xead2, 0xeadf, 0xebbb, 0xec53, 0xec55, 0xeceb, 0xecfe,
+	0xed28, 0xed88, 0xed8f, 0xed97, 0xeea7, 0xef29, 0xef38, 0xef69,
+	0xef6b, 0xefd7, 0xefe0, 0xeffa, 0xf009, 0xf03f, 0xf0a0, 0xf0ac,
+	0xf0b1, 0xf0d8, 0xf151, 0xf2d5, 0xf341, 0xf3b5, 0xf3dc, 0xf43f,
+	0xf464, 0xf481, 0xf4a8, 0xf556, 0xf6db, 0xf6e5, 0xf7a3, 0xf7dd,
+	0xf866, 0xf8b3, 0xf953, 0xf985, 0xfa16, 0xfa2f, 0xfaa0, 0xfab4,
+	0xfacd, 0xfaf3, 0xfb97, 0xfbb7, 0xfcd6, 0xfd68, 0xfe77, 0xfe97,
+	0xfeb4, 0xff08, 0xff43, 0xff54, 0xff75, 0xffc5, 0xffc8, 0xffea,
+};
+
+// position of prng_anchor_state[i] in the sequence, counted from state 0x0001
+static const uint16_t prng_anchor_pos[512] = {
+	0x0000, 0x1e00, 0xeb80, 0x0180, 0xeb00, 0x7380, 0xcf00, 0x8000,
+	0x1e80, 0x6600, 0x4300, 0x6f00, 0x3a00, 0x5600, 0xfa80, 0xea00,
+	0x8300, 0x1780, 0xa100, 0xd800, 0x2800, 0xf500, 0x8f00, 0x4700,
+	0xb600, 0xe180, 0x9c00, 0xe600, 0xf680, 0x9d80, 0xb980, 0x2e00,
+	0x5700, 0x6080, 0x5f80, 0x2e80, 0x8880, 0x6980, 0x2100, 0x4800,
+	0x5d80, 0x9200, 0x9300, 0xfa00, 0x0580, 0x7980, 0xcd00, 0x6500,
+	0xac00, 0xc180, 0xe280, 0xd100, 0x4400, 0x0e80, 0xb200, 0x7680,
+	0x0680, 0xf580, 0x0500, 0xce80, 0x0780, 0x6000, 0x9580, 0x0480,
+	0xc000, 0x0f00, 0x8600, 0xe500, 0x7b00, 0x3900, 0x9180, 0xc700,
+	0x5380, 0xe780, 0x2c80, 0xc500, 0x7280, 0xb180, 0x0880, 0x5f00,
+	0x7d00, 0xd380, 0xdd00, 0xf800, 0x2980, 0xc680, 0x9380, 0x4100,
+	0x4d00, 0x9400, 0x7f00, 0x2700, 0xcd80, 0xe580, 0x5800, 0x9a80,
+	0xbf80, 0x2400, 0x1080, 0xde00, 0x2a00, 0x7880, 0x0b00, 0x2580,
+	0xb380, 0x3f00, 0xf380, 0x7e00, 0x3300, 0x6680, 0xf900, 0x1f80,
+	0xa000, 0xdf00, 0x2d00, 0x2780, 0xaf80, 0xd080, 0xec00, 0x6b00,
+	0x3600, 0x1500, 0xbd00, 0x8b00, 0x5e00, 0x1880, 0x3280, 0x4980,
+	0x2b00, 0xd780, 0x6300, 0x3500, 0xf000, 0xd700, 0x3800, 0x5b80,
+	0xf400, 0xe000, 0x2a80, 0x8c00, 0xa480, 0x0800, 0xca00, 0xb780,
+	0xbb80, 0xbe00, 0xbc00, 0x8a00, 0x8780, 0xe380, 0x5c00, 0xae00,
+	0x8800, 0xc480, 0x5580, 0xad00, 0xa680, 0x6180, 0x8400, 0xc400,
+	0x0080, 0xb900, 0x0e00, 0xab80, 0x9700, 0xda80, 0x2500, 0x7900,
+	0x1300, 0xca80, 0xaa00, 0x9c80, 0xbd80, 0x6780, 0x9900, 0x3c00,
+	0x3100, 0xe980, 0x7780, 0x7400, 0x0900, 0xc100, 0xa080, 0x5780,
+	0xfc00, 0xdb00, 0xce00, 0xa180, 0x8380, 0x6900, 0xd680, 0x3d80,
+	0x4900, 0xe480, 0x1800, 0x0c80, 0x9d00, 0x6400, 0xc880, 0x7d80,
+	0x0b80, 0x4380, 0x2f80, 0x6280, 0xa780, 0x6700, 0x4c80, 0xac80,
+	0xc780, 0x4000, 0x1d00, 0x6d80, 0x5980, 0x6a80, 0x1000, 0xa380,
+	0x5880, 0xfe80, 0x1100, 0xd280, 0x2180, 0xc300, 0x3780, 0xa900,
+	0x8500, 0xa580, 0xe900, 0x6d00, 0xf780, 0x4480, 0x1f00, 0x3700,
+	0x4680, 0x3400, 0xad80, 0x8e80, 0x1c80, 0xfb80, 0xee00, 0x4500,
+	0x7580, 0xf280, 0xab00, 0x3480, 0x6c80, 0xa880, 0xee80, 0xb300,
+	0x6a00, 0x8180, 0xc600, 0x6380, 0x5680, 0xf300, 0xbe80, 0x3180,
+	0xae80, 0x4e00, 0xfd80, 0x6800, 0xfe00, 0xbb00, 0x8b80, 0x3d00,
+	0xc800, 0xb100, 0x1680, 0x2380, 0x5500, 0x1a80, 0x1580, 0x9f80,
+	0x8480, 0x6f80, 0x3680, 0x2480, 0x8680, 0x8d80, 0xdc80, 0x7100,
+	0xdf80, 0x0200, 0xe100, 0x1d80, 0xa400, 0x4c00, 0x4f80, 0xe080,
+	0xe300, 0x7500, 0x4180, 0x4600, 0x8d00, 0x5280, 0x9a00, 0x0380,
+	0xa700, 0x1180, 0xaf00, 0x8200, 0x4580, 0x9080, 0x5900, 0x9b00,
+	0x3e80, 0xf980, 0x1b80, 0x0f80, 0xba00, 0xcf80, 0x5200, 0x9100,
+	0x5e80, 0xb580, 0x0700, 0xf600, 0x3f80, 0x2f00, 0x4e80, 0xb700,
+	0x8700, 0x0100, 0x7080, 0xc580, 0xda00, 0x7e80, 0x4880, 0xbf00,
+	0x5d00, 0xe880, 0x4780, 0xd900, 0x3000, 0xb800, 0x5c80, 0x7000,
+	0x9800, 0x8a80, 0xe200, 0xa280, 0x0a80, 0x6100, 0x9600, 0xb400,
+	0x6480, 0xc200, 0x2880, 0x9f00, 0x2c00, 0xb880, 0x7800, 0xde80,
+	0xff80, 0xd300, 0x5a00, 0xcc80, 0x6580, 0x2600, 0x9880, 0x7b80,
+	0xf200, 0xea80, 0xdc00, 0x5b00, 0x1380, 0x7c00, 0xb500, 0x2280,
+	0x7700, 0xd180, 0x9480, 0x3200, 0xa980, 0xa500, 0x5100, 0xf700,
+	0x7180, 0xec80, 0x9e00, 0xd980, 0xc080, 0x6e80, 0xa200, 0x0400,
+	0x6b80, 0x1980, 0xd480, 0xb680, 0x2900, 0xc980, 0xe400, 0xa300,
+	0xa600, 0xc380, 0x1480, 0xd000, 0xa800, 0x7f80, 0xd500, 0xb480,
+	0x3e00, 0x6e00, 0xfb00, 0xf100, 0x5a80, 0x2000, 0x1200, 0x1c00,
+	0xd880, 0x3c80, 0x7300, 0xcb80, 0x0c00, 0x4280, 0x4080, 0x3b00,
+	0x2300, 0xf180, 0xcb00, 0x8280, 0x9500, 0x0d80, 0xc900, 0xfd00,
+	0xd400, 0x8e00, 0x1600, 0xba80, 0x4a80, 0xdb80, 0xef00, 0xe800,
+	0x7480, 0x0980, 0x2680, 0x5480, 0xdd80, 0x9980, 0xc280, 0x8c80,
+	0x1a00, 0x3580, 0x1b00, 0x7600, 0x0280, 0x8100, 0xff00, 0x5000,
+	0xf480, 0x8f80, 0x1900, 0x9e80, 0x5300, 0x5180, 0x9680, 0xfc80,
+	0x9b80, 0x0d00, 0xf880, 0x9000, 0x4a00, 0x8580, 0x2200, 0x2b80,
+	0x1700, 0x6200, 0xb080, 0x4b80, 0x1280, 0x8080, 0x5080, 0x1400,
+	0x7a80, 0x6880, 0x8980, 0x2d80, 0xe680, 0xaa80, 0x3980, 0x0600,
+	0xf080, 0x3a80, 0x3880, 0x3080, 0x7c80, 0xd580, 0x7a00, 0x9780,
+	0xd200, 0xb280, 0x9280, 0x8900, 0x0300, 0x0a00, 0xbc80, 0x4b00,
+	0x3b80, 0x4f00, 0x5400, 0x7200, 0x4d80, 0xed80, 0x3380, 0xe700,
+	0x2080, 0xef80, 0xd600, 0x6c00, 0xb000, 0xed00, 0x4200, 0xcc00,
+};
+
+#endif
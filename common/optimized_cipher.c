@@ -186,7 +186,7 @@ void opt_output(const uint8_t* k,State* s,  uint8_t *buffer)
 
 }
 
-void opt_MAC(uint8_t* k, uint8_t* input, uint8_t* out)
+void opt_MAC_N(uint8_t* k, uint8_t* input, uint8_t in_size, uint8_t* out)
 {
 	State _init  =  {
 			((k[0] ^ 0x4c) + 0xEC) & 0xFF,// l
@@ -195,10 +195,15 @@ void opt_MAC(uint8_t* k, uint8_t* input, uint8_t* out)
 			0xE012 // t
 			};
 
-	opt_suc(k,&_init,input,12, false);
+	opt_suc(k,&_init,input,in_size, false);
 	//printf("\noutp ");
 	opt_output(k,&_init, out);
 }
+
+void opt_MAC(uint8_t* k, uint8_t* input, uint8_t* out)
+{
+	opt_MAC_N(k, input, 12, out);
+}
 uint8_t rev_byte(uint8_t b) {
 	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
 	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
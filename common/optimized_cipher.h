@@ -38,6 +38,7 @@
  #ifndef OPTIMIZED_CIPHER_H
 #define OPTIMIZED_CIPHER_H
 #include <stdint.h>
+#include <stddef.h>
 
 /**
 * Definition 1 (Cipher state). A cipher state of iClass s is an element of F 40/2
@@ -54,6 +55,14 @@ typedef struct {
 	uint16_t t;
 } State;
 
+/**
+ * The MAC over 12 bytes (or in_size bytes) of input. Input and output are in the cipher's bit order,
+ * i.e. each byte bit reversed compared to what is sent over the air.
+ */
+void opt_MAC(uint8_t* k, uint8_t* input, uint8_t* out);
+void opt_MAC_N(uint8_t* k, uint8_t* input, uint8_t in_size, uint8_t* out);
+void opt_reverse_arraybytecpy(uint8_t* dest, uint8_t *src, size_t len);
+
 /** The reader MAC is MAC(key, CC * NR )
  **/
 void opt_doReaderMAC(uint8_t *cc_nr_p, uint8_t *div_key_p, uint8_t mac[4]);
@@ -163,6 +163,7 @@ typedef struct{
 #define CMD_ICLASS_WRITEBLOCK                                             0x0397
 #define CMD_ICLASS_EML_MEMSET                                             0x0398
 #define CMD_ICLASS_AUTHENTICATION                                         0x0399
+#define CMD_ICLASS_CHECK_KEYS                                             0x039A
 
 // For measurements of the antenna tuning
 #define CMD_MEASURE_ANTENNA_TUNING                                        0x0400
@@ -241,6 +242,16 @@ typedef struct{
 #define FLAG_ICLASS_READER_ONE_TRY      0x20
 #define FLAG_ICLASS_READER_CEDITKEY     0x40
 
+//Iclass check keys flags
+#define FLAG_ICLASS_CHKKEYS_CREDITKEY   0x01
+#define FLAG_ICLASS_CHKKEYS_CONTINUE    0x02    // card is still selected from the previous batch
+#define FLAG_ICLASS_CHKKEYS_KEEP_FIELD  0x04    // more batches will follow
+
+//Iclass check keys status (arg0 of the answer)
+#define ICLASS_CHKKEYS_NO_CARD          0
+#define ICLASS_CHKKEYS_OK               1
+#define ICLASS_CHKKEYS_CARD_CHANGED     2     // CSN or CC differ from the ones the MACs were computed for
+
 
 //hw tune args
 #define FLAG_TUNE_LF   1
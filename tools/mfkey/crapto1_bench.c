@@ -0,0 +1,571 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Micro benchmark for the crapto1 state recovery: compares the current
+// lfsr_recovery32() and lfsr_recovery64() with the previous implementation
+// (copied below) on fixed inputs. Both must return identical state lists.
+// Also compares the firmware's nonce distance (dist_nt() in armsrc/iso14443a.c)
+// with its previous stepping implementation, and the table based crypto1_byte()
+// and crypto1_word() with the bit by bit crypto1_bit() loop.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "crapto1/crapto1.h"
+#include "parity.h"
+#include "util_posix.h"
+
+#define BENCH_RUNS	3
+#define DIST_NT_PAIRS	2000
+#define CRYPTO1_STATES	2000000
+
+//-----------------------------------------------------------------------------
+// previous implementation, for reference
+//-----------------------------------------------------------------------------
+
+#if !defined LOWMEM && defined __GNUC__
+static uint8_t ref_filterlut[1 << 20];
+static void __attribute__((constructor)) ref_fill_lut()
+{
+		uint32_t i;
+		for(i = 0; i < 1 << 20; ++i)
+				ref_filterlut[i] = filter(i);
+}
+#define filter(x) (ref_filterlut[(x) & 0xfffff])
+#endif
+
+
+
+typedef struct bucket {
+	uint32_t *head;
+	uint32_t *bp;
+} bucket_t;
+
+typedef bucket_t bucket_array_t[2][0x100];
+
+typedef struct bucket_info {
+	struct {
+		uint32_t *head, *tail;
+		} bucket_info[2][0x100];
+		uint32_t numbuckets;
+	} bucket_info_t;
+
+
+static void ref_bucket_sort_intersect(uint32_t* const estart, uint32_t* const estop,
+								  uint32_t* const ostart, uint32_t* const ostop,
+								  bucket_info_t *bucket_info, bucket_array_t bucket)
+{
+	uint32_t *p1, *p2;
+	uint32_t *start[2];
+	uint32_t *stop[2];
+
+	start[0] = estart;
+	stop[0] = estop;
+	start[1] = ostart;
+	stop[1] = ostop;
+
+	// init buckets to be empty
+	for (uint32_t i = 0; i < 2; i++) {
+		for (uint32_t j = 0x00; j <= 0xff; j++) {
+			bucket[i][j].bp = bucket[i][j].head;
+		}
+	}
+
+	// sort the lists into the buckets based on the MSB (contribution bits)
+	for (uint32_t i = 0; i < 2; i++) {
+		for (p1 = start[i]; p1 <= stop[i]; p1++) {
+			uint32_t bucket_index = (*p1 & 0xff000000) >> 24;
+			*(bucket[i][bucket_index].bp++) = *p1;
+		}
+	}
+
+
+	// write back intersecting buckets as sorted list.
+	// fill in bucket_info with head and tail of the bucket contents in the list and number of non-empty buckets.
+	uint32_t nonempty_bucket;
+	for (uint32_t i = 0; i < 2; i++) {
+		p1 = start[i];
+		nonempty_bucket = 0;
+		for (uint32_t j = 0x00; j <= 0xff; j++) {
+			if (bucket[0][j].bp != bucket[0][j].head && bucket[1][j].bp != bucket[1][j].head) { // non-empty intersecting buckets only
+				bucket_info->bucket_info[i][nonempty_bucket].head = p1;
+				for (p2 = bucket[i][j].head; p2 < bucket[i][j].bp; *p1++ = *p2++);
+				bucket_info->bucket_info[i][nonempty_bucket].tail = p1 - 1;
+				nonempty_bucket++;
+			}
+		}
+		bucket_info->numbuckets = nonempty_bucket;
+		}
+}
+/** ref_update_contribution
+ * helper, calculates the partial linear feedback contributions and puts in MSB
+ */
+static inline void
+ref_update_contribution(uint32_t *item, const uint32_t mask1, const uint32_t mask2)
+{
+	uint32_t p = *item >> 25;
+
+	p = p << 1 | evenparity32(*item & mask1);
+	p = p << 1 | evenparity32(*item & mask2);
+	*item = p << 24 | (*item & 0xffffff);
+}
+
+/** ref_extend_table
+ * using a bit of the keystream extend the table of possible lfsr states
+ */
+static inline void
+ref_extend_table(uint32_t *tbl, uint32_t **end, int bit, int m1, int m2, uint32_t in)
+{
+	in <<= 24;
+	for(*tbl <<= 1; tbl <= *end; *++tbl <<= 1)
+		if(filter(*tbl) ^ filter(*tbl | 1)) {
+			*tbl |= filter(*tbl) ^ bit;
+			ref_update_contribution(tbl, m1, m2);
+			*tbl ^= in;
+		} else if(filter(*tbl) == bit) {
+			*++*end = tbl[1];
+			tbl[1] = tbl[0] | 1;
+			ref_update_contribution(tbl, m1, m2);
+			*tbl++ ^= in;
+			ref_update_contribution(tbl, m1, m2);
+			*tbl ^= in;
+		} else
+			*tbl-- = *(*end)--;
+}
+/** ref_extend_table_simple
+ * using a bit of the keystream extend the table of possible lfsr states
+ */
+static inline void ref_extend_table_simple(uint32_t *tbl, uint32_t **end, int bit)
+{
+	for(*tbl <<= 1; tbl <= *end; *++tbl <<= 1)
+		if(filter(*tbl) ^ filter(*tbl | 1))
+			*tbl |= filter(*tbl) ^ bit;
+		else if(filter(*tbl) == bit) {
+			*++*end = *++tbl;
+			*tbl = tbl[-1] | 1;
+
+		} else
+			*tbl-- = *(*end)--;
+}
+
+
+/** ref_recover
+ * recursively narrow down the search space, 4 bits of keystream at a time
+ */
+static struct Crypto1State*
+ref_recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
+	uint32_t *e_head, uint32_t *e_tail, uint32_t eks, int rem,
+	struct Crypto1State *sl, uint32_t in, bucket_array_t bucket)
+{
+	uint32_t *o, *e, i;
+	bucket_info_t bucket_info;
+
+	if(rem == -1) {
+		for(e = e_head; e <= e_tail; ++e) {
+			*e = *e << 1 ^ evenparity32(*e & LF_POLY_EVEN) ^ !!(in & 4);
+			for(o = o_head; o <= o_tail; ++o, ++sl) {
+				sl->even = *o;
+				sl->odd = *e ^ evenparity32(*o & LF_POLY_ODD);
+				sl[1].odd = sl[1].even = 0;
+			}
+		}
+		return sl;
+	}
+
+	for(i = 0; i < 4 && rem--; i++) {
+		oks >>= 1;
+		eks >>= 1;
+		in >>= 2;
+		ref_extend_table(o_head, &o_tail, oks & 1, LF_POLY_EVEN << 1 | 1,
+			     LF_POLY_ODD << 1, 0);
+		if(o_head > o_tail)
+			return sl;
+
+		ref_extend_table(e_head, &e_tail, eks & 1, LF_POLY_ODD,
+			     LF_POLY_EVEN << 1 | 1, in & 3);
+		if(e_head > e_tail)
+			return sl;
+	}
+	ref_bucket_sort_intersect(e_head, e_tail, o_head, o_tail, &bucket_info, bucket);
+
+	for (int i = bucket_info.numbuckets - 1; i >= 0; i--) {
+		sl = ref_recover(bucket_info.bucket_info[1][i].head, bucket_info.bucket_info[1][i].tail, oks,
+					 bucket_info.bucket_info[0][i].head, bucket_info.bucket_info[0][i].tail, eks,
+					 rem, sl, in, bucket);
+	}
+
+	return sl;
+}
+/** lfsr_recovery
+ * ref_recover the state of the lfsr given 32 bits of the keystream
+ * additionally you can use the in parameter to specify the value
+ * that was fed into the lfsr at the time the keystream was generated
+ */
+static struct Crypto1State* ref_lfsr_recovery32(uint32_t ks2, uint32_t in)
+{
+	struct Crypto1State *statelist;
+	uint32_t *odd_head = 0, *odd_tail = 0, oks = 0;
+	uint32_t *even_head = 0, *even_tail = 0, eks = 0;
+	int i;
+
+	for(i = 31; i >= 0; i -= 2)
+		oks = oks << 1 | BEBIT(ks2, i);
+	for(i = 30; i >= 0; i -= 2)
+ 		eks = eks << 1 | BEBIT(ks2, i);
+
+	odd_head = odd_tail = malloc(sizeof(uint32_t) << 21);
+	even_head = even_tail = malloc(sizeof(uint32_t) << 21);
+	statelist =  malloc(sizeof(struct Crypto1State) << 18);
+	if(!odd_tail-- || !even_tail-- || !statelist) {
+		free(statelist);
+		statelist = 0;
+		goto out;
+	}
+	statelist->odd = statelist->even = 0;
+
+	// allocate memory for out of place bucket_sort
+	bucket_array_t bucket;
+	for (uint32_t i = 0; i < 2; i++)
+		for (uint32_t j = 0; j <= 0xff; j++) {
+			bucket[i][j].head = malloc(sizeof(uint32_t)<<14);
+			if (!bucket[i][j].head) {
+				goto out;
+			}
+		}
+
+
+	for(i = 1 << 20; i >= 0; --i) {
+		if(filter(i) == (oks & 1))
+			*++odd_tail = i;
+		if(filter(i) == (eks & 1))
+			*++even_tail = i;
+	}
+
+	for(i = 0; i < 4; i++) {
+		ref_extend_table_simple(odd_head,  &odd_tail, (oks >>= 1) & 1);
+		ref_extend_table_simple(even_head, &even_tail, (eks >>= 1) & 1);
+	}
+
+	in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00);
+	ref_recover(odd_head, odd_tail, oks,
+		even_head, even_tail, eks, 11, statelist, in << 1, bucket);
+
+out:
+	free(odd_head);
+	free(even_head);
+	for (uint32_t i = 0; i < 2; i++)
+		for (uint32_t j = 0; j <= 0xff; j++)
+			free(bucket[i][j].head);
+
+	return statelist;
+}
+
+static const uint32_t REF_S1[] = {     0x62141, 0x310A0, 0x18850, 0x0C428, 0x06214,
+	0x0310A, 0x85E30, 0xC69AD, 0x634D6, 0xB5CDE, 0xDE8DA, 0x6F46D, 0xB3C83,
+	0x59E41, 0xA8995, 0xD027F, 0x6813F, 0x3409F, 0x9E6FA};
+static const uint32_t REF_S2[] = {  0x3A557B00, 0x5D2ABD80, 0x2E955EC0, 0x174AAF60,
+	0x0BA557B0, 0x05D2ABD8, 0x0449DE68, 0x048464B0, 0x42423258, 0x278192A8,
+	0x156042D0, 0x0AB02168, 0x43F89B30, 0x61FC4D98, 0x765EAD48, 0x7D8FDD20,
+	0x7EC7EE90, 0x7F63F748, 0x79117020};
+static const uint32_t REF_T1[] = {
+	0x4F37D, 0x279BE, 0x97A6A, 0x4BD35, 0x25E9A, 0x12F4D, 0x097A6, 0x80D66,
+	0xC4006, 0x62003, 0xB56B4, 0x5AB5A, 0xA9318, 0xD0F39, 0x6879C, 0xB057B,
+	0x582BD, 0x2C15E, 0x160AF, 0x8F6E2, 0xC3DC4, 0xE5857, 0x72C2B, 0x39615,
+	0x98DBF, 0xC806A, 0xE0680, 0x70340, 0x381A0, 0x98665, 0x4C332, 0xA272C};
+static const uint32_t REF_T2[] = {  0x3C88B810, 0x5E445C08, 0x2982A580, 0x14C152C0,
+	0x4A60A960, 0x253054B0, 0x52982A58, 0x2FEC9EA8, 0x1156C4D0, 0x08AB6268,
+	0x42F53AB0, 0x217A9D58, 0x161DC528, 0x0DAE6910, 0x46D73488, 0x25CB11C0,
+	0x52E588E0, 0x6972C470, 0x34B96238, 0x5CFC3A98, 0x28DE96C8, 0x12CFC0E0,
+	0x4967E070, 0x64B3F038, 0x74F97398, 0x7CDC3248, 0x38CE92A0, 0x1C674950,
+	0x0E33A4A8, 0x01B959D0, 0x40DCACE8, 0x26CEDDF0};
+static const uint32_t REF_C1[] = { 0x846B5, 0x4235A, 0x211AD};
+static const uint32_t REF_C2[] = { 0x1A822E0, 0x21A822E0, 0x21A822E0};
+/** Reverse 64 bits of keystream into possible cipher states
+ * Variation mentioned in the paper. Somewhat optimized version
+ */
+static struct Crypto1State* ref_lfsr_recovery64(uint32_t ks2, uint32_t ks3)
+{
+	struct Crypto1State *statelist, *sl;
+	uint8_t oks[32], eks[32], hi[32];
+	uint32_t low = 0,  win = 0;
+	uint32_t *tail, table[1 << 16];
+	int i, j;
+
+	sl = statelist = malloc(sizeof(struct Crypto1State) << 4);
+	if(!sl)
+		return 0;
+	sl->odd = sl->even = 0;
+
+	for(i = 30; i >= 0; i -= 2) {
+		oks[i >> 1] = BEBIT(ks2, i);
+		oks[16 + (i >> 1)] = BEBIT(ks3, i);
+	}
+	for(i = 31; i >= 0; i -= 2) {
+		eks[i >> 1] = BEBIT(ks2, i);
+		eks[16 + (i >> 1)] = BEBIT(ks3, i);
+	}
+
+	for(i = 0xfffff; i >= 0; --i) {
+		if (filter(i) != oks[0])
+			continue;
+
+		*(tail = table) = i;
+		for(j = 1; tail >= table && j < 29; ++j)
+			ref_extend_table_simple(table, &tail, oks[j]);
+
+		if(tail < table)
+			continue;
+
+		for(j = 0; j < 19; ++j)
+			low = low << 1 | evenparity32(i & REF_S1[j]);
+		for(j = 0; j < 32; ++j)
+			hi[j] = evenparity32(i & REF_T1[j]);
+
+		for(; tail >= table; --tail) {
+			for(j = 0; j < 3; ++j) {
+				*tail = *tail << 1;
+				*tail |= evenparity32((i & REF_C1[j]) ^ (*tail & REF_C2[j]));
+				if(filter(*tail) != oks[29 + j])
+					goto continue2;
+			}
+
+			for(j = 0; j < 19; ++j)
+				win = win << 1 | evenparity32(*tail & REF_S2[j]);
+
+			win ^= low;
+			for(j = 0; j < 32; ++j) {
+				win = win << 1 ^ hi[j] ^ evenparity32(*tail & REF_T2[j]);
+				if(filter(win) != eks[j])
+					goto continue2;
+			}
+
+			*tail = *tail << 1 | evenparity32(LF_POLY_EVEN & *tail);
+			sl->odd = *tail ^ evenparity32(LF_POLY_ODD & win);
+			sl->even = win;
+			++sl;
+			sl->odd = sl->even = 0;
+			continue2:;
+		}
+	}
+	return statelist;
+}
+
+
+//-----------------------------------------------------------------------------
+
+// lfsr_recovery32(ks2, in)
+static const uint32_t ks2_list[] = {0x12345678, 0x2468acf0, 0x369d0368, 0x48d159e0, 0x5b05b058, 0x9c599b32, 0xdeadbeef, 0xffffffff};
+static const uint32_t in_list[]  = {0x00000000, 0x00001111, 0x00002222, 0x11223344, 0x82a4166c, 0xa1e458ce, 0x01200145, 0x00000000};
+// lfsr_recovery64(ks2, ks3), keystreams of complete authentications (the first one is from example_trace.txt)
+static const uint32_t ks2_64_list[] = {0xe38f32ab, 0x5c1143b0, 0x1d9796fa, 0x3f8a3867, 0xb53549b5, 0x963763bf, 0x3effaf14, 0xeda31bef};
+static const uint32_t ks3_list[]    = {0xc6ef8f19, 0x21840854, 0x795069dd, 0x3c5651ae, 0x6301bb97, 0x69411281, 0x9302e489, 0x4e433c33};
+
+
+// previous dist_nt() of the firmware
+static int32_t ref_dist_nt(uint32_t nt1, uint32_t nt2)
+{
+	uint16_t i;
+	uint32_t nttmp1, nttmp2;
+
+	if (nt1 == nt2) return 0;
+
+	nttmp1 = nt1;
+	nttmp2 = nt2;
+
+	for (i = 1; i < 32768; i++) {
+		nttmp1 = prng_successor(nttmp1, 1);
+		if (nttmp1 == nt2) return i;
+		nttmp2 = prng_successor(nttmp2, 1);
+		if (nttmp2 == nt1) return -i;
+	}
+
+	return(-99999);
+}
+
+
+// current dist_nt() of the firmware
+static int32_t dist_nt(uint32_t nt1, uint32_t nt2)
+{
+	int32_t dist;
+
+	if (nt1 == nt2) return 0;
+
+	if (!prng_valid_nonce(nt1) || !prng_valid_nonce(nt2)) {
+		return(-99999);
+	}
+
+	dist = nonce_distance(nt1, nt2);
+	if (dist >= 32768) {
+		dist -= 65535;
+	}
+
+	return dist;
+}
+
+
+// previous crypto1_byte() and crypto1_word(), bit by bit
+static uint8_t ref_crypto1_byte(struct Crypto1State *s, uint8_t in, int is_encrypted)
+{
+	uint8_t i, ret = 0;
+
+	for (i = 0; i < 8; ++i)
+		ret |= crypto1_bit(s, BIT(in, i), is_encrypted) << i;
+
+	return ret;
+}
+static uint32_t ref_crypto1_word(struct Crypto1State *s, uint32_t in, int is_encrypted)
+{
+	uint32_t i, ret = 0;
+
+	for (i = 0; i < 32; ++i)
+		ret |= crypto1_bit(s, BEBIT(in, i), is_encrypted) << (i ^ 24);
+
+	return ret;
+}
+
+
+static uint32_t statelist_len(struct Crypto1State *sl)
+{
+	uint32_t len = 0;
+	while (sl[len].odd | sl[len].even)
+		len++;
+	return len;
+}
+
+
+static bool same_statelist(struct Crypto1State *sl1, struct Crypto1State *sl2)
+{
+	if (sl1 == NULL || sl2 == NULL)
+		return sl1 == sl2;
+	uint32_t len = statelist_len(sl1);
+	if (len != statelist_len(sl2))
+		return false;
+	for (uint32_t i = 0; i < len; i++)
+		if (sl1[i].odd != sl2[i].odd || sl1[i].even != sl2[i].even)
+			return false;
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t num_inputs = sizeof(ks2_list) / sizeof(ks2_list[0]);
+	uint64_t time_ref = 0, time_new = 0;
+	bool all_identical = true;
+
+	printf("crapto1 micro benchmark, %d runs per input\n\n", BENCH_RUNS);
+	printf("function         ks2      in/ks3     states  previous(ms)  current(ms)  identical\n");
+	printf("---------------------------------------------------------------------------------\n");
+
+	for (uint32_t r64 = 0; r64 < 2; r64++) {
+		for (uint32_t i = 0; i < num_inputs; i++) {
+			struct Crypto1State *sl_ref = NULL, *sl_new = NULL;
+			uint32_t ks2 = r64 ? ks2_64_list[i] : ks2_list[i];
+			uint32_t arg = r64 ? ks3_list[i] : in_list[i];
+			uint64_t t_ref = 0, t_new = 0;
+			for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+				free(sl_ref);
+				free(sl_new);
+				uint64_t start = msclock();
+				sl_ref = r64 ? ref_lfsr_recovery64(ks2, arg) : ref_lfsr_recovery32(ks2, arg);
+				t_ref += msclock() - start;
+				start = msclock();
+				sl_new = r64 ? lfsr_recovery64(ks2, arg) : lfsr_recovery32(ks2, arg);
+				t_new += msclock() - start;
+			}
+			bool identical = same_statelist(sl_ref, sl_new);
+			all_identical &= identical;
+			printf("%-15s  %08x %08x  %7u  %12.1f %12.1f  %s\n", r64 ? "lfsr_recovery64" : "lfsr_recovery32",
+				ks2, arg, sl_new ? statelist_len(sl_new) : 0,
+				(float)t_ref / BENCH_RUNS, (float)t_new / BENCH_RUNS, identical ? "yes" : "NO");
+			time_ref += t_ref;
+			time_new += t_new;
+			free(sl_ref);
+			free(sl_new);
+		}
+	}
+
+	printf("\nTotal: previous %1.2fs, current %1.2fs (%1.2fx)\n", (float)time_ref / 1000, (float)time_new / 1000, time_new ? (float)time_ref / time_new : 0.0);
+
+	// nonce pairs as seen when the darkside attack synchronises to the tag's PRNG
+	uint32_t nt1[DIST_NT_PAIRS], nt2[DIST_NT_PAIRS];
+	int32_t d_ref[DIST_NT_PAIRS], d_new[DIST_NT_PAIRS];
+	srand(0x01200145);
+	for (uint32_t i = 0; i < DIST_NT_PAIRS; i++) {
+		nt1[i] = prng_successor(0x01200145, rand() % 65535);
+		nt2[i] = i % 10 ? prng_successor(nt1[i], rand() % 65535) : (uint32_t)rand() << 16 ^ (uint32_t)rand();
+	}
+	uint64_t start = msclock();
+	for (uint32_t i = 0; i < DIST_NT_PAIRS; i++) {
+		d_ref[i] = ref_dist_nt(nt1[i], nt2[i]);
+	}
+	uint64_t t_ref = msclock() - start;
+	start = msclock();
+	for (uint32_t i = 0; i < DIST_NT_PAIRS; i++) {
+		d_new[i] = dist_nt(nt1[i], nt2[i]);
+	}
+	uint64_t t_new = msclock() - start;
+	uint32_t num_differ = 0;
+	for (uint32_t i = 0; i < DIST_NT_PAIRS; i++) {
+		// the previous implementation accepted an invalid nt2 if one of its successors happened to hit nt1
+		if (d_ref[i] != d_new[i] && (prng_valid_nonce(nt2[i]) || d_new[i] != -99999)) {
+			num_differ++;
+		}
+	}
+	all_identical &= (num_differ == 0);
+	printf("\ndist_nt: %d nonce pairs, previous %1.1fms, current %1.1fms, %d differ\n",
+		DIST_NT_PAIRS, (float)t_ref, (float)t_new, num_differ);
+
+	// random states and inputs. Each state is clocked with a byte and then a word, the output and the new
+	// state must match the bit by bit reference. Every 4th state uses encrypted input.
+	struct Crypto1State *cs_ref = malloc(CRYPTO1_STATES * sizeof(struct Crypto1State));
+	struct Crypto1State *cs_new = malloc(CRYPTO1_STATES * sizeof(struct Crypto1State));
+	uint32_t *cs_in = malloc(CRYPTO1_STATES * sizeof(uint32_t));
+	uint32_t *ks_ref = malloc(CRYPTO1_STATES * sizeof(uint32_t));
+	uint32_t *ks_new = malloc(CRYPTO1_STATES * sizeof(uint32_t));
+	if (cs_ref == NULL || cs_new == NULL || cs_in == NULL || ks_ref == NULL || ks_new == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	for (uint32_t i = 0; i < CRYPTO1_STATES; i++) {
+		cs_ref[i].odd = cs_new[i].odd = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+		cs_ref[i].even = cs_new[i].even = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+		cs_in[i] = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+	}
+	start = msclock();
+	for (uint32_t i = 0; i < CRYPTO1_STATES; i++) {
+		ks_ref[i] = ref_crypto1_byte(&cs_ref[i], cs_in[i], i % 4 == 3);
+		ks_ref[i] |= ref_crypto1_word(&cs_ref[i], cs_in[i], i % 4 == 3) << 8;
+	}
+	t_ref = msclock() - start;
+	start = msclock();
+	for (uint32_t i = 0; i < CRYPTO1_STATES; i++) {
+		ks_new[i] = crypto1_byte(&cs_new[i], cs_in[i], i % 4 == 3);
+		ks_new[i] |= crypto1_word(&cs_new[i], cs_in[i], i % 4 == 3) << 8;
+	}
+	t_new = msclock() - start;
+	num_differ = 0;
+	for (uint32_t i = 0; i < CRYPTO1_STATES; i++) {
+		if (ks_ref[i] != ks_new[i] || cs_ref[i].odd != cs_new[i].odd || cs_ref[i].even != cs_new[i].even) {
+			num_differ++;
+		}
+	}
+	all_identical &= (num_differ == 0);
+	printf("crypto1_byte/word: %d states, previous %1.1fms, current %1.1fms, %d differ\n",
+		CRYPTO1_STATES, (float)t_ref, (float)t_new, num_differ);
+	free(cs_ref);
+	free(cs_new);
+	free(cs_in);
+	free(ks_ref);
+	free(ks_new);
+
+	if (!all_identical) {
+		printf("ERROR: results differ!\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,224 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Test for the packed state lists of hardnested (client/hardnested/
+// hardnested_statelist.c): packs sparse, dense and mixed lists and checks
+// unpack_states() and find_packed_state() against the plain sorted list.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hardnested/hardnested_statelist.h"
+
+#define NUM_WINDOWS		2000
+#define NUM_LOOKUPS		20000
+
+static uint32_t *bitarray;
+static uint32_t *states;
+static uint32_t *unpacked;
+
+
+static uint32_t random24(void)
+{
+	return ((uint32_t)rand() << 12 ^ (uint32_t)rand()) & 0xffffff;
+}
+
+
+static void set_state(uint32_t state)
+{
+	bitarray[state >> 5] |= 0x80000000 >> (state & 0x1f);
+}
+
+
+static bool is_set(uint32_t state)
+{
+	return bitarray[state >> 5] & (0x80000000 >> (state & 0x1f));
+}
+
+
+// fill block (bits 16..23) with states of the given density (1/density of all states, 0 = none)
+static void fill_block(uint32_t block, uint32_t density)
+{
+	if (density == 0) return;
+	for (uint32_t i = 0; i < 1<<16; i++) {
+		if (rand() % density == 0) {
+			set_state(block << 16 | i);
+		}
+	}
+}
+
+
+static uint32_t bitarray_to_states(void)
+{
+	uint32_t len = 0;
+	for (uint32_t state = 0; state < 1<<24; state++) {
+		if (is_set(state)) {
+			states[len++] = state;
+		}
+	}
+	return len;
+}
+
+
+static bool check_list(const char *name, bool all_bitmaps)
+{
+	uint32_t len = bitarray_to_states();
+	packed_statelist_t *sl = pack_bitarray(bitarray);
+	uint32_t num_bitmaps = 0;
+	bool ok = true;
+
+	for (uint32_t i = 0; i < sl->num_containers; i++) {
+		if (sl->containers[i].type == CONTAINER_BITMAP) num_bitmaps++;
+	}
+	if (sl->len != len) {
+		printf("  %s: len %" PRIu32 ", expected %" PRIu32 "\n", name, sl->len, len);
+		ok = false;
+	}
+	if (all_bitmaps && num_bitmaps != sl->num_containers) {
+		printf("  %s: only %" PRIu32 " of %" PRIu32 " containers are bitmaps\n", name, num_bitmaps, sl->num_containers);
+		ok = false;
+	}
+
+	// the complete list, and a window which reaches past its end
+	if (unpack_states(sl, 0, len, unpacked) != len || memcmp(unpacked, states, len * sizeof(uint32_t)) != 0) {
+		printf("  %s: complete list differs\n", name);
+		ok = false;
+	}
+	if (unpack_states(sl, len, 10, unpacked) != 0) {
+		printf("  %s: states after the end of the list\n", name);
+		ok = false;
+	}
+
+	// windows at random positions and at the container boundaries
+	for (uint32_t i = 0; i < NUM_WINDOWS + 2 * sl->num_containers && len > 0; i++) {
+		uint32_t start, window;
+		if (i < 2 * sl->num_containers) {
+			packed_container_t *c = &sl->containers[i / 2];
+			start = i % 2 ? c->first + c->count - 1 : c->first;
+		} else {
+			start = (uint32_t)rand() % len;
+		}
+		window = i % 3 ? (uint32_t)rand() % 300 + 1 : (uint32_t)rand() % 100000 + 1;
+		uint32_t expected = start + window > len ? len - start : window;
+		if (unpack_states(sl, start, window, unpacked) != expected
+			|| memcmp(unpacked, states + start, expected * sizeof(uint32_t)) != 0) {
+			printf("  %s: window %" PRIu32 "+%" PRIu32 " differs\n", name, start, window);
+			ok = false;
+			break;
+		}
+	}
+
+	// lookups of states in the list, and of random states
+	for (uint32_t i = 0; i < NUM_LOOKUPS; i++) {
+		uint32_t expected_index = len > 0 && i % 2 ? (uint32_t)rand() % len : 0;
+		uint32_t state = len > 0 && i % 2 ? states[expected_index] : random24();
+		if (i == 0) state = 0;
+		if (i == 2) state = 0xffffff;
+		uint32_t index = 0;
+		bool found = find_packed_state(sl, state, &index);
+		if (found != is_set(state)) {
+			printf("  %s: state %06" PRIx32 " %s\n", name, state, found ? "found, but not in the list" : "not found");
+			ok = false;
+			break;
+		}
+		if (found && states[index] != state) {
+			printf("  %s: state %06" PRIx32 " found at index %" PRIu32 ", which holds %06" PRIx32 "\n", name, state, index, states[index]);
+			ok = false;
+			break;
+		}
+	}
+
+	printf("%-30s %8" PRIu32 " states %3" PRIu32 " containers %3" PRIu32 " bitmaps %9zu bytes  %s\n",
+		name, len, sl->num_containers, num_bitmaps, packed_statelist_size(sl), ok ? "ok" : "FAILED");
+	free_packed_statelist(sl);
+	memset(bitarray, 0, sizeof(uint32_t) << 19);
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool ok = true;
+
+	bitarray = calloc(1<<19, sizeof(uint32_t));
+	states = malloc(sizeof(uint32_t) << 24);
+	unpacked = malloc(sizeof(uint32_t) << 24);
+	if (bitarray == NULL || states == NULL || unpacked == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	srand(0x01200145);
+
+	printf("hardnested packed state list test\n\n");
+
+	ok &= check_list("empty", false);
+
+	set_state(0);
+	set_state(0xffffff);
+	ok &= check_list("first and last state", false);
+
+	for (uint32_t i = 0; i < 5000; i++) {
+		set_state(random24());
+	}
+	ok &= check_list("sparse", false);
+
+	// distances at the borders of the 1, 2 and 3 byte deltas
+	uint32_t state = 0x7e;
+	uint32_t gaps[] = {0x7f, 0x80, 0x81, 0x3fff, 0x4000, 0x4001, 1, 1, 0xffff};
+	for (uint32_t i = 0; state < 1<<24; i++) {
+		set_state(state);
+		state += gaps[i % (sizeof(gaps) / sizeof(gaps[0]))];
+	}
+	ok &= check_list("delta sizes", false);
+
+	for (uint32_t block = 0; block < 256; block++) {
+		fill_block(block, 4);
+	}
+	ok &= check_list("dense (all bitmaps)", true);
+
+	for (uint32_t block = 0; block < 256; block++) {
+		for (uint32_t i = 0; i < 1<<16; i++) {
+			set_state(block << 16 | i);
+		}
+	}
+	ok &= check_list("full", true);
+
+	// empty blocks, sparse and dense blocks, and a dense block 255
+	uint32_t densities[] = {0, 1000, 0, 20, 9, 7, 2, 0, 1, 30000};
+	for (uint32_t block = 0; block < 255; block++) {
+		fill_block(block, densities[rand() % (sizeof(densities) / sizeof(densities[0]))]);
+	}
+	fill_block(255, 3);
+	ok &= check_list("mixed", false);
+
+	fill_block(255, 50);
+	fill_block(128, 2);
+	ok &= check_list("only blocks 128 and 255", false);
+
+	// pack_statelist() accepts only ascending lists of 24 bit states
+	uint32_t unsorted[] = {5, 3};
+	uint32_t too_large[] = {1, 1<<24};
+	uint32_t sorted[] = {0, 0x10000, 0xffffff};
+	packed_statelist_t *sl = pack_statelist(sorted, 3);
+	if (pack_statelist(unsorted, 2) != NULL || pack_statelist(too_large, 2) != NULL || sl == NULL || sl->len != 3) {
+		printf("pack_statelist() doesn't check its input\n");
+		ok = false;
+	}
+	free_packed_statelist(sl);
+
+	free(bitarray);
+	free(states);
+	free(unpacked);
+
+	if (!ok) {
+		printf("\nERROR: packed state lists differ!\n");
+		return 1;
+	}
+	printf("\nAll packed state lists ok.\n");
+	return 0;
+}
@@ -66,6 +66,7 @@ int main (int argc, char *argv[]) {
 	} else {
 		success = mfkey32(data, &key);
 	}
+	crapto1_free_arenas();
 	
 	if (success) {
 		printf("Recovered key: %012" PRIx64 "\n", key);
@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crapto1/crapto1.h"
+#include "mfkey.h"
+#include "util.h"
+#include "util_posix.h"
+
+
+// recover the keys of many authentications read from a file. One authentication per line:
+//   <uid> <nt> <{nr}> <{ar}> <{at}>                      (mfkey64)
+//   <uid> <nt> <{nr_0}> <{ar_0}> <{nr_1}> <{ar_1}>        (mfkey32)
+//   <uid> <nt0> <{nr_0}> <{ar_0}> <nt1> <{nr_1}> <{ar_1}>  (mfkey32 moebius)
+// Empty lines and lines starting with # are ignored.
+static bool parse_line(char *line, mfkey_job_t *job) {
+	uint32_t v[7];
+	int n = sscanf(line, "%x %x %x %x %x %x %x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]);
+
+	memset(job, 0, sizeof(mfkey_job_t));
+	job->data.cuid = v[0];
+	job->data.nonce = v[1];
+	job->data.nonce2 = v[1];
+	job->data.nr = v[2];
+	job->data.ar = v[3];
+	switch (n) {
+		case 5:
+			job->attack = MFKEY64;
+			job->data.at = v[4];
+			break;
+		case 6:
+			job->attack = MFKEY32;
+			job->data.nr2 = v[4];
+			job->data.ar2 = v[5];
+			break;
+		case 7:
+			job->attack = MFKEY32_MOEBIUS;
+			job->data.nonce2 = v[4];
+			job->data.nr2 = v[5];
+			job->data.ar2 = v[6];
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+
+int main (int argc, char *argv[]) {
+
+	printf("MIFARE Classic key recovery - batch mode\n");
+	printf("Recover the keys of many authentications using all CPU cores\n\n");
+
+	if (argc != 2) {
+		printf(" syntax: %s <file>\n\n", argv[0]);
+		printf(" One authentication per line:\n");
+		printf("   <uid> <nt> <{nr}> <{ar}> <{at}>                      (mfkey64)\n");
+		printf("   <uid> <nt> <{nr_0}> <{ar_0}> <{nr_1}> <{ar_1}>        (mfkey32)\n");
+		printf("   <uid> <nt0> <{nr_0}> <{ar_0}> <nt1> <{nr_1}> <{ar_1}>  (mfkey32 moebius)\n\n");
+		return 1;
+	}
+
+	FILE *f = fopen(argv[1], "r");
+	if (f == NULL) {
+		printf("Could not open file %s\n", argv[1]);
+		return 1;
+	}
+
+	uint32_t num_jobs = 0;
+	uint32_t max_jobs = 1024;
+	mfkey_job_t *jobs = (mfkey_job_t *)malloc(max_jobs * sizeof(mfkey_job_t));
+	uint32_t *line_numbers = (uint32_t *)malloc(max_jobs * sizeof(uint32_t));
+	char line[256];
+	uint32_t line_number = 0;
+	while (jobs != NULL && line_numbers != NULL && fgets(line, sizeof(line), f) != NULL) {
+		line_number++;
+		char *p = line;
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+			continue;
+		}
+		if (num_jobs == max_jobs) {
+			max_jobs *= 2;
+			jobs = (mfkey_job_t *)realloc(jobs, max_jobs * sizeof(mfkey_job_t));
+			line_numbers = (uint32_t *)realloc(line_numbers, max_jobs * sizeof(uint32_t));
+			if (jobs == NULL || line_numbers == NULL) {
+				break;
+			}
+		}
+		if (!parse_line(p, &jobs[num_jobs])) {
+			printf("Line %" PRIu32 ": invalid authentication, skipped.\n", line_number);
+			continue;
+		}
+		line_numbers[num_jobs++] = line_number;
+	}
+	fclose(f);
+	if (jobs == NULL || line_numbers == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	uint64_t start_time = msclock();
+	uint32_t num_threads = num_CPUs();
+	uint32_t num_recoveries = mfkey_batch(jobs, num_jobs, num_threads);
+	crapto1_free_arenas();
+	uint64_t time_spent = msclock() - start_time;
+
+	uint32_t num_found = 0;
+	for (uint32_t i = 0; i < num_jobs; i++) {
+		mfkey_job_t *job = &jobs[i];
+		if (job->found) {
+			printf("Line %5" PRIu32 ": uid %08x, nt %08x: Found Key: [%012" PRIx64 "]\n", line_numbers[i], job->data.cuid, job->data.nonce, job->key);
+			num_found++;
+		} else {
+			printf("Line %5" PRIu32 ": uid %08x, nt %08x: Couldn't recover key.\n", line_numbers[i], job->data.cuid, job->data.nonce);
+		}
+	}
+
+	printf("\n%" PRIu32 " authentications, %" PRIu32 " distinct keystreams, %" PRIu32 " keys recovered.\n", num_jobs, num_recoveries, num_found);
+	printf("Time spent: %1.2f seconds using %" PRIu32 " threads\n", (float)time_spent/1000.0, num_threads);
+
+	free(jobs);
+	free(line_numbers);
+	return 0;
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+
+#  mkprngtable.py - generate common/crapto1/prng_table.h
+#
+#  The MIFARE Classic tag PRNG is a 16 bit LFSR with period 65535. The
+#  position of a state in the sequence is found by stepping the LFSR
+#  forward until it hits one of the anchor states below, which are spaced
+#  ANCHOR_SPACING steps apart. Anchors are sorted by state and bucketed by
+#  the state's high byte.
+#
+#  This code is licensed to you under the terms of the GNU GPL, version 2 or,
+#  at your option, any later version. See the LICENSE.txt file for the text of
+#  the license.
+
+import sys
+
+ANCHOR_SPACING = 128
+PERIOD = 65535
+
+
+def successor(x):
+    return (x >> 1 | (x ^ x >> 2 ^ x >> 3 ^ x >> 5) << 15) & 0xffff
+
+
+def c_array(name, values, per_line=8):
+    lines = ['static const uint16_t %s[%d] = {' % (name, len(values))]
+    for i in range(0, len(values), per_line):
+        lines.append('\t' + ', '.join('0x%04x' % v for v in values[i:i + per_line]) + ',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def main():
+    anchors = []
+    x = 1
+    for pos in range(PERIOD):
+        if pos % ANCHOR_SPACING == 0:
+            anchors.append((x, pos))
+        x = successor(x)
+    assert x == 1
+    anchors.sort()
+
+    bucket = [0] * 257
+    for state, _ in anchors:
+        bucket[(state >> 8) + 1] += 1
+    for i in range(256):
+        bucket[i + 1] += bucket[i]
+
+    out = []
+    out.append('//-----------------------------------------------------------------------------')
+    out.append('// This code is licensed to you under the terms of the GNU GPL, version 2 or,')
+    out.append('// at your option, any later version. See the LICENSE.txt file for the text of')
+    out.append('// the license.')
+    out.append('//-----------------------------------------------------------------------------')
+    out.append('// Anchor states of the MIFARE Classic tag PRNG. Generated by tools/mkprngtable.py,')
+    out.append('// do not edit.')
+    out.append('//-----------------------------------------------------------------------------')
+    out.append('')
+    out.append('#ifndef PRNG_TABLE_H__')
+    out.append('#define PRNG_TABLE_H__')
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('')
+    out.append('#define PRNG_PERIOD\t\t\t\t%d' % PERIOD)
+    out.append('#define PRNG_ANCHOR_SPACING\t\t%d' % ANCHOR_SPACING)
+    out.append('#define PRNG_ANCHORS\t\t\t%d' % len(anchors))
+    out.append('')
+    out.append('// anchors with state >> 8 == i are prng_anchor_state[prng_anchor_bucket[i]] ... [prng_anchor_bucket[i+1] - 1]')
+    out.append(c_array('prng_anchor_bucket', bucket))
+    out.append('')
+    out.append('// LFSR states (not byte swapped), sorted')
+    out.append(c_array('prng_anchor_state', [s for s, _ in anchors]))
+    out.append('')
+    out.append('// position of prng_anchor_state[i] in the sequence, counted from state 0x0001')
+    out.append(c_array('prng_anchor_pos', [p for _, p in anchors]))
+    out.append('')
+    out.append('#endif')
+    out.append('')
+
+    with open(sys.argv[1] if len(sys.argv) > 1 else 'prng_table.h', 'w') as f:
+        f.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+#-----------------------------------------------------------------------------
+# This code is licensed to you under the terms of the GNU GPL, version 2 or,
+# at your option, any later version. See the LICENSE.txt file for the text of
+# the license.
+#-----------------------------------------------------------------------------
+# Simulated Proxmark3 for testing the client without hardware.
+#
+# Opens a pseudo terminal which the client can use as its serial port and
+# answers the USB commands of 'hf mf hardnested' like a Proxmark3 with a
+# hardened MIFARE Classic card (random tag nonces) on the antenna:
+#   CMD_VERSION                          - a version string
+#   CMD_MIFARE_ACQUIRE_ENCRYPTED_NONCES  - batches of encrypted nested nonces
+#   CMD_MIFARE_CHKKEYS                   - check keys for one block
+# Other commands are reported on stderr and not answered.
+#
+# usage: pm3_mfsim.py [-u uid] [-k sector:A|B:key ...] [-d key] [-f batches] [-s seed]
+# The name of the pseudo terminal is printed on the first line of stdout.
+#-----------------------------------------------------------------------------
+
+import argparse, os, pty, random, select, struct, sys, tty
+
+USB_CMD_DATA_SIZE = 512
+USB_CMD_FORMAT = '<4Q%ds' % USB_CMD_DATA_SIZE
+USB_CMD_SIZE = struct.calcsize(USB_CMD_FORMAT)
+
+CMD_ACK = 0x00ff
+CMD_VERSION = 0x0107
+CMD_MIFARE_ACQUIRE_ENCRYPTED_NONCES = 0x0613
+CMD_MIFARE_CHKKEYS = 0x0623
+
+LF_POLY_ODD = 0x29CE5C
+LF_POLY_EVEN = 0x870804
+
+
+def bit(x, n):
+	return (x >> n) & 1
+
+def parity(x):
+	return bin(x).count('1') & 1
+
+def oddparity8(x):
+	return parity(x) ^ 1
+
+def crypto1_filter(x):
+	f  = 0xf22c0 >> (x       & 0xf) & 16
+	f |= 0x6c9c0 >> (x >>  4 & 0xf) &  8
+	f |= 0x3c8b0 >> (x >>  8 & 0xf) &  4
+	f |= 0x1e458 >> (x >> 12 & 0xf) &  2
+	f |= 0x0d938 >> (x >> 16 & 0xf) &  1
+	return bit(0xEC57E80A, f)
+
+
+class Crypto1:
+	# same state representation as common/crapto1/crypto1.c
+	def __init__(self, key):
+		self.odd = 0
+		self.even = 0
+		for i in range(47, 0, -2):
+			self.odd = (self.odd << 1 | bit(key, (i - 1) ^ 7)) & 0xffffff
+			self.even = (self.even << 1 | bit(key, i ^ 7)) & 0xffffff
+
+	def bit(self, inbit):
+		ret = crypto1_filter(self.odd)
+		feedin = inbit & 1
+		feedin ^= parity(LF_POLY_ODD & self.odd)
+		feedin ^= parity(LF_POLY_EVEN & self.even)
+		self.even = (self.even << 1 | feedin) & 0xffffff
+		self.odd, self.even = self.even, self.odd
+		return ret
+
+	def byte(self, inbyte):
+		ret = 0
+		for i in range(8):
+			ret |= self.bit(bit(inbyte, i)) << i
+		return ret
+
+
+def nested_nonce(cuid, key, nt):
+	# the tag nonce of a nested authentication, encrypted with the target key, and its encrypted parity bits
+	cs = Crypto1(key)
+	nt_enc = 0
+	par_enc = 0
+	for byte_pos in range(3, -1, -1):
+		nt_byte = (nt >> (8 * byte_pos)) & 0xff
+		nt_enc = nt_enc << 8 | (cs.byte(nt_byte ^ (cuid >> (8 * byte_pos)) & 0xff) ^ nt_byte)
+		par_enc = par_enc << 1 | (crypto1_filter(cs.odd) ^ oddparity8(nt_byte))
+	return nt_enc, par_enc
+
+
+def block_to_sector(block):
+	return block // 4 if block < 128 else 32 + (block - 128) // 16
+
+
+class Card:
+	def __init__(self, cuid, default_key, keys):
+		self.cuid = cuid
+		self.default_key = default_key
+		self.keys = keys					# (sector, key type) -> key
+
+	def key(self, block, key_type):
+		return self.keys.get((block_to_sector(block), key_type & 1), self.default_key)
+
+
+class Proxmark:
+	def __init__(self, fd, card, fail_after, rng):
+		self.fd = fd
+		self.card = card
+		self.fail_after = fail_after		# number of nonce batches delivered before the card is "removed"
+		self.num_batches = 0
+		self.rng = rng
+
+	def send(self, cmd, arg0=0, arg1=0, arg2=0, data=b''):
+		os.write(self.fd, struct.pack(USB_CMD_FORMAT, cmd, arg0, arg1, arg2, data))
+
+	def acquire_encrypted_nonces(self, arg0, arg1, flags, data):
+		block, key_type = arg0 & 0xff, arg0 >> 8 & 0xff
+		target_block, target_key_type = arg1 & 0xff, arg1 >> 8 & 0xff
+		if data[:6] != self.card.key(block, key_type).to_bytes(6, 'big'):
+			return							# the real firmware retries the authentication forever
+		if flags & 0x0004:					# field off
+			self.send(CMD_ACK, 0, self.card.cuid, 0)
+			return
+		if self.fail_after is not None and self.num_batches >= self.fail_after:
+			return
+		self.num_batches += 1
+		key = self.card.key(target_block, target_key_type)
+		buf = bytearray()
+		num_nonces = 0
+		while len(buf) <= USB_CMD_DATA_SIZE - 9:
+			nt_enc1, par_enc1 = nested_nonce(self.card.cuid, key, self.rng.getrandbits(32))
+			nt_enc2, par_enc2 = nested_nonce(self.card.cuid, key, self.rng.getrandbits(32))
+			buf += struct.pack('>II', nt_enc1, nt_enc2) + bytes([par_enc1 << 4 | par_enc2])
+			num_nonces += 2
+		self.send(CMD_ACK, 0, self.card.cuid, num_nonces, bytes(buf))
+
+	def check_keys(self, arg0, arg1, arg2, data):
+		block, key_type = arg0 & 0xff, arg0 >> 8 & 0xff
+		if arg1 & 0x02:
+			sys.stderr.write('pm3_mfsim: multi sector CMD_MIFARE_CHKKEYS not supported\n')
+			return
+		key = self.card.key(block, key_type).to_bytes(6, 'big')
+		for i in range(arg2):
+			if data[6*i:6*i+6] == key:
+				self.send(CMD_ACK, 1, 0, 0, key)
+				return
+		self.send(CMD_ACK, 0)
+
+	def handle(self, command):
+		cmd, arg0, arg1, arg2, data = struct.unpack(USB_CMD_FORMAT, command)
+		if cmd == CMD_VERSION:
+			self.send(CMD_ACK, 0, 0, 0, b'simulated Proxmark3 (tools/pm3_mfsim.py)\0')
+		elif cmd == CMD_MIFARE_ACQUIRE_ENCRYPTED_NONCES:
+			self.acquire_encrypted_nonces(arg0, arg1, arg2, data)
+		elif cmd == CMD_MIFARE_CHKKEYS:
+			self.check_keys(arg0, arg1, arg2, data)
+		else:
+			sys.stderr.write('pm3_mfsim: command 0x%04x not supported\n' % cmd)
+
+	def run(self):
+		rx = b''
+		while True:
+			try:
+				select.select([self.fd], [], [])
+				chunk = os.read(self.fd, USB_CMD_SIZE - len(rx))
+			except OSError:					# EIO when the client closes the port
+				chunk = b''
+			if not chunk:
+				select.select([], [], [], 0.05)
+				continue
+			rx += chunk
+			if len(rx) == USB_CMD_SIZE:
+				self.handle(rx)
+				rx = b''
+
+
+def parse_key(s):
+	if len(s) != 12:
+		raise argparse.ArgumentTypeError('key must have 12 hex digits')
+	return int(s, 16)
+
+def parse_sector_key(s):
+	try:
+		sector, key_type, key = s.split(':')
+		return (int(sector), 'ab'.index(key_type.lower())), parse_key(key)
+	except ValueError:
+		raise argparse.ArgumentTypeError('expected <sector>:<A|B>:<key>')
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Simulated Proxmark3 with a hardened MIFARE Classic card')
+	parser.add_argument('-u', '--uid', type=lambda s: int(s, 16), default=0x907a633e, help='card UID (hex)')
+	parser.add_argument('-d', '--default-key', type=parse_key, default=0xffffffffffff, help='key of all other sectors')
+	parser.add_argument('-k', '--key', type=parse_sector_key, action='append', default=[], help='<sector>:<A|B>:<key>')
+	parser.add_argument('-f', '--fail-after', type=int, default=None, help='stop answering after this many nonce batches')
+	parser.add_argument('-s', '--seed', type=int, default=None, help='seed for the tag nonces')
+	args = parser.parse_args()
+
+	master, slave = pty.openpty()
+	tty.setraw(master)
+	print(os.ttyname(slave))
+	sys.stdout.flush()
+
+	card = Card(args.uid, args.default_key, dict(args.key))
+	Proxmark(master, card, args.fail_after, random.Random(args.seed)).run()
+
+
+if __name__ == '__main__':
+	main()
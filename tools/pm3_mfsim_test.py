@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#-----------------------------------------------------------------------------
+# This code is licensed to you under the terms of the GNU GPL, version 2 or,
+# at your option, any later version. See the LICENSE.txt file for the text of
+# the license.
+#-----------------------------------------------------------------------------
+# Runs 'hf mf hardnested' of the client against the simulated Proxmark3 of
+# pm3_mfsim.py, and the distributed brute force with hardnested_worker.
+# Build the client first (make -C client proxmark3 hardnested_worker).
+#-----------------------------------------------------------------------------
+
+import glob, os, random, shutil, struct, subprocess, sys, tempfile, unittest
+import pm3_mfsim
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+CLIENT = os.path.join(TOOLS_DIR, '..', 'client', 'proxmark3')
+WORKER = os.path.join(TOOLS_DIR, '..', 'client', 'hardnested_worker')
+SIMULATOR = os.path.join(TOOLS_DIR, 'pm3_mfsim.py')
+
+
+class TestHardnestedSimulated(unittest.TestCase):
+	def setUp(self):
+		self.work_dir = tempfile.mkdtemp(prefix='pm3_mfsim_test')
+		self.simulator = None
+
+	def tearDown(self):
+		self.stop_simulator()
+		shutil.rmtree(self.work_dir)
+
+	def start_simulator(self, *args):
+		self.simulator = subprocess.Popen([sys.executable, SIMULATOR] + list(args), stdout=subprocess.PIPE, universal_newlines=True)
+		self.port = self.simulator.stdout.readline().strip()
+
+	def stop_simulator(self):
+		if self.simulator is not None:
+			self.simulator.kill()
+			self.simulator.wait()
+			self.simulator.stdout.close()
+			self.simulator = None
+
+	def client(self, command):
+		result = subprocess.run([CLIENT, self.port, '-c', command], cwd=self.work_dir, timeout=600,
+			stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+		return result.stdout
+
+	def test_hardnested(self):
+		self.start_simulator('-k', '1:A:a0a1a2a3a4a5', '-s', '1')
+		output = self.client('hf mf hardnested 0 A FFFFFFFFFFFF 4 A c')
+		self.assertIn('Key found: a0a1a2a3a4a5', output)
+		self.assertFalse(os.path.exists(os.path.join(self.work_dir, 'hardnested_checkpoint.bin')))
+
+	def test_resume_acquisition(self):
+		# the card is "removed" during the acquisition. Continue with another simulator run.
+		self.start_simulator('-k', '1:B:b0b1b2b3b4b5', '-s', '2', '-f', '20')
+		output = self.client('hf mf hardnested 0 A FFFFFFFFFFFF 4 B c')
+		self.assertNotIn('Key found', output)
+		self.assertTrue(os.path.exists(os.path.join(self.work_dir, 'hardnested_checkpoint.bin')))
+		self.stop_simulator()
+		self.start_simulator('-k', '1:B:b0b1b2b3b4b5', '-s', '3')
+		output = self.client('hf mf hardnested u c')
+		self.assertIn('Resuming from checkpoint', output)
+		self.assertIn('Key found: b0b1b2b3b4b5', output)
+
+	def test_resume_other_card(self):
+		self.start_simulator('-k', '1:A:a0a1a2a3a4a5', '-s', '4', '-f', '2')
+		self.client('hf mf hardnested 0 A FFFFFFFFFFFF 4 A c')
+		self.stop_simulator()
+		self.start_simulator('-k', '1:A:a0a1a2a3a4a5', '-u', '01020304')
+		output = self.client('hf mf hardnested u')
+		self.assertIn("doesn't match the expected UID", output)
+
+	def test_batch(self):
+		# the nonces for 1b are acquired while 1a is brute forced. The key of 2a is found by checking the key of 1a.
+		self.start_simulator('-k', '1:A:a0a1a2a3a4a5', '-k', '1:B:b0b1b2b3b4b5', '-k', '2:A:a0a1a2a3a4a5', '-s', '5')
+		output = self.client('hf mf hardnested 0 A FFFFFFFFFFFF * 1a,1b,2a')
+		self.assertIn('acquired during the previous brute force', output)
+		self.assertIn('Found key is also valid for block no:  8, key type:A', output)
+		self.assertIn('|001|  a0a1a2a3a4a5  | 1 |  b0b1b2b3b4b5  | 1 |', output)
+		self.assertIn('|002|  a0a1a2a3a4a5  | 1 |', output)
+
+
+class TestDistributedBruteForce(unittest.TestCase):
+	# 'hf mf hardnested r x <directory>' with a hardnested_worker processing the work units
+	CUID = 0x907a633e
+	KEY = 0xa0a1a2a3a4a5
+
+	def setUp(self):
+		self.work_dir = tempfile.mkdtemp(prefix='pm3_mfsim_test')
+		self.unit_dir = os.path.join(self.work_dir, 'units')
+		os.mkdir(self.unit_dir)
+		rng = random.Random(6)
+		with open(os.path.join(self.work_dir, 'nonces.bin'), 'wb') as f:
+			f.write(struct.pack('>IBB', self.CUID, 4, 0))
+			for i in range(2000):
+				nt_enc1, par_enc1 = pm3_mfsim.nested_nonce(self.CUID, self.KEY, rng.getrandbits(32))
+				nt_enc2, par_enc2 = pm3_mfsim.nested_nonce(self.CUID, self.KEY, rng.getrandbits(32))
+				f.write(struct.pack('>II', nt_enc1, nt_enc2) + bytes([par_enc1 << 4 | par_enc2]))
+		self.client = subprocess.Popen([CLIENT, '/dev/null', '-c', 'hf mf hardnested r x units'], cwd=self.work_dir,
+			stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+
+	def tearDown(self):
+		if self.client.poll() is None:
+			self.client.kill()
+		self.client.communicate()
+		shutil.rmtree(self.work_dir)
+
+	def wait_for_units(self):
+		for i in range(600):
+			if glob.glob(os.path.join(self.unit_dir, '*.unit')):
+				return
+			self.assertIsNone(self.client.poll(), 'client exited without writing work units')
+			subprocess.run(['sleep', '0.1'])
+		self.fail('no work units written')
+
+	def worker(self):
+		result = subprocess.run([WORKER, self.unit_dir], timeout=600,
+			stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+		return result.stdout
+
+	def test_round_trip(self):
+		self.wait_for_units()
+		output = self.worker()
+		self.assertIn('Key found: a0a1a2a3a4a5', output)
+		output = self.client.communicate(timeout=600)[0]
+		self.assertIn('Key found: a0a1a2a3a4a5', output)
+		self.assertNotIn('locally', output)
+		self.assertEqual(os.listdir(self.unit_dir), [])
+
+	def test_invalid_unit(self):
+		# the worker reports units it can't read. The client brute forces them itself.
+		self.wait_for_units()
+		for filename in glob.glob(os.path.join(self.unit_dir, '*.unit')):
+			with open(filename, 'r+b') as f:
+				f.truncate(100)
+		output = self.worker()
+		self.assertIn('is not a valid work unit', output)
+		output = self.client.communicate(timeout=600)[0]
+		self.assertIn("couldn't process work unit", output)
+		self.assertIn('Key found: a0a1a2a3a4a5', output)
+
+
+if __name__ == '__main__':
+	unittest.main()